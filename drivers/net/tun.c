@@ -115,6 +115,10 @@ do {								\
 #define TUN_FEATURES (IFF_NO_PI | IFF_ONE_QUEUE | IFF_VNET_HDR | \
 		      IFF_MULTI_QUEUE)
 #define GOODCOPY_LEN 128
+/* Smaller TUN_MMSG_ZEROCOPY frames are cheaper to copy than to pin */
+#define ZEROCOPY_MIN_LEN PAGE_SIZE
+/* Upper bound on packets handled by one TUNSENDMMSG/TUNRECVMMSG call */
+#define TUN_MMSG_MAX 1024
 
 #define FLT_EXACT_COUNT 8
 struct tap_filter {
@@ -346,9 +350,14 @@ static void tun_flow_update(struct tun_struct *tun, u32 rxhash,
 
 	e = tun_flow_find(head, rxhash);
 	if (likely(e)) {
+		/* Only write when something changed, so that queues sharing
+		 * a flow bucket do not bounce its cacheline on every packet.
+		 */
 		/* TODO: keep queueing to old queue until it's empty? */
-		e->queue_index = queue_index;
-		e->updated = jiffies;
+		if (unlikely(e->queue_index != queue_index))
+			ACCESS_ONCE(e->queue_index) = queue_index;
+		if (e->updated != jiffies)
+			ACCESS_ONCE(e->updated) = jiffies;
 		sock_rps_record_flow_hash(e->rps_rxhash);
 	} else {
 		spin_lock_bh(&tun->lock);
@@ -1113,13 +1122,8 @@ static ssize_t tun_get_user(struct tun_struct *tun, struct tun_file *tfile,
 
 	if (zerocopy)
 		err = zerocopy_sg_from_iter(skb, from);
-	else {
+	else
 		err = skb_copy_datagram_from_iter(skb, 0, from, len);
-		if (!err && msg_control) {
-			struct ubuf_info *uarg = msg_control;
-			uarg->callback(uarg, false);
-		}
-	}
 
 	if (err) {
 		tun->dev->stats.rx_dropped++;
@@ -1195,11 +1199,18 @@ static ssize_t tun_get_user(struct tun_struct *tun, struct tun_file *tfile,
 		skb_shinfo(skb)->gso_segs = 0;
 	}
 
-	/* copy skb_ubuf_info for callback when skb has no error */
+	/* copy skb_ubuf_info for callback when skb has no error; a copied
+	 * skb is complete already.  Either way the callback runs exactly
+	 * once for a packet that was accepted, and never for one that
+	 * failed.
+	 */
 	if (zerocopy) {
 		skb_shinfo(skb)->destructor_arg = msg_control;
 		skb_shinfo(skb)->tx_flags |= SKBTX_DEV_ZEROCOPY;
 		skb_shinfo(skb)->tx_flags |= SKBTX_SHARED_FRAG;
+	} else if (msg_control) {
+		struct ubuf_info *uarg = msg_control;
+		uarg->callback(uarg, false);
 	}
 
 	skb_reset_network_header(skb);
@@ -1392,6 +1403,139 @@ static ssize_t tun_chr_read_iter(struct kiocb *iocb, struct iov_iter *to)
 	return ret;
 }
 
+/* Shared by the zero-copy skbs of one TUNSENDMMSG call.  It can outlive
+ * the call, which only waits interruptibly for the skbs: "refs" holds one
+ * reference for the caller and one for the skbs as a group, which the
+ * last skb to be released drops after completing "done".
+ */
+struct tun_zc_batch {
+	struct ubuf_info ubuf;
+	atomic_t pending;	/* skbs in flight, plus a bias while sending */
+	atomic_t refs;
+	struct completion done;
+};
+
+static void tun_zc_batch_put(struct tun_zc_batch *zc)
+{
+	if (atomic_dec_and_test(&zc->refs))
+		kfree(zc);
+}
+
+static void tun_zc_batch_callback(struct ubuf_info *ubuf, bool success)
+{
+	struct tun_zc_batch *zc = container_of(ubuf, struct tun_zc_batch,
+					       ubuf);
+
+	if (atomic_dec_and_test(&zc->pending)) {
+		complete(&zc->done);
+		tun_zc_batch_put(zc);
+	}
+}
+
+/* TUNSENDMMSG/TUNRECVMMSG: move up to batch.count packets between the
+ * user buffers and the device.  Returns the number of packets moved, or
+ * the error of the first packet if none was.
+ */
+static long tun_chr_mmsg(struct file *file, unsigned int cmd,
+			 struct tun_mmsg_batch __user *argp)
+{
+	struct tun_file *tfile = file->private_data;
+	int noblock = file->f_flags & O_NONBLOCK;
+	struct tun_mmsg_batch batch;
+	struct tun_mmsg __user *umsg;
+	struct tun_zc_batch *zc = NULL;
+	struct tun_struct *tun;
+	ssize_t ret = 0;
+	unsigned int i;
+
+	if (copy_from_user(&batch, argp, sizeof(batch)))
+		return -EFAULT;
+	if (batch.flags & ~TUN_MMSG_ZEROCOPY ||
+	    (cmd == TUNRECVMMSG && batch.flags))
+		return -EINVAL;
+	batch.count = min_t(u32, batch.count, TUN_MMSG_MAX);
+	umsg = (struct tun_mmsg __user *)(unsigned long)batch.msgs;
+
+	tun = tun_get(file);
+	if (!tun)
+		return -EBADFD;
+
+	if (batch.flags & TUN_MMSG_ZEROCOPY) {
+		zc = kmalloc(sizeof(*zc), GFP_KERNEL);
+		if (!zc) {
+			tun_put(tun);
+			return -ENOMEM;
+		}
+		zc->ubuf.callback = tun_zc_batch_callback;
+		zc->ubuf.ctx = NULL;
+		zc->ubuf.desc = 0;
+		atomic_set(&zc->pending, 1);
+		atomic_set(&zc->refs, 2);
+		init_completion(&zc->done);
+	}
+
+	for (i = 0; i < batch.count; i++) {
+		struct tun_mmsg msg;
+		struct iov_iter iter;
+		struct iovec iov;
+
+		if (copy_from_user(&msg, &umsg[i], sizeof(msg))) {
+			ret = -EFAULT;
+			break;
+		}
+		if (msg.flags) {
+			ret = -EINVAL;
+			break;
+		}
+		iov.iov_base = (void __user *)(unsigned long)msg.addr;
+		iov.iov_len = msg.len;
+
+		if (cmd == TUNSENDMMSG) {
+			void *msg_control = NULL;
+
+			if (zc && msg.len >= ZEROCOPY_MIN_LEN) {
+				atomic_inc(&zc->pending);
+				msg_control = &zc->ubuf;
+			}
+			iov_iter_init(&iter, WRITE, &iov, 1, msg.len);
+			ret = tun_get_user(tun, tfile, msg_control, &iter,
+					   noblock);
+			if (ret < 0 && msg_control)
+				atomic_dec(&zc->pending);
+		} else {
+			/* Only the first packet may wait for data */
+			iov_iter_init(&iter, READ, &iov, 1, msg.len);
+			ret = tun_do_read(tun, tfile, &iter, noblock || i);
+			ret = min_t(ssize_t, ret, msg.len);
+		}
+		if (ret < 0)
+			break;
+
+		if (put_user(ret, &umsg[i].len)) {
+			ret = -EFAULT;
+			break;
+		}
+	}
+
+	/* Userspace owns its buffers again once we return, so wait until
+	 * the stack has dropped every page pinned from them.  An skb can be
+	 * held indefinitely (a stopped qdisc, a socket nobody reads), so a
+	 * signal ends the wait; the pages stay pinned until then, and
+	 * userspace must not rely on the frames' contents if it rewrites
+	 * the buffers early.
+	 */
+	if (zc) {
+		if (atomic_dec_and_test(&zc->pending))
+			tun_zc_batch_put(zc);
+		else
+			wait_for_completion_interruptible(&zc->done);
+		tun_zc_batch_put(zc);
+	}
+
+	tun_put(tun);
+	return i ? i : ret;
+}
+
 static void tun_free_netdev(struct net_device *dev)
 {
 	struct tun_struct *tun = netdev_priv(dev);
@@ -1859,6 +2003,8 @@ static long __tun_chr_ioctl(struct file *file, unsigned int cmd,
 				(unsigned int __user*)argp);
 	} else if (cmd == TUNSETQUEUE)
 		return tun_set_queue(file, &ifr);
+	else if (cmd == TUNSENDMMSG || cmd == TUNRECVMMSG)
+		return tun_chr_mmsg(file, cmd, argp);
 
 	ret = 0;
 	rtnl_lock();
@@ -2117,6 +2263,8 @@ static long tun_chr_compat_ioctl(struct file *file,
 	case TUNSETTXFILTER:
 	case TUNGETSNDBUF:
 	case TUNSETSNDBUF:
+	case TUNSENDMMSG:
+	case TUNRECVMMSG:
 	case SIOCGIFHWADDR:
 	case SIOCSIFHWADDR:
 		arg = (unsigned long)compat_ptr(arg);
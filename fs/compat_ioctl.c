@@ -1563,6 +1563,7 @@ COMPAT_SYSCALL_DEFINE3(ioctl, unsigned int, fd, unsigned int, cmd,
 	case FIONBIO:
 	case FIOASYNC:
 	case FIOQSIZE:
+	case FS_IOC_LOOKUP_BATCH:
 		break;
 
 #if defined(CONFIG_IA64) || defined(CONFIG_X86_64)
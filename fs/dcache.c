@@ -118,6 +118,16 @@ struct dentry_stat_t dentry_stat = {
 
 static DEFINE_PER_CPU(long, nr_dentry);
 static DEFINE_PER_CPU(long, nr_dentry_unused);
+static DEFINE_PER_CPU(long, nr_dentry_negative);
+
+/*
+ * Per-superblock cap on unused negative dentries, 0 for no limit.  Checked
+ * on every NEGATIVE_CHECK_BATCH'th negative dentry put on an LRU, going
+ * over it kicks off trimming of the superblock's negative LRU.
+ */
+unsigned long sysctl_negative_dentry_limit __read_mostly;
+static DEFINE_PER_CPU(unsigned int, nr_negative_adds);
+#define NEGATIVE_CHECK_BATCH	64
 
 #if defined(CONFIG_SYSCTL) && defined(CONFIG_PROC_FS)
 
@@ -151,11 +161,21 @@ static long get_nr_dentry_unused(void)
 	return sum < 0 ? 0 : sum;
 }
 
+static long get_nr_dentry_negative(void)
+{
+	int i;
+	long sum = 0;
+	for_each_possible_cpu(i)
+		sum += per_cpu(nr_dentry_negative, i);
+	return sum < 0 ? 0 : sum;
+}
+
 int proc_nr_dentry(struct ctl_table *table, int write, void __user *buffer,
 		   size_t *lenp, loff_t *ppos)
 {
 	dentry_stat.nr_dentry = get_nr_dentry();
 	dentry_stat.nr_unused = get_nr_dentry_unused();
+	dentry_stat.nr_negative = get_nr_dentry_negative();
 	return proc_doulongvec_minmax(table, write, buffer, lenp, ppos);
 }
 #endif
@@ -360,16 +380,55 @@ static void dentry_unlink_inode(struct dentry * dentry)
  * The per-cpu "nr_dentry_unused" counters are updated with
  * the DCACHE_LRU_LIST bit.
  *
+ * Dentries that are negative when they are added go on the
+ * superblock's separate negative LRU instead, and get the
+ * DCACHE_NEGATIVE_LRU bit, which the per-cpu "nr_dentry_negative"
+ * counters follow.  The bit stays set while the dentry sits on a
+ * shrink list.
+ *
  * These helper functions make sure we always follow the
  * rules. d_lock must be held by the caller.
  */
 #define D_FLAG_VERIFY(dentry,x) WARN_ON_ONCE(((dentry)->d_flags & (DCACHE_LRU_LIST | DCACHE_SHRINK_LIST)) != (x))
+static inline struct list_lru *d_lru_list(struct dentry *dentry)
+{
+	if (dentry->d_flags & DCACHE_NEGATIVE_LRU)
+		return &dentry->d_sb->s_dentry_neg_lru;
+	return &dentry->d_sb->s_dentry_lru;
+}
+
+static inline void d_lru_clear_negative(struct dentry *dentry)
+{
+	if (dentry->d_flags & DCACHE_NEGATIVE_LRU) {
+		dentry->d_flags &= ~DCACHE_NEGATIVE_LRU;
+		this_cpu_dec(nr_dentry_negative);
+	}
+}
+
+static void d_negative_check_limit(struct super_block *sb)
+{
+	unsigned long limit = READ_ONCE(sysctl_negative_dentry_limit);
+
+	if (!limit || this_cpu_inc_return(nr_negative_adds) % NEGATIVE_CHECK_BATCH)
+		return;
+	/* deactivate_locked_super() flushes the work after clearing MS_ACTIVE */
+	if ((sb->s_flags & MS_ACTIVE) &&
+	    list_lru_count(&sb->s_dentry_neg_lru) > limit)
+		schedule_work(&sb->s_dentry_neg_work);
+}
+
 static void d_lru_add(struct dentry *dentry)
 {
 	D_FLAG_VERIFY(dentry, 0);
 	dentry->d_flags |= DCACHE_LRU_LIST;
 	this_cpu_inc(nr_dentry_unused);
-	WARN_ON_ONCE(!list_lru_add(&dentry->d_sb->s_dentry_lru, &dentry->d_lru));
+	if (d_is_negative(dentry)) {
+		dentry->d_flags |= DCACHE_NEGATIVE_LRU;
+		this_cpu_inc(nr_dentry_negative);
+	}
+	WARN_ON_ONCE(!list_lru_add(d_lru_list(dentry), &dentry->d_lru));
+	if (dentry->d_flags & DCACHE_NEGATIVE_LRU)
+		d_negative_check_limit(dentry->d_sb);
 }
 
 static void d_lru_del(struct dentry *dentry)
@@ -377,7 +436,8 @@ static void d_lru_del(struct dentry *dentry)
 	D_FLAG_VERIFY(dentry, DCACHE_LRU_LIST);
 	dentry->d_flags &= ~DCACHE_LRU_LIST;
 	this_cpu_dec(nr_dentry_unused);
-	WARN_ON_ONCE(!list_lru_del(&dentry->d_sb->s_dentry_lru, &dentry->d_lru));
+	WARN_ON_ONCE(!list_lru_del(d_lru_list(dentry), &dentry->d_lru));
+	d_lru_clear_negative(dentry);
 }
 
 static void d_shrink_del(struct dentry *dentry)
@@ -386,6 +446,7 @@ static void d_shrink_del(struct dentry *dentry)
 	list_del_init(&dentry->d_lru);
 	dentry->d_flags &= ~(DCACHE_SHRINK_LIST | DCACHE_LRU_LIST);
 	this_cpu_dec(nr_dentry_unused);
+	d_lru_clear_negative(dentry);
 }
 
 static void d_shrink_add(struct dentry *dentry, struct list_head *list)
@@ -407,6 +468,7 @@ static void d_lru_isolate(struct list_lru_one *lru, struct dentry *dentry)
 	D_FLAG_VERIFY(dentry, DCACHE_LRU_LIST);
 	dentry->d_flags &= ~DCACHE_LRU_LIST;
 	this_cpu_dec(nr_dentry_unused);
+	d_lru_clear_negative(dentry);
 	list_lru_isolate(lru, &dentry->d_lru);
 }
 
@@ -423,8 +485,21 @@ static void d_lru_shrink_move(struct list_lru_one *lru, struct dentry *dentry,
  */
 static void dentry_lru_add(struct dentry *dentry)
 {
-	if (unlikely(!(dentry->d_flags & DCACHE_LRU_LIST)))
+	if (unlikely(!(dentry->d_flags & DCACHE_LRU_LIST))) {
 		d_lru_add(dentry);
+		return;
+	}
+
+	/*
+	 * Instantiated or turned negative since it was put on the LRU:
+	 * refile it, unless a shrinker has already taken it off.
+	 */
+	if (unlikely(!(dentry->d_flags & DCACHE_NEGATIVE_LRU) !=
+		     !d_is_negative(dentry)) &&
+	    !(dentry->d_flags & DCACHE_SHRINK_LIST)) {
+		d_lru_del(dentry);
+		d_lru_add(dentry);
+	}
 }
 
 /**
@@ -1063,6 +1138,58 @@ long prune_dcache_sb(struct super_block *sb, struct shrink_control *sc)
 	return freed;
 }
 
+/**
+ * prune_negative_dcache_sb - shrink the negative dentry LRU
+ * @sb: superblock
+ * @sc: shrink control, passed to list_lru_shrink_walk()
+ *
+ * Like prune_dcache_sb(), for the unused negative dentries of @sb.
+ */
+long prune_negative_dcache_sb(struct super_block *sb, struct shrink_control *sc)
+{
+	LIST_HEAD(dispose);
+	long freed;
+
+	freed = list_lru_shrink_walk(&sb->s_dentry_neg_lru, sc,
+				     dentry_lru_isolate, &dispose);
+	shrink_dentry_list(&dispose);
+	return freed;
+}
+
+/**
+ * trim_negative_dentries - enforce the negative dentry limit
+ * @sb: superblock
+ *
+ * Frees the least recently used unused negative dentries of @sb until an
+ * eighth below sysctl_negative_dentry_limit is left, so that a workload
+ * producing misses at a steady rate does not retrigger this on every
+ * batch.  Dentries that were looked up again since they were added get
+ * another pass, hence the walk covers up to twice the list.  Called from
+ * the superblock's trimming work with ->s_umount held shared.
+ */
+void trim_negative_dentries(struct super_block *sb)
+{
+	unsigned long limit = READ_ONCE(sysctl_negative_dentry_limit);
+	unsigned long count, nr, walked, freed = 0;
+
+	if (!limit)
+		return;
+	limit -= limit / 8;
+	count = list_lru_count(&sb->s_dentry_neg_lru);
+	if (count <= limit)
+		return;
+
+	nr = count - limit;
+	for (walked = 0; freed < nr && walked < 2 * count; walked += 1024) {
+		LIST_HEAD(dispose);
+
+		freed += list_lru_walk(&sb->s_dentry_neg_lru,
+				       dentry_lru_isolate, &dispose, 1024);
+		shrink_dentry_list(&dispose);
+		cond_resched();
+	}
+}
+
 static enum lru_status dentry_lru_isolate_shrink(struct list_head *item,
 		struct list_lru_one *lru, spinlock_t *lru_lock, void *arg)
 {
@@ -1100,6 +1227,8 @@ void shrink_dcache_sb(struct super_block *sb)
 
 		freed = list_lru_walk(&sb->s_dentry_lru,
 			dentry_lru_isolate_shrink, &dispose, UINT_MAX);
+		freed += list_lru_walk(&sb->s_dentry_neg_lru,
+			dentry_lru_isolate_shrink, &dispose, UINT_MAX);
 
 		this_cpu_sub(nr_dentry_unused, freed);
 		shrink_dentry_list(&dispose);
@@ -3385,6 +3514,10 @@ static void __init dcache_init(void)
 	dentry_cache = KMEM_CACHE(dentry,
 		SLAB_RECLAIM_ACCOUNT|SLAB_PANIC|SLAB_MEM_SPREAD);
 
+	/* let each superblock keep 1% of memory in negative dentries */
+	sysctl_negative_dentry_limit =
+		(totalram_pages / 100) * (PAGE_SIZE / sizeof(struct dentry));
+
 	/* Hash may have been set up in dcache_init_early */
 	if (!hashdist)
 		return;
@@ -34,6 +34,9 @@
 #include <linux/mutex.h>
 #include <linux/anon_inodes.h>
 #include <linux/device.h>
+#include <linux/net.h>
+#include <net/sock.h>
+#include <net/busy_poll.h>
 #include <asm/uaccess.h>
 #include <asm/io.h>
 #include <asm/mman.h>
@@ -219,6 +222,18 @@ struct eventpoll {
 	/* used to optimize loop detection check */
 	int visited;
 	struct list_head visited_list_link;
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	/* NAPI context of the last socket seen ready, busy polled by ep_poll() */
+	unsigned int napi_id;
+
+	/* busy poll time budget in usecs, 0 for net.core.busy_poll */
+	u32 busy_poll_usecs;
+
+	/* EPIOCSPARAMS values kept for EPIOCGPARAMS only */
+	u16 busy_poll_budget;
+	bool prefer_busy_poll;
+#endif
 };
 
 /* Wait structure used by the poll hooks */
@@ -379,6 +394,144 @@ static inline int ep_events_available(struct eventpoll *ep)
 	return !list_empty(&ep->rdllist) || ep->ovflist != EP_UNACTIVE_PTR;
 }
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+static bool ep_busy_loop_on(struct eventpoll *ep)
+{
+	return ACCESS_ONCE(ep->busy_poll_usecs) || net_busy_loop_on();
+}
+
+static bool ep_busy_loop_end(void *p)
+{
+	struct eventpoll *ep = p;
+
+	return ep_events_available(ep) || signal_pending(current);
+}
+
+/*
+ * Busy poll if globally on and supporting sockets found && no events,
+ * busy loop will return if need_resched or ep_events_available.
+ *
+ * we must do our busy polling with irqs enabled
+ */
+static void ep_busy_loop(struct eventpoll *ep, int nonblock)
+{
+	unsigned int napi_id = ACCESS_ONCE(ep->napi_id);
+	unsigned long end_time = 0;
+	u32 usecs;
+
+	if (!napi_id || !ep_busy_loop_on(ep))
+		return;
+
+	if (!nonblock) {
+		usecs = ACCESS_ONCE(ep->busy_poll_usecs) ?:
+			ACCESS_ONCE(sysctl_net_busy_poll);
+		end_time = busy_loop_us_clock() + usecs;
+	}
+
+	napi_busy_loop(napi_id, end_time,
+		       nonblock ? NULL : ep_busy_loop_end, ep);
+}
+
+static inline void ep_reset_busy_poll_napi_id(struct eventpoll *ep)
+{
+	if (ep->napi_id)
+		ep->napi_id = 0;
+}
+
+/*
+ * Remember the NAPI context of a socket file, so that ep_poll() can busy
+ * poll the queue its packets arrive on.  Only the most recent one is
+ * kept: the sockets of a busy polling server typically share a queue.
+ */
+static inline void ep_set_busy_poll_napi_id(struct epitem *epi)
+{
+	struct eventpoll *ep = epi->ep;
+	unsigned int napi_id;
+	struct socket *sock;
+	struct sock *sk;
+	int err;
+
+	if (!ep_busy_loop_on(ep))
+		return;
+
+	sock = sock_from_file(epi->ffd.file, &err);
+	if (!sock)
+		return;
+
+	sk = sock->sk;
+	if (!sk)
+		return;
+
+	napi_id = ACCESS_ONCE(sk->sk_napi_id);
+	if (!napi_id || napi_id == ep->napi_id)
+		return;
+
+	/* record NAPI ID for use in next busy poll */
+	ep->napi_id = napi_id;
+}
+
+static long ep_eventpoll_set_params(struct eventpoll *ep,
+				    struct epoll_params __user *uparams)
+{
+	struct epoll_params params;
+
+	if (copy_from_user(&params, uparams, sizeof(params)))
+		return -EFAULT;
+
+	if (params.__pad || params.busy_poll_usecs > S32_MAX ||
+	    params.prefer_busy_poll > 1)
+		return -EINVAL;
+
+	if (params.busy_poll_budget > NAPI_POLL_WEIGHT &&
+	    !capable(CAP_NET_ADMIN))
+		return -EPERM;
+
+	ACCESS_ONCE(ep->busy_poll_usecs) = params.busy_poll_usecs;
+	ACCESS_ONCE(ep->busy_poll_budget) = params.busy_poll_budget;
+	ACCESS_ONCE(ep->prefer_busy_poll) = params.prefer_busy_poll;
+	return 0;
+}
+
+static long ep_eventpoll_get_params(struct eventpoll *ep,
+				    struct epoll_params __user *uparams)
+{
+	struct epoll_params params = {
+		.busy_poll_usecs = ACCESS_ONCE(ep->busy_poll_usecs),
+		.busy_poll_budget = ACCESS_ONCE(ep->busy_poll_budget),
+		.prefer_busy_poll = ACCESS_ONCE(ep->prefer_busy_poll),
+	};
+
+	if (copy_to_user(uparams, &params, sizeof(params)))
+		return -EFAULT;
+
+	return 0;
+}
+#else
+static inline void ep_busy_loop(struct eventpoll *ep, int nonblock)
+{
+}
+
+static inline void ep_reset_busy_poll_napi_id(struct eventpoll *ep)
+{
+}
+
+static inline void ep_set_busy_poll_napi_id(struct epitem *epi)
+{
+}
+
+static long ep_eventpoll_set_params(struct eventpoll *ep,
+				    struct epoll_params __user *uparams)
+{
+	return -EOPNOTSUPP;
+}
+
+static long ep_eventpoll_get_params(struct eventpoll *ep,
+				    struct epoll_params __user *uparams)
+{
+	return -EOPNOTSUPP;
+}
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+
 /**
  * ep_call_nested - Perform a bound (possibly) nested call, by checking
  *                  that the recursion limit is not exceeded, and that
@@ -889,6 +1042,30 @@ static void ep_show_fdinfo(struct seq_file *m, struct file *f)
 }
 #endif
 
+static long ep_eventpoll_ioctl(struct file *file, unsigned int cmd,
+			       unsigned long arg)
+{
+	struct eventpoll *ep = file->private_data;
+	void __user *uarg = (void __user *)arg;
+
+	switch (cmd) {
+	case EPIOCSPARAMS:
+		return ep_eventpoll_set_params(ep, uarg);
+	case EPIOCGPARAMS:
+		return ep_eventpoll_get_params(ep, uarg);
+	default:
+		return -ENOTTY;
+	}
+}
+
+#ifdef CONFIG_COMPAT
+static long ep_eventpoll_compat_ioctl(struct file *file, unsigned int cmd,
+				      unsigned long arg)
+{
+	return ep_eventpoll_ioctl(file, cmd, (unsigned long)compat_ptr(arg));
+}
+#endif
+
 /* File callbacks that implement the eventpoll file behaviour */
 static const struct file_operations eventpoll_fops = {
 #ifdef CONFIG_PROC_FS
@@ -896,6 +1073,10 @@ static const struct file_operations eventpoll_fops = {
 #endif
 	.release	= ep_eventpoll_release,
 	.poll		= ep_eventpoll_poll,
+	.unlocked_ioctl	= ep_eventpoll_ioctl,
+#ifdef CONFIG_COMPAT
+	.compat_ioctl	= ep_eventpoll_compat_ioctl,
+#endif
 	.llseek		= noop_llseek,
 };
 
@@ -1331,6 +1512,8 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 	if (full_check && reverse_path_check())
 		goto error_remove_epi;
 
+	ep_set_busy_poll_napi_id(epi);
+
 	/* We have to drop the new item inside our item list to keep track of it */
 	spin_lock_irqsave(&ep->lock, flags);
 
@@ -1520,6 +1703,7 @@ static int ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
 			}
 			eventcnt++;
 			uevent++;
+			ep_set_busy_poll_napi_id(epi);
 			if (epi->event.events & EPOLLONESHOT)
 				epi->event.events &= EP_PRIVATE_BITS;
 			else if (!(epi->event.events & EPOLLET)) {
@@ -1608,9 +1792,20 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 	}
 
 fetch_events:
+
+	if (!ep_events_available(ep))
+		ep_busy_loop(ep, timed_out);
+
 	spin_lock_irqsave(&ep->lock, flags);
 
 	if (!ep_events_available(ep)) {
+		/*
+		 * Busy poll timed out.  Drop NAPI ID for now, we can add
+		 * it back in when we have moved a socket with a valid NAPI
+		 * ID onto the ready list.
+		 */
+		ep_reset_busy_poll_napi_id(ep);
+
 		/*
 		 * We don't have any available event to return to the caller.
 		 * We need to sleep here, and we will be wake up by
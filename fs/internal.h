@@ -51,6 +51,7 @@ extern void __init chrdev_init(void);
 extern int user_path_mountpoint_at(int, const char __user *, unsigned int, struct path *);
 extern int vfs_path_lookup(struct dentry *, struct vfsmount *,
 			   const char *, unsigned int, struct path *);
+extern int vfs_lookup_batch(struct file *, struct lookup_batch __user *);
 
 /*
  * namespace.c
@@ -130,6 +131,9 @@ extern int invalidate_inodes(struct super_block *, bool);
 extern struct dentry *__d_alloc(struct super_block *, const struct qstr *);
 extern int d_set_mounted(struct dentry *dentry);
 extern long prune_dcache_sb(struct super_block *sb, struct shrink_control *sc);
+extern long prune_negative_dcache_sb(struct super_block *sb,
+				     struct shrink_control *sc);
+extern void trim_negative_dentries(struct super_block *sb);
 
 /*
  * read_write.c
@@ -2121,6 +2121,187 @@ int vfs_path_lookup(struct dentry *dentry, struct vfsmount *mnt,
 }
 EXPORT_SYMBOL(vfs_path_lookup);
 
+/*
+ * FS_IOC_LOOKUP_BATCH works on the names in chunks: copy them in, find
+ * the cached ones in a single RCU pass, then stat the hits and do a full
+ * lookup for the rest.  An entry's result is 1 while it still needs the
+ * full lookup.
+ */
+#define LOOKUP_BATCH_CHUNK	32
+
+struct lookup_batch_chunk {
+	struct lookup_batch_entry	ent[LOOKUP_BATCH_CHUNK];
+	struct dentry			*dentry[LOOKUP_BATCH_CHUNK];
+	unsigned int			len[LOOKUP_BATCH_CHUNK];
+	char				name[LOOKUP_BATCH_CHUNK][NAME_MAX + 1];
+};
+
+static void lookup_batch_names(struct lookup_batch_chunk *c, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		struct lookup_batch_entry *e = &c->ent[i];
+		const char __user *uname;
+		long len;
+
+		c->dentry[i] = NULL;
+		uname = (const char __user *)(unsigned long)e->name;
+		len = strncpy_from_user(c->name[i], uname, NAME_MAX + 1);
+		if (len < 0)
+			e->result = len;
+		else if (len > NAME_MAX)
+			e->result = -ENAMETOOLONG;
+		else if (!len)
+			e->result = -ENOENT;
+		else if (memchr(c->name[i], '/', len) ||
+			 (len == 2 && !memcmp(c->name[i], "..", 2)))
+			e->result = -EINVAL;
+		else
+			e->result = 1;
+		c->len[i] = len;
+	}
+}
+
+/*
+ * Answer negative hits right away and pin the positive ones in
+ * c->dentry[].  Dentries that need revalidation or have something mounted
+ * on them, and names that are not in the dcache at all, are left to the
+ * full lookup.  Like lookup_fast(), a hit counts once d_seq confirms that
+ * the dentry still had this name when its type was read.
+ */
+static void lookup_batch_rcu(struct dentry *parent,
+			     struct lookup_batch_chunk *c, unsigned int n)
+{
+	unsigned int i;
+
+	rcu_read_lock();
+	for (i = 0; i < n; i++) {
+		struct dentry *dentry;
+		struct qstr this;
+		unsigned seq;
+		bool negative;
+
+		if (c->ent[i].result != 1)
+			continue;
+
+		this.name = c->name[i];
+		this.len = c->len[i];
+		this.hash = full_name_hash(this.name, this.len);
+		dentry = __d_lookup_rcu(parent, &this, &seq);
+		if (!dentry)
+			continue;
+		if (dentry->d_flags & (DCACHE_OP_REVALIDATE |
+				       DCACHE_MANAGED_DENTRY))
+			continue;
+		negative = d_is_negative(dentry);
+		if (read_seqcount_retry(&dentry->d_seq, seq))
+			continue;
+
+		if (negative)
+			c->ent[i].result = -ENOENT;
+		else if (lockref_get_not_dead(&dentry->d_lockref))
+			c->dentry[i] = dentry;
+	}
+	rcu_read_unlock();
+}
+
+static void lookup_batch_finish(struct path *dir,
+				struct lookup_batch_chunk *c, unsigned int n)
+{
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		struct lookup_batch_entry *e = &c->ent[i];
+		struct kstat stat;
+
+		if (c->dentry[i]) {
+			struct path path = { .mnt = dir->mnt,
+					     .dentry = c->dentry[i] };
+
+			e->result = vfs_getattr(&path, &stat);
+			dput(c->dentry[i]);
+		} else if (e->result == 1) {
+			struct path path;
+
+			/* same directory as the RCU pass, whatever the fd is now */
+			e->result = vfs_path_lookup(dir->dentry, dir->mnt,
+						    c->name[i], 0, &path);
+			if (!e->result) {
+				e->result = vfs_getattr(&path, &stat);
+				path_put(&path);
+			}
+		} else {
+			continue;
+		}
+
+		if (!e->result) {
+			e->mode = stat.mode;
+			e->ino = stat.ino;
+		}
+	}
+}
+
+/**
+ * vfs_lookup_batch - look up many names in one directory
+ * @file: open directory
+ * @arg: user's struct lookup_batch
+ *
+ * Fills in result, mode and inode number of every entry of the batch, as
+ * fstatat(fd, name, AT_SYMLINK_NOFOLLOW) would.  The whole batch is
+ * resolved in @file's directory, names with a '/' and ".." are refused.  Search permission on the
+ * directory is checked once for the whole batch, and names that are in the
+ * dcache are resolved without taking any locks or references on the
+ * directory.  Returns 0 or an error that applies to the whole batch.
+ */
+int vfs_lookup_batch(struct file *file, struct lookup_batch __user *arg)
+{
+	struct dentry *parent = file->f_path.dentry;
+	struct lookup_batch_entry __user *uent;
+	struct lookup_batch_chunk *c;
+	struct lookup_batch lb;
+	unsigned int done, n;
+	int error;
+
+	if (copy_from_user(&lb, arg, sizeof(lb)))
+		return -EFAULT;
+	if (lb.flags || lb.count > LOOKUP_BATCH_MAX)
+		return -EINVAL;
+	if (!d_can_lookup(parent))
+		return -ENOTDIR;
+	error = inode_permission(parent->d_inode, MAY_EXEC);
+	if (error)
+		return error;
+
+	c = kmalloc(sizeof(*c), GFP_KERNEL);
+	if (!c)
+		return -ENOMEM;
+
+	uent = (struct lookup_batch_entry __user *)(unsigned long)lb.entries;
+	for (done = 0; done < lb.count; done += n) {
+		n = min_t(unsigned int, lb.count - done, LOOKUP_BATCH_CHUNK);
+		if (copy_from_user(c->ent, uent + done, n * sizeof(c->ent[0]))) {
+			error = -EFAULT;
+			break;
+		}
+
+		lookup_batch_names(c, n);
+		/* names must be hashed by the filesystem otherwise */
+		if (!(parent->d_flags & DCACHE_OP_HASH))
+			lookup_batch_rcu(parent, c, n);
+		lookup_batch_finish(&file->f_path, c, n);
+
+		if (copy_to_user(uent + done, c->ent, n * sizeof(c->ent[0]))) {
+			error = -EFAULT;
+			break;
+		}
+		cond_resched();
+	}
+
+	kfree(c);
+	return error;
+}
+
 /*
  * Restricted form of lookup. Doesn't follow links, single-component only,
  * needs parent already locked. Doesn't follow mounts.
@@ -552,28 +552,29 @@ static int nfs_launder_page(struct page *page)
 }
 
 #ifdef CONFIG_NFS_SWAP
+static int nfs_swap_xprt(struct rpc_clnt *clnt, struct rpc_xprt *xprt,
+			 void *enable)
+{
+	return xs_swapper(xprt, *(int *)enable);
+}
+
 static int nfs_swap_activate(struct swap_info_struct *sis, struct file *file,
 						sector_t *span)
 {
-	int ret;
 	struct rpc_clnt *clnt = NFS_CLIENT(file->f_mapping->host);
+	int enable = 1;
 
 	*span = sis->pages;
 
-	rcu_read_lock();
-	ret = xs_swapper(rcu_dereference(clnt->cl_xprt), 1);
-	rcu_read_unlock();
-
-	return ret;
+	return rpc_clnt_iterate_for_each_xprt(clnt, nfs_swap_xprt, &enable);
 }
 
 static void nfs_swap_deactivate(struct file *file)
 {
 	struct rpc_clnt *clnt = NFS_CLIENT(file->f_mapping->host);
+	int enable = 0;
 
-	rcu_read_lock();
-	xs_swapper(rcu_dereference(clnt->cl_xprt), 0);
-	rcu_read_unlock();
+	rpc_clnt_iterate_for_each_xprt(clnt, nfs_swap_xprt, &enable);
 }
 #endif
 
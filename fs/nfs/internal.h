@@ -53,6 +53,11 @@ struct nfs_clone_mount {
  */
 #define NFS_MAX_SECFLAVORS	(12)
 
+/*
+ * Maximum number of transport connections to one server (nconnect).
+ */
+#define NFS_MAX_CONNECTIONS	(16)
+
 /*
  * Value used if the user did not specify a port value.
  */
@@ -72,6 +77,7 @@ struct nfs_client_initdata {
 	struct nfs_subversion *nfs_mod;
 	int proto;
 	u32 minorversion;
+	unsigned int nconnect;
 	struct net *net;
 };
 
@@ -111,6 +117,7 @@ struct nfs_parsed_mount_data {
 		char			*export_path;
 		int			port;
 		unsigned short		protocol;
+		unsigned short		nconnect;
 	} nfs_server;
 
 	struct security_mnt_opts lsm_opts;
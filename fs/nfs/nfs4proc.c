@@ -6639,13 +6639,17 @@ nfs41_same_server_scope(struct nfs41_server_scope *a,
 	return false;
 }
 
+static const struct rpc_call_ops nfs4_bind_one_conn_to_session_ops = {
+};
+
 /*
- * nfs4_proc_bind_conn_to_session()
- *
- * The 4.1 client currently uses the same TCP connection for the
- * fore and backchannel.
+ * The 4.1 client uses the same TCP connection for the fore and
+ * backchannel.  Any additional connections (nconnect) only carry
+ * fore channel traffic.
  */
-int nfs4_proc_bind_conn_to_session(struct nfs_client *clp, struct rpc_cred *cred)
+static int nfs4_proc_bind_one_conn_to_session(struct rpc_clnt *clnt,
+		struct rpc_xprt *xprt, struct nfs_client *clp,
+		struct rpc_cred *cred)
 {
 	int status;
 	struct nfs41_bind_conn_to_session_args args = {
@@ -6660,14 +6664,28 @@ int nfs4_proc_bind_conn_to_session(struct nfs_client *clp, struct rpc_cred *cred
 		.rpc_resp = &res,
 		.rpc_cred = cred,
 	};
+	struct rpc_task_setup task_setup_data = {
+		.rpc_client = clnt,
+		.rpc_xprt = xprt,
+		.callback_ops = &nfs4_bind_one_conn_to_session_ops,
+		.rpc_message = &msg,
+		.flags = RPC_TASK_TIMEOUT,
+	};
+	struct rpc_task *task;
 
 	dprintk("--> %s\n", __func__);
 
 	nfs4_copy_sessionid(&args.sessionid, &clp->cl_session->sess_id);
-	if (!(clp->cl_session->flags & SESSION4_BACK_CHAN))
+	if (!(clp->cl_session->flags & SESSION4_BACK_CHAN) ||
+	    xprt != rcu_access_pointer(clnt->cl_xprt))
 		args.dir = NFS4_CDFC4_FORE;
 
-	status = rpc_call_sync(clp->cl_rpcclient, &msg, RPC_TASK_TIMEOUT);
+	task = rpc_run_task(&task_setup_data);
+	if (!IS_ERR(task)) {
+		status = task->tk_status;
+		rpc_put_task(task);
+	} else
+		status = PTR_ERR(task);
 	trace_nfs4_bind_conn_to_session(clp, status);
 	if (status == 0) {
 		if (memcmp(res.sessionid.data,
@@ -6694,6 +6712,37 @@ out:
 	return status;
 }
 
+struct rpc_bind_conn_calldata {
+	struct nfs_client *clp;
+	struct rpc_cred *cred;
+};
+
+static int
+nfs4_proc_bind_conn_to_session_callback(struct rpc_clnt *clnt,
+		struct rpc_xprt *xprt,
+		void *calldata)
+{
+	struct rpc_bind_conn_calldata *p = calldata;
+
+	return nfs4_proc_bind_one_conn_to_session(clnt, xprt, p->clp, p->cred);
+}
+
+/*
+ * nfs4_proc_bind_conn_to_session()
+ *
+ * Bind every connection of the client to its session.
+ */
+int nfs4_proc_bind_conn_to_session(struct nfs_client *clp, struct rpc_cred *cred)
+{
+	struct rpc_bind_conn_calldata data = {
+		.clp = clp,
+		.cred = cred,
+	};
+
+	return rpc_clnt_iterate_for_each_xprt(clp->cl_rpcclient,
+			nfs4_proc_bind_conn_to_session_callback, &data);
+}
+
 /*
  * Minimum set of SP4_MACH_CRED operations from RFC 5661 in the enforce map
  * and operations we'd like to see to enable certain features in the allow map
@@ -7300,6 +7349,15 @@ int nfs4_proc_create_session(struct nfs_client *clp, struct rpc_cred *cred)
 	ptr = (unsigned *)&session->sess_id.data[0];
 	dprintk("%s client>seqid %d sessionid %u:%u:%u:%u\n", __func__,
 		clp->cl_seqid, ptr[0], ptr[1], ptr[2], ptr[3]);
+
+	/*
+	 * With SP4_NONE the server binds additional connections to the
+	 * session on first use.  With SP4_MACH_CRED they must be bound
+	 * explicitly before they can carry a SEQUENCE.
+	 */
+	if (test_bit(NFS_SP4_MACH_CRED_MINIMAL, &clp->cl_sp4_flags) &&
+	    rcu_access_pointer(clp->cl_rpcclient->cl_xpsw) != NULL)
+		set_bit(NFS4CLNT_BIND_CONN_TO_SESSION, &clp->cl_state);
 out:
 	dprintk("<-- %s\n", __func__);
 	return status;
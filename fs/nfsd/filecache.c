@@ -0,0 +1,515 @@
+/*
+ * Open file cache for stateless NFS I/O.
+ *
+ * NFSv2 and v3 have no OPEN, so every READ, WRITE and COMMIT used to open
+ * the file, do its I/O and close it again.  Opening means permission and
+ * security hooks, ima and fsnotify, and a trip through the filesystem's
+ * ->open and ->release, which is often more expensive than a small read.
+ * Instead keep recently used open files around, keyed by inode, access
+ * mode, credentials and network namespace.
+ *
+ * Files that go unused for a couple of laundrette passes are closed, as
+ * are files whose inode is unlinked or renamed over through nfsd, or on
+ * which NFSv4 wants to set a delegation lease.  Flushing the export cache
+ * closes everything so that unexported filesystems can be unmounted.
+ */
+
+#include <linux/slab.h>
+#include <linux/hash.h>
+#include <linux/file.h>
+#include <linux/cred.h>
+#include <linux/list_lru.h>
+#include <linux/seq_file.h>
+#include <linux/sched.h>
+
+#include "nfsd.h"
+#include "vfs.h"
+#include "filecache.h"
+
+#define NFSDDBG_FACILITY	NFSDDBG_FILEOP
+
+#define NFSD_FILE_HASH_BITS	12
+#define NFSD_FILE_HASH_SIZE	(1 << NFSD_FILE_HASH_BITS)
+
+/* idle files are closed after two to three of these */
+#define NFSD_LAUNDRETTE_DELAY	(2 * HZ)
+
+/* above this many files, age them now rather than on the next pass */
+#define NFSD_FILE_LRU_THRESHOLD	4096
+
+/* the part of the NFSD_MAY_* flags that is the key's access mode */
+#define NFSD_FILE_MAY_MASK	(NFSD_MAY_READ | NFSD_MAY_WRITE)
+
+struct nfsd_fcache_bucket {
+	struct hlist_head	nb_head;
+	spinlock_t		nb_lock;
+} ____cacheline_aligned_in_smp;
+
+static struct nfsd_fcache_bucket	nfsd_file_hashtbl[NFSD_FILE_HASH_SIZE];
+static struct kmem_cache		*nfsd_file_slab;
+static struct list_lru			nfsd_file_lru;
+static atomic_t				nfsd_file_count;
+
+static DEFINE_PER_CPU(unsigned long, nfsd_file_cache_hits);
+static DEFINE_PER_CPU(unsigned long, nfsd_file_cache_misses);
+static DEFINE_PER_CPU(unsigned long, nfsd_file_evictions);
+
+static void nfsd_file_gc_worker(struct work_struct *work);
+static DECLARE_DELAYED_WORK(nfsd_filecache_laundrette, nfsd_file_gc_worker);
+
+static void
+nfsd_file_schedule_laundrette(void)
+{
+	if (atomic_read(&nfsd_file_count) > NFSD_FILE_LRU_THRESHOLD)
+		mod_delayed_work(system_wq, &nfsd_filecache_laundrette, 0);
+	else
+		schedule_delayed_work(&nfsd_filecache_laundrette,
+				      NFSD_LAUNDRETTE_DELAY);
+}
+
+static void
+nfsd_file_slab_free(struct rcu_head *rcu)
+{
+	struct nfsd_file *nf = container_of(rcu, struct nfsd_file, nf_rcu);
+
+	kmem_cache_free(nfsd_file_slab, nf);
+}
+
+static void
+nfsd_file_free(struct nfsd_file *nf)
+{
+	dprintk("nfsd: closing cached file %p\n", nf->nf_file);
+	fput(nf->nf_file);
+	put_cred(nf->nf_cred);
+	/* lookups walk the hash chains under RCU only */
+	call_rcu(&nf->nf_rcu, nfsd_file_slab_free);
+}
+
+/**
+ * nfsd_file_put - release a file from nfsd_file_acquire()
+ * @nf: file to release
+ *
+ * The file stays cached and is marked as recently used.
+ */
+void
+nfsd_file_put(struct nfsd_file *nf)
+{
+	set_bit(NFSD_FILE_REFERENCED, &nf->nf_flags);
+	if (atomic_dec_and_test(&nf->nf_ref))
+		nfsd_file_free(nf);
+}
+
+/*
+ * Two creds are interchangeable for I/O if they carry the same fs ids and
+ * groups.  nfsd builds new creds for every request, so compare contents.
+ */
+static bool
+nfsd_file_cred_match(const struct cred *c1, const struct cred *c2)
+{
+	const struct group_info *g1 = c1->group_info, *g2 = c2->group_info;
+	int i;
+
+	if (!uid_eq(c1->fsuid, c2->fsuid) || !gid_eq(c1->fsgid, c2->fsgid))
+		return false;
+	if (g1 == g2)
+		return true;
+	if (g1->ngroups != g2->ngroups)
+		return false;
+	for (i = 0; i < g1->ngroups; i++) {
+		if (!gid_eq(GROUP_AT(g1, i), GROUP_AT(g2, i)))
+			return false;
+	}
+	return true;
+}
+
+/* Called under RCU or the bucket lock; returns a new reference */
+static struct nfsd_file *
+nfsd_file_find(struct nfsd_fcache_bucket *b, struct inode *inode,
+	       unsigned char may, struct net *net)
+{
+	struct nfsd_file *nf;
+
+	hlist_for_each_entry_rcu(nf, &b->nb_head, nf_node) {
+		if (nf->nf_inode != inode || nf->nf_may != may ||
+		    nf->nf_net != net)
+			continue;
+		if (!test_bit(NFSD_FILE_HASHED, &nf->nf_flags))
+			continue;
+		if (!nfsd_file_cred_match(nf->nf_cred, current_cred()))
+			continue;
+		if (atomic_inc_not_zero(&nf->nf_ref))
+			return nf;
+	}
+	return NULL;
+}
+
+/*
+ * Unhash the files for @inode in bucket @b, or all of them if @inode is
+ * NULL, and move them to @dispose.  Files an RPC is still using are
+ * closed when it puts them.
+ */
+static void
+nfsd_file_unhash_bucket(struct nfsd_fcache_bucket *b, struct inode *inode,
+			struct list_head *dispose)
+{
+	struct nfsd_file *nf;
+	struct hlist_node *tmp;
+
+	spin_lock(&b->nb_lock);
+	hlist_for_each_entry_safe(nf, tmp, &b->nb_head, nf_node) {
+		if (inode && nf->nf_inode != inode)
+			continue;
+		/* the laundrette may already own it */
+		if (!test_and_clear_bit(NFSD_FILE_HASHED, &nf->nf_flags))
+			continue;
+		hlist_del_rcu(&nf->nf_node);
+		atomic_dec(&nfsd_file_count);
+		list_lru_del(&nfsd_file_lru, &nf->nf_lru);
+		list_add(&nf->nf_lru, dispose);
+	}
+	spin_unlock(&b->nb_lock);
+}
+
+static void
+nfsd_file_dispose_list(struct list_head *dispose)
+{
+	struct nfsd_file *nf;
+
+	while (!list_empty(dispose)) {
+		nf = list_first_entry(dispose, struct nfsd_file, nf_lru);
+		list_del_init(&nf->nf_lru);
+		if (atomic_dec_and_test(&nf->nf_ref))
+			nfsd_file_free(nf);
+	}
+}
+
+/*
+ * The LRU holds every hashed file.  Skip those in use, give recently used
+ * ones another pass and take the rest off the LRU; the caller unhashes
+ * them.  Runs under the LRU lock, so can't take bucket locks.
+ */
+static enum lru_status
+nfsd_file_lru_cb(struct list_head *item, struct list_lru_one *lru,
+		 spinlock_t *lock, void *arg)
+{
+	struct list_head *head = arg;
+	struct nfsd_file *nf = list_entry(item, struct nfsd_file, nf_lru);
+
+	if (atomic_read(&nf->nf_ref) > 1)
+		return LRU_SKIP;
+	if (test_and_clear_bit(NFSD_FILE_REFERENCED, &nf->nf_flags))
+		return LRU_ROTATE;
+	/* being unhashed by nfsd_file_unhash_bucket() */
+	if (!test_and_clear_bit(NFSD_FILE_HASHED, &nf->nf_flags))
+		return LRU_SKIP;
+	list_lru_isolate_move(lru, &nf->nf_lru, head);
+	return LRU_REMOVED;
+}
+
+/* Unhash and put the files nfsd_file_lru_cb() took off the LRU */
+static unsigned long
+nfsd_file_dispose_lru(struct list_head *dispose)
+{
+	struct nfsd_file *nf;
+	unsigned long ret = 0;
+
+	list_for_each_entry(nf, dispose, nf_lru) {
+		struct nfsd_fcache_bucket *b;
+
+		b = &nfsd_file_hashtbl[nf->nf_hashval];
+		spin_lock(&b->nb_lock);
+		hlist_del_rcu(&nf->nf_node);
+		spin_unlock(&b->nb_lock);
+		atomic_dec(&nfsd_file_count);
+		ret++;
+	}
+	this_cpu_add(nfsd_file_evictions, ret);
+	nfsd_file_dispose_list(dispose);
+	return ret;
+}
+
+static void
+nfsd_file_gc_worker(struct work_struct *work)
+{
+	LIST_HEAD(dispose);
+
+	list_lru_walk(&nfsd_file_lru, nfsd_file_lru_cb, &dispose, ULONG_MAX);
+	nfsd_file_dispose_lru(&dispose);
+	if (list_lru_count(&nfsd_file_lru))
+		schedule_delayed_work(&nfsd_filecache_laundrette,
+				      NFSD_LAUNDRETTE_DELAY);
+}
+
+static unsigned long
+nfsd_file_lru_count(struct shrinker *s, struct shrink_control *sc)
+{
+	return list_lru_shrink_count(&nfsd_file_lru, sc);
+}
+
+static unsigned long
+nfsd_file_lru_scan(struct shrinker *s, struct shrink_control *sc)
+{
+	LIST_HEAD(dispose);
+
+	list_lru_shrink_walk(&nfsd_file_lru, sc, nfsd_file_lru_cb, &dispose);
+	return nfsd_file_dispose_lru(&dispose);
+}
+
+static struct shrinker nfsd_file_shrinker = {
+	.scan_objects = nfsd_file_lru_scan,
+	.count_objects = nfsd_file_lru_count,
+	.seeks = 1,
+	.flags = SHRINKER_NUMA_AWARE,
+};
+
+/**
+ * nfsd_file_acquire - get an open file for stateless I/O
+ * @rqstp: the RPC
+ * @fhp: file handle of a regular file
+ * @may_flags: NFSD_MAY_READ or NFSD_MAY_WRITE, plus modifiers
+ * @pnf: set to the file on success
+ *
+ * Verifies @fhp and the caller's access to it as nfsd_open() would, then
+ * returns a cached open file if there is one and opens one if not.  The
+ * file must be released with nfsd_file_put().
+ */
+__be32
+nfsd_file_acquire(struct svc_rqst *rqstp, struct svc_fh *fhp,
+		  unsigned int may_flags, struct nfsd_file **pnf)
+{
+	unsigned char may = may_flags & NFSD_FILE_MAY_MASK;
+	struct net *net = SVC_NET(rqstp);
+	struct nfsd_fcache_bucket *b;
+	struct nfsd_file *nf, *new;
+	struct inode *inode;
+	struct file *file;
+	unsigned int hashval;
+	__be32 status;
+	int host_err;
+
+	status = fh_verify(rqstp, fhp, S_IFREG,
+			   may_flags | NFSD_MAY_OWNER_OVERRIDE);
+	if (status)
+		return status;
+
+	inode = fhp->fh_dentry->d_inode;
+	hashval = hash_ptr(inode, NFSD_FILE_HASH_BITS);
+	b = &nfsd_file_hashtbl[hashval];
+
+	rcu_read_lock();
+	nf = nfsd_file_find(b, inode, may, net);
+	rcu_read_unlock();
+	if (nf) {
+		/* the checks nfsd_open() makes on every open */
+		status = nfserr_perm;
+		if (IS_APPEND(inode) && (may_flags & NFSD_MAY_WRITE))
+			goto out_put;
+		if (mandatory_lock(inode))
+			goto out_put;
+		host_err = nfsd_open_break_lease(inode, may_flags);
+		if (host_err) {
+			status = nfserrno(host_err);
+			goto out_put;
+		}
+		this_cpu_inc(nfsd_file_cache_hits);
+		*pnf = nf;
+		return nfs_ok;
+	}
+
+	this_cpu_inc(nfsd_file_cache_misses);
+	status = nfsd_open(rqstp, fhp, S_IFREG, may_flags, &file);
+	if (status)
+		return status;
+
+	new = kmem_cache_alloc(nfsd_file_slab, GFP_KERNEL);
+	if (!new) {
+		nfsd_close(file);
+		return nfserr_jukebox;
+	}
+	new->nf_file = file;
+	new->nf_cred = get_cred(current_cred());
+	new->nf_net = net;
+	new->nf_inode = inode;
+	new->nf_hashval = hashval;
+	new->nf_may = may;
+	new->nf_flags = 1 << NFSD_FILE_HASHED;
+	/* one for the hash table, one for the caller */
+	atomic_set(&new->nf_ref, 2);
+	INIT_LIST_HEAD(&new->nf_lru);
+
+	spin_lock(&b->nb_lock);
+	nf = nfsd_file_find(b, inode, may, net);
+	if (nf) {
+		/* somebody else opened it meanwhile: use theirs */
+		spin_unlock(&b->nb_lock);
+		nfsd_file_free(new);
+		*pnf = nf;
+		return nfs_ok;
+	}
+	hlist_add_head_rcu(&new->nf_node, &b->nb_head);
+	list_lru_add(&nfsd_file_lru, &new->nf_lru);
+	atomic_inc(&nfsd_file_count);
+	spin_unlock(&b->nb_lock);
+
+	nfsd_file_schedule_laundrette();
+	*pnf = new;
+	return nfs_ok;
+
+out_put:
+	nfsd_file_put(nf);
+	return status;
+}
+
+/**
+ * nfsd_file_close_inode - close the cached files for an inode
+ * @inode: inode being unlinked or renamed over
+ *
+ * Files still in use are closed when their RPCs finish.
+ */
+void
+nfsd_file_close_inode(struct inode *inode)
+{
+	struct nfsd_fcache_bucket *b;
+	LIST_HEAD(dispose);
+
+	b = &nfsd_file_hashtbl[hash_ptr(inode, NFSD_FILE_HASH_BITS)];
+	if (hlist_empty(&b->nb_head))
+		return;
+	nfsd_file_unhash_bucket(b, inode, &dispose);
+	nfsd_file_dispose_list(&dispose);
+}
+
+/**
+ * nfsd_file_close_inode_sync - close the cached files for an inode now
+ * @inode: inode about to get a lease
+ *
+ * As nfsd_file_close_inode(), but waits for the final close, which for a
+ * kernel thread is otherwise deferred, so that the files no longer count
+ * as conflicting opens.
+ */
+void
+nfsd_file_close_inode_sync(struct inode *inode)
+{
+	nfsd_file_close_inode(inode);
+	flush_delayed_fput();
+}
+
+/**
+ * nfsd_file_cache_purge - close every cached file
+ *
+ * Called with nfsd_mutex held when the export cache is flushed, so that
+ * filesystems that are no longer exported can be unmounted.
+ */
+void
+nfsd_file_cache_purge(void)
+{
+	LIST_HEAD(dispose);
+	unsigned int i;
+
+	if (!nfsd_file_slab)
+		return;
+
+	for (i = 0; i < NFSD_FILE_HASH_SIZE; i++) {
+		if (hlist_empty(&nfsd_file_hashtbl[i].nb_head))
+			continue;
+		nfsd_file_unhash_bucket(&nfsd_file_hashtbl[i], NULL, &dispose);
+	}
+	nfsd_file_dispose_list(&dispose);
+	flush_delayed_fput();
+}
+
+int
+nfsd_file_cache_init(void)
+{
+	unsigned int i;
+	int ret;
+
+	if (nfsd_file_slab)
+		return 0;
+
+	for (i = 0; i < NFSD_FILE_HASH_SIZE; i++) {
+		INIT_HLIST_HEAD(&nfsd_file_hashtbl[i].nb_head);
+		spin_lock_init(&nfsd_file_hashtbl[i].nb_lock);
+	}
+
+	ret = list_lru_init(&nfsd_file_lru);
+	if (ret)
+		goto out_err;
+
+	nfsd_file_slab = kmem_cache_create("nfsd_file",
+					   sizeof(struct nfsd_file), 0, 0,
+					   NULL);
+	if (!nfsd_file_slab) {
+		ret = -ENOMEM;
+		goto out_lru;
+	}
+
+	ret = register_shrinker(&nfsd_file_shrinker);
+	if (ret)
+		goto out_slab;
+	return 0;
+
+out_slab:
+	kmem_cache_destroy(nfsd_file_slab);
+	nfsd_file_slab = NULL;
+out_lru:
+	list_lru_destroy(&nfsd_file_lru);
+out_err:
+	printk(KERN_ERR "nfsd: failed to allocate open file cache\n");
+	return ret;
+}
+
+void
+nfsd_file_cache_shutdown(void)
+{
+	if (!nfsd_file_slab)
+		return;
+
+	unregister_shrinker(&nfsd_file_shrinker);
+	cancel_delayed_work_sync(&nfsd_filecache_laundrette);
+	/* no nfsd threads are left, so this closes everything */
+	nfsd_file_cache_purge();
+	list_lru_destroy(&nfsd_file_lru);
+	/* wait for nfsd_file_slab_free() */
+	rcu_barrier();
+	kmem_cache_destroy(nfsd_file_slab);
+	nfsd_file_slab = NULL;
+}
+
+static unsigned long
+nfsd_file_stat_sum(unsigned long __percpu *stat)
+{
+	unsigned long sum = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		sum += *per_cpu_ptr(stat, cpu);
+	return sum;
+}
+
+static int nfsd_file_cache_stats_show(struct seq_file *m, void *v)
+{
+	unsigned long lru = 0;
+
+	mutex_lock(&nfsd_mutex);
+	if (nfsd_file_slab)
+		lru = list_lru_count(&nfsd_file_lru);
+	mutex_unlock(&nfsd_mutex);
+
+	seq_printf(m, "total entries:         %u\n",
+			atomic_read(&nfsd_file_count));
+	seq_printf(m, "lru entries:           %lu\n", lru);
+	seq_printf(m, "hash buckets:          %u\n", NFSD_FILE_HASH_SIZE);
+	seq_printf(m, "cache hits:            %lu\n",
+			nfsd_file_stat_sum(&nfsd_file_cache_hits));
+	seq_printf(m, "cache misses:          %lu\n",
+			nfsd_file_stat_sum(&nfsd_file_cache_misses));
+	seq_printf(m, "evictions:             %lu\n",
+			nfsd_file_stat_sum(&nfsd_file_evictions));
+	return 0;
+}
+
+int nfsd_file_cache_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, nfsd_file_cache_stats_show, NULL);
+}
@@ -0,0 +1,43 @@
+#ifndef _FS_NFSD_FILECACHE_H
+#define _FS_NFSD_FILECACHE_H
+
+#include <linux/fs.h>
+
+struct svc_rqst;
+struct svc_fh;
+
+/*
+ * An open file kept around between stateless (NFSv2/v3) READ, WRITE and
+ * COMMIT calls so that they don't each pay for an open and a close.
+ *
+ * A file in the cache holds one reference on behalf of the hash table and
+ * one for each RPC using it.  Idle files age off an LRU list.
+ */
+struct nfsd_file {
+	struct hlist_node	nf_node;	/* hash chain */
+	struct list_head	nf_lru;		/* LRU, then dispose list */
+	struct rcu_head		nf_rcu;
+	struct file		*nf_file;
+	const struct cred	*nf_cred;	/* creds the file was opened with */
+	struct net		*nf_net;
+	struct inode		*nf_inode;
+	unsigned int		nf_hashval;
+	atomic_t		nf_ref;
+	unsigned char		nf_may;		/* NFSD_MAY_READ/WRITE */
+	unsigned long		nf_flags;
+#define	NFSD_FILE_HASHED	(0)
+#define	NFSD_FILE_REFERENCED	(1)
+};
+
+int		nfsd_file_cache_init(void);
+void		nfsd_file_cache_shutdown(void);
+void		nfsd_file_cache_purge(void);
+__be32		nfsd_file_acquire(struct svc_rqst *rqstp, struct svc_fh *fhp,
+				  unsigned int may_flags,
+				  struct nfsd_file **nfp);
+void		nfsd_file_put(struct nfsd_file *nf);
+void		nfsd_file_close_inode(struct inode *inode);
+void		nfsd_file_close_inode_sync(struct inode *inode);
+int		nfsd_file_cache_stats_open(struct inode *, struct file *);
+
+#endif /* _FS_NFSD_FILECACHE_H */
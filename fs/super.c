@@ -60,6 +60,7 @@ static unsigned long super_cache_scan(struct shrinker *shrink,
 	long	total_objects;
 	long	freed = 0;
 	long	dentries;
+	long	negative;
 	long	inodes;
 
 	sb = container_of(shrink, struct super_block, s_shrink);
@@ -79,24 +80,29 @@ static unsigned long super_cache_scan(struct shrinker *shrink,
 
 	inodes = list_lru_shrink_count(&sb->s_inode_lru, sc);
 	dentries = list_lru_shrink_count(&sb->s_dentry_lru, sc);
-	total_objects = dentries + inodes + fs_objects + 1;
+	negative = list_lru_shrink_count(&sb->s_dentry_neg_lru, sc);
+	total_objects = dentries + negative + inodes + fs_objects + 1;
 	if (!total_objects)
 		total_objects = 1;
 
 	/* proportion the scan between the caches */
 	dentries = mult_frac(sc->nr_to_scan, dentries, total_objects);
+	negative = mult_frac(sc->nr_to_scan, negative, total_objects);
 	inodes = mult_frac(sc->nr_to_scan, inodes, total_objects);
 	fs_objects = mult_frac(sc->nr_to_scan, fs_objects, total_objects);
 
 	/*
-	 * prune the dcache first as the icache is pinned by it, then
-	 * prune the icache, followed by the filesystem specific caches
+	 * prune the negative dentries first as they are the cheapest to
+	 * rebuild, then the rest of the dcache as the icache is pinned by it,
+	 * then the icache, followed by the filesystem specific caches
 	 *
 	 * Ensure that we always scan at least one object - memcg kmem
 	 * accounting uses this to fully empty the caches.
 	 */
+	sc->nr_to_scan = negative + 1;
+	freed = prune_negative_dcache_sb(sb, sc);
 	sc->nr_to_scan = dentries + 1;
-	freed = prune_dcache_sb(sb, sc);
+	freed += prune_dcache_sb(sb, sc);
 	sc->nr_to_scan = inodes + 1;
 	freed += prune_icache_sb(sb, sc);
 
@@ -129,6 +135,7 @@ static unsigned long super_cache_count(struct shrinker *shrink,
 		total_objects = sb->s_op->nr_cached_objects(sb, sc);
 
 	total_objects += list_lru_shrink_count(&sb->s_dentry_lru, sc);
+	total_objects += list_lru_shrink_count(&sb->s_dentry_neg_lru, sc);
 	total_objects += list_lru_shrink_count(&sb->s_inode_lru, sc);
 
 	total_objects = vfs_pressure_ratio(total_objects);
@@ -145,6 +152,7 @@ static void destroy_super(struct super_block *s)
 {
 	int i;
 	list_lru_destroy(&s->s_dentry_lru);
+	list_lru_destroy(&s->s_dentry_neg_lru);
 	list_lru_destroy(&s->s_inode_lru);
 	for (i = 0; i < SB_FREEZE_LEVELS; i++)
 		percpu_counter_destroy(&s->s_writers.counter[i]);
@@ -155,6 +163,22 @@ static void destroy_super(struct super_block *s)
 	kfree_rcu(s, rcu);
 }
 
+/*
+ * Trim the negative dentries of a superblock back below the limit.  Queued
+ * from the dcache when an active superblock goes over it, and flushed by
+ * deactivate_locked_super() before the superblock goes away.
+ */
+static void super_trim_negative_dentries(struct work_struct *work)
+{
+	struct super_block *sb;
+
+	sb = container_of(work, struct super_block, s_dentry_neg_work);
+	if (!trylock_super(sb))
+		return;
+	trim_negative_dentries(sb);
+	up_read(&sb->s_umount);
+}
+
 /**
  *	alloc_super	-	create new superblock
  *	@type:	filesystem type superblock should belong to
@@ -192,8 +216,12 @@ static struct super_block *alloc_super(struct file_system_type *type, int flags)
 	INIT_HLIST_BL_HEAD(&s->s_anon);
 	INIT_LIST_HEAD(&s->s_inodes);
 
+	INIT_WORK(&s->s_dentry_neg_work, super_trim_negative_dentries);
+
 	if (list_lru_init_memcg(&s->s_dentry_lru))
 		goto fail;
+	if (list_lru_init_memcg(&s->s_dentry_neg_lru))
+		goto fail;
 	if (list_lru_init_memcg(&s->s_inode_lru))
 		goto fail;
 
@@ -285,12 +313,19 @@ void deactivate_locked_super(struct super_block *s)
 		unregister_shrinker(&s->s_shrink);
 		fs->kill_sb(s);
 
+		/*
+		 * No dentries are left to queue the trimming work again,
+		 * and with ->s_umount held here a pending one bails out.
+		 */
+		cancel_work_sync(&s->s_dentry_neg_work);
+
 		/*
 		 * Since list_lru_destroy() may sleep, we cannot call it from
 		 * put_super(), where we hold the sb_lock. Therefore we destroy
 		 * the lru lists right now.
 		 */
 		list_lru_destroy(&s->s_dentry_lru);
+		list_lru_destroy(&s->s_dentry_neg_lru);
 		list_lru_destroy(&s->s_inode_lru);
 
 		put_filesystem(fs);
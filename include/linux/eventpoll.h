@@ -14,6 +14,30 @@
 #define _LINUX_EVENTPOLL_H
 
 #include <uapi/linux/eventpoll.h>
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/*
+ * Per-instance parameters set and read with ioctl() on an epoll fd, laid
+ * out as the upstream interface.
+ * busy_poll_usecs: how long epoll_wait() busy polls the NAPI context of
+ * its sockets before sleeping; 0 means net.core.busy_poll.
+ * busy_poll_budget, prefer_busy_poll: checked and kept like upstream, but
+ * without effect here: ndo_busy_poll() takes no budget, and the NET_RX
+ * softirq is never deferred in favour of busy polling.
+ */
+struct epoll_params {
+	__u32 busy_poll_usecs;
+	__u16 busy_poll_budget;
+	__u8 prefer_busy_poll;
+
+	/* pad the struct to a multiple of 64bits */
+	__u8 __pad;
+};
+
+#define EPOLL_IOC_TYPE		0x8A
+#define EPIOCSPARAMS		_IOW(EPOLL_IOC_TYPE, 0x01, struct epoll_params)
+#define EPIOCGPARAMS		_IOR(EPOLL_IOC_TYPE, 0x02, struct epoll_params)
 
 
 /* Forward declarations to avoid compiler errors */
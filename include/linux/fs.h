@@ -29,6 +29,7 @@
 #include <linux/uidgid.h>
 #include <linux/lockdep.h>
 #include <linux/percpu-rwsem.h>
+#include <linux/workqueue.h>
 #include <linux/blk_types.h>
 
 #include <asm/byteorder.h>
@@ -777,6 +778,19 @@ struct fown_struct {
 /*
  * Track a single file's readahead state
  */
+/*
+ * A readahead window of another sequential stream on the same file.  With
+ * async_size == 0 it is only the last small read of a stream that has not
+ * been recognised as sequential yet.
+ */
+struct file_ra_stream {
+	pgoff_t start;
+	unsigned int size;
+	unsigned int async_size;
+};
+
+#define RA_NR_STREAMS	4
+
 struct file_ra_state {
 	pgoff_t start;			/* where readahead started */
 	unsigned int size;		/* # of readahead pages */
@@ -786,6 +800,10 @@ struct file_ra_state {
 	unsigned int ra_pages;		/* Maximum readahead window */
 	unsigned int mmap_miss;		/* Cache miss stat for mmap accesses */
 	loff_t prev_pos;		/* Cache last read() position */
+
+	unsigned int stream_next;	/* Next streams[] slot to replace */
+	struct file_ra_stream streams[RA_NR_STREAMS];
+					/* Windows of interleaved streams */
 };
 
 /*
@@ -1303,11 +1321,15 @@ struct super_block {
 	struct workqueue_struct *s_dio_done_wq;
 	struct hlist_head s_pins;
 
+	/* Trims s_dentry_neg_lru when it grows past the negative dentry limit */
+	struct work_struct s_dentry_neg_work;
+
 	/*
 	 * Keep the lru lists last in the structure so they always sit on their
 	 * own individual cachelines.
 	 */
 	struct list_lru		s_dentry_lru ____cacheline_aligned_in_smp;
+	struct list_lru		s_dentry_neg_lru ____cacheline_aligned_in_smp;
 	struct list_lru		s_inode_lru ____cacheline_aligned_in_smp;
 	struct rcu_head		rcu;
 
@@ -1473,6 +1495,27 @@ int fiemap_fill_next_extent(struct fiemap_extent_info *info, u64 logical,
 			    u64 phys, u64 len, u32 flags);
 int fiemap_check_flags(struct fiemap_extent_info *fieinfo, u32 fs_flags);
 
+/*
+ * FS_IOC_LOOKUP_BATCH: stat many names in the directory the ioctl is
+ * issued on, without following a final symlink.  include/uapi/linux/fs.h
+ * is not part of this tree, so the ABI is declared here for now.
+ */
+struct lookup_batch_entry {
+	__u64	name;		/* in: name, no '/' and not ".." */
+	__s32	result;		/* out: 0 or -errno */
+	__u32	mode;		/* out: st_mode if result is 0 */
+	__u64	ino;		/* out: st_ino if result is 0 */
+};
+
+struct lookup_batch {
+	__u64	entries;	/* array of struct lookup_batch_entry */
+	__u32	count;		/* at most LOOKUP_BATCH_MAX */
+	__u32	flags;		/* must be 0 */
+};
+
+#define LOOKUP_BATCH_MAX	4096
+#define FS_IOC_LOOKUP_BATCH	_IOWR('f', 40, struct lookup_batch)
+
 /*
  * File types
  *
@@ -324,14 +324,42 @@ static inline struct page *alloc_pages_exact_node(int nid, gfp_t gfp_mask,
 	return __alloc_pages(gfp_mask, order, node_zonelist(nid, gfp_mask));
 }
 
+unsigned long
+__alloc_pages_bulk_nodemask(gfp_t gfp_mask, struct zonelist *zonelist,
+			    nodemask_t *nodemask, unsigned long nr_pages,
+			    struct page **page_array);
+
+static inline unsigned long alloc_pages_bulk_node(int nid, gfp_t gfp_mask,
+						  unsigned long nr_pages,
+						  struct page **page_array)
+{
+	/* Unknown node is current node */
+	if (nid < 0)
+		nid = numa_node_id();
+
+	return __alloc_pages_bulk_nodemask(gfp_mask,
+					   node_zonelist(nid, gfp_mask), NULL,
+					   nr_pages, page_array);
+}
+
 #ifdef CONFIG_NUMA
 extern struct page *alloc_pages_current(gfp_t gfp_mask, unsigned order);
+extern unsigned long alloc_pages_bulk_current(gfp_t gfp_mask,
+					      unsigned long nr_pages,
+					      struct page **page_array);
 
 static inline struct page *
 alloc_pages(gfp_t gfp_mask, unsigned int order)
 {
 	return alloc_pages_current(gfp_mask, order);
 }
+
+static inline unsigned long
+alloc_pages_bulk(gfp_t gfp_mask, unsigned long nr_pages,
+		 struct page **page_array)
+{
+	return alloc_pages_bulk_current(gfp_mask, nr_pages, page_array);
+}
 extern struct page *alloc_pages_vma(gfp_t gfp_mask, int order,
 			struct vm_area_struct *vma, unsigned long addr,
 			int node, bool hugepage);
@@ -340,6 +368,9 @@ extern struct page *alloc_pages_vma(gfp_t gfp_mask, int order,
 #else
 #define alloc_pages(gfp_mask, order) \
 		alloc_pages_node(numa_node_id(), gfp_mask, order)
+#define alloc_pages_bulk(gfp_mask, nr_pages, page_array) \
+		alloc_pages_bulk_node(numa_node_id(), gfp_mask, nr_pages, \
+				      page_array)
 #define alloc_pages_vma(gfp_mask, order, vma, addr, node, false)\
 	alloc_pages(gfp_mask, order)
 #define alloc_hugepage_vma(gfp_mask, vma, addr, order)	\
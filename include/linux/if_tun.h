@@ -17,6 +17,31 @@
 
 #include <uapi/linux/if_tun.h>
 
+/* Batched packet I/O: TUNSENDMMSG injects and TUNRECVMMSG reads up to
+ * tun_mmsg_batch.count packets per call.  The return value is the number
+ * of packets transferred; tun_mmsg.len is updated with each packet's size.
+ */
+struct tun_mmsg {
+	__u64	addr;		/* user buffer */
+	__u32	len;		/* buffer size in, packet size out */
+	__u32	flags;		/* must be zero */
+};
+
+struct tun_mmsg_batch {
+	__u64	msgs;		/* struct tun_mmsg array */
+	__u32	count;
+	__u32	flags;		/* TUN_MMSG_* */
+};
+
+/* Pin large TUNSENDMMSG frames instead of copying them.  The call returns
+ * once the stack has released every pinned page, or early on a signal, in
+ * which case frames still in flight may see later changes to the buffers.
+ */
+#define TUN_MMSG_ZEROCOPY	0x0001
+
+#define TUNSENDMMSG	_IOW('T', 222, struct tun_mmsg_batch)
+#define TUNRECVMMSG	_IOW('T', 223, struct tun_mmsg_batch)
+
 #if defined(CONFIG_TUN) || defined(CONFIG_TUN_MODULE)
 struct socket *tun_get_socket(struct file *);
 #else
@@ -14,6 +14,9 @@
 
 #include <uapi/linux/ipv6_route.h>
 
+/* Kernel internal: per-cpu copy of a fib6 route, never linked in the tree */
+#define RTF_PCPU	0x40000000
+
 #define IPV6_EXTRACT_PREF(flag)	(((flag) & RTF_PREF_MASK) >> 27)
 #define IPV6_DECODE_PREF(pref)	((pref) ^ 2)	/* 1:low,2:med,3:high */
 #endif
@@ -2,6 +2,7 @@
 #define LINUX_MM_INLINE_H
 
 #include <linux/huge_mm.h>
+#include <linux/jump_label.h>
 #include <linux/swap.h>
 
 /**
@@ -22,10 +23,170 @@ static inline int page_is_file_cache(struct page *page)
 	return !PageSwapBacked(page);
 }
 
+#ifdef CONFIG_LRU_GEN
+
+extern struct static_key lru_gen_key;
+
+static inline bool lru_gen_enabled(void)
+{
+	return static_key_false(&lru_gen_key);
+}
+
+static inline int lru_gen_from_seq(unsigned long seq)
+{
+	return seq % MAX_NR_GENS;
+}
+
+/* Returns the generation of @page, or -1 if it is on a classic LRU list */
+static inline int page_lru_gen(struct page *page)
+{
+	return (int)((page->flags & LRU_GEN_MASK) >> LRU_GEN_PGOFF) - 1;
+}
+
+static inline void lru_gen_set_page_gen(struct page *page, int gen)
+{
+	set_mask_bits(&page->flags, LRU_GEN_MASK,
+		      (unsigned long)(gen + 1) << LRU_GEN_PGOFF);
+}
+
+/* The two youngest generations count as the active list */
+static inline bool lru_gen_is_active(struct lruvec *lruvec, int type, int gen)
+{
+	unsigned long max_seq = lruvec->lrugen.max_seq[type];
+
+	return gen == lru_gen_from_seq(max_seq) ||
+	       gen == lru_gen_from_seq(max_seq - 1);
+}
+
+static inline void lru_gen_update_size(struct lruvec *lruvec, int type,
+				       int gen, long delta)
+{
+	enum lru_list lru = type * LRU_FILE;
+
+	if (lru_gen_is_active(lruvec, type, gen))
+		lru += LRU_ACTIVE;
+
+	lruvec->lrugen.nr_pages[gen][type] += delta;
+	mem_cgroup_update_lru_size(lruvec, lru, delta);
+	__mod_zone_page_state(lruvec_zone(lruvec), NR_LRU_BASE + lru, delta);
+}
+
+/*
+ * Puts @page on a generation list if the multigenerational LRU is enabled
+ * and @page is evictable.  Activated pages go to the youngest generation.
+ * Pages that are likely to be used again soon, fresh anon pages and pages
+ * that were dirty or under writeback when reclaim found them, go to the
+ * second youngest one.  Everything else starts out old.
+ */
+static inline bool lru_gen_add_page(struct page *page, struct lruvec *lruvec)
+{
+	struct lru_gen *lrugen = &lruvec->lrugen;
+	int type = page_is_file_cache(page);
+	unsigned long seq;
+	int gen;
+
+	if (!lru_gen_enabled() || PageUnevictable(page))
+		return false;
+
+	if (PageActive(page))
+		seq = lrugen->max_seq[type];
+	else if ((!type && !PageSwapCache(page)) ||
+		 (PageReclaim(page) &&
+		  (PageDirty(page) || PageWriteback(page))))
+		seq = lrugen->max_seq[type] - 1;
+	else if (lrugen->min_seq[type] + MIN_NR_GENS >= lrugen->max_seq[type])
+		seq = lrugen->min_seq[type];
+	else
+		seq = lrugen->min_seq[type] + 1;
+
+	gen = lru_gen_from_seq(seq);
+	ClearPageActive(page);
+	lru_gen_set_page_gen(page, gen);
+	lru_gen_update_size(lruvec, type, gen, hpage_nr_pages(page));
+	list_add(&page->lru, &lrugen->lists[gen][type]);
+	return true;
+}
+
+static inline bool lru_gen_del_page(struct page *page, struct lruvec *lruvec)
+{
+	int gen = page_lru_gen(page);
+
+	if (gen < 0)
+		return false;
+
+	lru_gen_update_size(lruvec, page_is_file_cache(page), gen,
+			    -hpage_nr_pages(page));
+	list_del(&page->lru);
+	lru_gen_set_page_gen(page, -1);
+	return true;
+}
+
+/* Moves @page to the tail of the oldest generation, i.e. next to evict */
+static inline bool lru_gen_move_tail(struct page *page, struct lruvec *lruvec)
+{
+	int type = page_is_file_cache(page);
+	int gen = page_lru_gen(page);
+	int old_gen;
+
+	if (gen < 0)
+		return false;
+
+	old_gen = lru_gen_from_seq(lruvec->lrugen.min_seq[type]);
+	if (gen != old_gen) {
+		int nr_pages = hpage_nr_pages(page);
+
+		lru_gen_update_size(lruvec, type, gen, -nr_pages);
+		lru_gen_update_size(lruvec, type, old_gen, nr_pages);
+		lru_gen_set_page_gen(page, old_gen);
+	}
+	list_move_tail(&page->lru, &lruvec->lrugen.lists[old_gen][type]);
+	return true;
+}
+
+/* The tail pages of a split THP stay in the generation of the head page */
+static inline void lru_gen_inherit(struct page *page_tail, struct page *page)
+{
+	int gen = page_lru_gen(page);
+
+	if (gen >= 0)
+		lru_gen_set_page_gen(page_tail, gen);
+}
+
+#else /* CONFIG_LRU_GEN */
+
+static inline bool lru_gen_enabled(void)
+{
+	return false;
+}
+
+static inline bool lru_gen_add_page(struct page *page, struct lruvec *lruvec)
+{
+	return false;
+}
+
+static inline bool lru_gen_del_page(struct page *page, struct lruvec *lruvec)
+{
+	return false;
+}
+
+static inline bool lru_gen_move_tail(struct page *page, struct lruvec *lruvec)
+{
+	return false;
+}
+
+static inline void lru_gen_inherit(struct page *page_tail, struct page *page)
+{
+}
+
+#endif /* CONFIG_LRU_GEN */
+
 static __always_inline void add_page_to_lru_list(struct page *page,
 				struct lruvec *lruvec, enum lru_list lru)
 {
 	int nr_pages = hpage_nr_pages(page);
+
+	if (lru_gen_add_page(page, lruvec))
+		return;
 	mem_cgroup_update_lru_size(lruvec, lru, nr_pages);
 	list_add(&page->lru, &lruvec->lists[lru]);
 	__mod_zone_page_state(lruvec_zone(lruvec), NR_LRU_BASE + lru, nr_pages);
@@ -35,6 +196,9 @@ static __always_inline void del_page_from_lru_list(struct page *page,
 				struct lruvec *lruvec, enum lru_list lru)
 {
 	int nr_pages = hpage_nr_pages(page);
+
+	if (lru_gen_del_page(page, lruvec))
+		return;
 	mem_cgroup_update_lru_size(lruvec, lru, -nr_pages);
 	list_del(&page->lru);
 	__mod_zone_page_state(lruvec_zone(lruvec), NR_LRU_BASE + lru, -nr_pages);
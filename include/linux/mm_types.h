@@ -374,6 +374,10 @@ struct mm_struct {
 						 * together off init_mm.mmlist, and are protected
 						 * by mmlist_lock
 						 */
+#ifdef CONFIG_LRU_GEN
+	struct list_head lru_gen_list;		/* On lru_gen_mm_list, walked by aging */
+	unsigned long lru_gen_seq;		/* Walk pass that last visited this mm */
+#endif
 
 
 	unsigned long hiwater_rss;	/* High-watermark of RSS usage */
@@ -213,9 +213,35 @@ struct zone_reclaim_stat {
 	unsigned long		recent_scanned[2];
 };
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * The multigenerational LRU replaces the active and inactive lists of
+ * evictable pages with up to MAX_NR_GENS generations per type.  Each type
+ * has a sequence of generations from min_seq (oldest) to max_seq
+ * (youngest), stored in the lists indexed by lru_gen_from_seq().  Aging
+ * starts a new generation after promoting the pages found accessed in
+ * page tables, and eviction works on the oldest one.  The two youngest
+ * generations are accounted as active, the others as inactive, so that
+ * the per-zone and per-memcg LRU sizes keep their meaning.
+ */
+#define MIN_NR_GENS	2
+#define MAX_NR_GENS	4
+
+struct lru_gen {
+	/* anon in [0], file in [1], as in zone_reclaim_stat */
+	unsigned long		max_seq[2];
+	unsigned long		min_seq[2];
+	struct list_head	lists[MAX_NR_GENS][2];
+	long			nr_pages[MAX_NR_GENS][2];
+};
+#endif
+
 struct lruvec {
 	struct list_head lists[NR_LRU_LISTS];
 	struct zone_reclaim_stat reclaim_stat;
+#ifdef CONFIG_LRU_GEN
+	struct lru_gen lrugen;
+#endif
 #ifdef CONFIG_MEMCG
 	struct zone *zone;
 #endif
@@ -321,6 +321,8 @@ struct napi_struct {
 	struct list_head	dev_list;
 	struct hlist_node	napi_hash_node;
 	unsigned int		napi_id;
+	int			index;
+	struct task_struct	*thread;
 };
 
 enum {
@@ -328,6 +330,8 @@ enum {
 	NAPI_STATE_DISABLE,	/* Disable pending */
 	NAPI_STATE_NPSVC,	/* Netpoll - don't dequeue from poll_list */
 	NAPI_STATE_HASHED,	/* In NAPI hash */
+	NAPI_STATE_THREADED,	/* Polled by its own kthread */
+	NAPI_STATE_SCHED_THREADED, /* Handed to the kthread for polling */
 };
 
 enum gro_result {
@@ -391,6 +395,7 @@ typedef rx_handler_result_t rx_handler_func_t(struct sk_buff **pskb);
 
 void __napi_schedule(struct napi_struct *n);
 void __napi_schedule_irqoff(struct napi_struct *n);
+int dev_set_threaded(struct net_device *dev, bool threaded);
 
 static inline bool napi_disable_pending(struct napi_struct *n)
 {
@@ -1412,6 +1417,9 @@ enum netdev_priv_flags {
  *				allocated at register_netdev() time
  *	@real_num_rx_queues: 	Number of RX queues currently active in device
  *
+ *	@gro_flush_timeout:	timeout for GRO layer in NAPI
+ *	@threaded:		NAPI instances are polled by dedicated kthreads
+ *				instead of the NET_RX softirq
  *	@rx_handler:		handler for received packets
  *	@rx_handler_data: 	XXX: need comments on this one
  *	@ingress_queue:		XXX: need comments on this one
@@ -1637,6 +1645,7 @@ struct net_device {
 #endif
 
 	unsigned long		gro_flush_timeout;
+	bool			threaded;
 	rx_handler_func_t __rcu	*rx_handler;
 	void __rcu		*rx_handler_data;
 
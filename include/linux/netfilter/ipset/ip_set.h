@@ -180,6 +180,13 @@ struct ip_set_type_variant {
 	/* Return true if "b" set is the same as "a"
 	 * according to the create set parameters */
 	bool (*same_set)(const struct ip_set *a, const struct ip_set *b);
+
+	/* Kernelspace test can run under rcu_read_lock_bh() alone,
+	 * without taking the set lock */
+	bool rcu_test;
+	/* Kernelspace add/del serialize on the bucket locks of the type
+	 * and need the set lock for reading only */
+	bool bucket_locks;
 };
 
 /* The core set type structure */
@@ -331,6 +331,41 @@ extern void init_idle_bootup_task(struct task_struct *idle);
 
 extern int runqueue_is_locked(int cpu);
 
+/*
+ * Wake-up queues: collect the tasks that have to be woken up while the
+ * lock that protects their wait state is held, and wake them once it has
+ * been dropped, so that the woken tasks do not immediately contend on it.
+ *
+ *	WAKE_Q(wake_q);
+ *
+ *	lock();
+ *	wake_q_add(&wake_q, task);
+ *	unlock();
+ *	wake_up_q(&wake_q);
+ *
+ * A task can only be on one wake_q at a time; if it already is, the
+ * pending wakeup from that queue is sufficient and wake_q_add() does
+ * nothing.  wake_q_add() takes a reference on the task, so the waker may
+ * publish the wakeup condition right after it even if the task can exit
+ * as soon as it sees the condition.
+ */
+struct wake_q_node {
+	struct wake_q_node *next;
+};
+
+struct wake_q_head {
+	struct wake_q_node *first;
+	struct wake_q_node **lastp;
+};
+
+#define WAKE_Q_TAIL ((struct wake_q_node *) 0x01)
+
+#define WAKE_Q(name)					\
+	struct wake_q_head name = { WAKE_Q_TAIL, &name.first }
+
+extern void wake_q_add(struct wake_q_head *head, struct task_struct *task);
+extern void wake_up_q(struct wake_q_head *head);
+
 #if defined(CONFIG_SMP) && defined(CONFIG_NO_HZ_COMMON)
 extern void nohz_balance_enter_idle(int cpu);
 extern void set_cpu_sd_state_idle(void);
@@ -1497,6 +1532,9 @@ struct task_struct {
 	/* Protection of the PI data structures: */
 	raw_spinlock_t pi_lock;
 
+	/* Pending wakeup, see wake_q_add() */
+	struct wake_q_node wake_q;
+
 #ifdef CONFIG_RT_MUTEXES
 	/* PI waiters blocked on a rt_mutex held by this task */
 	struct rb_root pi_waiters;
@@ -101,6 +101,8 @@ struct cache_detail {
 	int			(*match)(struct cache_head *orig, struct cache_head *new);
 	void			(*init)(struct cache_head *orig, struct cache_head *new);
 	void			(*update)(struct cache_head *orig, struct cache_head *new);
+	void			(*flush)(void);	/* called after userspace
+						 * flushes the cache */
 
 	/* fields below this comment are for internal use
 	 * and should not be touched by cache owners
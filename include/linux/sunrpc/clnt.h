@@ -28,6 +28,17 @@
 
 struct rpc_inode;
 
+/*
+ * Additional transports to the same server, shared by a client and its
+ * clones.  Tasks are spread round-robin over cl_xprt and these.
+ */
+struct rpc_xprt_switch {
+	atomic_t		xps_count;	/* Number of references */
+	atomic_t		xps_next;	/* round-robin cursor */
+	unsigned int		xps_nxprts;	/* number of xps_xprt */
+	struct rpc_xprt *	xps_xprt[];	/* extra transports */
+};
+
 /*
  * The high-level client handle
  */
@@ -38,6 +49,7 @@ struct rpc_clnt {
 	struct list_head	cl_tasks;	/* List of tasks */
 	spinlock_t		cl_lock;	/* spinlock */
 	struct rpc_xprt __rcu *	cl_xprt;	/* transport */
+	struct rpc_xprt_switch __rcu *cl_xpsw;	/* extra transports */
 	struct rpc_procinfo *	cl_procinfo;	/* procedure info */
 	u32			cl_prog,	/* RPC program number */
 				cl_vers,	/* RPC version number */
@@ -120,6 +132,7 @@ struct rpc_create_args {
 	unsigned long		flags;
 	char			*client_name;
 	struct svc_xprt		*bc_xprt;	/* NFSv4.1 backchannel */
+	unsigned int		nconnect;	/* transports to open */
 };
 
 /* Values for "flags" field */
@@ -149,6 +162,10 @@ int		rpc_switch_client_transport(struct rpc_clnt *,
 void		rpc_shutdown_client(struct rpc_clnt *);
 void		rpc_release_client(struct rpc_clnt *);
 void		rpc_task_release_client(struct rpc_task *);
+struct rpc_xprt	*rpc_clnt_next_xprt(struct rpc_clnt *);
+int		rpc_clnt_iterate_for_each_xprt(struct rpc_clnt *clnt,
+			int (*fn)(struct rpc_clnt *, struct rpc_xprt *, void *),
+			void *data);
 
 int		rpcb_create_local(struct net *);
 void		rpcb_put_local(struct net *);
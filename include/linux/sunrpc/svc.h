@@ -18,6 +18,7 @@
 #include <linux/sunrpc/svcauth.h>
 #include <linux/wait.h>
 #include <linux/mm.h>
+#include <linux/ktime.h>
 
 /*
  * This is the RPC server thread function prototype
@@ -30,17 +31,19 @@ struct svc_pool_stats {
 	unsigned long	sockets_queued;
 	atomic_long_t	threads_woken;
 	atomic_long_t	threads_timedout;
+	atomic_long_t	queue_time;	/* usecs transports spent queued */
+	atomic_long_t	wakeup_time;	/* usecs from handoff to thread run */
 };
 
 /*
  *
  * RPC service thread pool.
  *
- * Pool of threads and temporary sockets.  Generally there is only
- * a single one of these per RPC service, but on NUMA machines those
- * services that can benefit from it (i.e. nfs but not lockd) will
- * have one pool per NUMA node.  This optimisation reduces cross-
- * node traffic on multi-node NUMA NFS servers.
+ * Pool of threads and temporary sockets.  Services that can benefit
+ * from it (i.e. nfs but not lockd) have one pool per NUMA node on
+ * NUMA machines and one pool per cpu on other SMP machines, so that
+ * a request is normally handled near the cpu it arrived on.  Other
+ * services have a single pool.
  */
 struct svc_pool {
 	unsigned int		sp_id;	    	/* pool id; also node id on NUMA */
@@ -48,6 +51,7 @@ struct svc_pool {
 	struct list_head	sp_sockets;	/* pending sockets */
 	unsigned int		sp_nrthreads;	/* # of threads in pool */
 	struct list_head	sp_all_threads;	/* all server threads */
+	atomic_t		sp_nridle;	/* # of threads waiting for work */
 	struct svc_pool_stats	sp_stats;	/* statistics on pool operation */
 #define	SP_TASK_PENDING		(0)		/* still work to do even if no
 						 * xprt is queued. */
@@ -284,7 +288,8 @@ struct svc_rqst {
 	struct auth_domain *	rq_gssclient;	/* "gss/"-style peer info */
 	struct svc_cacherep *	rq_cacherep;	/* cache info */
 	struct task_struct	*rq_task;	/* service thread */
-	spinlock_t		rq_lock;	/* per-request lock */
+	ktime_t			rq_qtime;	/* when a transport was handed
+						 * to this thread */
 };
 
 #define SVC_NET(svc_rqst)	(svc_rqst->rq_xprt->xpt_net)
@@ -4,6 +4,7 @@
 #include <linux/spinlock.h>
 #include <linux/init.h>
 #include <linux/list.h>
+#include <linux/llist.h>
 #include <asm/page.h>		/* pgprot_t */
 #include <linux/rbtree.h>
 
@@ -43,8 +44,9 @@ struct vmap_area {
 	unsigned long va_end;
 	unsigned long flags;
 	struct rb_node rb_node;         /* address sorted rbtree */
+	unsigned long subtree_max_gap;  /* largest hole in rb_node subtree */
 	struct list_head list;          /* address sorted list */
-	struct list_head purge_list;    /* "lazy purge" list */
+	struct llist_node purge_list;   /* "lazy purge" list */
 	struct vm_struct *vm;
 	struct rcu_head rcu_head;
 };
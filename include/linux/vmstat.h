@@ -185,12 +185,12 @@ static inline unsigned long node_page_state(int node,
 		zone_page_state(&zones[ZONE_MOVABLE], item);
 }
 
-extern void zone_statistics(struct zone *, struct zone *, gfp_t gfp);
+extern void zone_statistics(struct zone *, struct zone *, gfp_t gfp, long nr);
 
 #else
 
 #define node_page_state(node, item) global_page_state(item)
-#define zone_statistics(_zl, _z, gfp) do { } while (0)
+#define zone_statistics(_zl, _z, gfp, nr) do { } while (0)
 
 #endif /* CONFIG_NUMA */
 
@@ -0,0 +1,39 @@
+/*
+ * xxHash - extremely fast non-cryptographic hash
+ *
+ * Copyright (C) 2012-2016, Yann Collet.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.  The algorithm is described at
+ * https://github.com/Cyan4973/xxHash.
+ *
+ * Only the one-shot variants are provided.  They are several times faster
+ * than jhash2() on large buffers, so they suit checksumming whole pages;
+ * for hash tables keyed on a few words, jhash remains the better choice.
+ */
+#ifndef _LINUX_XXHASH_H
+#define _LINUX_XXHASH_H
+
+#include <linux/types.h>
+
+u32 xxh32(const void *input, size_t length, u32 seed);
+u64 xxh64(const void *input, size_t length, u64 seed);
+
+/*
+ * xxhash() - the variant that is faster on this architecture
+ *
+ * Returns a 32-bit hash on 32-bit machines and a 64-bit one on 64-bit
+ * machines; callers that need a fixed width must truncate.
+ */
+static inline unsigned long xxhash(const void *input, size_t length,
+				   u64 seed)
+{
+#if BITS_PER_LONG == 64
+	return xxh64(input, length, seed);
+#else
+	return xxh32(input, length, seed);
+#endif
+}
+
+#endif /* _LINUX_XXHASH_H */
@@ -66,6 +66,7 @@ struct fib6_node {
 	__u16			fn_flags;
 	int			fn_sernum;
 	struct rt6_info		*rr_ptr;
+	struct rcu_head		rcu;
 };
 
 #ifndef CONFIG_IPV6_SUBTREES
@@ -101,6 +102,8 @@ struct rt6_info {
 	 */
 	struct fib6_table		*rt6i_table;
 	struct fib6_node		*rt6i_node;
+	/* copies handed out by output and input lookups, see RTF_PCPU */
+	struct rt6_info * __percpu	*rt6i_pcpu;
 
 	struct in6_addr			rt6i_gateway;
 
@@ -198,6 +201,15 @@ static inline void rt6_set_from(struct rt6_info *rt, struct rt6_info *from)
 	rt->dst.from = new;
 }
 
+/* The serial number a socket caches with a route to validate it later */
+static inline u32 rt6_get_cookie(const struct rt6_info *rt)
+{
+	if (rt->rt6i_flags & RTF_PCPU)
+		rt = (struct rt6_info *)rt->dst.from;
+
+	return rt->rt6i_node ? rt->rt6i_node->fn_sernum : 0;
+}
+
 static inline void ip6_rt_put(struct rt6_info *rt)
 {
 	/* dst_release() accepts a NULL parameter.
@@ -126,9 +126,15 @@ struct neigh_statistics {
 	unsigned long forced_gc_runs;	/* number of forced GC runs */
 
 	unsigned long unres_discards;	/* number of unresolved drops */
+
+	unsigned long gc_time_us;	/* time spent in GC runs, in usecs */
+	unsigned long gc_reclaimed;	/* entries released by GC */
+	unsigned long confirms_coalesced; /* updates done without neigh->lock */
 };
 
 #define NEIGH_CACHE_STAT_INC(tbl, field) this_cpu_inc((tbl)->stats->field)
+#define NEIGH_CACHE_STAT_ADD(tbl, field, val) \
+	this_cpu_add((tbl)->stats->field, (val))
 
 struct neighbour {
 	struct neighbour __rcu	*next;
@@ -208,6 +214,7 @@ struct neigh_table {
 	int			gc_thresh2;
 	int			gc_thresh3;
 	unsigned long		last_flush;
+	unsigned int		gc_cursor;	/* next hash bucket to scan */
 	struct delayed_work	gc_work;
 	struct timer_list 	proxy_timer;
 	struct sk_buff_head	proxy_queue;
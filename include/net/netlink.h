@@ -619,6 +619,27 @@ nl_dump_check_consistent(struct netlink_callback *cb,
 	cb->prev_seq = cb->seq;
 }
 
+/**
+ * nl_dump_mark_interrupted - advertise that a dump lost its position
+ * @cb: netlink callback structure of the dump
+ *
+ * Dumps resume from a cursor kept in cb->args, typically a hash bucket or
+ * a key of the table being walked. For tables without a generation
+ * counter that is the only state, and when the cursor stops identifying a
+ * position (the table was rehashed, the remembered entry went away) the
+ * dump can only carry on from the nearest safe point. Calling this then
+ * makes the final NLMSG_DONE carry NLM_F_DUMP_INTR, so that userspace
+ * knows entries may have been repeated or missed.
+ *
+ * Not to be mixed with setting cb->seq to a generation counter.
+ */
+static inline void nl_dump_mark_interrupted(struct netlink_callback *cb)
+{
+	if (!cb->prev_seq)
+		cb->prev_seq = 1;
+	cb->seq = cb->prev_seq + 1;
+}
+
 /**************************************************************************
  * Netlink Attributes
  **************************************************************************/
@@ -8,7 +8,7 @@
 #include <linux/uidgid.h>
 #include <net/inet_frag.h>
 
-struct tcpm_hash_bucket;
+struct tcpm_table;
 struct ctl_table_header;
 struct ipv4_devconf;
 struct fib_rules_ops;
@@ -51,8 +51,7 @@ struct netns_ipv4 {
 	struct sock  * __percpu	*icmp_sk;
 
 	struct inet_peer_base	*peers;
-	struct tcpm_hash_bucket	*tcp_metrics_hash;
-	unsigned int		tcp_metrics_hash_log;
+	struct tcpm_table	*tcp_metrics;
 	struct sock  * __percpu	*tcp_sk;
 	struct netns_frags	frags;
 #ifdef CONFIG_NETFILTER
@@ -0,0 +1,81 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM readahead
+
+#if !defined(_TRACE_READAHEAD_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_READAHEAD_H
+
+#include <linux/types.h>
+#include <linux/tracepoint.h>
+#include <linux/fs.h>
+#include <linux/kdev_t.h>
+
+/*
+ * How ondemand_readahead() placed the window.  WINDOW and STREAM continue a
+ * known sequential stream (the current window, or one from the stream
+ * table) and count as hits, the others had to start a new window or fell
+ * back to a plain read.
+ */
+#define RA_PATTERN_WINDOW	0
+#define RA_PATTERN_STREAM	1
+#define RA_PATTERN_MARKER	2
+#define RA_PATTERN_CONTEXT	3
+#define RA_PATTERN_INITIAL	4
+#define RA_PATTERN_RANDOM	5
+
+#define show_ra_pattern(pattern)				\
+	__print_symbolic(pattern,				\
+		{RA_PATTERN_WINDOW,	"window"},		\
+		{RA_PATTERN_STREAM,	"stream"},		\
+		{RA_PATTERN_MARKER,	"marker"},		\
+		{RA_PATTERN_CONTEXT,	"context"},		\
+		{RA_PATTERN_INITIAL,	"initial"},		\
+		{RA_PATTERN_RANDOM,	"random"})
+
+TRACE_EVENT(mm_readahead,
+
+	TP_PROTO(struct address_space *mapping, struct file_ra_state *ra,
+		 pgoff_t offset, unsigned long req_size, bool async,
+		 int pattern),
+
+	TP_ARGS(mapping, ra, offset, req_size, async, pattern),
+
+	TP_STRUCT__entry(
+		__field(dev_t,		s_dev)
+		__field(unsigned long,	i_ino)
+		__field(pgoff_t,	offset)
+		__field(unsigned long,	req_size)
+		__field(pgoff_t,	start)
+		__field(unsigned int,	size)
+		__field(unsigned int,	async_size)
+		__field(bool,		async)
+		__field(int,		pattern)
+	),
+
+	TP_fast_assign(
+		__entry->s_dev		= mapping->host->i_sb->s_dev;
+		__entry->i_ino		= mapping->host->i_ino;
+		__entry->offset		= offset;
+		__entry->req_size	= req_size;
+		__entry->start		= ra->start;
+		__entry->size		= ra->size;
+		__entry->async_size	= ra->async_size;
+		__entry->async		= async;
+		__entry->pattern	= pattern;
+	),
+
+	TP_printk("dev %d:%d ino %lx %s %s offset=%lu req_size=%lu start=%lu size=%u async_size=%u",
+		MAJOR(__entry->s_dev), MINOR(__entry->s_dev),
+		__entry->i_ino,
+		__entry->async ? "async" : "sync",
+		show_ra_pattern(__entry->pattern),
+		(unsigned long)__entry->offset,
+		__entry->req_size,
+		(unsigned long)__entry->start,
+		__entry->size,
+		__entry->async_size)
+);
+
+#endif /* _TRACE_READAHEAD_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
@@ -35,6 +35,7 @@
 #include <linux/ipc_namespace.h>
 #include <linux/user_namespace.h>
 #include <linux/slab.h>
+#include <linux/security.h>
 
 #include <net/sock.h>
 #include "util.h"
@@ -47,8 +48,22 @@
 #define RECV		1
 
 #define STATE_NONE	0
-#define STATE_PENDING	1
-#define STATE_READY	2
+#define STATE_READY	1
+
+/*
+ * Messages are kept in one FIFO bucket per priority.  The buckets of the
+ * priorities below MQ_PRIO_DIRECT, which is what nearly all programs use,
+ * are embedded in the queue and found through a bitmap of the non-empty
+ * ones, so insert and remove are O(1).  Higher priorities get a bucket in
+ * msg_tree.
+ */
+#define MQ_PRIO_DIRECT	32
+
+/*
+ * Queues with messages of at most MQ_POOL_MSGSIZE bytes preallocate
+ * mq_maxmsg of them, see mq_pool_init().
+ */
+#define MQ_POOL_MSGSIZE	256
 
 struct posix_msg_tree_node {
 	struct rb_node		rb_node;
@@ -69,7 +84,10 @@ struct mqueue_inode_info {
 	wait_queue_head_t wait_q;
 
 	struct rb_root msg_tree;
+	struct rb_node *msg_tree_rightmost;
 	struct posix_msg_tree_node *node_cache;
+	unsigned long msg_prio_map;
+	struct list_head msg_prio[MQ_PRIO_DIRECT];
 	struct mq_attr attr;
 
 	struct sigevent notify;
@@ -83,6 +101,12 @@ struct mqueue_inode_info {
 	struct ext_wait_queue e_wait_q[2];
 
 	unsigned long qsize; /* size of queue in memory (sum of all msgs) */
+
+	/* preallocated messages, protected by pool_lock */
+	spinlock_t pool_lock;
+	struct list_head pool;
+	void *pool_mem;
+	int pool_size;
 };
 
 static const struct inode_operations mqueue_dir_inode_operations;
@@ -122,18 +146,27 @@ static int msg_insert(struct msg_msg *msg, struct mqueue_inode_info *info)
 {
 	struct rb_node **p, *parent = NULL;
 	struct posix_msg_tree_node *leaf;
+	bool rightmost = true;
+
+	if (likely(msg->m_type < MQ_PRIO_DIRECT)) {
+		list_add_tail(&msg->m_list, &info->msg_prio[msg->m_type]);
+		__set_bit(msg->m_type, &info->msg_prio_map);
+		goto insert_done;
+	}
 
 	p = &info->msg_tree.rb_node;
 	while (*p) {
 		parent = *p;
 		leaf = rb_entry(parent, struct posix_msg_tree_node, rb_node);
 
-		if (likely(leaf->priority == msg->m_type))
+		if (likely(leaf->priority == msg->m_type)) {
 			goto insert_msg;
-		else if (msg->m_type < leaf->priority)
+		} else if (msg->m_type < leaf->priority) {
 			p = &(*p)->rb_left;
-		else
+			rightmost = false;
+		} else {
 			p = &(*p)->rb_right;
+		}
 	}
 	if (info->node_cache) {
 		leaf = info->node_cache;
@@ -146,33 +179,64 @@ static int msg_insert(struct msg_msg *msg, struct mqueue_inode_info *info)
 		info->qsize += sizeof(*leaf);
 	}
 	leaf->priority = msg->m_type;
+	if (rightmost)
+		info->msg_tree_rightmost = &leaf->rb_node;
 	rb_link_node(&leaf->rb_node, parent, p);
 	rb_insert_color(&leaf->rb_node, &info->msg_tree);
 insert_msg:
+	list_add_tail(&msg->m_list, &leaf->msg_list);
+insert_done:
 	info->attr.mq_curmsgs++;
 	info->qsize += msg->m_ts;
-	list_add_tail(&msg->m_list, &leaf->msg_list);
 	return 0;
 }
 
+static void msg_tree_erase(struct posix_msg_tree_node *leaf,
+			   struct mqueue_inode_info *info)
+{
+	struct rb_node *node = &leaf->rb_node;
+
+	if (info->msg_tree_rightmost == node)
+		info->msg_tree_rightmost = rb_prev(node);
+
+	rb_erase(node, &info->msg_tree);
+	if (info->node_cache) {
+		info->qsize -= sizeof(*leaf);
+		kfree(leaf);
+	} else {
+		info->node_cache = leaf;
+	}
+}
+
 static inline struct msg_msg *msg_get(struct mqueue_inode_info *info)
 {
-	struct rb_node **p, *parent = NULL;
 	struct posix_msg_tree_node *leaf;
+	struct list_head *bucket;
 	struct msg_msg *msg;
+	int prio = 0;
 
 try_again:
-	p = &info->msg_tree.rb_node;
-	while (*p) {
-		parent = *p;
-		/*
-		 * During insert, low priorities go to the left and high to the
-		 * right.  On receive, we want the highest priorities first, so
-		 * walk all the way to the right.
-		 */
-		p = &(*p)->rb_right;
-	}
-	if (!parent) {
+	/*
+	 * On receive, we want the highest priorities first: anything in the
+	 * tree beats the embedded buckets, and in the tree the rightmost
+	 * node has the highest priority.
+	 */
+	if (info->msg_tree_rightmost) {
+		leaf = rb_entry(info->msg_tree_rightmost,
+				struct posix_msg_tree_node, rb_node);
+		if (unlikely(list_empty(&leaf->msg_list))) {
+			pr_warn_once("Inconsistency in POSIX message queue, "
+				     "empty leaf node but we haven't implemented "
+				     "lazy leaf delete!\n");
+			msg_tree_erase(leaf, info);
+			goto try_again;
+		}
+		bucket = &leaf->msg_list;
+	} else if (info->msg_prio_map) {
+		leaf = NULL;
+		prio = __fls(info->msg_prio_map);
+		bucket = &info->msg_prio[prio];
+	} else {
 		if (info->attr.mq_curmsgs) {
 			pr_warn_once("Inconsistency in POSIX message queue, "
 				     "no tree element, but supposedly messages "
@@ -181,38 +245,116 @@ try_again:
 		}
 		return NULL;
 	}
-	leaf = rb_entry(parent, struct posix_msg_tree_node, rb_node);
-	if (unlikely(list_empty(&leaf->msg_list))) {
-		pr_warn_once("Inconsistency in POSIX message queue, "
-			     "empty leaf node but we haven't implemented "
-			     "lazy leaf delete!\n");
-		rb_erase(&leaf->rb_node, &info->msg_tree);
-		if (info->node_cache) {
-			info->qsize -= sizeof(*leaf);
-			kfree(leaf);
-		} else {
-			info->node_cache = leaf;
-		}
-		goto try_again;
-	} else {
-		msg = list_first_entry(&leaf->msg_list,
-				       struct msg_msg, m_list);
-		list_del(&msg->m_list);
-		if (list_empty(&leaf->msg_list)) {
-			rb_erase(&leaf->rb_node, &info->msg_tree);
-			if (info->node_cache) {
-				info->qsize -= sizeof(*leaf);
-				kfree(leaf);
-			} else {
-				info->node_cache = leaf;
-			}
-		}
+
+	msg = list_first_entry(bucket, struct msg_msg, m_list);
+	list_del(&msg->m_list);
+	if (list_empty(bucket)) {
+		if (leaf)
+			msg_tree_erase(leaf, info);
+		else
+			__clear_bit(prio, &info->msg_prio_map);
 	}
 	info->attr.mq_curmsgs--;
 	info->qsize -= msg->m_ts;
 	return msg;
 }
 
+/*
+ * Message pool: queues for small messages preallocate mq_maxmsg of them
+ * in one block, which is accounted to the user anyway (see mq_bytes in
+ * mqueue_get_inode()), so that senders do not go through kmalloc for
+ * every message.  Messages are taken from the pool outside of info->lock,
+ * and larger ones, or those sent while the pool is empty, are allocated
+ * by load_msg() as before.
+ */
+static int mq_pool_slot_size(struct mqueue_inode_info *info)
+{
+	return ALIGN(sizeof(struct msg_msg) + info->attr.mq_msgsize,
+		     L1_CACHE_BYTES);
+}
+
+static void mq_pool_init(struct mqueue_inode_info *info)
+{
+	int slot = mq_pool_slot_size(info);
+	long i;
+
+	if (info->attr.mq_msgsize > MQ_POOL_MSGSIZE ||
+	    info->attr.mq_maxmsg > INT_MAX / slot)
+		return;
+
+	info->pool_mem = ipc_alloc(info->attr.mq_maxmsg * slot);
+	if (!info->pool_mem)
+		return;
+	info->pool_size = info->attr.mq_maxmsg * slot;
+
+	for (i = 0; i < info->attr.mq_maxmsg; i++) {
+		struct msg_msg *msg = info->pool_mem + i * slot;
+
+		list_add_tail(&msg->m_list, &info->pool);
+	}
+}
+
+static bool mq_pool_owns(struct mqueue_inode_info *info, struct msg_msg *msg)
+{
+	void *p = msg;
+
+	return p >= info->pool_mem && p < info->pool_mem + info->pool_size;
+}
+
+static void mq_pool_put(struct mqueue_inode_info *info, struct msg_msg *msg)
+{
+	spin_lock(&info->pool_lock);
+	list_add(&msg->m_list, &info->pool);
+	spin_unlock(&info->pool_lock);
+}
+
+/* Like load_msg(), but from the pool if possible */
+static struct msg_msg *mq_load_msg(struct mqueue_inode_info *info,
+				   const void __user *src, size_t len)
+{
+	struct msg_msg *msg = NULL;
+	int err;
+
+	if (!info->pool_mem)
+		return load_msg(src, len);
+
+	spin_lock(&info->pool_lock);
+	if (!list_empty(&info->pool)) {
+		msg = list_first_entry(&info->pool, struct msg_msg, m_list);
+		list_del(&msg->m_list);
+	}
+	spin_unlock(&info->pool_lock);
+	if (!msg)
+		return load_msg(src, len);
+
+	msg->next = NULL;
+	msg->security = NULL;
+
+	err = -EFAULT;
+	if (copy_from_user(msg + 1, src, len))
+		goto out_err;
+
+	err = security_msg_msg_alloc(msg);
+	if (err)
+		goto out_err;
+
+	return msg;
+
+out_err:
+	mq_pool_put(info, msg);
+	return ERR_PTR(err);
+}
+
+static void mq_free_msg(struct mqueue_inode_info *info, struct msg_msg *msg)
+{
+	if (!mq_pool_owns(info, msg)) {
+		free_msg(msg);
+		return;
+	}
+	security_msg_msg_free(msg);
+	mq_pool_put(info, msg);
+}
+
 static struct inode *mqueue_get_inode(struct super_block *sb,
 		struct ipc_namespace *ipc_ns, umode_t mode,
 		struct mq_attr *attr)
@@ -234,6 +376,7 @@ static struct inode *mqueue_get_inode(struct super_block *sb,
 	if (S_ISREG(mode)) {
 		struct mqueue_inode_info *info;
 		unsigned long mq_bytes, mq_treesize;
+		int i;
 
 		inode->i_fop = &mqueue_file_operations;
 		inode->i_size = FILENT_SIZE;
@@ -248,7 +391,15 @@ static struct inode *mqueue_get_inode(struct super_block *sb,
 		info->qsize = 0;
 		info->user = NULL;	/* set when all is ok */
 		info->msg_tree = RB_ROOT;
+		info->msg_tree_rightmost = NULL;
 		info->node_cache = NULL;
+		info->msg_prio_map = 0;
+		for (i = 0; i < MQ_PRIO_DIRECT; i++)
+			INIT_LIST_HEAD(&info->msg_prio[i]);
+		spin_lock_init(&info->pool_lock);
+		INIT_LIST_HEAD(&info->pool);
+		info->pool_mem = NULL;
+		info->pool_size = 0;
 		memset(&info->attr, 0, sizeof(info->attr));
 		info->attr.mq_maxmsg = min(ipc_ns->mq_msg_max,
 					   ipc_ns->mq_msg_default);
@@ -291,6 +442,7 @@ static struct inode *mqueue_get_inode(struct super_block *sb,
 
 		/* all is ok */
 		info->user = get_uid(u);
+		mq_pool_init(info);
 	} else if (S_ISDIR(mode)) {
 		inc_nlink(inode);
 		/* Some things misbehave if size == 0 on a directory */
@@ -388,9 +540,11 @@ static void mqueue_evict_inode(struct inode *inode)
 	info = MQUEUE_I(inode);
 	spin_lock(&info->lock);
 	while ((msg = msg_get(info)) != NULL)
-		free_msg(msg);
+		mq_free_msg(info, msg);
 	kfree(info->node_cache);
 	spin_unlock(&info->lock);
+	if (info->pool_mem)
+		ipc_free(info->pool_mem, info->pool_size);
 
 	/* Total amount of bytes accounted for the mqueue */
 	mq_treesize = info->attr.mq_maxmsg * sizeof(struct msg_msg) +
@@ -577,10 +731,8 @@ static int wq_sleep(struct mqueue_inode_info *info, int sr,
 		time = schedule_hrtimeout_range_clock(timeout, 0,
 			HRTIMER_MODE_ABS, CLOCK_REALTIME);
 
-		while (ewp->state == STATE_PENDING)
-			cpu_relax();
-
-		if (ewp->state == STATE_READY) {
+		/* Pairs with smp_store_release() in pipelined_send/receive */
+		if (smp_load_acquire(&ewp->state) == STATE_READY) {
 			retval = 0;
 			goto out;
 		}
@@ -626,7 +778,8 @@ static inline void set_cookie(struct sk_buff *skb, char code)
 }
 
 /*
- * The next function is only to split too long sys_mq_timedsend
+ * The next function is only to split too long sys_mq_timedsend.
+ * The caller wakes up info->wait_q after dropping info->lock.
  */
 static void __do_notify(struct mqueue_inode_info *info)
 {
@@ -669,7 +822,6 @@ static void __do_notify(struct mqueue_inode_info *info)
 		info->notify_owner = NULL;
 		info->notify_user_ns = NULL;
 	}
-	wake_up(&info->wait_q);
 }
 
 static int prepare_timeout(const struct timespec __user *u_abs_timeout,
@@ -909,9 +1061,11 @@ out_name:
  * bypasses the message array and directly hands the message over to the
  * receiver.
  * The receiver accepts the message and returns without grabbing the queue
- * spinlock. Therefore an intermediate STATE_PENDING state and memory barriers
- * are necessary. The same algorithm is used for sysv semaphores, see
- * ipc/sem.c for more details.
+ * spinlock. The waiter is added to a wake_q, which pins its task_struct,
+ * before its state is set to STATE_READY, so the waiter may return as soon
+ * as it sees that state; the actual wake-up calls are issued after
+ * info->lock has been dropped. The same algorithm is used for sysv
+ * semaphores, see ipc/sem.c for more details.
  *
  * The same algorithm is used for senders.
  */
@@ -919,36 +1073,35 @@ out_name:
 /* pipelined_send() - send a message directly to the task waiting in
  * sys_mq_timedreceive() (without inserting message into a queue).
  */
-static inline void pipelined_send(struct mqueue_inode_info *info,
+static inline void pipelined_send(struct wake_q_head *wake_q,
+				  struct mqueue_inode_info *info,
 				  struct msg_msg *message,
 				  struct ext_wait_queue *receiver)
 {
 	receiver->msg = message;
 	list_del(&receiver->list);
-	receiver->state = STATE_PENDING;
-	wake_up_process(receiver->task);
-	smp_wmb();
-	receiver->state = STATE_READY;
+	wake_q_add(wake_q, receiver->task);
+	/* receiver can disappear as soon as it sees STATE_READY */
+	smp_store_release(&receiver->state, STATE_READY);
 }
 
 /* pipelined_receive() - if there is task waiting in sys_mq_timedsend()
- * gets its message and put to the queue (we have one free place for sure). */
-static inline void pipelined_receive(struct mqueue_inode_info *info)
+ * gets its message and put to the queue (we have one free place for sure).
+ * Returns true if poll waiters have to be woken up instead.
+ */
+static inline bool pipelined_receive(struct wake_q_head *wake_q,
+				     struct mqueue_inode_info *info)
 {
 	struct ext_wait_queue *sender = wq_get_first_waiter(info, SEND);
 
-	if (!sender) {
-		/* for poll */
-		wake_up_interruptible(&info->wait_q);
-		return;
-	}
+	if (!sender)
+		return true;
 	if (msg_insert(sender->msg, info))
-		return;
+		return false;
 	list_del(&sender->list);
-	sender->state = STATE_PENDING;
-	wake_up_process(sender->task);
-	smp_wmb();
-	sender->state = STATE_READY;
+	wake_q_add(wake_q, sender->task);
+	smp_store_release(&sender->state, STATE_READY);
+	return false;
 }
 
 SYSCALL_DEFINE5(mq_timedsend, mqd_t, mqdes, const char __user *, u_msg_ptr,
@@ -964,7 +1117,9 @@ SYSCALL_DEFINE5(mq_timedsend, mqd_t, mqdes, const char __user *, u_msg_ptr,
 	ktime_t expires, *timeout = NULL;
 	struct timespec ts;
 	struct posix_msg_tree_node *new_leaf = NULL;
+	bool wake_poll = false;
 	int ret = 0;
+	WAKE_Q(wake_q);
 
 	if (u_abs_timeout) {
 		int res = prepare_timeout(u_abs_timeout, &expires, &ts);
@@ -1004,7 +1159,7 @@ SYSCALL_DEFINE5(mq_timedsend, mqd_t, mqdes, const char __user *, u_msg_ptr,
 
 	/* First try to allocate memory, before doing anything with
 	 * existing queues. */
-	msg_ptr = load_msg(u_msg_ptr, msg_len);
+	msg_ptr = mq_load_msg(info, u_msg_ptr, msg_len);
 	if (IS_ERR(msg_ptr)) {
 		ret = PTR_ERR(msg_ptr);
 		goto out_fput;
@@ -1015,9 +1170,10 @@ SYSCALL_DEFINE5(mq_timedsend, mqd_t, mqdes, const char __user *, u_msg_ptr,
 	/*
 	 * msg_insert really wants us to have a valid, spare node struct so
 	 * it doesn't have to kmalloc a GFP_ATOMIC allocation, but it will
-	 * fall back to that if necessary.
+	 * fall back to that if necessary.  Only the priorities above the
+	 * embedded buckets need one.
 	 */
-	if (!info->node_cache)
+	if (msg_prio >= MQ_PRIO_DIRECT && !info->node_cache)
 		new_leaf = kmalloc(sizeof(*new_leaf), GFP_KERNEL);
 
 	spin_lock(&info->lock);
@@ -1049,22 +1205,26 @@ SYSCALL_DEFINE5(mq_timedsend, mqd_t, mqdes, const char __user *, u_msg_ptr,
 	} else {
 		receiver = wq_get_first_waiter(info, RECV);
 		if (receiver) {
-			pipelined_send(info, msg_ptr, receiver);
+			pipelined_send(&wake_q, info, msg_ptr, receiver);
 		} else {
 			/* adds message to the queue */
 			ret = msg_insert(msg_ptr, info);
 			if (ret)
 				goto out_unlock;
 			__do_notify(info);
+			wake_poll = true;
 		}
 		inode->i_atime = inode->i_mtime = inode->i_ctime =
 				CURRENT_TIME;
 	}
 out_unlock:
 	spin_unlock(&info->lock);
+	wake_up_q(&wake_q);
+	if (wake_poll)
+		wake_up(&info->wait_q);
 out_free:
 	if (ret)
-		free_msg(msg_ptr);
+		mq_free_msg(info, msg_ptr);
 out_fput:
 	fdput(f);
 out:
@@ -1084,6 +1244,8 @@ SYSCALL_DEFINE5(mq_timedreceive, mqd_t, mqdes, char __user *, u_msg_ptr,
 	ktime_t expires, *timeout = NULL;
 	struct timespec ts;
 	struct posix_msg_tree_node *new_leaf = NULL;
+	bool wake_poll;
+	WAKE_Q(wake_q);
 
 	if (u_abs_timeout) {
 		int res = prepare_timeout(u_abs_timeout, &expires, &ts);
@@ -1155,8 +1317,12 @@ SYSCALL_DEFINE5(mq_timedreceive, mqd_t, mqdes, char __user *, u_msg_ptr,
 				CURRENT_TIME;
 
 		/* There is now free space in queue. */
-		pipelined_receive(info);
+		wake_poll = pipelined_receive(&wake_q, info);
 		spin_unlock(&info->lock);
+		wake_up_q(&wake_q);
+		/* for poll */
+		if (wake_poll)
+			wake_up_interruptible(&info->wait_q);
 		ret = 0;
 	}
 	if (ret == 0) {
@@ -1166,7 +1332,7 @@ SYSCALL_DEFINE5(mq_timedreceive, mqd_t, mqdes, char __user *, u_msg_ptr,
 			store_msg(u_msg_ptr, msg_ptr, msg_ptr->m_ts)) {
 			ret = -EFAULT;
 		}
-		free_msg(msg_ptr);
+		mq_free_msg(info, msg_ptr);
 	}
 out_fput:
 	fdput(f);
@@ -53,15 +53,13 @@
  *   Semaphores are actively given to waiting tasks (necessary for FIFO).
  *   (see update_queue())
  * - To improve the scalability, the actual wake-up calls are performed after
- *   dropping all locks. (see wake_up_sem_queue_prepare(),
- *   wake_up_sem_queue_do())
+ *   dropping all locks. (see wake_up_sem_queue_prepare(), wake_up_q())
  * - All work is done by the waker, the woken up task does not have to do
  *   anything - not even acquiring a lock or dropping a refcount.
  * - A woken up task may not even touch the semaphore array anymore, it may
  *   have been destroyed already by a semctl(RMID).
- * - The synchronizations between wake-ups due to a timeout/signal and a
- *   wake-up due to a completed semaphore operation is achieved by using an
- *   intermediate state (IN_WAKEUP).
+ * - The wake_q holds a reference to the woken up task, thus the result can
+ *   be stored in the queue entry before the wake-up call is made.
  * - UNDO values are stored in an array (one per process and per
  *   semaphore array, lazily allocated). For backwards compatibility, multiple
  *   modes for the UNDO variables are supported (per process, per thread)
@@ -69,6 +67,9 @@
  * - There are two lists of the pending operations: a per-array list
  *   and per-semaphore list (stored in the array). This allows to achieve FIFO
  *   ordering without always scanning all pending operations.
+ *   Operations with multiple sops stay on the per-semaphore list if they
+ *   only decrement, or only wait for zero on, one semaphore (see
+ *   sem_ops_simple()).
  *   The worst-case behavior is nevertheless O(N^2) for N wakeups.
  */
 
@@ -94,9 +95,9 @@ struct sem {
 	int	semval;		/* current value */
 	int	sempid;		/* pid of last operation */
 	spinlock_t	lock;	/* spinlock for fine-grained semtimedop */
-	struct list_head pending_alter; /* pending single-sop operations */
+	struct list_head pending_alter; /* pending simple operations */
 					/* that alter the semaphore */
-	struct list_head pending_const; /* pending single-sop operations */
+	struct list_head pending_const; /* pending simple operations */
 					/* that do not alter the semaphore*/
 	time_t	sem_otime;	/* candidate for sem_otime */
 } ____cacheline_aligned_in_smp;
@@ -112,6 +113,7 @@ struct sem_queue {
 	struct sembuf		*blocking; /* the operation that blocked */
 	int			nsops;	 /* number of operations */
 	int			alter;	 /* does *sops alter the array? */
+	int			complex; /* on the per-array lists? */
 };
 
 /* Each task has a list of undo requests. They are executed automatically
@@ -277,9 +279,42 @@ static void sem_wait_array(struct sem_array *sma)
 	}
 }
 
+/**
+ * sem_ops_simple - can the operation be handled with the semaphore lock?
+ * @sops: array of operations
+ * @nsops: number of operations, -1 if there is no operation
+ *
+ * An operation is simple if all its sops act on one semaphore and either
+ * all of them decrement it or all of them wait for zero. It then behaves
+ * like a single decrement or wait-for-zero on that semaphore: it only
+ * needs the per-semaphore lock and, if it has to sleep, it can wait on the
+ * per-semaphore lists without breaking their invariants (see
+ * update_queue() and check_restart()).
+ *
+ * Mixing the two is not simple: {-1, 0} sleeping at semval 2 becomes
+ * runnable through a decrement, but the per-semaphore lists are only
+ * rescanned after increments, so it would never be woken.
+ */
+static bool sem_ops_simple(struct sembuf *sops, int nsops)
+{
+	int i;
+
+	if (nsops < 1)
+		return false;
+
+	for (i = 0; i < nsops; i++) {
+		if (sops[i].sem_num != sops[0].sem_num)
+			return false;
+		if (nsops > 1 && (sops[i].sem_op > 0 ||
+				  !sops[i].sem_op != !sops[0].sem_op))
+			return false;
+	}
+	return true;
+}
+
 /*
- * If the request contains only one semaphore operation, and there are
- * no complex transactions pending, lock only the semaphore involved.
+ * If the request is simple (see sem_ops_simple()), and there are no
+ * complex transactions pending, lock only the semaphore involved.
  * Otherwise, lock the entire semaphore array, since we either have
  * multiple semaphores in our own semops, or we need to look at
  * semaphores from other pending complex operations.
@@ -289,7 +324,7 @@ static inline int sem_lock(struct sem_array *sma, struct sembuf *sops,
 {
 	struct sem *sem;
 
-	if (nsops != 1) {
+	if (!sem_ops_simple(sops, nsops)) {
 		/* Complex operation - acquire a full lock */
 		ipc_lock_object(&sma->sem_perm);
 
@@ -446,33 +481,21 @@ static inline void sem_rmid(struct ipc_namespace *ns, struct sem_array *s)
  * - queue.status is initialized to -EINTR before blocking.
  * - wakeup is performed by
  *	* unlinking the queue entry from the pending list
- *	* setting queue.status to IN_WAKEUP
- *	  This is the notification for the blocked thread that a
- *	  result value is imminent.
- *	* call wake_up_process
- *	* set queue.status to the final value.
+ *	* adding the sleeper to a wake_q, which pins its task_struct
+ *	* setting queue.status to the final value
+ *	* calling wake_up_q() after dropping all locks.
  * - the previously blocked thread checks queue.status:
- *	* if it's IN_WAKEUP, then it must wait until the value changes
  *	* if it's not -EINTR, then the operation was completed by
  *	  update_queue. semtimedop can return queue.status without
  *	  performing any operation on the sem array.
  *	* otherwise it must acquire the spinlock and check what's up.
  *
- * The two-stage algorithm is necessary to protect against the following
- * races:
- * - if queue.status is set after wake_up_process, then the woken up idle
- *   thread could race forward and try (and fail) to acquire sma->lock
- *   before update_queue had a chance to set queue.status
- * - if queue.status is written before wake_up_process and if the
- *   blocked process is woken up by a signal between writing
- *   queue.status and the wake_up_process, then the woken up
- *   process could return from semtimedop and die by calling
- *   sys_exit before wake_up_process is called. Then wake_up_process
- *   will oops, because the task structure is already invalid.
- *   (yes, this happened on s390 with sysv msg).
- *
+ * queue.status may be written before the wake-up call: if the blocked
+ * task is woken up by a signal in between, returns from semtimedop and
+ * exits, the reference held by the wake_q keeps the task structure valid
+ * until wake_up_q() is done with it. The waker must not touch the queue
+ * entry after writing queue.status, it lives on the sleeper's stack.
  */
-#define IN_WAKEUP	1
 
 /**
  * newary - Create a new semaphore set
@@ -672,56 +695,30 @@ undo:
 }
 
 /** wake_up_sem_queue_prepare(q, error): Prepare wake-up
+ * @wake_q: wake_q the sleeper is added to
  * @q: queue entry that must be signaled
  * @error: Error value for the signal
  *
- * Prepare the wake-up of the queue entry q.
+ * Prepare the wake-up of the queue entry q: the result is stored right
+ * away, the wake-up call is done by wake_up_q() after dropping the locks.
+ * q can disappear as soon as the status is set.
  */
-static void wake_up_sem_queue_prepare(struct list_head *pt,
+static void wake_up_sem_queue_prepare(struct wake_q_head *wake_q,
 				struct sem_queue *q, int error)
 {
-	if (list_empty(pt)) {
-		/*
-		 * Hold preempt off so that we don't get preempted and have the
-		 * wakee busy-wait until we're scheduled back on.
-		 */
-		preempt_disable();
-	}
-	q->status = IN_WAKEUP;
-	q->pid = error;
-
-	list_add_tail(&q->list, pt);
-}
-
-/**
- * wake_up_sem_queue_do - do the actual wake-up
- * @pt: list of tasks to be woken up
- *
- * Do the actual wake-up.
- * The function is called without any locks held, thus the semaphore array
- * could be destroyed already and the tasks can disappear as soon as the
- * status is set to the actual return code.
- */
-static void wake_up_sem_queue_do(struct list_head *pt)
-{
-	struct sem_queue *q, *t;
-	int did_something;
-
-	did_something = !list_empty(pt);
-	list_for_each_entry_safe(q, t, pt, list) {
-		wake_up_process(q->sleeper);
-		/* q can disappear immediately after writing q->status. */
-		smp_wmb();
-		q->status = q->pid;
-	}
-	if (did_something)
-		preempt_enable();
+	wake_q_add(wake_q, q->sleeper);
+	/*
+	 * Pairs with smp_load_acquire() in semtimedop(): the sleeper may
+	 * return as soon as it sees the final status, so it must not become
+	 * visible before the sleeper is pinned by the wake_q.
+	 */
+	smp_store_release(&q->status, error);
 }
 
 static void unlink_queue(struct sem_array *sma, struct sem_queue *q)
 {
 	list_del(&q->list);
-	if (q->nsops > 1)
+	if (q->complex)
 		sma->complex_count--;
 }
 
@@ -742,7 +739,7 @@ static int check_restart(struct sem_array *sma, struct sem_queue *q)
 		return 1;
 
 	/* we were a sleeping complex operation. Too difficult */
-	if (q->nsops > 1)
+	if (q->complex)
 		return 1;
 
 	/* It is impossible that someone waits for the new value:
@@ -750,7 +747,8 @@ static int check_restart(struct sem_array *sma, struct sem_queue *q)
 	 * - wait-for-zero are handled seperately.
 	 * - q is a previously sleeping simple operation that
 	 *   altered the array. It must be a decrement, because
-	 *   simple increments never sleep.
+	 *   simple increments never sleep and simple operations
+	 *   with multiple sops never increment.
 	 * - If there are older (higher priority) decrements
 	 *   in the queue, then they have observed the original
 	 *   semval value and couldn't proceed. The operation
@@ -763,18 +761,18 @@ static int check_restart(struct sem_array *sma, struct sem_queue *q)
  * wake_const_ops - wake up non-alter tasks
  * @sma: semaphore array.
  * @semnum: semaphore that was modified.
- * @pt: list head for the tasks that must be woken up.
+ * @wake_q: wake_q for the tasks that must be woken up.
  *
  * wake_const_ops must be called after a semaphore in a semaphore array
  * was set to 0. If complex const operations are pending, wake_const_ops must
  * be called with semnum = -1, as well as with the number of each modified
  * semaphore.
- * The tasks that must be woken up are added to @pt. The return code
- * is stored in q->pid.
+ * The tasks that must be woken up are added to @wake_q. The return code
+ * is stored in q->status.
  * The function returns 1 if at least one operation was completed successfully.
  */
 static int wake_const_ops(struct sem_array *sma, int semnum,
-				struct list_head *pt)
+				struct wake_q_head *wake_q)
 {
 	struct sem_queue *q;
 	struct list_head *walk;
@@ -800,7 +798,7 @@ static int wake_const_ops(struct sem_array *sma, int semnum,
 
 			unlink_queue(sma, q);
 
-			wake_up_sem_queue_prepare(pt, q, error);
+			wake_up_sem_queue_prepare(wake_q, q, error);
 			if (error == 0)
 				semop_completed = 1;
 		}
@@ -813,14 +811,14 @@ static int wake_const_ops(struct sem_array *sma, int semnum,
  * @sma: semaphore array
  * @sops: operations that were performed
  * @nsops: number of operations
- * @pt: list head of the tasks that must be woken up.
+ * @wake_q: wake_q for the tasks that must be woken up.
  *
  * Checks all required queue for wait-for-zero operations, based
  * on the actual changes that were performed on the semaphore array.
  * The function returns 1 if at least one operation was completed successfully.
  */
 static int do_smart_wakeup_zero(struct sem_array *sma, struct sembuf *sops,
-					int nsops, struct list_head *pt)
+					int nsops, struct wake_q_head *wake_q)
 {
 	int i;
 	int semop_completed = 0;
@@ -833,7 +831,8 @@ static int do_smart_wakeup_zero(struct sem_array *sma, struct sembuf *sops,
 
 			if (sma->sem_base[num].semval == 0) {
 				got_zero = 1;
-				semop_completed |= wake_const_ops(sma, num, pt);
+				semop_completed |= wake_const_ops(sma, num,
+								  wake_q);
 			}
 		}
 	} else {
@@ -844,7 +843,7 @@ static int do_smart_wakeup_zero(struct sem_array *sma, struct sembuf *sops,
 		for (i = 0; i < sma->sem_nsems; i++) {
 			if (sma->sem_base[i].semval == 0) {
 				got_zero = 1;
-				semop_completed |= wake_const_ops(sma, i, pt);
+				semop_completed |= wake_const_ops(sma, i, wake_q);
 			}
 		}
 	}
@@ -853,7 +852,7 @@ static int do_smart_wakeup_zero(struct sem_array *sma, struct sembuf *sops,
 	 * then check the global queue, too.
 	 */
 	if (got_zero)
-		semop_completed |= wake_const_ops(sma, -1, pt);
+		semop_completed |= wake_const_ops(sma, -1, wake_q);
 
 	return semop_completed;
 }
@@ -863,19 +862,20 @@ static int do_smart_wakeup_zero(struct sem_array *sma, struct sembuf *sops,
  * update_queue - look for tasks that can be completed.
  * @sma: semaphore array.
  * @semnum: semaphore that was modified.
- * @pt: list head for the tasks that must be woken up.
+ * @wake_q: wake_q for the tasks that must be woken up.
  *
  * update_queue must be called after a semaphore in a semaphore array
  * was modified. If multiple semaphores were modified, update_queue must
  * be called with semnum = -1, as well as with the number of each modified
  * semaphore.
- * The tasks that must be woken up are added to @pt. The return code
- * is stored in q->pid.
+ * The tasks that must be woken up are added to @wake_q. The return code
+ * is stored in q->status.
  * The function internally checks if const operations can now succeed.
  *
  * The function return 1 if at least one semop was completed successfully.
  */
-static int update_queue(struct sem_array *sma, int semnum, struct list_head *pt)
+static int update_queue(struct sem_array *sma, int semnum,
+			struct wake_q_head *wake_q)
 {
 	struct sem_queue *q;
 	struct list_head *walk;
@@ -895,8 +895,8 @@ again:
 		q = container_of(walk, struct sem_queue, list);
 		walk = walk->next;
 
-		/* If we are scanning the single sop, per-semaphore list of
-		 * one semaphore and that semaphore is 0, then it is not
+		/* If we are scanning the per-semaphore list of one
+		 * semaphore and that semaphore is 0, then it is not
 		 * necessary to scan further: simple increments
 		 * that affect only one entry succeed immediately and cannot
 		 * be in the  per semaphore pending queue, and decrements
@@ -917,11 +917,11 @@ again:
 			restart = 0;
 		} else {
 			semop_completed = 1;
-			do_smart_wakeup_zero(sma, q->sops, q->nsops, pt);
+			do_smart_wakeup_zero(sma, q->sops, q->nsops, wake_q);
 			restart = check_restart(sma, q);
 		}
 
-		wake_up_sem_queue_prepare(pt, q, error);
+		wake_up_sem_queue_prepare(wake_q, q, error);
 		if (restart)
 			goto again;
 	}
@@ -952,24 +952,24 @@ static void set_semotime(struct sem_array *sma, struct sembuf *sops)
  * @sops: operations that were performed
  * @nsops: number of operations
  * @otime: force setting otime
- * @pt: list head of the tasks that must be woken up.
+ * @wake_q: wake_q for the tasks that must be woken up.
  *
  * do_smart_update() does the required calls to update_queue and wakeup_zero,
  * based on the actual changes that were performed on the semaphore array.
  * Note that the function does not do the actual wake-up: the caller is
- * responsible for calling wake_up_sem_queue_do(@pt).
+ * responsible for calling wake_up_q(@wake_q).
  * It is safe to perform this call after dropping all locks.
  */
 static void do_smart_update(struct sem_array *sma, struct sembuf *sops, int nsops,
-			int otime, struct list_head *pt)
+			int otime, struct wake_q_head *wake_q)
 {
 	int i;
 
-	otime |= do_smart_wakeup_zero(sma, sops, nsops, pt);
+	otime |= do_smart_wakeup_zero(sma, sops, nsops, wake_q);
 
 	if (!list_empty(&sma->pending_alter)) {
 		/* semaphore array uses the global queue - just process it. */
-		otime |= update_queue(sma, -1, pt);
+		otime |= update_queue(sma, -1, wake_q);
 	} else {
 		if (!sops) {
 			/*
@@ -977,7 +977,7 @@ static void do_smart_update(struct sem_array *sma, struct sembuf *sops, int nsop
 			 * known. Check all.
 			 */
 			for (i = 0; i < sma->sem_nsems; i++)
-				otime |= update_queue(sma, i, pt);
+				otime |= update_queue(sma, i, wake_q);
 		} else {
 			/*
 			 * Check the semaphores that were increased:
@@ -991,7 +991,7 @@ static void do_smart_update(struct sem_array *sma, struct sembuf *sops, int nsop
 			for (i = 0; i < nsops; i++) {
 				if (sops[i].sem_op > 0) {
 					otime |= update_queue(sma,
-							sops[i].sem_num, pt);
+							sops[i].sem_num, wake_q);
 				}
 			}
 		}
@@ -1079,7 +1079,7 @@ static void freeary(struct ipc_namespace *ns, struct kern_ipc_perm *ipcp)
 	struct sem_undo *un, *tu;
 	struct sem_queue *q, *tq;
 	struct sem_array *sma = container_of(ipcp, struct sem_array, sem_perm);
-	struct list_head tasks;
+	WAKE_Q(wake_q);
 	int i;
 
 	/* Free the existing undo structures for this semaphore set.  */
@@ -1094,25 +1094,24 @@ static void freeary(struct ipc_namespace *ns, struct kern_ipc_perm *ipcp)
 	}
 
 	/* Wake up all pending processes and let them fail with EIDRM. */
-	INIT_LIST_HEAD(&tasks);
 	list_for_each_entry_safe(q, tq, &sma->pending_const, list) {
 		unlink_queue(sma, q);
-		wake_up_sem_queue_prepare(&tasks, q, -EIDRM);
+		wake_up_sem_queue_prepare(&wake_q, q, -EIDRM);
 	}
 
 	list_for_each_entry_safe(q, tq, &sma->pending_alter, list) {
 		unlink_queue(sma, q);
-		wake_up_sem_queue_prepare(&tasks, q, -EIDRM);
+		wake_up_sem_queue_prepare(&wake_q, q, -EIDRM);
 	}
 	for (i = 0; i < sma->sem_nsems; i++) {
 		struct sem *sem = sma->sem_base + i;
 		list_for_each_entry_safe(q, tq, &sem->pending_const, list) {
 			unlink_queue(sma, q);
-			wake_up_sem_queue_prepare(&tasks, q, -EIDRM);
+			wake_up_sem_queue_prepare(&wake_q, q, -EIDRM);
 		}
 		list_for_each_entry_safe(q, tq, &sem->pending_alter, list) {
 			unlink_queue(sma, q);
-			wake_up_sem_queue_prepare(&tasks, q, -EIDRM);
+			wake_up_sem_queue_prepare(&wake_q, q, -EIDRM);
 		}
 	}
 
@@ -1121,7 +1120,7 @@ static void freeary(struct ipc_namespace *ns, struct kern_ipc_perm *ipcp)
 	sem_unlock(sma, -1);
 	rcu_read_unlock();
 
-	wake_up_sem_queue_do(&tasks);
+	wake_up_q(&wake_q);
 	ns->used_sems -= sma->sem_nsems;
 	ipc_rcu_putref(sma, sem_rcu_free);
 }
@@ -1261,7 +1260,7 @@ static int semctl_setval(struct ipc_namespace *ns, int semid, int semnum,
 	struct sem_array *sma;
 	struct sem *curr;
 	int err;
-	struct list_head tasks;
+	WAKE_Q(wake_q);
 	int val;
 #if defined(CONFIG_64BIT) && defined(__BIG_ENDIAN)
 	/* big-endian 64bit */
@@ -1274,7 +1273,6 @@ static int semctl_setval(struct ipc_namespace *ns, int semid, int semnum,
 	if (val > SEMVMX || val < 0)
 		return -ERANGE;
 
-	INIT_LIST_HEAD(&tasks);
 
 	rcu_read_lock();
 	sma = sem_obtain_object_check(ns, semid);
@@ -1318,10 +1316,10 @@ static int semctl_setval(struct ipc_namespace *ns, int semid, int semnum,
 	curr->sempid = task_tgid_vnr(current);
 	sma->sem_ctime = get_seconds();
 	/* maybe some queued-up processes were waiting for this */
-	do_smart_update(sma, NULL, 0, 0, &tasks);
+	do_smart_update(sma, NULL, 0, 0, &wake_q);
 	sem_unlock(sma, -1);
 	rcu_read_unlock();
-	wake_up_sem_queue_do(&tasks);
+	wake_up_q(&wake_q);
 	return 0;
 }
 
@@ -1333,9 +1331,8 @@ static int semctl_main(struct ipc_namespace *ns, int semid, int semnum,
 	int err, nsems;
 	ushort fast_sem_io[SEMMSL_FAST];
 	ushort *sem_io = fast_sem_io;
-	struct list_head tasks;
+	WAKE_Q(wake_q);
 
-	INIT_LIST_HEAD(&tasks);
 
 	rcu_read_lock();
 	sma = sem_obtain_object_check(ns, semid);
@@ -1444,7 +1441,7 @@ static int semctl_main(struct ipc_namespace *ns, int semid, int semnum,
 		}
 		sma->sem_ctime = get_seconds();
 		/* maybe some queued-up processes were waiting for this */
-		do_smart_update(sma, NULL, 0, 0, &tasks);
+		do_smart_update(sma, NULL, 0, 0, &wake_q);
 		err = 0;
 		goto out_unlock;
 	}
@@ -1480,7 +1477,7 @@ out_unlock:
 	sem_unlock(sma, -1);
 out_rcu_wakeup:
 	rcu_read_unlock();
-	wake_up_sem_queue_do(&tasks);
+	wake_up_q(&wake_q);
 out_free:
 	if (sem_io != fast_sem_io)
 		ipc_free(sem_io, sizeof(ushort)*nsems);
@@ -1754,31 +1751,6 @@ out:
 }
 
 
-/**
- * get_queue_result - retrieve the result code from sem_queue
- * @q: Pointer to queue structure
- *
- * Retrieve the return code from the pending queue. If IN_WAKEUP is found in
- * q->status, then we must loop until the value is replaced with the final
- * value: This may happen if a task is woken up by an unrelated event (e.g.
- * signal) and in parallel the task is woken up by another task because it got
- * the requested semaphores.
- *
- * The function can be called with or without holding the semaphore spinlock.
- */
-static int get_queue_result(struct sem_queue *q)
-{
-	int error;
-
-	error = q->status;
-	while (unlikely(error == IN_WAKEUP)) {
-		cpu_relax();
-		error = q->status;
-	}
-
-	return error;
-}
-
 SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 		unsigned, nsops, const struct timespec __user *, timeout)
 {
@@ -1791,7 +1763,7 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 	struct sem_queue queue;
 	unsigned long jiffies_left = 0;
 	struct ipc_namespace *ns;
-	struct list_head tasks;
+	WAKE_Q(wake_q);
 
 	ns = current->nsproxy->ipc_ns;
 
@@ -1831,7 +1803,6 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 			alter = 1;
 	}
 
-	INIT_LIST_HEAD(&tasks);
 
 	if (undos) {
 		/* On success, find_alloc_undo takes the rcu_read_lock */
@@ -1869,10 +1840,11 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 	/*
 	 * We eventually might perform the following check in a lockless
 	 * fashion, considering ipc_valid_object() locking constraints.
-	 * If nsops == 1 and there is no contention for sem_perm.lock, then
-	 * only a per-semaphore lock is held and it's OK to proceed with the
-	 * check below. More details on the fine grained locking scheme
-	 * entangled here and why it's RMID race safe on comments at sem_lock()
+	 * If the operation is simple and there is no contention for
+	 * sem_perm.lock, then only a per-semaphore lock is held and it's
+	 * OK to proceed with the check below. More details on the fine
+	 * grained locking scheme entangled here and why it's RMID race
+	 * safe on comments at sem_lock()
 	 */
 	if (!ipc_valid_object(&sma->sem_perm))
 		goto out_unlock_free;
@@ -1891,6 +1863,7 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 	queue.undo = un;
 	queue.pid = task_tgid_vnr(current);
 	queue.alter = alter;
+	queue.complex = !sem_ops_simple(sops, nsops);
 
 	error = perform_atomic_semop(sma, &queue);
 	if (error == 0) {
@@ -1898,7 +1871,7 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 		 * the required updates.
 		 */
 		if (alter)
-			do_smart_update(sma, sops, nsops, 1, &tasks);
+			do_smart_update(sma, sops, nsops, 1, &wake_q);
 		else
 			set_semotime(sma, sops);
 	}
@@ -1909,7 +1882,7 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 	 * task into the pending queue and go to sleep.
 	 */
 
-	if (nsops == 1) {
+	if (!queue.complex) {
 		struct sem *curr;
 		curr = &sma->sem_base[sops->sem_num];
 
@@ -1950,7 +1923,8 @@ sleep_again:
 	else
 		schedule();
 
-	error = get_queue_result(&queue);
+	/* Pairs with smp_store_release() in wake_up_sem_queue_prepare() */
+	error = smp_load_acquire(&queue.status);
 
 	if (error != -EINTR) {
 		/* fast path: update_queue already obtained all requested
@@ -1969,9 +1943,11 @@ sleep_again:
 	sma = sem_obtain_lock(ns, semid, sops, nsops, &locknum);
 
 	/*
-	 * Wait until it's guaranteed that no wakeup_sem_queue_do() is ongoing.
+	 * The status is only written with the lock held, thus this read is
+	 * final unless the array was removed; then freeary() has already
+	 * stored -EIDRM before dropping the lock.
 	 */
-	error = get_queue_result(&queue);
+	error = READ_ONCE(queue.status);
 
 	/*
 	 * Array removed? If yes, leave without sem_unlock().
@@ -2007,7 +1983,7 @@ out_unlock_free:
 	sem_unlock(sma, locknum);
 out_rcu_wakeup:
 	rcu_read_unlock();
-	wake_up_sem_queue_do(&tasks);
+	wake_up_q(&wake_q);
 out_free:
 	if (sops != fast_sops)
 		kfree(sops);
@@ -2068,7 +2044,7 @@ void exit_sem(struct task_struct *tsk)
 	for (;;) {
 		struct sem_array *sma;
 		struct sem_undo *un;
-		struct list_head tasks;
+		WAKE_Q(wake_q);
 		int semid, i;
 
 		rcu_read_lock();
@@ -2142,11 +2118,10 @@ void exit_sem(struct task_struct *tsk)
 			}
 		}
 		/* maybe some queued-up processes were waiting for this */
-		INIT_LIST_HEAD(&tasks);
-		do_smart_update(sma, NULL, 0, 1, &tasks);
+		do_smart_update(sma, NULL, 0, 1, &wake_q);
 		sem_unlock(sma, -1);
 		rcu_read_unlock();
-		wake_up_sem_queue_do(&tasks);
+		wake_up_q(&wake_q);
 
 		kfree_rcu(un, rcu);
 	}
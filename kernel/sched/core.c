@@ -1749,6 +1749,59 @@ int wake_up_state(struct task_struct *p, unsigned int state)
 	return try_to_wake_up(p, state, 0);
 }
 
+/**
+ * wake_q_add - queue a task for a deferred wakeup
+ * @head: the wake_q_head to add @task to
+ * @task: the task to wake up
+ *
+ * Called with the lock held that protects whatever @task sleeps on.  The
+ * actual wakeup is done by wake_up_q(), normally after dropping that lock.
+ * Implies a full memory barrier if @task was queued.
+ */
+void wake_q_add(struct wake_q_head *head, struct task_struct *task)
+{
+	struct wake_q_node *node = &task->wake_q;
+
+	/*
+	 * If ->wake_q.next is set already, the task sits on some wake_q and
+	 * will be woken from there.  The cmpxchg() pairs with the barrier
+	 * implied by wake_up_process() in wake_up_q().
+	 */
+	if (cmpxchg(&node->next, NULL, WAKE_Q_TAIL))
+		return;
+
+	get_task_struct(task);
+
+	/* the head is local to the caller, no concurrency here */
+	*head->lastp = node;
+	head->lastp = &node->next;
+}
+
+/**
+ * wake_up_q - wake up all tasks queued with wake_q_add()
+ * @head: the wake_q_head
+ */
+void wake_up_q(struct wake_q_head *head)
+{
+	struct wake_q_node *node = head->first;
+
+	while (node != WAKE_Q_TAIL) {
+		struct task_struct *task;
+
+		task = container_of(node, struct task_struct, wake_q);
+		node = node->next;
+		/* the task may be queued again from now on */
+		task->wake_q.next = NULL;
+
+		/*
+		 * wake_up_process() implies a write barrier, so the task
+		 * cannot miss a wakeup queued after it has been cleared.
+		 */
+		wake_up_process(task);
+		put_task_struct(task);
+	}
+}
+
 /*
  * This function clears the sched_dl_entity static params.
  */
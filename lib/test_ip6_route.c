@@ -0,0 +1,175 @@
+/*
+ * IPv6 route lookup micro-benchmark
+ *
+ * Runs one kthread per online cpu, each resolving output routes in
+ * init_net through ip6_route_output() for a fixed time, and reports the
+ * aggregate number of lookups per second.  The destination is taken from
+ * the "dst" parameter; with "host_bits" set, the low bits of it are
+ * randomized per lookup so that a whole prefix is exercised.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/atomic.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/err.h>
+#include <linux/inet.h>
+#include <linux/init.h>
+#include <linux/jiffies.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/module.h>
+#include <linux/random.h>
+#include <linux/slab.h>
+#include <net/ip6_route.h>
+#include <net/net_namespace.h>
+
+static char *dst = "::1";
+module_param(dst, charp, 0444);
+MODULE_PARM_DESC(dst, "Destination address to look up (default: ::1)");
+
+static unsigned int host_bits;
+module_param(host_bits, uint, 0444);
+MODULE_PARM_DESC(host_bits, "Number of low address bits to randomize (0-32)");
+
+static unsigned int duration = 1000;
+module_param(duration, uint, 0444);
+MODULE_PARM_DESC(duration, "Milliseconds each thread runs (default: 1000)");
+
+static unsigned int nthreads;
+module_param(nthreads, uint, 0444);
+MODULE_PARM_DESC(nthreads, "Number of threads (default: online cpus)");
+
+struct test_thread {
+	struct task_struct	*task;
+	unsigned long		lookups;
+	unsigned long		errors;
+};
+
+static struct in6_addr test_daddr;
+static atomic_t test_running;
+static DECLARE_COMPLETION(test_done);
+static DECLARE_COMPLETION(test_start);
+
+static int test_ip6_route_thread(void *arg)
+{
+	struct test_thread *t = arg;
+	u32 mask = host_bits >= 32 ? ~0U : (1U << host_bits) - 1;
+	__be32 base = test_daddr.s6_addr32[3] & ~htonl(mask);
+	struct flowi6 fl6 = {
+		.flowi6_oif = 0,
+		.daddr = test_daddr,
+	};
+	unsigned long end;
+	u32 seed = prandom_u32();
+
+	wait_for_completion(&test_start);
+
+	end = jiffies + msecs_to_jiffies(duration);
+	while (time_before(jiffies, end)) {
+		struct dst_entry *dst_entry;
+		int i;
+
+		for (i = 0; i < 256; i++) {
+			if (mask) {
+				seed = seed * 1664525 + 1013904223;
+				fl6.daddr.s6_addr32[3] = base |
+							 htonl(seed & mask);
+			}
+			dst_entry = ip6_route_output(&init_net, NULL, &fl6);
+			if (dst_entry->error)
+				t->errors++;
+			dst_release(dst_entry);
+		}
+		t->lookups += i;
+		cond_resched();
+	}
+
+	if (atomic_dec_and_test(&test_running))
+		complete(&test_done);
+
+	while (!kthread_should_stop())
+		schedule_timeout_interruptible(HZ / 10);
+
+	return 0;
+}
+
+static int __init test_ip6_route_init(void)
+{
+	struct test_thread *threads;
+	unsigned long lookups = 0, errors = 0;
+	unsigned int i, cpu;
+	int err = 0;
+
+	if (!in6_pton(dst, -1, test_daddr.s6_addr, -1, NULL)) {
+		pr_warn("test_ip6_route: invalid address %s\n", dst);
+		return -EINVAL;
+	}
+
+	if (!nthreads)
+		nthreads = num_online_cpus();
+
+	threads = kcalloc(nthreads, sizeof(*threads), GFP_KERNEL);
+	if (!threads)
+		return -ENOMEM;
+
+	atomic_set(&test_running, nthreads);
+
+	cpu = cpumask_first(cpu_online_mask);
+	for (i = 0; i < nthreads; i++) {
+		struct task_struct *task;
+
+		task = kthread_create(test_ip6_route_thread, &threads[i],
+				      "ip6_route_test/%u", i);
+		if (IS_ERR(task)) {
+			err = PTR_ERR(task);
+			pr_warn("test_ip6_route: kthread_create failed: %d\n",
+				err);
+			break;
+		}
+		kthread_bind(task, cpu);
+		threads[i].task = task;
+		wake_up_process(task);
+
+		cpu = cpumask_next(cpu, cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_online_mask);
+	}
+
+	if (err) {
+		/* threads that were started still wait for test_start */
+		atomic_sub(nthreads - i, &test_running);
+		nthreads = i;
+	}
+
+	complete_all(&test_start);
+	if (nthreads)
+		wait_for_completion(&test_done);
+
+	for (i = 0; i < nthreads; i++) {
+		kthread_stop(threads[i].task);
+		lookups += threads[i].lookups;
+		errors += threads[i].errors;
+	}
+	kfree(threads);
+
+	if (nthreads)
+		pr_info("test_ip6_route: %pI6c/%u: %u threads, %lu lookups (%lu errors) in %ums, %lu lookups/s\n",
+			&test_daddr, 128 - min(host_bits, 32U), nthreads,
+			lookups, errors, duration,
+			lookups * 1000 / max(duration, 1U));
+
+	return err;
+}
+
+static void __exit test_ip6_route_exit(void)
+{
+}
+
+module_init(test_ip6_route_init);
+module_exit(test_ip6_route_exit);
+
+MODULE_LICENSE("GPL v2");
@@ -0,0 +1,112 @@
+/*
+ * Bulk page allocator micro-benchmark
+ *
+ * Allocates order-0 pages in batches of several sizes, once with a loop
+ * of alloc_page() and once with alloc_pages_bulk(), and reports the
+ * average allocation cost per page for each.  Freeing the batch is not
+ * included in the measurement.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/gfp.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+
+static unsigned int pages_total = 1 << 16;
+module_param(pages_total, uint, 0444);
+MODULE_PARM_DESC(pages_total, "Pages allocated per batch size and method (default: 65536)");
+
+static const unsigned int batch_sizes[] = { 1, 8, 16, 32, 64, 128, 256 };
+
+static void test_page_bulk_free(struct page **pages, unsigned int nr)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr; i++) {
+		if (pages[i])
+			__free_page(pages[i]);
+		pages[i] = NULL;
+	}
+}
+
+/* Returns the average cost in ns per page, or 0 if an allocation failed */
+static u64 test_page_bulk_run(struct page **pages, unsigned int batch,
+			      bool bulk)
+{
+	unsigned int done, i;
+	u64 start, ns = 0;
+
+	for (done = 0; done < pages_total; done += batch) {
+		unsigned long nr;
+
+		start = ktime_get_ns();
+		if (bulk) {
+			nr = alloc_pages_bulk(GFP_KERNEL, batch, pages);
+		} else {
+			for (i = 0; i < batch; i++) {
+				pages[i] = alloc_page(GFP_KERNEL);
+				if (!pages[i])
+					break;
+			}
+			nr = i;
+		}
+		ns += ktime_get_ns() - start;
+
+		test_page_bulk_free(pages, batch);
+		if (nr < batch)
+			return 0;
+		cond_resched();
+	}
+
+	return div_u64(ns, done);
+}
+
+static int __init test_page_bulk_init(void)
+{
+	struct page **pages;
+	unsigned int i, max_batch = 0;
+
+	for (i = 0; i < ARRAY_SIZE(batch_sizes); i++)
+		max_batch = max(max_batch, batch_sizes[i]);
+
+	pages = kcalloc(max_batch, sizeof(*pages), GFP_KERNEL);
+	if (!pages)
+		return -ENOMEM;
+
+	for (i = 0; i < ARRAY_SIZE(batch_sizes); i++) {
+		unsigned int batch = batch_sizes[i];
+		u64 single, bulk;
+
+		single = test_page_bulk_run(pages, batch, false);
+		bulk = test_page_bulk_run(pages, batch, true);
+		if (!single || !bulk) {
+			pr_warn("test_page_bulk: batch %u: allocation failed\n",
+				batch);
+			kfree(pages);
+			return -ENOMEM;
+		}
+
+		pr_info("test_page_bulk: batch %3u: alloc_page %llu ns/page, alloc_pages_bulk %llu ns/page\n",
+			batch, single, bulk);
+	}
+
+	kfree(pages);
+	return 0;
+}
+
+static void __exit test_page_bulk_exit(void)
+{
+}
+
+module_init(test_page_bulk_init);
+module_exit(test_page_bulk_exit);
+
+MODULE_LICENSE("GPL v2");
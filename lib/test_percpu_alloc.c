@@ -0,0 +1,296 @@
+/*
+ * percpu allocator test
+ *
+ * Checks and times the area cache and the atomic path of the percpu
+ * allocator:
+ *
+ *   cache     a small area freed and allocated again comes back from the
+ *             local area cache, cleared on every cpu, and a round trip
+ *             through the cache is timed against sizes that always take
+ *             pcpu_lock;
+ *   atomic    GFP_NOWAIT allocations with irqs off are served from the
+ *             populated pages and are cleared;
+ *   pressure  with the area caches of all cpus full, allocations that
+ *             need new chunks make the allocator drain the caches; no
+ *             area may be handed out twice afterwards.
+ *
+ * Prints a line per check and a summary, and fails to load if a check
+ * failed.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/smp.h>
+#include <linux/sort.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+static unsigned int loops = 100000;
+module_param(loops, uint, 0444);
+MODULE_PARM_DESC(loops, "Timed round trips per size (default: 100000)");
+
+static unsigned int nr_atomic = 1024;
+module_param(nr_atomic, uint, 0444);
+MODULE_PARM_DESC(nr_atomic, "Atomic allocations (default: 1024)");
+
+static unsigned int pressure_kb = 256;
+module_param(pressure_kb, uint, 0444);
+MODULE_PARM_DESC(pressure_kb,
+		 "Per-cpu kilobytes allocated to run the chunks full (default: 256)");
+
+/* the allocator caches areas of up to this size ... */
+#define TEST_CACHE_MAX		32
+/* ... and fewer than this many of each size on a cpu */
+#define TEST_CACHE_FILL		16
+
+static const size_t test_sizes[] = { 4, 8, 16, 32, 64, 256, 1024 };
+
+static int pass_cnt, err_cnt;
+
+struct test_area {
+	void __percpu	*ptr;
+	size_t		size;
+};
+
+static __printf(2, 3) void test_result(bool ok, const char *fmt, ...)
+{
+	struct va_format vaf;
+	va_list args;
+
+	va_start(args, fmt);
+	vaf.fmt = fmt;
+	vaf.va = &args;
+	pr_info("%s %pV\n", ok ? "PASS" : "FAIL", &vaf);
+	va_end(args);
+
+	if (ok)
+		pass_cnt++;
+	else
+		err_cnt++;
+}
+
+static bool test_area_clear(void __percpu *ptr, size_t size)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		if (memchr_inv(per_cpu_ptr(ptr, cpu), 0, size))
+			return false;
+	return true;
+}
+
+/* leave a pattern that a reuse without clearing would show */
+static void test_area_dirty(void __percpu *ptr, size_t size)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(ptr, cpu), 0xa5, size);
+}
+
+static void test_cache(void)
+{
+	void __percpu *fill[TEST_CACHE_FILL];
+	void __percpu *p, *q;
+	unsigned int i, idx;
+	bool reused, clear;
+	u64 start, ns;
+
+	for (idx = 0; idx < ARRAY_SIZE(test_sizes); idx++) {
+		size_t size = test_sizes[idx];
+
+		if (size <= TEST_CACHE_MAX) {
+			/*
+			 * Stay on this cpu, empty its cache of this size so
+			 * that the free below is cached, and expect the same
+			 * area back.
+			 */
+			preempt_disable();
+			for (i = 0; i < TEST_CACHE_FILL; i++)
+				fill[i] = __alloc_percpu_gfp(size, size,
+							     GFP_NOWAIT);
+			p = __alloc_percpu_gfp(size, size, GFP_NOWAIT);
+			if (p)
+				test_area_dirty(p, size);
+			free_percpu(p);
+			q = __alloc_percpu_gfp(size, size, GFP_NOWAIT);
+			preempt_enable();
+
+			reused = p && q == p;
+			clear = q && test_area_clear(q, size);
+			free_percpu(q);
+			for (i = 0; i < TEST_CACHE_FILL; i++)
+				free_percpu(fill[i]);
+			test_result(reused && clear,
+				    "cache %4zu bytes: area %s, %s",
+				    size, reused ? "reused" : "not reused",
+				    clear ? "cleared" : "not cleared");
+		}
+
+		start = ktime_get_ns();
+		for (i = 0; i < loops; i++) {
+			p = __alloc_percpu(size, min_t(size_t, size,
+						       sizeof(long)));
+			if (!p)
+				break;
+			free_percpu(p);
+			if (!(i % 256))
+				cond_resched();
+		}
+		ns = ktime_get_ns() - start;
+		test_result(i == loops,
+			    "cache %4zu bytes: %s, %llu ns per alloc+free",
+			    size, size <= TEST_CACHE_MAX ? "hit " : "miss",
+			    i ? div_u64(ns, i) : 0);
+	}
+}
+
+static void test_atomic(void)
+{
+	void __percpu **areas;
+	unsigned int i, done = 0, dirty = 0;
+	unsigned long flags;
+
+	areas = vzalloc(nr_atomic * sizeof(*areas));
+	if (!areas) {
+		test_result(false, "atomic: no memory for %u areas",
+			    nr_atomic);
+		return;
+	}
+
+	local_irq_save(flags);
+	for (i = 0; i < nr_atomic; i++) {
+		size_t size = test_sizes[i % ARRAY_SIZE(test_sizes)];
+
+		areas[i] = __alloc_percpu_gfp(size, sizeof(long), GFP_NOWAIT);
+		if (!areas[i])
+			continue;
+		done++;
+		if (!test_area_clear(areas[i], size))
+			dirty++;
+		test_area_dirty(areas[i], size);
+	}
+	local_irq_restore(flags);
+
+	/* atomic allocations may fail once the populated pages run out */
+	test_result(done && !dirty,
+		    "atomic: %u of %u allocated with irqs off, %u not cleared",
+		    done, nr_atomic, dirty);
+
+	for (i = 0; i < nr_atomic; i++)
+		free_percpu(areas[i]);
+	vfree(areas);
+}
+
+/* free TEST_CACHE_FILL areas of every cached size to this cpu's cache */
+static void test_fill_cache(void *unused)
+{
+	void __percpu *fill[TEST_CACHE_FILL];
+	size_t size;
+	unsigned int i;
+
+	for (size = 4; size <= TEST_CACHE_MAX; size *= 2) {
+		for (i = 0; i < TEST_CACHE_FILL; i++) {
+			fill[i] = __alloc_percpu_gfp(size, size, GFP_NOWAIT);
+			if (fill[i])
+				test_area_dirty(fill[i], size);
+		}
+		for (i = 0; i < TEST_CACHE_FILL; i++)
+			free_percpu(fill[i]);
+	}
+}
+
+static int test_area_cmp(const void *a, const void *b)
+{
+	const struct test_area *x = a, *y = b;
+	unsigned long px = (unsigned long __force)x->ptr;
+	unsigned long py = (unsigned long __force)y->ptr;
+
+	return px < py ? -1 : px > py;
+}
+
+static void test_pressure(void)
+{
+	unsigned int nr_big = pressure_kb, nr_small = 4 * TEST_CACHE_FILL;
+	unsigned int i, nr = 0, overlaps = 0, dirty = 0;
+	struct test_area *areas;
+	size_t size;
+
+	areas = vzalloc((nr_big + nr_small) * sizeof(*areas));
+	if (!areas) {
+		test_result(false, "pressure: no memory for %u areas",
+			    nr_big + nr_small);
+		return;
+	}
+
+	on_each_cpu(test_fill_cache, NULL, 1);
+
+	/* more than fits into the chunks there are, so new ones are made */
+	for (i = 0; i < nr_big; i++) {
+		areas[nr].ptr = __alloc_percpu(1024, sizeof(long));
+		if (!areas[nr].ptr)
+			break;
+		areas[nr++].size = 1024;
+	}
+	test_result(i == nr_big, "pressure: %u of %u 1k areas allocated",
+		    i, nr_big);
+
+	/* areas drained from the caches must not also be handed out again */
+	for (i = 0; i < nr_small; i++) {
+		size = 4 << (i % 4);
+		areas[nr].ptr = __alloc_percpu(size, size);
+		if (!areas[nr].ptr)
+			continue;
+		if (!test_area_clear(areas[nr].ptr, size))
+			dirty++;
+		areas[nr++].size = size;
+	}
+
+	sort(areas, nr, sizeof(*areas), test_area_cmp, NULL);
+	for (i = 1; i < nr; i++) {
+		unsigned long end = (unsigned long __force)areas[i - 1].ptr +
+				    areas[i - 1].size;
+
+		if (end > (unsigned long __force)areas[i].ptr)
+			overlaps++;
+	}
+	test_result(!overlaps && !dirty,
+		    "pressure: %u areas live, %u overlaps, %u not cleared",
+		    nr, overlaps, dirty);
+
+	for (i = 0; i < nr; i++)
+		free_percpu(areas[i].ptr);
+	vfree(areas);
+}
+
+static int __init test_percpu_alloc_init(void)
+{
+	if (!loops)
+		return -EINVAL;
+
+	test_cache();
+	test_atomic();
+	test_pressure();
+
+	pr_info("Summary: %d PASSED, %d FAILED\n", pass_cnt, err_cnt);
+	return err_cnt ? -EINVAL : 0;
+}
+
+static void __exit test_percpu_alloc_exit(void)
+{
+}
+
+module_init(test_percpu_alloc_init);
+module_exit(test_percpu_alloc_exit);
+
+MODULE_LICENSE("GPL v2");
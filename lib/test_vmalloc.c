@@ -0,0 +1,198 @@
+/*
+ * vmalloc stress test
+ *
+ * Runs one kthread per online cpu.  For each of a range of sizes, every
+ * thread allocates with vmalloc(), touches and frees the area "loops"
+ * times, while also holding on to a window of older allocations that it
+ * frees in a scrambled order, so that the vmap area tree stays fragmented
+ * and the lazy purge has work to do.  Reports the average cost of one
+ * vmalloc()/vfree() pair for each size, over all threads.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/atomic.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/err.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+static unsigned int loops = 10000;
+module_param(loops, uint, 0444);
+MODULE_PARM_DESC(loops, "Allocations per size and thread (default: 10000)");
+
+static unsigned int window = 64;
+module_param(window, uint, 0444);
+MODULE_PARM_DESC(window, "Allocations each thread keeps alive (default: 64)");
+
+static unsigned int nthreads;
+module_param(nthreads, uint, 0444);
+MODULE_PARM_DESC(nthreads, "Number of threads (default: online cpus)");
+
+static const unsigned int test_pages[] = { 1, 2, 4, 8, 15, 64, 256 };
+#define NR_TEST_SIZES	ARRAY_SIZE(test_pages)
+
+struct test_thread {
+	struct task_struct	*task;
+	void			**live;
+	u64			ns[NR_TEST_SIZES];
+	unsigned long		failed;
+};
+
+static atomic_t test_running;
+static DECLARE_COMPLETION(test_done);
+static DECLARE_COMPLETION(test_start);
+
+static void test_vmalloc_size(struct test_thread *t, unsigned int idx)
+{
+	unsigned long size = test_pages[idx] * PAGE_SIZE;
+	u32 seed = (unsigned long)t;
+	unsigned int i;
+	u64 start;
+
+	start = ktime_get_ns();
+	for (i = 0; i < loops; i++) {
+		unsigned int slot;
+		void *p;
+
+		p = vmalloc(size);
+		if (!p) {
+			t->failed++;
+			continue;
+		}
+		*(volatile char *)p = 0;
+
+		/* swap it for a random older allocation */
+		seed = seed * 1664525 + 1013904223;
+		slot = seed % window;
+		vfree(t->live[slot]);
+		t->live[slot] = p;
+
+		if (!(i % 64))
+			cond_resched();
+	}
+	t->ns[idx] = ktime_get_ns() - start;
+
+	for (i = 0; i < window; i++) {
+		vfree(t->live[i]);
+		t->live[i] = NULL;
+	}
+}
+
+static int test_vmalloc_thread(void *arg)
+{
+	struct test_thread *t = arg;
+	unsigned int idx;
+
+	wait_for_completion(&test_start);
+
+	for (idx = 0; idx < NR_TEST_SIZES; idx++)
+		test_vmalloc_size(t, idx);
+
+	if (atomic_dec_and_test(&test_running))
+		complete(&test_done);
+
+	while (!kthread_should_stop())
+		schedule_timeout_interruptible(HZ / 10);
+
+	return 0;
+}
+
+static int __init test_vmalloc_init(void)
+{
+	struct test_thread *threads;
+	unsigned long failed = 0;
+	unsigned int i, idx, cpu, nr_threads;
+	int err = 0;
+
+	if (!loops || !window)
+		return -EINVAL;
+	if (!nthreads)
+		nthreads = num_online_cpus();
+
+	nr_threads = nthreads;
+	threads = kcalloc(nr_threads, sizeof(*threads), GFP_KERNEL);
+	if (!threads)
+		return -ENOMEM;
+	for (i = 0; i < nr_threads; i++) {
+		threads[i].live = kcalloc(window, sizeof(void *), GFP_KERNEL);
+		if (!threads[i].live) {
+			err = -ENOMEM;
+			goto out;
+		}
+	}
+
+	atomic_set(&test_running, nthreads);
+
+	cpu = cpumask_first(cpu_online_mask);
+	for (i = 0; i < nthreads; i++) {
+		struct task_struct *task;
+
+		task = kthread_create(test_vmalloc_thread, &threads[i],
+				      "vmalloc_test/%u", i);
+		if (IS_ERR(task)) {
+			err = PTR_ERR(task);
+			pr_warn("test_vmalloc: kthread_create failed: %d\n",
+				err);
+			break;
+		}
+		kthread_bind(task, cpu);
+		threads[i].task = task;
+		wake_up_process(task);
+
+		cpu = cpumask_next(cpu, cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_online_mask);
+	}
+
+	if (err) {
+		/* threads that were started still wait for test_start */
+		atomic_sub(nthreads - i, &test_running);
+		nthreads = i;
+	}
+
+	complete_all(&test_start);
+	if (nthreads)
+		wait_for_completion(&test_done);
+
+	for (i = 0; i < nthreads; i++) {
+		kthread_stop(threads[i].task);
+		failed += threads[i].failed;
+	}
+
+	for (idx = 0; nthreads && idx < NR_TEST_SIZES; idx++) {
+		u64 ns = 0;
+
+		for (i = 0; i < nthreads; i++)
+			ns += threads[i].ns[idx];
+
+		pr_info("test_vmalloc: %3u pages: %u threads, %llu ns per vmalloc+vfree\n",
+			test_pages[idx], nthreads,
+			div_u64(ns, nthreads * loops));
+	}
+	if (failed)
+		pr_warn("test_vmalloc: %lu allocations failed\n", failed);
+
+out:
+	for (i = 0; i < nr_threads; i++)
+		kfree(threads[i].live);
+	kfree(threads);
+	return err;
+}
+
+static void __exit test_vmalloc_exit(void)
+{
+}
+
+module_init(test_vmalloc_init);
+module_exit(test_vmalloc_exit);
+
+MODULE_LICENSE("GPL v2");
@@ -0,0 +1,162 @@
+/*
+ * xxHash - extremely fast non-cryptographic hash
+ *
+ * Copyright (C) 2012-2016, Yann Collet.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as published
+ * by the Free Software Foundation.
+ */
+
+#include <asm/unaligned.h>
+#include <linux/bitops.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/xxhash.h>
+
+#define PRIME32_1	2654435761U
+#define PRIME32_2	2246822519U
+#define PRIME32_3	3266489917U
+#define PRIME32_4	 668265263U
+#define PRIME32_5	 374761393U
+
+#define PRIME64_1	11400714785074694791ULL
+#define PRIME64_2	14029467366897019727ULL
+#define PRIME64_3	 1609587929392839161ULL
+#define PRIME64_4	 9650029242287828579ULL
+#define PRIME64_5	 2870177450012600261ULL
+
+static u32 xxh32_round(u32 acc, u32 input)
+{
+	acc += input * PRIME32_2;
+	acc = rol32(acc, 13);
+	return acc * PRIME32_1;
+}
+
+u32 xxh32(const void *input, size_t length, u32 seed)
+{
+	const u8 *p = input;
+	const u8 *end = p + length;
+	u32 h32;
+
+	if (length >= 16) {
+		const u8 *limit = end - 16;
+		u32 v1 = seed + PRIME32_1 + PRIME32_2;
+		u32 v2 = seed + PRIME32_2;
+		u32 v3 = seed;
+		u32 v4 = seed - PRIME32_1;
+
+		do {
+			v1 = xxh32_round(v1, get_unaligned_le32(p));
+			v2 = xxh32_round(v2, get_unaligned_le32(p + 4));
+			v3 = xxh32_round(v3, get_unaligned_le32(p + 8));
+			v4 = xxh32_round(v4, get_unaligned_le32(p + 12));
+			p += 16;
+		} while (p <= limit);
+
+		h32 = rol32(v1, 1) + rol32(v2, 7) +
+		      rol32(v3, 12) + rol32(v4, 18);
+	} else {
+		h32 = seed + PRIME32_5;
+	}
+
+	h32 += (u32)length;
+
+	while (p + 4 <= end) {
+		h32 += get_unaligned_le32(p) * PRIME32_3;
+		h32 = rol32(h32, 17) * PRIME32_4;
+		p += 4;
+	}
+
+	while (p < end) {
+		h32 += *p * PRIME32_5;
+		h32 = rol32(h32, 11) * PRIME32_1;
+		p++;
+	}
+
+	h32 ^= h32 >> 15;
+	h32 *= PRIME32_2;
+	h32 ^= h32 >> 13;
+	h32 *= PRIME32_3;
+	h32 ^= h32 >> 16;
+
+	return h32;
+}
+EXPORT_SYMBOL(xxh32);
+
+static u64 xxh64_round(u64 acc, u64 input)
+{
+	acc += input * PRIME64_2;
+	acc = rol64(acc, 31);
+	return acc * PRIME64_1;
+}
+
+static u64 xxh64_merge_round(u64 acc, u64 val)
+{
+	acc ^= xxh64_round(0, val);
+	return acc * PRIME64_1 + PRIME64_4;
+}
+
+u64 xxh64(const void *input, size_t length, u64 seed)
+{
+	const u8 *p = input;
+	const u8 *end = p + length;
+	u64 h64;
+
+	if (length >= 32) {
+		const u8 *limit = end - 32;
+		u64 v1 = seed + PRIME64_1 + PRIME64_2;
+		u64 v2 = seed + PRIME64_2;
+		u64 v3 = seed;
+		u64 v4 = seed - PRIME64_1;
+
+		do {
+			v1 = xxh64_round(v1, get_unaligned_le64(p));
+			v2 = xxh64_round(v2, get_unaligned_le64(p + 8));
+			v3 = xxh64_round(v3, get_unaligned_le64(p + 16));
+			v4 = xxh64_round(v4, get_unaligned_le64(p + 24));
+			p += 32;
+		} while (p <= limit);
+
+		h64 = rol64(v1, 1) + rol64(v2, 7) +
+		      rol64(v3, 12) + rol64(v4, 18);
+		h64 = xxh64_merge_round(h64, v1);
+		h64 = xxh64_merge_round(h64, v2);
+		h64 = xxh64_merge_round(h64, v3);
+		h64 = xxh64_merge_round(h64, v4);
+	} else {
+		h64 = seed + PRIME64_5;
+	}
+
+	h64 += (u64)length;
+
+	while (p + 8 <= end) {
+		h64 ^= xxh64_round(0, get_unaligned_le64(p));
+		h64 = rol64(h64, 27) * PRIME64_1 + PRIME64_4;
+		p += 8;
+	}
+
+	if (p + 4 <= end) {
+		h64 ^= (u64)get_unaligned_le32(p) * PRIME64_1;
+		h64 = rol64(h64, 23) * PRIME64_2 + PRIME64_3;
+		p += 4;
+	}
+
+	while (p < end) {
+		h64 ^= *p * PRIME64_5;
+		h64 = rol64(h64, 11) * PRIME64_1;
+		p++;
+	}
+
+	h64 ^= h64 >> 33;
+	h64 *= PRIME64_2;
+	h64 ^= h64 >> 29;
+	h64 *= PRIME64_3;
+	h64 ^= h64 >> 32;
+
+	return h64;
+}
+EXPORT_SYMBOL(xxh64);
+
+MODULE_LICENSE("GPL v2");
+MODULE_DESCRIPTION("xxHash");
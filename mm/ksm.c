@@ -23,7 +23,7 @@
 #include <linux/pagemap.h>
 #include <linux/rmap.h>
 #include <linux/spinlock.h>
-#include <linux/jhash.h>
+#include <linux/xxhash.h>
 #include <linux/delay.h>
 #include <linux/kthread.h>
 #include <linux/wait.h>
@@ -223,6 +223,34 @@ static unsigned int ksm_thread_pages_to_scan = 100;
 /* Milliseconds ksmd should sleep between batches */
 static unsigned int ksm_thread_sleep_millisecs = 20;
 
+/* Whether ksmd adapts pages_to_scan to how many pages it merges */
+static unsigned int ksm_auto_tune;
+
+/* Share of a cpu ksmd may use when auto tuning, in percent */
+static unsigned int ksm_max_cpu_percent = 20;
+
+/* Auto tuning never scans fewer pages per batch than this */
+#define KSM_AUTO_MIN_PAGES	100
+
+/* How often the merge rate is sampled and pages_to_scan adjusted */
+#define KSM_TUNE_INTERVAL	HZ
+
+/* Whether to map all-zero pages to the shared zero page */
+static unsigned int ksm_use_zero_pages = 1;
+
+/* Checksum of an all-zero page, to spot candidates for the zero page */
+static u32 zero_checksum __read_mostly;
+
+/* Statistics of ksmd, and the baseline of the current tuning interval */
+static struct {
+	u64 scan_ns;			/* cpu time spent scanning */
+	unsigned long pages_scanned;
+	unsigned long pages_merged;	/* replaced by a ksm or zero page */
+	unsigned long zero_pages_merged;
+	unsigned long merge_rate;	/* pages merged per second */
+} ksm_stat, ksm_tune_base;
+static unsigned long ksm_tune_jiffies;
+
 #ifdef CONFIG_NUMA
 /* Zeroed when merging across nodes is not allowed */
 static unsigned int ksm_merge_across_nodes = 1;
@@ -829,7 +857,7 @@ static u32 calc_checksum(struct page *page)
 {
 	u32 checksum;
 	void *addr = kmap_atomic(page);
-	checksum = jhash2(addr, PAGE_SIZE / 4, 17);
+	checksum = xxhash(addr, PAGE_SIZE, 0);
 	kunmap_atomic(addr);
 	return checksum;
 }
@@ -921,7 +949,7 @@ out:
  * replace_page - replace page in vma by new ksm page
  * @vma:      vma that holds the pte pointing to page
  * @page:     the page we are replacing by kpage
- * @kpage:    the ksm page we replace page by
+ * @kpage:    the ksm page we replace page by, or the zero page
  * @orig_pte: the original value of the pte
  *
  * Returns 0 on success, -EFAULT on failure.
@@ -932,6 +960,7 @@ static int replace_page(struct vm_area_struct *vma, struct page *page,
 	struct mm_struct *mm = vma->vm_mm;
 	pmd_t *pmd;
 	pte_t *ptep;
+	pte_t newpte;
 	spinlock_t *ptl;
 	unsigned long addr;
 	int err = -EFAULT;
@@ -956,12 +985,19 @@ static int replace_page(struct vm_area_struct *vma, struct page *page,
 		goto out_mn;
 	}
 
-	get_page(kpage);
-	page_add_anon_rmap(kpage, vma, addr);
+	if (!is_zero_pfn(page_to_pfn(kpage))) {
+		get_page(kpage);
+		page_add_anon_rmap(kpage, vma, addr);
+		newpte = mk_pte(kpage, vma->vm_page_prot);
+	} else {
+		newpte = pte_mkspecial(pfn_pte(page_to_pfn(kpage),
+					       vma->vm_page_prot));
+		dec_mm_counter(mm, MM_ANONPAGES);
+	}
 
 	flush_cache_page(vma, addr, pte_pfn(*ptep));
 	ptep_clear_flush_notify(vma, addr, ptep);
-	set_pte_at_notify(mm, addr, ptep, mk_pte(kpage, vma->vm_page_prot));
+	set_pte_at_notify(mm, addr, ptep, newpte);
 
 	page_remove_rmap(page);
 	if (!page_mapped(page))
@@ -969,6 +1005,7 @@ static int replace_page(struct vm_area_struct *vma, struct page *page,
 	put_page(page);
 
 	pte_unmap_unlock(ptep, ptl);
+	ksm_stat.pages_merged++;
 	err = 0;
 out_mn:
 	mmu_notifier_invalidate_range_end(mm, mmun_start, mmun_end);
@@ -1108,6 +1145,34 @@ out:
 	return err;
 }
 
+/*
+ * try_to_merge_with_zero_page - map the shared zero page in place of a page
+ * whose checksum says it is all zeroes.  There is no ksm page or stable
+ * node involved: a later write just faults in a new anonymous page.
+ *
+ * This function returns 0 if the page was merged, -EFAULT otherwise.
+ */
+static int try_to_merge_with_zero_page(struct rmap_item *rmap_item,
+				       struct page *page)
+{
+	struct mm_struct *mm = rmap_item->mm;
+	struct vm_area_struct *vma;
+	int err = -EFAULT;
+
+	down_read(&mm->mmap_sem);
+	vma = find_mergeable_vma(mm, rmap_item->address);
+	/* the zero page cannot be mlocked */
+	if (!vma || (vma->vm_flags & VM_LOCKED))
+		goto out;
+
+	err = try_to_merge_one_page(vma, page, ZERO_PAGE(rmap_item->address));
+	if (!err)
+		ksm_stat.zero_pages_merged++;
+out:
+	up_read(&mm->mmap_sem);
+	return err;
+}
+
 /*
  * try_to_merge_two_pages - take two identical pages and prepare them
  * to be merged into one page.
@@ -1471,6 +1536,15 @@ static void cmp_and_merge_page(struct page *page, struct rmap_item *rmap_item)
 		return;
 	}
 
+	/*
+	 * An empty page need not wait in the unstable tree for a twin:
+	 * map the zero page instead.  If the page was not empty after all,
+	 * pages_identical() caught it and we carry on as usual.
+	 */
+	if (ksm_use_zero_pages && checksum == zero_checksum &&
+	    !try_to_merge_with_zero_page(rmap_item, page))
+		return;
+
 	tree_rmap_item =
 		unstable_tree_search_insert(rmap_item, page, &tree_page);
 	if (tree_rmap_item) {
@@ -1702,9 +1776,61 @@ static void ksm_do_scan(unsigned int scan_npages)
 			return;
 		cmp_and_merge_page(page, rmap_item);
 		put_page(page);
+		ksm_stat.pages_scanned++;
 	}
 }
 
+/*
+ * Scale pages_to_scan with the merge yield of the last interval: double it
+ * while at least 1% of the scanned pages get merged, let it decay while
+ * nothing is merged.  The cost per page just measured bounds it so that
+ * scanning takes no more than max_cpu_percent of the time, sleeps included.
+ */
+static void ksm_auto_tune_scan(u64 scan_ns, unsigned long scanned,
+			       unsigned long merged)
+{
+	u64 pages = ksm_thread_pages_to_scan;
+	u64 page_ns, sleep_ns, max_pages;
+
+	page_ns = div_u64(scan_ns, scanned) ? : 1;
+	sleep_ns = (u64)ksm_thread_sleep_millisecs * NSEC_PER_MSEC;
+	max_pages = div64_u64(sleep_ns * ksm_max_cpu_percent,
+			      (100 - ksm_max_cpu_percent) * page_ns);
+	max_pages = clamp_t(u64, max_pages, KSM_AUTO_MIN_PAGES, UINT_MAX);
+
+	if (merged * 100 >= scanned)
+		pages *= 2;
+	else if (!merged)
+		pages -= pages / 4;
+
+	ksm_thread_pages_to_scan = clamp(pages, (u64)KSM_AUTO_MIN_PAGES,
+					 max_pages);
+}
+
+/*
+ * Called by ksmd after each batch: every KSM_TUNE_INTERVAL, update the
+ * merge rate and, in auto tuning mode, the number of pages to scan.
+ */
+static void ksm_tune(void)
+{
+	unsigned long scanned, merged, msecs;
+
+	if (time_before(jiffies, ksm_tune_jiffies + KSM_TUNE_INTERVAL))
+		return;
+
+	msecs = jiffies_to_msecs(jiffies - ksm_tune_jiffies);
+	scanned = ksm_stat.pages_scanned - ksm_tune_base.pages_scanned;
+	merged = ksm_stat.pages_merged - ksm_tune_base.pages_merged;
+	ksm_stat.merge_rate = merged * MSEC_PER_SEC / msecs;
+
+	if (ksm_auto_tune && scanned)
+		ksm_auto_tune_scan(ksm_stat.scan_ns - ksm_tune_base.scan_ns,
+				   scanned, merged);
+
+	ksm_tune_base = ksm_stat;
+	ksm_tune_jiffies = jiffies;
+}
+
 static int ksmd_should_run(void)
 {
 	return (ksm_run & KSM_RUN_MERGE) && !list_empty(&ksm_mm_head.mm_list);
@@ -1718,8 +1844,13 @@ static int ksm_scan_thread(void *nothing)
 	while (!kthread_should_stop()) {
 		mutex_lock(&ksm_thread_mutex);
 		wait_while_offlining();
-		if (ksmd_should_run())
+		if (ksmd_should_run()) {
+			u64 start = task_sched_runtime(current);
+
 			ksm_do_scan(ksm_thread_pages_to_scan);
+			ksm_stat.scan_ns += task_sched_runtime(current) - start;
+			ksm_tune();
+		}
 		mutex_unlock(&ksm_thread_mutex);
 
 		try_to_freeze();
@@ -2127,6 +2258,81 @@ static ssize_t pages_to_scan_store(struct kobject *kobj,
 }
 KSM_ATTR(pages_to_scan);
 
+static ssize_t auto_tune_show(struct kobject *kobj,
+			      struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_auto_tune);
+}
+
+static ssize_t auto_tune_store(struct kobject *kobj,
+			       struct kobj_attribute *attr,
+			       const char *buf, size_t count)
+{
+	int err;
+	unsigned long knob;
+
+	err = kstrtoul(buf, 10, &knob);
+	if (err)
+		return err;
+	if (knob > 1)
+		return -EINVAL;
+
+	ksm_auto_tune = knob;
+
+	return count;
+}
+KSM_ATTR(auto_tune);
+
+static ssize_t max_cpu_percent_show(struct kobject *kobj,
+				    struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_max_cpu_percent);
+}
+
+static ssize_t max_cpu_percent_store(struct kobject *kobj,
+				     struct kobj_attribute *attr,
+				     const char *buf, size_t count)
+{
+	int err;
+	unsigned long percent;
+
+	err = kstrtoul(buf, 10, &percent);
+	if (err)
+		return err;
+	if (!percent || percent > 99)
+		return -EINVAL;
+
+	ksm_max_cpu_percent = percent;
+
+	return count;
+}
+KSM_ATTR(max_cpu_percent);
+
+static ssize_t use_zero_pages_show(struct kobject *kobj,
+				   struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", ksm_use_zero_pages);
+}
+
+static ssize_t use_zero_pages_store(struct kobject *kobj,
+				    struct kobj_attribute *attr,
+				    const char *buf, size_t count)
+{
+	int err;
+	unsigned long knob;
+
+	err = kstrtoul(buf, 10, &knob);
+	if (err)
+		return err;
+	if (knob > 1)
+		return -EINVAL;
+
+	ksm_use_zero_pages = knob;
+
+	return count;
+}
+KSM_ATTR(use_zero_pages);
+
 static ssize_t run_show(struct kobject *kobj, struct kobj_attribute *attr,
 			char *buf)
 {
@@ -2278,6 +2484,29 @@ static ssize_t full_scans_show(struct kobject *kobj,
 }
 KSM_ATTR_RO(full_scans);
 
+static ssize_t zero_pages_merged_show(struct kobject *kobj,
+				      struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_stat.zero_pages_merged);
+}
+KSM_ATTR_RO(zero_pages_merged);
+
+static ssize_t pages_merged_per_sec_show(struct kobject *kobj,
+					 struct kobj_attribute *attr,
+					 char *buf)
+{
+	return sprintf(buf, "%lu\n", ksm_stat.merge_rate);
+}
+KSM_ATTR_RO(pages_merged_per_sec);
+
+static ssize_t cpu_time_ms_show(struct kobject *kobj,
+				struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%llu\n", div_u64(ksm_stat.scan_ns,
+					      NSEC_PER_MSEC));
+}
+KSM_ATTR_RO(cpu_time_ms);
+
 static struct attribute *ksm_attrs[] = {
 	&sleep_millisecs_attr.attr,
 	&pages_to_scan_attr.attr,
@@ -2287,6 +2516,12 @@ static struct attribute *ksm_attrs[] = {
 	&pages_unshared_attr.attr,
 	&pages_volatile_attr.attr,
 	&full_scans_attr.attr,
+	&auto_tune_attr.attr,
+	&max_cpu_percent_attr.attr,
+	&use_zero_pages_attr.attr,
+	&zero_pages_merged_attr.attr,
+	&pages_merged_per_sec_attr.attr,
+	&cpu_time_ms_attr.attr,
 #ifdef CONFIG_NUMA
 	&merge_across_nodes_attr.attr,
 #endif
@@ -2308,6 +2543,9 @@ static int __init ksm_init(void)
 	if (err)
 		goto out;
 
+	zero_checksum = calc_checksum(ZERO_PAGE(0));
+	ksm_tune_jiffies = jiffies;
+
 	ksm_thread = kthread_run(ksm_scan_thread, NULL, "ksmd");
 	if (IS_ERR(ksm_thread)) {
 		pr_err("ksm: creating kthread failed\n");
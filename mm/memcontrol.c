@@ -124,8 +124,21 @@ struct mem_cgroup_stat_cpu {
 	unsigned long events[MEMCG_NR_EVENTS];
 	unsigned long nr_page_events;
 	unsigned long targets[MEM_CGROUP_NTARGETS];
+	/* not yet folded into the hierarchical totals, see tree_stat() */
+	long count_delta[MEM_CGROUP_STAT_NSTATS];
+	unsigned long events_delta[MEMCG_NR_EVENTS];
 };
 
+/*
+ * Per-cpu stat and event changes are folded into the hierarchical totals
+ * of a memcg and all its ancestors once they grow beyond this.  A total
+ * can thus lag by up to MEMCG_STAT_BATCH * nr_cpus * (cgroups in the
+ * subtree): for root on a 256 cpu machine with 1000 cgroups, that is
+ * 16M pages or 64G in the worst case, although in practice deltas of
+ * both signs mostly cancel out.
+ */
+#define MEMCG_STAT_BATCH	64
+
 struct reclaim_iter {
 	struct mem_cgroup *position;
 	/* scan generation, increased every round-trip */
@@ -271,6 +284,9 @@ struct mem_cgroup {
 	unsigned long low;
 	unsigned long high;
 
+	/* reclaims the excess over high, see try_charge() */
+	struct work_struct high_work;
+
 	unsigned long soft_limit;
 
 	/* vmpressure notifications */
@@ -327,6 +343,14 @@ struct mem_cgroup {
 	 */
 	struct mem_cgroup_stat_cpu nocpu_base;
 	spinlock_t pcp_counter_lock;
+	/*
+	 * Stats and events of the whole subtree, fed in batches from the
+	 * percpu deltas.  Off by at most MEMCG_STAT_BATCH per cpu and
+	 * cgroup in the subtree.  Root's cover every cgroup, also those
+	 * below a use_hierarchy=0 parent.
+	 */
+	atomic_long_t tree_count[MEM_CGROUP_STAT_NSTATS];
+	atomic_long_t tree_events[MEMCG_NR_EVENTS];
 
 #if defined(CONFIG_MEMCG_KMEM) && defined(CONFIG_INET)
 	struct cg_proto tcp_mem;
@@ -818,6 +842,101 @@ static unsigned long mem_cgroup_read_events(struct mem_cgroup *memcg,
 	return val;
 }
 
+/*
+ * Fold a delta into the totals of @memcg and its ancestors.  With
+ * use_hierarchy=0 the parent chain ends before root, but root's totals
+ * (memory.usage_in_bytes, its thresholds, the total_* lines of
+ * memory.stat) have always covered the whole system, so they get every
+ * delta regardless.
+ */
+static void tree_count_add(struct mem_cgroup *memcg,
+			   enum mem_cgroup_stat_index idx, long val)
+{
+	struct mem_cgroup *mi;
+
+	for (mi = memcg; mi; mi = parent_mem_cgroup(mi)) {
+		atomic_long_add(val, &mi->tree_count[idx]);
+		if (mem_cgroup_is_root(mi))
+			return;
+	}
+	atomic_long_add(val, &root_mem_cgroup->tree_count[idx]);
+}
+
+static void tree_events_add(struct mem_cgroup *memcg,
+			    enum mem_cgroup_events_index idx, long val)
+{
+	struct mem_cgroup *mi;
+
+	for (mi = memcg; mi; mi = parent_mem_cgroup(mi)) {
+		atomic_long_add(val, &mi->tree_events[idx]);
+		if (mem_cgroup_is_root(mi))
+			return;
+	}
+	atomic_long_add(val, &root_mem_cgroup->tree_events[idx]);
+}
+
+/*
+ * Stat and event updates.  Each one is a percpu add to the counters of
+ * @memcg and to a percpu delta, which is only folded into the
+ * hierarchical totals of @memcg and its ancestors once it exceeds
+ * MEMCG_STAT_BATCH.  That keeps the update path lockless and the
+ * hierarchy walk off it, and makes subtree reads a single atomic read.
+ * Must be called with irqs disabled, stats are updated from irq context.
+ */
+static void __mem_cgroup_mod_stat(struct mem_cgroup *memcg,
+				  enum mem_cgroup_stat_index idx, long val)
+{
+	long x;
+
+	__this_cpu_add(memcg->stat->count[idx], val);
+
+	x = val + __this_cpu_read(memcg->stat->count_delta[idx]);
+	if (unlikely(abs(x) > MEMCG_STAT_BATCH)) {
+		tree_count_add(memcg, idx, x);
+		x = 0;
+	}
+	__this_cpu_write(memcg->stat->count_delta[idx], x);
+}
+
+static void __mem_cgroup_count_events(struct mem_cgroup *memcg,
+				      enum mem_cgroup_events_index idx,
+				      unsigned long nr)
+{
+	unsigned long x;
+
+	__this_cpu_add(memcg->stat->events[idx], nr);
+
+	x = nr + __this_cpu_read(memcg->stat->events_delta[idx]);
+	if (unlikely(x > MEMCG_STAT_BATCH)) {
+		tree_events_add(memcg, idx, x);
+		x = 0;
+	}
+	__this_cpu_write(memcg->stat->events_delta[idx], x);
+}
+
+/*
+ * Fold the deltas @cpu has left into the hierarchical totals, for a cpu
+ * that went away or a memcg that is being freed.
+ */
+static void mem_cgroup_flush_stat_deltas(struct mem_cgroup *memcg, int cpu)
+{
+	struct mem_cgroup_stat_cpu *stat = per_cpu_ptr(memcg->stat, cpu);
+	int i;
+
+	for (i = 0; i < MEM_CGROUP_STAT_NSTATS; i++) {
+		if (!stat->count_delta[i])
+			continue;
+		tree_count_add(memcg, i, stat->count_delta[i]);
+		stat->count_delta[i] = 0;
+	}
+	for (i = 0; i < MEMCG_NR_EVENTS; i++) {
+		if (!stat->events_delta[i])
+			continue;
+		tree_events_add(memcg, i, stat->events_delta[i]);
+		stat->events_delta[i] = 0;
+	}
+}
+
 static void mem_cgroup_charge_statistics(struct mem_cgroup *memcg,
 					 struct page *page,
 					 int nr_pages)
@@ -827,21 +946,19 @@ static void mem_cgroup_charge_statistics(struct mem_cgroup *memcg,
 	 * counted as CACHE even if it's on ANON LRU.
 	 */
 	if (PageAnon(page))
-		__this_cpu_add(memcg->stat->count[MEM_CGROUP_STAT_RSS],
-				nr_pages);
+		__mem_cgroup_mod_stat(memcg, MEM_CGROUP_STAT_RSS, nr_pages);
 	else
-		__this_cpu_add(memcg->stat->count[MEM_CGROUP_STAT_CACHE],
-				nr_pages);
+		__mem_cgroup_mod_stat(memcg, MEM_CGROUP_STAT_CACHE, nr_pages);
 
 	if (PageTransHuge(page))
-		__this_cpu_add(memcg->stat->count[MEM_CGROUP_STAT_RSS_HUGE],
-				nr_pages);
+		__mem_cgroup_mod_stat(memcg, MEM_CGROUP_STAT_RSS_HUGE,
+				      nr_pages);
 
 	/* pagein of a big page is an event. So, ignore page size */
 	if (nr_pages > 0)
-		__this_cpu_inc(memcg->stat->events[MEM_CGROUP_EVENTS_PGPGIN]);
+		__mem_cgroup_count_events(memcg, MEM_CGROUP_EVENTS_PGPGIN, 1);
 	else {
-		__this_cpu_inc(memcg->stat->events[MEM_CGROUP_EVENTS_PGPGOUT]);
+		__mem_cgroup_count_events(memcg, MEM_CGROUP_EVENTS_PGPGOUT, 1);
 		nr_pages = -nr_pages; /* for event */
 	}
 
@@ -1148,22 +1265,26 @@ void mem_cgroup_iter_break(struct mem_cgroup *root,
 void __mem_cgroup_count_vm_event(struct mm_struct *mm, enum vm_event_item idx)
 {
 	struct mem_cgroup *memcg;
+	unsigned long flags;
 
 	rcu_read_lock();
 	memcg = mem_cgroup_from_task(rcu_dereference(mm->owner));
 	if (unlikely(!memcg))
 		goto out;
 
+	local_irq_save(flags);
 	switch (idx) {
 	case PGFAULT:
-		this_cpu_inc(memcg->stat->events[MEM_CGROUP_EVENTS_PGFAULT]);
+		__mem_cgroup_count_events(memcg, MEM_CGROUP_EVENTS_PGFAULT, 1);
 		break;
 	case PGMAJFAULT:
-		this_cpu_inc(memcg->stat->events[MEM_CGROUP_EVENTS_PGMAJFAULT]);
+		__mem_cgroup_count_events(memcg, MEM_CGROUP_EVENTS_PGMAJFAULT,
+					  1);
 		break;
 	default:
 		BUG();
 	}
+	local_irq_restore(flags);
 out:
 	rcu_read_unlock();
 }
@@ -2032,10 +2153,15 @@ void mem_cgroup_end_page_stat(struct mem_cgroup *memcg)
 void mem_cgroup_update_page_stat(struct mem_cgroup *memcg,
 				 enum mem_cgroup_stat_index idx, int val)
 {
+	unsigned long flags;
+
 	VM_BUG_ON(!rcu_read_lock_held());
 
-	if (memcg)
-		this_cpu_add(memcg->stat->count[idx], val);
+	if (memcg) {
+		local_irq_save(flags);
+		__mem_cgroup_mod_stat(memcg, idx, val);
+		local_irq_restore(flags);
+	}
 }
 
 /*
@@ -2043,9 +2169,17 @@ void mem_cgroup_update_page_stat(struct mem_cgroup *memcg,
  * TODO: maybe necessary to use big numbers in big irons.
  */
 #define CHARGE_BATCH	32U
+
+/*
+ * Number of memcgs a cpu keeps stock for.  Tasks of a handful of cgroups
+ * sharing a cpu would otherwise keep draining each other's stock.
+ */
+#define MEMCG_STOCK_SLOTS	4
+
 struct memcg_stock_pcp {
-	struct mem_cgroup *cached; /* this never be root cgroup */
-	unsigned int nr_pages;
+	struct mem_cgroup *cached[MEMCG_STOCK_SLOTS]; /* never root cgroup */
+	unsigned int nr_pages[MEMCG_STOCK_SLOTS];
+	unsigned int next;	/* slot to evict next */
 	struct work_struct work;
 	unsigned long flags;
 #define FLUSHING_CACHED_CHARGE	0
@@ -2058,9 +2192,9 @@ static DEFINE_MUTEX(percpu_charge_mutex);
  * @memcg: memcg to consume from.
  * @nr_pages: how many pages to charge.
  *
- * The charges will only happen if @memcg matches the current cpu's memcg
- * stock, and at least @nr_pages are available in that stock.  Failure to
- * service an allocation will refill the stock.
+ * The charges will only happen if @memcg is among the current cpu's
+ * memcg stocks, and at least @nr_pages are available in its stock.
+ * Failure to service an allocation will refill the stock.
  *
  * returns true if successful, false otherwise.
  */
@@ -2068,34 +2202,51 @@ static bool consume_stock(struct mem_cgroup *memcg, unsigned int nr_pages)
 {
 	struct memcg_stock_pcp *stock;
 	bool ret = false;
+	int i;
 
 	if (nr_pages > CHARGE_BATCH)
 		return ret;
 
 	stock = &get_cpu_var(memcg_stock);
-	if (memcg == stock->cached && stock->nr_pages >= nr_pages) {
-		stock->nr_pages -= nr_pages;
-		ret = true;
+	for (i = 0; i < MEMCG_STOCK_SLOTS; i++) {
+		if (memcg == stock->cached[i]) {
+			if (stock->nr_pages[i] >= nr_pages) {
+				stock->nr_pages[i] -= nr_pages;
+				ret = true;
+			}
+			break;
+		}
 	}
 	put_cpu_var(memcg_stock);
 	return ret;
 }
 
 /*
- * Returns stocks cached in percpu and reset cached information.
+ * Returns the charges of one stock slot and resets it.
  */
-static void drain_stock(struct memcg_stock_pcp *stock)
+static void drain_stock_slot(struct memcg_stock_pcp *stock, int i)
 {
-	struct mem_cgroup *old = stock->cached;
+	struct mem_cgroup *old = stock->cached[i];
 
-	if (stock->nr_pages) {
-		page_counter_uncharge(&old->memory, stock->nr_pages);
+	if (stock->nr_pages[i]) {
+		page_counter_uncharge(&old->memory, stock->nr_pages[i]);
 		if (do_swap_account)
-			page_counter_uncharge(&old->memsw, stock->nr_pages);
-		css_put_many(&old->css, stock->nr_pages);
-		stock->nr_pages = 0;
+			page_counter_uncharge(&old->memsw, stock->nr_pages[i]);
+		css_put_many(&old->css, stock->nr_pages[i]);
+		stock->nr_pages[i] = 0;
 	}
-	stock->cached = NULL;
+	stock->cached[i] = NULL;
+}
+
+/*
+ * Returns stocks cached in percpu and reset cached information.
+ */
+static void drain_stock(struct memcg_stock_pcp *stock)
+{
+	int i;
+
+	for (i = 0; i < MEMCG_STOCK_SLOTS; i++)
+		drain_stock_slot(stock, i);
 }
 
 /*
@@ -2111,17 +2262,30 @@ static void drain_local_stock(struct work_struct *dummy)
 
 /*
  * Cache charges(val) to local per_cpu area.
- * This will be consumed by consume_stock() function, later.
+ * This will be consumed by consume_stock() function, later.  @memcg
+ * takes over a free slot, or evicts the stock of another memcg in
+ * round-robin order if there is none.
  */
 static void refill_stock(struct mem_cgroup *memcg, unsigned int nr_pages)
 {
 	struct memcg_stock_pcp *stock = &get_cpu_var(memcg_stock);
+	int i, slot = -1;
 
-	if (stock->cached != memcg) { /* reset if necessary */
-		drain_stock(stock);
-		stock->cached = memcg;
+	for (i = 0; i < MEMCG_STOCK_SLOTS; i++) {
+		if (stock->cached[i] == memcg) {
+			slot = i;
+			break;
+		}
+		if (!stock->cached[i] && slot < 0)
+			slot = i;
+	}
+	if (slot < 0) { /* reset if necessary */
+		slot = stock->next;
+		stock->next = (slot + 1) % MEMCG_STOCK_SLOTS;
+		drain_stock_slot(stock, slot);
 	}
-	stock->nr_pages += nr_pages;
+	stock->cached[slot] = memcg;
+	stock->nr_pages[slot] += nr_pages;
 	put_cpu_var(memcg_stock);
 }
 
@@ -2141,12 +2305,19 @@ static void drain_all_stock(struct mem_cgroup *root_memcg)
 	curcpu = get_cpu();
 	for_each_online_cpu(cpu) {
 		struct memcg_stock_pcp *stock = &per_cpu(memcg_stock, cpu);
-		struct mem_cgroup *memcg;
+		bool flush = false;
+		int i;
 
-		memcg = stock->cached;
-		if (!memcg || !stock->nr_pages)
-			continue;
-		if (!mem_cgroup_is_descendant(memcg, root_memcg))
+		for (i = 0; i < MEMCG_STOCK_SLOTS; i++) {
+			struct mem_cgroup *memcg = stock->cached[i];
+
+			if (memcg && stock->nr_pages[i] &&
+			    mem_cgroup_is_descendant(memcg, root_memcg)) {
+				flush = true;
+				break;
+			}
+		}
+		if (!flush)
 			continue;
 		if (!test_and_set_bit(FLUSHING_CACHED_CHARGE, &stock->flags)) {
 			if (cpu == curcpu)
@@ -2198,14 +2369,44 @@ static int memcg_cpu_hotplug_callback(struct notifier_block *nb,
 	if (action != CPU_DEAD && action != CPU_DEAD_FROZEN)
 		return NOTIFY_OK;
 
-	for_each_mem_cgroup(iter)
+	for_each_mem_cgroup(iter) {
 		mem_cgroup_drain_pcp_counter(iter, cpu);
+		mem_cgroup_flush_stat_deltas(iter, cpu);
+	}
 
 	stock = &per_cpu(memcg_stock, cpu);
 	drain_stock(stock);
 	return NOTIFY_OK;
 }
 
+/*
+ * How far usage may run ahead of memory.high before the charging tasks
+ * help out the background reclaim, in pages.
+ */
+#define MEMCG_HIGH_SLACK	(CHARGE_BATCH * 32)
+
+/*
+ * Background reclaim of the excess over memory.high of a memcg and of
+ * those of its ancestors that are over their own high boundary.
+ */
+static void high_work_func(struct work_struct *work)
+{
+	struct mem_cgroup *memcg;
+
+	memcg = container_of(work, struct mem_cgroup, high_work);
+	do {
+		unsigned long usage = page_counter_read(&memcg->memory);
+		unsigned long high = ACCESS_ONCE(memcg->high);
+
+		if (usage <= high)
+			continue;
+		try_to_free_mem_cgroup_pages(memcg,
+					     max(usage - high,
+						 (unsigned long)CHARGE_BATCH),
+					     GFP_KERNEL, true);
+	} while ((memcg = parent_mem_cgroup(memcg)));
+}
+
 static int try_charge(struct mem_cgroup *memcg, gfp_t gfp_mask,
 		      unsigned int nr_pages)
 {
@@ -2315,14 +2516,23 @@ done_restock:
 	if (batch > nr_pages)
 		refill_stock(memcg, batch - nr_pages);
 	/*
-	 * If the hierarchy is above the normal consumption range,
-	 * make the charging task trim their excess contribution.
+	 * If the hierarchy is above the normal consumption range, have
+	 * the excess reclaimed in the background rather than in the
+	 * charge path, which often runs with locks held.  Only when the
+	 * background reclaim falls behind by more than MEMCG_HIGH_SLACK
+	 * is the charging task throttled with synchronous reclaim.
 	 */
 	do {
-		if (page_counter_read(&memcg->memory) <= memcg->high)
+		unsigned long usage = page_counter_read(&memcg->memory);
+		unsigned long high = ACCESS_ONCE(memcg->high);
+
+		if (usage <= high)
 			continue;
 		mem_cgroup_events(memcg, MEMCG_HIGH, 1);
-		try_to_free_mem_cgroup_pages(memcg, nr_pages, gfp_mask, true);
+		schedule_work(&memcg->high_work);
+		if (usage - high > MEMCG_HIGH_SLACK && (gfp_mask & __GFP_WAIT))
+			try_to_free_mem_cgroup_pages(memcg, nr_pages,
+						     gfp_mask, true);
 	} while ((memcg = parent_mem_cgroup(memcg)));
 done:
 	return ret;
@@ -2774,8 +2984,8 @@ void mem_cgroup_split_huge_fixup(struct page *head)
 	for (i = 1; i < HPAGE_PMD_NR; i++)
 		head[i].mem_cgroup = head->mem_cgroup;
 
-	__this_cpu_sub(head->mem_cgroup->stat->count[MEM_CGROUP_STAT_RSS_HUGE],
-		       HPAGE_PMD_NR);
+	__mem_cgroup_mod_stat(head->mem_cgroup, MEM_CGROUP_STAT_RSS_HUGE,
+			      -HPAGE_PMD_NR);
 }
 #endif /* CONFIG_TRANSPARENT_HUGEPAGE */
 
@@ -2828,17 +3038,17 @@ static int mem_cgroup_move_account(struct page *page,
 	spin_lock_irqsave(&from->move_lock, flags);
 
 	if (!PageAnon(page) && page_mapped(page)) {
-		__this_cpu_sub(from->stat->count[MEM_CGROUP_STAT_FILE_MAPPED],
-			       nr_pages);
-		__this_cpu_add(to->stat->count[MEM_CGROUP_STAT_FILE_MAPPED],
-			       nr_pages);
+		__mem_cgroup_mod_stat(from, MEM_CGROUP_STAT_FILE_MAPPED,
+				      -nr_pages);
+		__mem_cgroup_mod_stat(to, MEM_CGROUP_STAT_FILE_MAPPED,
+				      nr_pages);
 	}
 
 	if (PageWriteback(page)) {
-		__this_cpu_sub(from->stat->count[MEM_CGROUP_STAT_WRITEBACK],
-			       nr_pages);
-		__this_cpu_add(to->stat->count[MEM_CGROUP_STAT_WRITEBACK],
-			       nr_pages);
+		__mem_cgroup_mod_stat(from, MEM_CGROUP_STAT_WRITEBACK,
+				      -nr_pages);
+		__mem_cgroup_mod_stat(to, MEM_CGROUP_STAT_WRITEBACK,
+				      nr_pages);
 	}
 
 	/*
@@ -2870,7 +3080,11 @@ static void mem_cgroup_swap_statistics(struct mem_cgroup *memcg,
 					 bool charge)
 {
 	int val = (charge) ? 1 : -1;
-	this_cpu_add(memcg->stat->count[MEM_CGROUP_STAT_SWAP], val);
+	unsigned long flags;
+
+	local_irq_save(flags);
+	__mem_cgroup_mod_stat(memcg, MEM_CGROUP_STAT_SWAP, val);
+	local_irq_restore(flags);
 }
 
 /**
@@ -3200,21 +3414,29 @@ out:
 	return retval;
 }
 
+/*
+ * Subtree stats and events.  These don't walk the subtree and all cpus
+ * but may lag behind by up to MEMCG_STAT_BATCH per cpu and cgroup in the
+ * subtree, see MEMCG_STAT_BATCH.  Root's include every cgroup, as the
+ * for_each_mem_cgroup_tree() walk did, regardless of use_hierarchy.
+ */
 static unsigned long tree_stat(struct mem_cgroup *memcg,
 			       enum mem_cgroup_stat_index idx)
 {
-	struct mem_cgroup *iter;
-	long val = 0;
+	long val = atomic_long_read(&memcg->tree_count[idx]);
 
-	/* Per-cpu values can be negative, use a signed accumulator */
-	for_each_mem_cgroup_tree(iter, memcg)
-		val += mem_cgroup_read_stat(iter, idx);
-
-	if (val < 0) /* race ? */
+	/* unfolded negative deltas elsewhere can make it go negative */
+	if (val < 0)
 		val = 0;
 	return val;
 }
 
+static unsigned long tree_events(struct mem_cgroup *memcg,
+				 enum mem_cgroup_events_index idx)
+{
+	return atomic_long_read(&memcg->tree_events[idx]);
+}
+
 static inline u64 mem_cgroup_usage(struct mem_cgroup *memcg, bool swap)
 {
 	u64 val;
@@ -3579,23 +3801,15 @@ static int memcg_stat_show(struct seq_file *m, void *v)
 			   (u64)memsw * PAGE_SIZE);
 
 	for (i = 0; i < MEM_CGROUP_STAT_NSTATS; i++) {
-		long long val = 0;
-
 		if (i == MEM_CGROUP_STAT_SWAP && !do_swap_account)
 			continue;
-		for_each_mem_cgroup_tree(mi, memcg)
-			val += mem_cgroup_read_stat(mi, i) * PAGE_SIZE;
-		seq_printf(m, "total_%s %lld\n", mem_cgroup_stat_names[i], val);
+		seq_printf(m, "total_%s %llu\n", mem_cgroup_stat_names[i],
+			   (u64)tree_stat(memcg, i) * PAGE_SIZE);
 	}
 
-	for (i = 0; i < MEM_CGROUP_EVENTS_NSTATS; i++) {
-		unsigned long long val = 0;
-
-		for_each_mem_cgroup_tree(mi, memcg)
-			val += mem_cgroup_read_events(mi, i);
-		seq_printf(m, "total_%s %llu\n",
-			   mem_cgroup_events_names[i], val);
-	}
+	for (i = 0; i < MEM_CGROUP_EVENTS_NSTATS; i++)
+		seq_printf(m, "total_%s %lu\n",
+			   mem_cgroup_events_names[i], tree_events(memcg, i));
 
 	for (i = 0; i < NR_LRU_LISTS; i++) {
 		unsigned long long val = 0;
@@ -4469,6 +4683,7 @@ static struct mem_cgroup *mem_cgroup_alloc(void)
 	if (!memcg->stat)
 		goto out_free;
 	spin_lock_init(&memcg->pcp_counter_lock);
+	INIT_WORK(&memcg->high_work, high_work_func);
 	return memcg;
 
 out_free:
@@ -4489,10 +4704,15 @@ out_free:
 
 static void __mem_cgroup_free(struct mem_cgroup *memcg)
 {
-	int node;
+	int node, cpu;
 
+	cancel_work_sync(&memcg->high_work);
 	mem_cgroup_remove_from_trees(memcg);
 
+	/* what is left of our stats has to go from the ancestors' totals */
+	for_each_possible_cpu(cpu)
+		mem_cgroup_flush_stat_deltas(memcg, cpu);
+
 	for_each_node(node)
 		free_mem_cgroup_per_zone_info(memcg, node);
 
@@ -5401,7 +5621,11 @@ void mem_cgroup_events(struct mem_cgroup *memcg,
 		       enum mem_cgroup_events_index idx,
 		       unsigned int nr)
 {
-	this_cpu_add(memcg->stat->events[idx], nr);
+	unsigned long flags;
+
+	local_irq_save(flags);
+	__mem_cgroup_count_events(memcg, idx, nr);
+	local_irq_restore(flags);
 }
 
 /**
@@ -5604,10 +5828,10 @@ static void uncharge_batch(struct mem_cgroup *memcg, unsigned long pgpgout,
 	}
 
 	local_irq_save(flags);
-	__this_cpu_sub(memcg->stat->count[MEM_CGROUP_STAT_RSS], nr_anon);
-	__this_cpu_sub(memcg->stat->count[MEM_CGROUP_STAT_CACHE], nr_file);
-	__this_cpu_sub(memcg->stat->count[MEM_CGROUP_STAT_RSS_HUGE], nr_huge);
-	__this_cpu_add(memcg->stat->events[MEM_CGROUP_EVENTS_PGPGOUT], pgpgout);
+	__mem_cgroup_mod_stat(memcg, MEM_CGROUP_STAT_RSS, -nr_anon);
+	__mem_cgroup_mod_stat(memcg, MEM_CGROUP_STAT_CACHE, -nr_file);
+	__mem_cgroup_mod_stat(memcg, MEM_CGROUP_STAT_RSS_HUGE, -nr_huge);
+	__mem_cgroup_count_events(memcg, MEM_CGROUP_EVENTS_PGPGOUT, pgpgout);
 	__this_cpu_add(memcg->stat->nr_page_events, nr_pages);
 	memcg_check_events(memcg, dummy_page);
 	local_irq_restore(flags);
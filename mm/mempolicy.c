@@ -2058,6 +2058,56 @@ retry_cpuset:
 }
 EXPORT_SYMBOL(alloc_pages_current);
 
+/**
+ * 	alloc_pages_bulk_current - Allocate a batch of order-0 pages.
+ *
+ *	@gfp: GFP flags, as for alloc_pages_current()
+ *	@nr_pages: number of entries of @page_array to populate
+ *	@page_array: array to store the pages in; NULL entries are filled
+ *
+ *	Like alloc_pages_current() for each NULL entry of @page_array, but
+ *	takes the pages from the per-cpu lists in one go where the policy
+ *	allows it.  Interleaved pages are still allocated one by one.
+ *
+ *	Returns the number of leading entries of @page_array that hold a
+ *	page, which is @nr_pages unless the allocation failed.
+ */
+unsigned long alloc_pages_bulk_current(gfp_t gfp, unsigned long nr_pages,
+				       struct page **page_array)
+{
+	struct mempolicy *pol = &default_policy;
+	unsigned int cpuset_mems_cookie;
+	unsigned long nr;
+
+	if (!in_interrupt() && !(gfp & __GFP_THISNODE))
+		pol = get_task_policy(current);
+
+	if (pol->mode == MPOL_INTERLEAVE) {
+		for (nr = 0; nr < nr_pages; nr++) {
+			if (page_array[nr])
+				continue;
+			page_array[nr] = alloc_pages_current(gfp, 0);
+			if (!page_array[nr])
+				break;
+		}
+		return nr;
+	}
+
+retry_cpuset:
+	cpuset_mems_cookie = read_mems_allowed_begin();
+
+	nr = __alloc_pages_bulk_nodemask(gfp,
+			policy_zonelist(gfp, pol, numa_node_id()),
+			policy_nodemask(gfp, pol), nr_pages, page_array);
+
+	if (unlikely(nr < nr_pages &&
+		     read_mems_allowed_retry(cpuset_mems_cookie)))
+		goto retry_cpuset;
+
+	return nr;
+}
+EXPORT_SYMBOL(alloc_pages_bulk_current);
+
 int vma_dup_policy(struct vm_area_struct *src, struct vm_area_struct *dst)
 {
 	struct mempolicy *pol = mpol_dup(vma_policy(src));
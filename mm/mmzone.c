@@ -93,6 +93,18 @@ void lruvec_init(struct lruvec *lruvec)
 
 	for_each_lru(lru)
 		INIT_LIST_HEAD(&lruvec->lists[lru]);
+
+#ifdef CONFIG_LRU_GEN
+	{
+		int gen, type;
+
+		for (type = 0; type < 2; type++) {
+			lruvec->lrugen.max_seq[type] = MIN_NR_GENS;
+			for (gen = 0; gen < MAX_NR_GENS; gen++)
+				INIT_LIST_HEAD(&lruvec->lrugen.lists[gen][type]);
+		}
+	}
+#endif
 }
 
 #if defined(CONFIG_NUMA_BALANCING) && !defined(LAST_CPUPID_NOT_IN_PAGE_FLAGS)
@@ -666,6 +666,10 @@ static inline int free_pages_check(struct page *page)
 		bad_reason = "PAGE_FLAGS_CHECK_AT_FREE flag(s) set";
 		bad_flags = PAGE_FLAGS_CHECK_AT_FREE;
 	}
+	if (unlikely(page->flags & LRU_GEN_MASK)) {
+		bad_reason = "page still on a generation list";
+		bad_flags = LRU_GEN_MASK;
+	}
 #ifdef CONFIG_MEMCG
 	if (unlikely(page->mem_cgroup))
 		bad_reason = "page still charged to cgroup";
@@ -1704,7 +1708,7 @@ struct page *buffered_rmqueue(struct zone *preferred_zone,
 		set_bit(ZONE_FAIR_DEPLETED, &zone->flags);
 
 	__count_zone_vm_events(PGALLOC, zone, 1 << order);
-	zone_statistics(preferred_zone, zone, gfp_flags);
+	zone_statistics(preferred_zone, zone, gfp_flags, 1);
 	local_irq_restore(flags);
 
 	VM_BUG_ON_PAGE(bad_range(zone, page), page);
@@ -2870,6 +2874,161 @@ out:
 }
 EXPORT_SYMBOL(__alloc_pages_nodemask);
 
+/**
+ * __alloc_pages_bulk_nodemask - allocate a batch of order-0 pages
+ * @gfp_mask: GFP flags for the allocation
+ * @zonelist: zonelist to allocate from
+ * @nodemask: nodes allowed, or NULL for all
+ * @nr_pages: number of entries of @page_array to populate
+ * @page_array: array to store the pages in; only NULL entries are filled
+ *
+ * Takes the pages straight off the per-cpu list of the first local zone
+ * that has room for the whole batch above its low watermark, disabling
+ * interrupts once for all of them and refilling the list from the buddy
+ * lists in pcp->batch units whenever it runs dry.  Whatever cannot be had
+ * that way is allocated one page at a time by __alloc_pages_nodemask(),
+ * which may enter reclaim if @gfp_mask allows it.
+ *
+ * Returns the number of leading entries of @page_array that hold a page,
+ * which is @nr_pages unless the allocation failed.
+ */
+unsigned long
+__alloc_pages_bulk_nodemask(gfp_t gfp_mask, struct zonelist *zonelist,
+			    nodemask_t *nodemask, unsigned long nr_pages,
+			    struct page **page_array)
+{
+	struct zoneref *preferred_zoneref, *z;
+	struct per_cpu_pages *pcp;
+	struct list_head *list;
+	struct page *page, *next;
+	struct zone *zone;
+	unsigned long flags, i;
+	unsigned long nr_want = 0, nr_taken = 0;
+	int alloc_flags = ALLOC_WMARK_LOW|ALLOC_CPUSET;
+	bool cold = ((gfp_mask & __GFP_COLD) != 0);
+	LIST_HEAD(pages);
+	struct alloc_context ac = {
+		.high_zoneidx = gfp_zone(gfp_mask),
+		.nodemask = nodemask,
+		.migratetype = gfpflags_to_migratetype(gfp_mask),
+		.zonelist = zonelist,
+	};
+
+	for (i = 0; i < nr_pages; i++)
+		if (!page_array[i])
+			nr_want++;
+
+	/*
+	 * Single pages gain nothing from batching, and fault injection and
+	 * kmemcheck want to see every page go through the usual path.
+	 */
+	if (nr_want <= 1 || IS_ENABLED(CONFIG_FAIL_PAGE_ALLOC) ||
+	    kmemcheck_enabled)
+		goto fallback;
+
+	gfp_mask &= gfp_allowed_mask;
+
+	lockdep_trace_alloc(gfp_mask);
+
+	might_sleep_if(gfp_mask & __GFP_WAIT);
+
+	if (IS_ENABLED(CONFIG_CMA) && ac.migratetype == MIGRATE_MOVABLE)
+		alloc_flags |= ALLOC_CMA;
+
+	preferred_zoneref = first_zones_zonelist(ac.zonelist, ac.high_zoneidx,
+				ac.nodemask ? : &cpuset_current_mems_allowed,
+				&ac.preferred_zone);
+	if (!ac.preferred_zone)
+		goto fallback;
+	ac.classzone_idx = zonelist_zone_idx(preferred_zoneref);
+
+	/*
+	 * Only local zones with fair allocation batch left are tried, like
+	 * in the first pass of get_page_from_freelist(); remote zones, dirty
+	 * limits on other zones and reclaim are left to the slow path.
+	 */
+	for_each_zone_zonelist_nodemask(zone, z, ac.zonelist, ac.high_zoneidx,
+								ac.nodemask) {
+		unsigned long mark;
+
+		if (!zone_local(ac.preferred_zone, zone))
+			break;
+		if (cpusets_enabled() &&
+		    !cpuset_zone_allowed(zone, gfp_mask|__GFP_HARDWALL))
+			continue;
+		if (test_bit(ZONE_FAIR_DEPLETED, &zone->flags))
+			continue;
+		if ((gfp_mask & __GFP_WRITE) && !zone_dirty_ok(zone))
+			continue;
+
+		mark = low_wmark_pages(zone) + nr_want;
+		if (zone_watermark_ok(zone, 0, mark, ac.classzone_idx,
+				      alloc_flags))
+			goto try_this_zone;
+	}
+	goto fallback;
+
+try_this_zone:
+	local_irq_save(flags);
+	pcp = &this_cpu_ptr(zone->pageset)->pcp;
+	list = &pcp->lists[ac.migratetype];
+	while (nr_taken < nr_want) {
+		if (list_empty(list)) {
+			pcp->count += rmqueue_bulk(zone, 0,
+					pcp->batch, list,
+					ac.migratetype, cold);
+			if (unlikely(list_empty(list)))
+				break;
+		}
+
+		if (cold)
+			page = list_entry(list->prev, struct page, lru);
+		else
+			page = list_entry(list->next, struct page, lru);
+
+		list_move_tail(&page->lru, &pages);
+		pcp->count--;
+		nr_taken++;
+	}
+
+	if (nr_taken) {
+		__mod_zone_page_state(zone, NR_ALLOC_BATCH, -nr_taken);
+		if (atomic_long_read(&zone->vm_stat[NR_ALLOC_BATCH]) <= 0 &&
+		    !test_bit(ZONE_FAIR_DEPLETED, &zone->flags))
+			set_bit(ZONE_FAIR_DEPLETED, &zone->flags);
+
+		__count_zone_vm_events(PGALLOC, zone, nr_taken);
+		zone_statistics(ac.preferred_zone, zone, gfp_mask, nr_taken);
+	}
+	local_irq_restore(flags);
+
+	/* Zeroing and debug checks are done with interrupts enabled */
+	i = 0;
+	list_for_each_entry_safe(page, next, &pages, lru) {
+		list_del(&page->lru);
+		VM_BUG_ON_PAGE(bad_range(zone, page), page);
+		if (prep_new_page(page, 0, gfp_mask, alloc_flags))
+			continue;
+		trace_mm_page_alloc(page, 0, gfp_mask, ac.migratetype);
+
+		while (page_array[i])
+			i++;
+		page_array[i] = page;
+	}
+
+fallback:
+	for (i = 0; i < nr_pages; i++) {
+		if (page_array[i])
+			continue;
+		page_array[i] = __alloc_pages_nodemask(gfp_mask, 0, zonelist,
+						       nodemask);
+		if (!page_array[i])
+			break;
+	}
+	return i;
+}
+EXPORT_SYMBOL(__alloc_pages_bulk_nodemask);
+
 /*
  * Common helper functions.
  */
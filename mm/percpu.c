@@ -35,14 +35,21 @@
  * area in the chunk.  This helps the allocator not to iterate the
  * chunk maps unnecessarily.
  *
- * Allocation state in each chunk is kept using an array of integers
- * on chunk->map.  A positive value in the map represents a free
- * region and negative allocated.  Allocation inside a chunk is done
- * by scanning this map sequentially and serving the first matching
- * entry.  This is mostly copied from the percpu_modalloc() allocator.
- * Chunks can be determined from the address using the index field
+ * Allocation state in each chunk is kept in a bitmap, chunk->alloc_map,
+ * with one bit per PCPU_MIN_ALLOC_SIZE bytes, and the start of each
+ * allocated area is marked in a second bitmap, chunk->bound_map.  The
+ * bitmap is cut into page sized blocks, and each block keeps hints
+ * about its free space: the largest free area in it and the free areas
+ * at either end.  Allocation walks the block hints to find the first
+ * block the area fits in and only scans the bitmap there, so finding
+ * free space costs the same however fragmented the rest of the chunk
+ * is.  Chunks can be determined from the address using the index field
  * in the page struct. The index field contains a pointer to the chunk.
  *
+ * Small areas are freed to and allocated from a per-cpu cache of areas
+ * of the same size first, which skips pcpu_lock altogether for the
+ * common alloc_percpu(int)/free_percpu() churn.
+ *
  * To use this allocator, arch code should do the followings.
  *
  * - define __addr_to_pcpu_ptr() and __pcpu_ptr_to_addr() to translate
@@ -55,6 +62,7 @@
 
 #include <linux/bitmap.h>
 #include <linux/bootmem.h>
+#include <linux/cpu.h>
 #include <linux/err.h>
 #include <linux/list.h>
 #include <linux/log2.h>
@@ -75,12 +83,19 @@
 #include <asm/io.h>
 
 #define PCPU_SLOT_BASE_SHIFT		5	/* 1-31 shares the same slot */
-#define PCPU_DFL_MAP_ALLOC		16	/* start a map with 16 ents */
-#define PCPU_ATOMIC_MAP_MARGIN_LOW	32
-#define PCPU_ATOMIC_MAP_MARGIN_HIGH	64
 #define PCPU_EMPTY_POP_PAGES_LOW	2
 #define PCPU_EMPTY_POP_PAGES_HIGH	4
 
+/* allocation map granularity, and one block of hints per page */
+#define PCPU_MIN_ALLOC_SHIFT		2
+#define PCPU_MIN_ALLOC_SIZE		(1 << PCPU_MIN_ALLOC_SHIFT)
+#define PCPU_BITMAP_BLOCK_BITS		(PAGE_SIZE >> PCPU_MIN_ALLOC_SHIFT)
+
+/* per-cpu cache of freed areas, one stack per size up to the max */
+#define PCPU_CACHE_MAX_SIZE		32
+#define PCPU_CACHE_NR_CLASSES		(PCPU_CACHE_MAX_SIZE / PCPU_MIN_ALLOC_SIZE)
+#define PCPU_CACHE_DEPTH		8
+
 #ifdef CONFIG_SMP
 /* default addr <-> pcpu_ptr mapping, override in asm/percpu.h if necessary */
 #ifndef __addr_to_pcpu_ptr
@@ -101,19 +116,27 @@
 #define __pcpu_ptr_to_addr(ptr)		(void __force *)(ptr)
 #endif	/* CONFIG_SMP */
 
+struct pcpu_block_md {
+	int			contig_hint;	/* max free area in the block */
+	int			contig_hint_start; /* block offset of it */
+	int			left_free;	/* free size at block start */
+	int			right_free;	/* free size at block end */
+	int			first_free;	/* block offset of first free */
+};
+
 struct pcpu_chunk {
 	struct list_head	list;		/* linked to pcpu_slot lists */
-	int			free_size;	/* free bytes in the chunk */
-	int			contig_hint;	/* max contiguous size hint */
+	int			free_bytes;	/* free bytes in the chunk */
+	int			contig_bits;	/* max free area, in map bits */
+	int			contig_bits_start; /* map offset of it */
 	void			*base_addr;	/* base address of this chunk */
 
-	int			map_used;	/* # of map entries used before the sentry */
-	int			map_alloc;	/* # of map entries allocated */
-	int			*map;		/* allocation map */
-	struct work_struct	map_extend_work;/* async ->map[] extension */
+	unsigned long		*alloc_map;	/* allocation map */
+	unsigned long		*bound_map;	/* start of each area */
+	struct pcpu_block_md	*md_blocks;	/* hints, one per page */
 
 	void			*data;		/* chunk data */
-	int			first_free;	/* no free below this */
+	int			first_bit;	/* no free bit below this */
 	bool			immutable;	/* no [de]population allowed */
 	int			nr_populated;	/* # of populated pages */
 	unsigned long		populated[];	/* populated bitmap */
@@ -181,6 +204,20 @@ static DECLARE_WORK(pcpu_balance_work, pcpu_balance_workfn);
 static bool pcpu_async_enabled __read_mostly;
 static bool pcpu_atomic_alloc_failed;
 
+/*
+ * Areas of up to PCPU_CACHE_MAX_SIZE bytes are freed to a per-cpu cache
+ * and allocations of the same size are served from it, without taking
+ * pcpu_lock.  Cached areas stay allocated in their chunk.  The caches
+ * are drained before a new chunk is created and when a cpu goes away.
+ * Protected by disabling irqs.
+ */
+struct pcpu_area_cache {
+	int			nr[PCPU_CACHE_NR_CLASSES];
+	void __percpu		*areas[PCPU_CACHE_NR_CLASSES][PCPU_CACHE_DEPTH];
+};
+
+static DEFINE_PER_CPU(struct pcpu_area_cache, pcpu_area_cache);
+
 static void pcpu_schedule_balance_work(void)
 {
 	if (pcpu_async_enabled)
@@ -217,10 +254,10 @@ static int pcpu_size_to_slot(int size)
 
 static int pcpu_chunk_slot(const struct pcpu_chunk *chunk)
 {
-	if (chunk->free_size < sizeof(int) || chunk->contig_hint < sizeof(int))
+	if (chunk->free_bytes < PCPU_MIN_ALLOC_SIZE || !chunk->contig_bits)
 		return 0;
 
-	return pcpu_size_to_slot(chunk->free_size);
+	return pcpu_size_to_slot(chunk->free_bytes);
 }
 
 /* set the pointer to a chunk in a page struct */
@@ -320,33 +357,31 @@ static void pcpu_mem_free(void *ptr, size_t size)
 /**
  * pcpu_count_occupied_pages - count the number of pages an area occupies
  * @chunk: chunk of interest
- * @i: index of the area in question
+ * @bit_off: start of the area, in allocation map bits
+ * @bits: size of the area, in allocation map bits
  *
- * Count the number of pages chunk's @i'th area occupies.  When the area's
- * start and/or end address isn't aligned to page boundary, the straddled
- * page is included in the count iff the rest of the page is free.
+ * Count the number of pages the area occupies on its own: those that
+ * would be empty without it.  The area itself is ignored whether it is
+ * marked allocated or free in the allocation map, so this works both
+ * after allocating and after freeing it.
  */
-static int pcpu_count_occupied_pages(struct pcpu_chunk *chunk, int i)
+static int pcpu_count_occupied_pages(struct pcpu_chunk *chunk, int bit_off,
+				     int bits)
 {
-	int off = chunk->map[i] & ~1;
-	int end = chunk->map[i + 1] & ~1;
+	int start = bit_off, end = bit_off + bits;
+	int page_start = round_down(start, PCPU_BITMAP_BLOCK_BITS);
+	int page_end = round_up(end, PCPU_BITMAP_BLOCK_BITS);
 
-	if (!PAGE_ALIGNED(off) && i > 0) {
-		int prev = chunk->map[i - 1];
+	/* the straddled pages count iff the rest of them is free */
+	if (page_start < start &&
+	    find_next_bit(chunk->alloc_map, start, page_start) < start)
+		page_start += PCPU_BITMAP_BLOCK_BITS;
 
-		if (!(prev & 1) && prev <= round_down(off, PAGE_SIZE))
-			off = round_down(off, PAGE_SIZE);
-	}
-
-	if (!PAGE_ALIGNED(end) && i + 1 < chunk->map_used) {
-		int next = chunk->map[i + 1];
-		int nend = chunk->map[i + 2] & ~1;
+	if (page_end > end &&
+	    find_next_bit(chunk->alloc_map, page_end, end) < page_end)
+		page_end -= PCPU_BITMAP_BLOCK_BITS;
 
-		if (!(next & 1) && nend >= round_up(end, PAGE_SIZE))
-			end = round_up(end, PAGE_SIZE);
-	}
-
-	return max_t(int, PFN_DOWN(end) - PFN_UP(off), 0);
+	return max_t(int, page_end - page_start, 0) / PCPU_BITMAP_BLOCK_BITS;
 }
 
 /**
@@ -374,353 +409,518 @@ static void pcpu_chunk_relocate(struct pcpu_chunk *chunk, int oslot)
 	}
 }
 
+/*
+ * Allocation map helpers.  The allocation map is cut into blocks of
+ * PCPU_BITMAP_BLOCK_BITS bits, one per page, and each block has a
+ * pcpu_block_md describing the free space in it:
+ *
+ *   contig_hint	size of the largest free area in the block
+ *   contig_hint_start	where that area starts
+ *   left_free		size of the free area at the start of the block
+ *   right_free		size of the free area at the end of the block
+ *   first_free		no free bit below this
+ *
+ * Free areas spanning blocks are found by joining right_free of a block
+ * with left_free of the next ones, so the largest free area of a chunk and
+ * the first one an allocation fits in can be found by walking the blocks
+ * rather than the bitmap.  Offsets and sizes are in allocation map bits
+ * unless noted otherwise.
+ */
+static int pcpu_off_to_block_index(int off)
+{
+	return off / PCPU_BITMAP_BLOCK_BITS;
+}
+
+static int pcpu_off_to_block_off(int off)
+{
+	return off & (PCPU_BITMAP_BLOCK_BITS - 1);
+}
+
+static int pcpu_block_off_to_off(int index, int off)
+{
+	return index * PCPU_BITMAP_BLOCK_BITS + off;
+}
+
+static unsigned long *pcpu_index_alloc_map(struct pcpu_chunk *chunk, int index)
+{
+	return chunk->alloc_map +
+		index * (PCPU_BITMAP_BLOCK_BITS / BITS_PER_LONG);
+}
+
+/* number of bits in the allocation map of a chunk */
+static int pcpu_chunk_map_bits(void)
+{
+	return pcpu_unit_size >> PCPU_MIN_ALLOC_SHIFT;
+}
+
 /**
- * pcpu_need_to_extend - determine whether chunk area map needs to be extended
+ * pcpu_next_md_free_region - find the next hint free area
  * @chunk: chunk of interest
- * @is_atomic: the allocation context
- *
- * Determine whether area map of @chunk needs to be extended.  If
- * @is_atomic, only the amount necessary for a new allocation is
- * considered; however, async extension is scheduled if the left amount is
- * low.  If !@is_atomic, it aims for more empty space.  Combined, this
- * ensures that the map is likely to have enough available space to
- * accomodate atomic allocations which can't extend maps directly.
- *
- * CONTEXT:
- * pcpu_lock.
+ * @bit_off: on input, where to start looking; on output, the area found
+ * @bits: size of the area found
  *
- * RETURNS:
- * New target map allocation length if extension is necessary, 0
- * otherwise.
+ * Walks the block hints from @bit_off and returns the next block
+ * contig_hint or free area spanning blocks.  Ends with @bit_off at or
+ * beyond the end of the map.
  */
-static int pcpu_need_to_extend(struct pcpu_chunk *chunk, bool is_atomic)
+static void pcpu_next_md_free_region(struct pcpu_chunk *chunk, int *bit_off,
+				     int *bits)
 {
-	int margin, new_alloc;
+	int i = pcpu_off_to_block_index(*bit_off);
+	int block_off = pcpu_off_to_block_off(*bit_off);
+	struct pcpu_block_md *block;
+
+	*bits = 0;
+	for (block = chunk->md_blocks + i; i < pcpu_unit_pages;
+	     block++, i++) {
+		/* continue an area from the previous block */
+		if (*bits) {
+			*bits += block->left_free;
+			if (block->left_free == PCPU_BITMAP_BLOCK_BITS)
+				continue;
+			return;
+		}
 
-	if (is_atomic) {
-		margin = 3;
+		/*
+		 * Report the contig hint unless it was reported already or
+		 * it reaches the end of the block, in which case it is
+		 * handled as right_free below.
+		 */
+		*bits = block->contig_hint;
+		if (*bits && block->contig_hint_start >= block_off &&
+		    *bits + block->contig_hint_start < PCPU_BITMAP_BLOCK_BITS) {
+			*bit_off = pcpu_block_off_to_off(i,
+					block->contig_hint_start);
+			return;
+		}
+		block_off = 0;
 
-		if (chunk->map_alloc <
-		    chunk->map_used + PCPU_ATOMIC_MAP_MARGIN_LOW &&
-		    pcpu_async_enabled)
-			schedule_work(&chunk->map_extend_work);
-	} else {
-		margin = PCPU_ATOMIC_MAP_MARGIN_HIGH;
+		*bits = block->right_free;
+		*bit_off = (i + 1) * PCPU_BITMAP_BLOCK_BITS - block->right_free;
 	}
+}
 
-	if (chunk->map_alloc >= chunk->map_used + margin)
-		return 0;
-
-	new_alloc = PCPU_DFL_MAP_ALLOC;
-	while (new_alloc < chunk->map_used + margin)
-		new_alloc *= 2;
+#define pcpu_for_each_md_free_region(chunk, bit_off, bits)		\
+	for (pcpu_next_md_free_region((chunk), &(bit_off), &(bits));	\
+	     (bit_off) < pcpu_chunk_map_bits();				\
+	     (bit_off) += (bits) + 1,					\
+	     pcpu_next_md_free_region((chunk), &(bit_off), &(bits)))
 
-	return new_alloc;
+/* update the chunk contig hint with a free area */
+static void pcpu_chunk_update(struct pcpu_chunk *chunk, int bit_off, int bits)
+{
+	if (bits > chunk->contig_bits) {
+		chunk->contig_bits_start = bit_off;
+		chunk->contig_bits = bits;
+	}
 }
 
 /**
- * pcpu_extend_area_map - extend area map of a chunk
+ * pcpu_chunk_refresh_hint - recompute the chunk contig hint
  * @chunk: chunk of interest
- * @new_alloc: new target allocation length of the area map
- *
- * Extend area map of @chunk to have @new_alloc entries.
  *
- * CONTEXT:
- * Does GFP_KERNEL allocation.  Grabs and releases pcpu_lock.
- *
- * RETURNS:
- * 0 on success, -errno on failure.
+ * Walks the block hints, which is much cheaper than scanning the map.
  */
-static int pcpu_extend_area_map(struct pcpu_chunk *chunk, int new_alloc)
+static void pcpu_chunk_refresh_hint(struct pcpu_chunk *chunk)
 {
-	int *old = NULL, *new = NULL;
-	size_t old_size = 0, new_size = new_alloc * sizeof(new[0]);
-	unsigned long flags;
+	int bit_off, bits;
 
-	new = pcpu_mem_zalloc(new_size);
-	if (!new)
-		return -ENOMEM;
+	chunk->contig_bits = 0;
 
-	/* acquire pcpu_lock and switch to new area map */
-	spin_lock_irqsave(&pcpu_lock, flags);
+	bit_off = chunk->first_bit;
+	bits = 0;
+	pcpu_for_each_md_free_region(chunk, bit_off, bits)
+		pcpu_chunk_update(chunk, bit_off, bits);
+}
 
-	if (new_alloc <= chunk->map_alloc)
-		goto out_unlock;
+/* update a block's hints with the free area [@start, @end) */
+static void pcpu_block_update(struct pcpu_block_md *block, int start, int end)
+{
+	int contig = end - start;
 
-	old_size = chunk->map_alloc * sizeof(chunk->map[0]);
-	old = chunk->map;
+	block->first_free = min(block->first_free, start);
+	if (start == 0)
+		block->left_free = contig;
 
-	memcpy(new, old, old_size);
+	if (end == PCPU_BITMAP_BLOCK_BITS)
+		block->right_free = contig;
 
-	chunk->map_alloc = new_alloc;
-	chunk->map = new;
-	new = NULL;
+	if (contig > block->contig_hint) {
+		block->contig_hint_start = start;
+		block->contig_hint = contig;
+	}
+}
 
-out_unlock:
-	spin_unlock_irqrestore(&pcpu_lock, flags);
+/* recompute the hints of block @index from the allocation map */
+static void pcpu_block_refresh(struct pcpu_chunk *chunk, int index)
+{
+	struct pcpu_block_md *block = chunk->md_blocks + index;
+	unsigned long *alloc_map = pcpu_index_alloc_map(chunk, index);
+	int rs, re;
 
-	/*
-	 * pcpu_mem_free() might end up calling vfree() which uses
-	 * IRQ-unsafe lock and thus can't be called under pcpu_lock.
-	 */
-	pcpu_mem_free(old, old_size);
-	pcpu_mem_free(new, new_size);
+	block->contig_hint = 0;
+	block->left_free = block->right_free = 0;
 
-	return 0;
+	rs = block->first_free;
+	while (true) {
+		rs = find_next_zero_bit(alloc_map, PCPU_BITMAP_BLOCK_BITS, rs);
+		if (rs >= PCPU_BITMAP_BLOCK_BITS)
+			break;
+		re = find_next_bit(alloc_map, PCPU_BITMAP_BLOCK_BITS, rs + 1);
+		pcpu_block_update(block, rs, re);
+		rs = re + 1;
+	}
 }
 
-static void pcpu_map_extend_workfn(struct work_struct *work)
+/**
+ * pcpu_block_update_hint_alloc - update hints after an allocation
+ * @chunk: chunk of interest
+ * @bit_off: start of the allocation
+ * @bits: size of the allocation
+ *
+ * Only the blocks the allocation touches can change.  A block is
+ * rescanned only if the allocation cut into its contig hint, and the chunk
+ * hint is recomputed only if the allocation cut into it.
+ */
+static void pcpu_block_update_hint_alloc(struct pcpu_chunk *chunk, int bit_off,
+					 int bits)
 {
-	struct pcpu_chunk *chunk = container_of(work, struct pcpu_chunk,
-						map_extend_work);
-	int new_alloc;
+	struct pcpu_block_md *s_block, *e_block, *block;
+	int s_index, e_index;	/* first and last block of the allocation */
+	int s_off, e_off;	/* [s_off, e_off) in those blocks */
+
+	s_index = pcpu_off_to_block_index(bit_off);
+	e_index = pcpu_off_to_block_index(bit_off + bits - 1);
+	s_off = pcpu_off_to_block_off(bit_off);
+	e_off = pcpu_off_to_block_off(bit_off + bits - 1) + 1;
+
+	s_block = chunk->md_blocks + s_index;
+	e_block = chunk->md_blocks + e_index;
+
+	if (s_off == s_block->first_free)
+		s_block->first_free = find_next_zero_bit(
+					pcpu_index_alloc_map(chunk, s_index),
+					PCPU_BITMAP_BLOCK_BITS, s_off + bits);
+
+	if (s_off < s_block->contig_hint_start + s_block->contig_hint &&
+	    s_off + bits > s_block->contig_hint_start) {
+		pcpu_block_refresh(chunk, s_index);
+	} else {
+		s_block->left_free = min(s_block->left_free, s_off);
+		if (s_index == e_index)
+			s_block->right_free = min_t(int, s_block->right_free,
+					PCPU_BITMAP_BLOCK_BITS - e_off);
+		else
+			s_block->right_free = 0;
+	}
 
-	spin_lock_irq(&pcpu_lock);
-	new_alloc = pcpu_need_to_extend(chunk, false);
-	spin_unlock_irq(&pcpu_lock);
+	if (s_index != e_index) {
+		/* the allocation covers the start of e_block */
+		if (e_off == PCPU_BITMAP_BLOCK_BITS) {
+			e_block++;
+		} else {
+			e_block->first_free = find_next_zero_bit(
+					pcpu_index_alloc_map(chunk, e_index),
+					PCPU_BITMAP_BLOCK_BITS, e_off);
+			if (e_off > e_block->contig_hint_start) {
+				pcpu_block_refresh(chunk, e_index);
+			} else {
+				e_block->left_free = 0;
+				e_block->right_free =
+					min_t(int, e_block->right_free,
+					      PCPU_BITMAP_BLOCK_BITS - e_off);
+			}
+		}
 
-	if (new_alloc)
-		pcpu_extend_area_map(chunk, new_alloc);
+		/* blocks in between are now full */
+		for (block = s_block + 1; block < e_block; block++) {
+			block->first_free = PCPU_BITMAP_BLOCK_BITS;
+			block->contig_hint = 0;
+			block->left_free = 0;
+			block->right_free = 0;
+		}
+	}
+
+	if (bit_off < chunk->contig_bits_start + chunk->contig_bits &&
+	    bit_off + bits > chunk->contig_bits_start)
+		pcpu_chunk_refresh_hint(chunk);
 }
 
 /**
- * pcpu_fit_in_area - try to fit the requested allocation in a candidate area
- * @chunk: chunk the candidate area belongs to
- * @off: the offset to the start of the candidate area
- * @this_size: the size of the candidate area
- * @size: the size of the target allocation
- * @align: the alignment of the target allocation
- * @pop_only: only allocate from already populated region
- *
- * We're trying to allocate @size bytes aligned at @align.  @chunk's area
- * at @off sized @this_size is a candidate.  This function determines
- * whether the target allocation fits in the candidate area and returns the
- * number of bytes to pad after @off.  If the target area doesn't fit, -1
- * is returned.
- *
- * If @pop_only is %true, this function only considers the already
- * populated part of the candidate area.
+ * pcpu_block_update_hint_free - update hints after a free
+ * @chunk: chunk of interest
+ * @bit_off: start of the freed area
+ * @bits: size of the freed area
+ *
+ * The freed area is merged with the free space around it in its first and
+ * last block, and the blocks in between become entirely free.  The chunk
+ * hint only needs a walk over the blocks if the merged area may continue
+ * into neighbouring blocks.
  */
-static int pcpu_fit_in_area(struct pcpu_chunk *chunk, int off, int this_size,
-			    int size, int align, bool pop_only)
+static void pcpu_block_update_hint_free(struct pcpu_chunk *chunk, int bit_off,
+					int bits)
 {
-	int cand_off = off;
+	struct pcpu_block_md *s_block, *e_block, *block;
+	int s_index, e_index;	/* first and last block of the freed area */
+	int s_off, e_off;	/* [s_off, e_off) in those blocks */
+	int start, end;		/* extent of the merged free area */
+
+	s_index = pcpu_off_to_block_index(bit_off);
+	e_index = pcpu_off_to_block_index(bit_off + bits - 1);
+	s_off = pcpu_off_to_block_off(bit_off);
+	e_off = pcpu_off_to_block_off(bit_off + bits - 1) + 1;
+
+	s_block = chunk->md_blocks + s_index;
+	e_block = chunk->md_blocks + e_index;
+
+	/* extend backwards, using the contig hint to skip the scan */
+	start = s_off;
+	if (s_block->contig_hint &&
+	    s_off == s_block->contig_hint_start + s_block->contig_hint) {
+		start = s_block->contig_hint_start;
+	} else if (s_off) {
+		int l_bit = find_last_bit(pcpu_index_alloc_map(chunk, s_index),
+					  s_off);
+
+		start = (l_bit == s_off) ? 0 : l_bit + 1;
+	}
 
-	while (true) {
-		int head = ALIGN(cand_off, align) - off;
-		int page_start, page_end, rs, re;
+	/* and forwards */
+	end = e_off;
+	if (e_block->contig_hint && e_off == e_block->contig_hint_start)
+		end = e_block->contig_hint_start + e_block->contig_hint;
+	else
+		end = find_next_bit(pcpu_index_alloc_map(chunk, e_index),
+				    PCPU_BITMAP_BLOCK_BITS, end);
 
-		if (this_size < head + size)
-			return -1;
+	pcpu_block_update(s_block, start,
+			  s_index == e_index ? end : PCPU_BITMAP_BLOCK_BITS);
 
-		if (!pop_only)
-			return head;
+	if (s_index != e_index) {
+		pcpu_block_update(e_block, 0, end);
 
-		/*
-		 * If the first unpopulated page is beyond the end of the
-		 * allocation, the whole allocation is populated;
-		 * otherwise, retry from the end of the unpopulated area.
-		 */
-		page_start = PFN_DOWN(head + off);
-		page_end = PFN_UP(head + off + size);
-
-		rs = page_start;
-		pcpu_next_unpop(chunk, &rs, &re, PFN_UP(off + this_size));
-		if (rs >= page_end)
-			return head;
-		cand_off = re * PAGE_SIZE;
+		for (block = s_block + 1; block < e_block; block++) {
+			block->first_free = 0;
+			block->contig_hint_start = 0;
+			block->contig_hint = PCPU_BITMAP_BLOCK_BITS;
+			block->left_free = PCPU_BITMAP_BLOCK_BITS;
+			block->right_free = PCPU_BITMAP_BLOCK_BITS;
+		}
 	}
+
+	if (s_index != e_index || start == 0 || end == PCPU_BITMAP_BLOCK_BITS)
+		pcpu_chunk_refresh_hint(chunk);
+	else
+		pcpu_chunk_update(chunk, pcpu_block_off_to_off(s_index, start),
+				  end - start);
+}
+
+/* whether the pages under [@bit_off, @bit_off + @bits) are all populated */
+static bool pcpu_is_populated(struct pcpu_chunk *chunk, int bit_off, int bits)
+{
+	int rs, re;
+
+	rs = PFN_DOWN(bit_off * PCPU_MIN_ALLOC_SIZE);
+	pcpu_next_unpop(chunk, &rs, &re,
+			PFN_UP((bit_off + bits) * PCPU_MIN_ALLOC_SIZE));
+	return rs >= re;
 }
 
 /**
- * pcpu_alloc_area - allocate area from a pcpu_chunk
+ * pcpu_find_block_fit - find room for an allocation in a chunk
  * @chunk: chunk of interest
- * @size: wanted size in bytes
- * @align: wanted align
- * @pop_only: allocate only from the populated area
- * @occ_pages_p: out param for the number of pages the area occupies
- *
- * Try to allocate @size bytes area aligned at @align from @chunk.
- * Note that this function only allocates the offset.  It doesn't
- * populate or map the area.
+ * @alloc_bits: size of the allocation
+ * @align: alignment of the allocation, in bits
+ * @pop_only: only consider populated areas
  *
- * @chunk->map must have at least two free slots.
+ * Walks the blocks from the first free one.  The bitmap of a block is
+ * only searched if its contig hint says the allocation fits in it, and
+ * areas spanning blocks are found from right_free and left_free alone.
+ * Blocks are page sized and so populated as a whole.
  *
  * CONTEXT:
  * pcpu_lock.
  *
  * RETURNS:
- * Allocated offset in @chunk on success, -1 if no matching area is
- * found.
+ * Offset of the area in allocation map bits, -1 if nothing fits.
  */
-static int pcpu_alloc_area(struct pcpu_chunk *chunk, int size, int align,
-			   bool pop_only, int *occ_pages_p)
+static int pcpu_find_block_fit(struct pcpu_chunk *chunk, int alloc_bits,
+			       int align, bool pop_only)
 {
-	int oslot = pcpu_chunk_slot(chunk);
-	int max_contig = 0;
-	int i, off;
-	bool seen_free = false;
-	int *p;
-
-	for (i = chunk->first_free, p = chunk->map + i; i < chunk->map_used; i++, p++) {
-		int head, tail;
-		int this_size;
-
-		off = *p;
-		if (off & 1)
-			continue;
-
-		this_size = (p[1] & ~1) - off;
-
-		head = pcpu_fit_in_area(chunk, off, this_size, size, align,
-					pop_only);
-		if (head < 0) {
-			if (!seen_free) {
-				chunk->first_free = i;
-				seen_free = true;
-			}
-			max_contig = max(this_size, max_contig);
-			continue;
+	struct pcpu_block_md *block;
+	int carry = -1;		/* start of a free area from previous blocks */
+	int i, bit_off, end;
+
+	if (alloc_bits > chunk->contig_bits)
+		return -1;
+
+	for (i = pcpu_off_to_block_index(chunk->first_bit);
+	     i < pcpu_unit_pages; i++) {
+		block = chunk->md_blocks + i;
+		end = pcpu_block_off_to_off(i + 1, 0);
+
+		if (carry >= 0) {
+			bit_off = pcpu_block_off_to_off(i, block->left_free);
+			if (bit_off - carry >= alloc_bits &&
+			    (!pop_only ||
+			     pcpu_is_populated(chunk, carry, alloc_bits)))
+				return carry;
+			if (block->left_free < PCPU_BITMAP_BLOCK_BITS)
+				carry = -1;
 		}
 
-		/*
-		 * If head is small or the previous block is free,
-		 * merge'em.  Note that 'small' is defined as smaller
-		 * than sizeof(int), which is very small but isn't too
-		 * uncommon for percpu allocations.
-		 */
-		if (head && (head < sizeof(int) || !(p[-1] & 1))) {
-			*p = off += head;
-			if (p[-1] & 1)
-				chunk->free_size -= head;
-			else
-				max_contig = max(*p - p[-1], max_contig);
-			this_size -= head;
-			head = 0;
+		if (block->contig_hint >= alloc_bits &&
+		    (!pop_only || test_bit(i, chunk->populated))) {
+			bit_off = bitmap_find_next_zero_area(chunk->alloc_map,
+					end, pcpu_block_off_to_off(i,
+						block->first_free),
+					alloc_bits, align - 1);
+			if (bit_off + alloc_bits <= end)
+				return bit_off;
 		}
 
-		/* if tail is small, just keep it around */
-		tail = this_size - head - size;
-		if (tail < sizeof(int)) {
-			tail = 0;
-			size = this_size - head;
+		/* the start of a free area continuing into the next block */
+		if (carry < 0 && block->right_free) {
+			carry = ALIGN(end - block->right_free, align);
+			if (carry >= end)
+				carry = -1;
 		}
+	}
 
-		/* split if warranted */
-		if (head || tail) {
-			int nr_extra = !!head + !!tail;
-
-			/* insert new subblocks */
-			memmove(p + nr_extra + 1, p + 1,
-				sizeof(chunk->map[0]) * (chunk->map_used - i));
-			chunk->map_used += nr_extra;
-
-			if (head) {
-				if (!seen_free) {
-					chunk->first_free = i;
-					seen_free = true;
-				}
-				*++p = off += head;
-				++i;
-				max_contig = max(head, max_contig);
-			}
-			if (tail) {
-				p[1] = off + size;
-				max_contig = max(tail, max_contig);
-			}
-		}
+	return -1;
+}
+
+/*
+ * Mark [@bit_off, @bit_off + @bits) allocated and update the hints.
+ * CONTEXT: pcpu_lock, or early boot.
+ */
+static void pcpu_mark_area(struct pcpu_chunk *chunk, int bit_off, int bits)
+{
+	bitmap_set(chunk->alloc_map, bit_off, bits);
 
-		if (!seen_free)
-			chunk->first_free = i + 1;
+	set_bit(bit_off, chunk->bound_map);
+	bitmap_clear(chunk->bound_map, bit_off + 1, bits - 1);
+	set_bit(bit_off + bits, chunk->bound_map);
 
-		/* update hint and mark allocated */
-		if (i + 1 == chunk->map_used)
-			chunk->contig_hint = max_contig; /* fully scanned */
-		else
-			chunk->contig_hint = max(chunk->contig_hint,
-						 max_contig);
+	chunk->free_bytes -= bits * PCPU_MIN_ALLOC_SIZE;
 
-		chunk->free_size -= size;
-		*p |= 1;
+	if (bit_off == chunk->first_bit)
+		chunk->first_bit = find_next_zero_bit(chunk->alloc_map,
+						      pcpu_chunk_map_bits(),
+						      bit_off + bits);
 
-		*occ_pages_p = pcpu_count_occupied_pages(chunk, i);
-		pcpu_chunk_relocate(chunk, oslot);
-		return off;
-	}
+	pcpu_block_update_hint_alloc(chunk, bit_off, bits);
+}
+
+/**
+ * pcpu_alloc_area - allocate area from a pcpu_chunk
+ * @chunk: chunk of interest
+ * @alloc_bits: wanted size, in allocation map bits
+ * @bit_off: where, as found by pcpu_find_block_fit()
+ * @occ_pages_p: out param for the number of pages the area occupies
+ *
+ * Allocate @alloc_bits at @bit_off from @chunk.  Note that this function
+ * only allocates the offset.  It doesn't populate or map the area.
+ *
+ * CONTEXT:
+ * pcpu_lock.
+ *
+ * RETURNS:
+ * Allocated offset in @chunk, in bytes.
+ */
+static int pcpu_alloc_area(struct pcpu_chunk *chunk, int alloc_bits,
+			   int bit_off, int *occ_pages_p)
+{
+	int oslot = pcpu_chunk_slot(chunk);
 
-	chunk->contig_hint = max_contig;	/* fully scanned */
+	pcpu_mark_area(chunk, bit_off, alloc_bits);
+
+	*occ_pages_p = pcpu_count_occupied_pages(chunk, bit_off, alloc_bits);
 	pcpu_chunk_relocate(chunk, oslot);
+	return bit_off * PCPU_MIN_ALLOC_SIZE;
+}
 
-	/* tell the upper layer that this chunk has no matching area */
-	return -1;
+/*
+ * Size in bytes of the area allocated at @off.  The boundary bits of an
+ * allocated area only change when it is freed, so this is safe without
+ * pcpu_lock as long as the area stays allocated.
+ */
+static int pcpu_area_size(struct pcpu_chunk *chunk, int off)
+{
+	int bit_off = off / PCPU_MIN_ALLOC_SIZE;
+	int end;
+
+	end = find_next_bit(chunk->bound_map, pcpu_chunk_map_bits(),
+			    bit_off + 1);
+	return (end - bit_off) * PCPU_MIN_ALLOC_SIZE;
 }
 
 /**
  * pcpu_free_area - free area to a pcpu_chunk
  * @chunk: chunk of interest
- * @freeme: offset of area to free
+ * @off: offset of area to free
  * @occ_pages_p: out param for the number of pages the area occupies
  *
- * Free area starting from @freeme to @chunk.  Note that this function
+ * Free area starting from @off to @chunk.  Note that this function
  * only modifies the allocation map.  It doesn't depopulate or unmap
  * the area.
  *
  * CONTEXT:
  * pcpu_lock.
  */
-static void pcpu_free_area(struct pcpu_chunk *chunk, int freeme,
+static void pcpu_free_area(struct pcpu_chunk *chunk, int off,
 			   int *occ_pages_p)
 {
 	int oslot = pcpu_chunk_slot(chunk);
-	int off = 0;
-	unsigned i, j;
-	int to_free = 0;
-	int *p;
-
-	freeme |= 1;	/* we are searching for <given offset, in use> pair */
-
-	i = 0;
-	j = chunk->map_used;
-	while (i != j) {
-		unsigned k = (i + j) / 2;
-		off = chunk->map[k];
-		if (off < freeme)
-			i = k + 1;
-		else if (off > freeme)
-			j = k;
-		else
-			i = j = k;
-	}
-	BUG_ON(off != freeme);
+	int bit_off, bits;
 
-	if (i < chunk->first_free)
-		chunk->first_free = i;
+	bit_off = off / PCPU_MIN_ALLOC_SIZE;
+	bits = pcpu_area_size(chunk, off) / PCPU_MIN_ALLOC_SIZE;
+	BUG_ON(!test_bit(bit_off, chunk->alloc_map) ||
+	       !test_bit(bit_off, chunk->bound_map));
 
-	p = chunk->map + i;
-	*p = off &= ~1;
-	chunk->free_size += (p[1] & ~1) - off;
+	bitmap_clear(chunk->alloc_map, bit_off, bits);
 
-	*occ_pages_p = pcpu_count_occupied_pages(chunk, i);
+	chunk->free_bytes += bits * PCPU_MIN_ALLOC_SIZE;
+	chunk->first_bit = min(chunk->first_bit, bit_off);
 
-	/* merge with next? */
-	if (!(p[1] & 1))
-		to_free++;
-	/* merge with previous? */
-	if (i > 0 && !(p[-1] & 1)) {
-		to_free++;
-		i--;
-		p--;
-	}
-	if (to_free) {
-		chunk->map_used -= to_free;
-		memmove(p + 1, p + 1 + to_free,
-			(chunk->map_used - i) * sizeof(chunk->map[0]));
-	}
+	pcpu_block_update_hint_free(chunk, bit_off, bits);
 
-	chunk->contig_hint = max(chunk->map[i + 1] - chunk->map[i] - 1, chunk->contig_hint);
+	*occ_pages_p = pcpu_count_occupied_pages(chunk, bit_off, bits);
 	pcpu_chunk_relocate(chunk, oslot);
 }
 
+static void pcpu_init_md_blocks(struct pcpu_chunk *chunk)
+{
+	struct pcpu_block_md *block;
+
+	for (block = chunk->md_blocks;
+	     block < chunk->md_blocks + pcpu_unit_pages; block++) {
+		block->contig_hint = PCPU_BITMAP_BLOCK_BITS;
+		block->left_free = PCPU_BITMAP_BLOCK_BITS;
+		block->right_free = PCPU_BITMAP_BLOCK_BITS;
+	}
+
+	chunk->free_bytes = pcpu_unit_size;
+	chunk->contig_bits = pcpu_chunk_map_bits();
+}
+
+static size_t pcpu_alloc_map_size(void)
+{
+	return BITS_TO_LONGS(pcpu_chunk_map_bits()) * sizeof(unsigned long);
+}
+
+static size_t pcpu_bound_map_size(void)
+{
+	return BITS_TO_LONGS(pcpu_chunk_map_bits() + 1) *
+		sizeof(unsigned long);
+}
+
+static size_t pcpu_md_blocks_size(void)
+{
+	return pcpu_unit_pages * sizeof(struct pcpu_block_md);
+}
+
 static struct pcpu_chunk *pcpu_alloc_chunk(void)
 {
 	struct pcpu_chunk *chunk;
@@ -729,22 +929,19 @@ static struct pcpu_chunk *pcpu_alloc_chunk(void)
 	if (!chunk)
 		return NULL;
 
-	chunk->map = pcpu_mem_zalloc(PCPU_DFL_MAP_ALLOC *
-						sizeof(chunk->map[0]));
-	if (!chunk->map) {
+	chunk->alloc_map = pcpu_mem_zalloc(pcpu_alloc_map_size());
+	chunk->bound_map = pcpu_mem_zalloc(pcpu_bound_map_size());
+	chunk->md_blocks = pcpu_mem_zalloc(pcpu_md_blocks_size());
+	if (!chunk->alloc_map || !chunk->bound_map || !chunk->md_blocks) {
+		pcpu_mem_free(chunk->alloc_map, pcpu_alloc_map_size());
+		pcpu_mem_free(chunk->bound_map, pcpu_bound_map_size());
+		pcpu_mem_free(chunk->md_blocks, pcpu_md_blocks_size());
 		pcpu_mem_free(chunk, pcpu_chunk_struct_size);
 		return NULL;
 	}
 
-	chunk->map_alloc = PCPU_DFL_MAP_ALLOC;
-	chunk->map[0] = 0;
-	chunk->map[1] = pcpu_unit_size | 1;
-	chunk->map_used = 1;
-
 	INIT_LIST_HEAD(&chunk->list);
-	INIT_WORK(&chunk->map_extend_work, pcpu_map_extend_workfn);
-	chunk->free_size = pcpu_unit_size;
-	chunk->contig_hint = pcpu_unit_size;
+	pcpu_init_md_blocks(chunk);
 
 	return chunk;
 }
@@ -753,7 +950,9 @@ static void pcpu_free_chunk(struct pcpu_chunk *chunk)
 {
 	if (!chunk)
 		return;
-	pcpu_mem_free(chunk->map, chunk->map_alloc * sizeof(chunk->map[0]));
+	pcpu_mem_free(chunk->alloc_map, pcpu_alloc_map_size());
+	pcpu_mem_free(chunk->bound_map, pcpu_bound_map_size());
+	pcpu_mem_free(chunk->md_blocks, pcpu_md_blocks_size());
 	pcpu_mem_free(chunk, pcpu_chunk_struct_size);
 }
 
@@ -857,6 +1056,150 @@ static struct pcpu_chunk *pcpu_chunk_addr_search(void *addr)
 	return pcpu_get_page_chunk(pcpu_addr_to_page(addr));
 }
 
+/**
+ * pcpu_release_area - free an area and do the bookkeeping
+ * @chunk: chunk the area belongs to
+ * @off: offset of the area in @chunk
+ *
+ * Free the area at @off to @chunk and wake up the grim reaper if that
+ * left more than one fully free chunk.
+ *
+ * CONTEXT:
+ * Can be called from atomic context.
+ */
+static void pcpu_release_area(struct pcpu_chunk *chunk, int off)
+{
+	unsigned long flags;
+	int occ_pages;
+
+	spin_lock_irqsave(&pcpu_lock, flags);
+
+	pcpu_free_area(chunk, off, &occ_pages);
+
+	if (chunk != pcpu_reserved_chunk)
+		pcpu_nr_empty_pop_pages += occ_pages;
+
+	/* if there are more than one fully free chunks, wake up grim reaper */
+	if (chunk->free_bytes == pcpu_unit_size) {
+		struct pcpu_chunk *pos;
+
+		list_for_each_entry(pos, &pcpu_slot[pcpu_nr_slots - 1], list)
+			if (pos != chunk) {
+				pcpu_schedule_balance_work();
+				break;
+			}
+	}
+
+	spin_unlock_irqrestore(&pcpu_lock, flags);
+}
+
+static int pcpu_cache_class(size_t size)
+{
+	return size / PCPU_MIN_ALLOC_SIZE - 1;
+}
+
+/**
+ * pcpu_cache_get - allocate an area from the local area cache
+ * @size: size of the area, a multiple of PCPU_MIN_ALLOC_SIZE
+ * @align: wanted alignment
+ *
+ * RETURNS:
+ * Percpu pointer to a cached area of @size bytes aligned at @align,
+ * %NULL if there is none.  The area is not cleared.
+ */
+static void __percpu *pcpu_cache_get(size_t size, size_t align)
+{
+	struct pcpu_area_cache *cache;
+	void __percpu *ptr = NULL;
+	unsigned long flags;
+	int class = pcpu_cache_class(size);
+	int i;
+
+	local_irq_save(flags);
+	cache = this_cpu_ptr(&pcpu_area_cache);
+	for (i = cache->nr[class] - 1; i >= 0; i--) {
+		void __percpu *area = cache->areas[class][i];
+
+		if (IS_ALIGNED((unsigned long)__pcpu_ptr_to_addr(area), align)) {
+			cache->areas[class][i] =
+				cache->areas[class][--cache->nr[class]];
+			ptr = area;
+			break;
+		}
+	}
+	local_irq_restore(flags);
+
+	return ptr;
+}
+
+/**
+ * pcpu_cache_put - free an area to the local area cache
+ * @chunk: chunk the area belongs to
+ * @off: offset of the area in @chunk
+ * @ptr: percpu pointer to the area
+ *
+ * RETURNS:
+ * %true if the area was cached, %false if it is too big or the cache is
+ * full and it should be freed to @chunk.
+ */
+static bool pcpu_cache_put(struct pcpu_chunk *chunk, int off,
+			   void __percpu *ptr)
+{
+	struct pcpu_area_cache *cache;
+	int size = pcpu_area_size(chunk, off);
+	unsigned long flags;
+	bool cached = false;
+	int class;
+
+	if (chunk == pcpu_reserved_chunk || size > PCPU_CACHE_MAX_SIZE)
+		return false;
+
+	class = pcpu_cache_class(size);
+
+	local_irq_save(flags);
+	cache = this_cpu_ptr(&pcpu_area_cache);
+	if (cache->nr[class] < PCPU_CACHE_DEPTH) {
+		cache->areas[class][cache->nr[class]++] = ptr;
+		cached = true;
+	}
+	local_irq_restore(flags);
+
+	return cached;
+}
+
+/* free all areas in @cache to their chunks, irqs off or the cpu dead */
+static void pcpu_cache_drain(struct pcpu_area_cache *cache)
+{
+	struct pcpu_chunk *chunk;
+	int class;
+
+	for (class = 0; class < PCPU_CACHE_NR_CLASSES; class++) {
+		while (cache->nr[class]) {
+			void *addr = __pcpu_ptr_to_addr(
+				cache->areas[class][--cache->nr[class]]);
+
+			chunk = pcpu_chunk_addr_search(addr);
+			pcpu_release_area(chunk, addr - chunk->base_addr);
+		}
+	}
+}
+
+static void pcpu_cache_drain_local(void *unused)
+{
+	pcpu_cache_drain(this_cpu_ptr(&pcpu_area_cache));
+}
+
+static int pcpu_cpu_notify(struct notifier_block *self,
+			   unsigned long action, void *hcpu)
+{
+	int cpu = (unsigned long)hcpu;
+
+	if (action == CPU_DEAD || action == CPU_DEAD_FROZEN)
+		pcpu_cache_drain(per_cpu_ptr(&pcpu_area_cache, cpu));
+
+	return NOTIFY_OK;
+}
+
 /**
  * pcpu_alloc - the percpu allocator
  * @size: size of area to allocate in bytes
@@ -877,19 +1220,20 @@ static void __percpu *pcpu_alloc(size_t size, size_t align, bool reserved,
 	struct pcpu_chunk *chunk;
 	const char *err;
 	bool is_atomic = (gfp & GFP_KERNEL) != GFP_KERNEL;
+	bool drained = false;
 	int occ_pages = 0;
-	int slot, off, new_alloc, cpu, ret;
+	int slot, off, cpu, ret;
+	int bits, bit_align;
 	unsigned long flags;
 	void __percpu *ptr;
 
-	/*
-	 * We want the lowest bit of offset available for in-use/free
-	 * indicator, so force >= 16bit alignment and make size even.
-	 */
-	if (unlikely(align < 2))
-		align = 2;
+	/* the allocation map tracks PCPU_MIN_ALLOC_SIZE byte units */
+	if (unlikely(align < PCPU_MIN_ALLOC_SIZE))
+		align = PCPU_MIN_ALLOC_SIZE;
 
-	size = ALIGN(size, 2);
+	size = ALIGN(size, PCPU_MIN_ALLOC_SIZE);
+	bits = size >> PCPU_MIN_ALLOC_SHIFT;
+	bit_align = align >> PCPU_MIN_ALLOC_SHIFT;
 
 	if (unlikely(!size || size > PCPU_MIN_UNIT_SIZE || align > PAGE_SIZE)) {
 		WARN(true, "illegal size (%zu) or align (%zu) for "
@@ -897,65 +1241,39 @@ static void __percpu *pcpu_alloc(size_t size, size_t align, bool reserved,
 		return NULL;
 	}
 
+	if (!reserved && size <= PCPU_CACHE_MAX_SIZE) {
+		ptr = pcpu_cache_get(size, align);
+		if (ptr)
+			goto clear;
+	}
+
 	spin_lock_irqsave(&pcpu_lock, flags);
 
 	/* serve reserved allocations from the reserved chunk if available */
 	if (reserved && pcpu_reserved_chunk) {
 		chunk = pcpu_reserved_chunk;
 
-		if (size > chunk->contig_hint) {
+		off = pcpu_find_block_fit(chunk, bits, bit_align, is_atomic);
+		if (off < 0) {
 			err = "alloc from reserved chunk failed";
 			goto fail_unlock;
 		}
 
-		while ((new_alloc = pcpu_need_to_extend(chunk, is_atomic))) {
-			spin_unlock_irqrestore(&pcpu_lock, flags);
-			if (is_atomic ||
-			    pcpu_extend_area_map(chunk, new_alloc) < 0) {
-				err = "failed to extend area map of reserved chunk";
-				goto fail;
-			}
-			spin_lock_irqsave(&pcpu_lock, flags);
-		}
-
-		off = pcpu_alloc_area(chunk, size, align, is_atomic,
-				      &occ_pages);
-		if (off >= 0)
-			goto area_found;
-
-		err = "alloc from reserved chunk failed";
-		goto fail_unlock;
+		off = pcpu_alloc_area(chunk, bits, off, &occ_pages);
+		goto area_found;
 	}
 
 restart:
 	/* search through normal chunks */
 	for (slot = pcpu_size_to_slot(size); slot < pcpu_nr_slots; slot++) {
 		list_for_each_entry(chunk, &pcpu_slot[slot], list) {
-			if (size > chunk->contig_hint)
+			off = pcpu_find_block_fit(chunk, bits, bit_align,
+						  is_atomic);
+			if (off < 0)
 				continue;
 
-			new_alloc = pcpu_need_to_extend(chunk, is_atomic);
-			if (new_alloc) {
-				if (is_atomic)
-					continue;
-				spin_unlock_irqrestore(&pcpu_lock, flags);
-				if (pcpu_extend_area_map(chunk,
-							 new_alloc) < 0) {
-					err = "failed to extend area map";
-					goto fail;
-				}
-				spin_lock_irqsave(&pcpu_lock, flags);
-				/*
-				 * pcpu_lock has been dropped, need to
-				 * restart cpu_slot list walking.
-				 */
-				goto restart;
-			}
-
-			off = pcpu_alloc_area(chunk, size, align, is_atomic,
-					      &occ_pages);
-			if (off >= 0)
-				goto area_found;
+			off = pcpu_alloc_area(chunk, bits, off, &occ_pages);
+			goto area_found;
 		}
 	}
 
@@ -969,6 +1287,14 @@ restart:
 	if (is_atomic)
 		goto fail;
 
+	/* but first give back what the area caches are sitting on */
+	if (!drained) {
+		drained = true;
+		on_each_cpu(pcpu_cache_drain_local, NULL, 1);
+		spin_lock_irqsave(&pcpu_lock, flags);
+		goto restart;
+	}
+
 	mutex_lock(&pcpu_alloc_mutex);
 
 	if (list_empty(&pcpu_slot[pcpu_nr_slots - 1])) {
@@ -1025,11 +1351,13 @@ area_found:
 	if (pcpu_nr_empty_pop_pages < PCPU_EMPTY_POP_PAGES_LOW)
 		pcpu_schedule_balance_work();
 
+	ptr = __addr_to_pcpu_ptr(chunk->base_addr + off);
+
+clear:
 	/* clear the areas and return address relative to base address */
 	for_each_possible_cpu(cpu)
-		memset((void *)pcpu_chunk_addr(chunk, cpu, 0) + off, 0, size);
+		memset(per_cpu_ptr(ptr, cpu), 0, size);
 
-	ptr = __addr_to_pcpu_ptr(chunk->base_addr + off);
 	kmemleak_alloc_percpu(ptr, size);
 	return ptr;
 
@@ -1232,38 +1560,22 @@ void free_percpu(void __percpu *ptr)
 {
 	void *addr;
 	struct pcpu_chunk *chunk;
-	unsigned long flags;
-	int off, occ_pages;
+	int off;
 
 	if (!ptr)
 		return;
 
 	kmemleak_free_percpu(ptr);
 
+	/* @ptr is still allocated, so its chunk can't go away under us */
 	addr = __pcpu_ptr_to_addr(ptr);
-
-	spin_lock_irqsave(&pcpu_lock, flags);
-
 	chunk = pcpu_chunk_addr_search(addr);
 	off = addr - chunk->base_addr;
 
-	pcpu_free_area(chunk, off, &occ_pages);
-
-	if (chunk != pcpu_reserved_chunk)
-		pcpu_nr_empty_pop_pages += occ_pages;
-
-	/* if there are more than one fully free chunks, wake up grim reaper */
-	if (chunk->free_size == pcpu_unit_size) {
-		struct pcpu_chunk *pos;
-
-		list_for_each_entry(pos, &pcpu_slot[pcpu_nr_slots - 1], list)
-			if (pos != chunk) {
-				pcpu_schedule_balance_work();
-				break;
-			}
-	}
+	if (pcpu_cache_put(chunk, off, ptr))
+		return;
 
-	spin_unlock_irqrestore(&pcpu_lock, flags);
+	pcpu_release_area(chunk, off);
 }
 EXPORT_SYMBOL_GPL(free_percpu);
 
@@ -1469,6 +1781,49 @@ static void pcpu_dump_alloc_info(const char *lvl,
 	printk(KERN_CONT "\n");
 }
 
+/**
+ * pcpu_alloc_first_chunk - create a chunk serving part of the first chunk
+ * @base_addr: mapped address of the first chunk
+ * @start: offset of the area the chunk serves
+ * @size: size of that area
+ *
+ * The first chunk is set up before slab is available, so the chunk and
+ * its maps come from memblock.  Everything outside [@start, @start +
+ * @size) is marked allocated and never freed.
+ *
+ * RETURNS:
+ * The new chunk.
+ */
+static struct pcpu_chunk * __init pcpu_alloc_first_chunk(void *base_addr,
+							 int start, int size)
+{
+	struct pcpu_chunk *chunk;
+	int start_bit, end_bit;
+
+	chunk = memblock_virt_alloc(pcpu_chunk_struct_size, 0);
+	INIT_LIST_HEAD(&chunk->list);
+	chunk->base_addr = base_addr;
+	chunk->immutable = true;
+	bitmap_fill(chunk->populated, pcpu_unit_pages);
+	chunk->nr_populated = pcpu_unit_pages;
+
+	chunk->alloc_map = memblock_virt_alloc(pcpu_alloc_map_size(), 0);
+	chunk->bound_map = memblock_virt_alloc(pcpu_bound_map_size(), 0);
+	chunk->md_blocks = memblock_virt_alloc(pcpu_md_blocks_size(), 0);
+	pcpu_init_md_blocks(chunk);
+
+	/* hide the areas outside of [start, start + size) */
+	start_bit = ALIGN(start, PCPU_MIN_ALLOC_SIZE) / PCPU_MIN_ALLOC_SIZE;
+	end_bit = (start + size) / PCPU_MIN_ALLOC_SIZE;
+	if (start_bit)
+		pcpu_mark_area(chunk, 0, start_bit);
+	if (end_bit < pcpu_chunk_map_bits())
+		pcpu_mark_area(chunk, end_bit,
+			       pcpu_chunk_map_bits() - end_bit);
+
+	return chunk;
+}
+
 /**
  * pcpu_setup_first_chunk - initialize the first percpu chunk
  * @ai: pcpu_alloc_info describing how to percpu area is shaped
@@ -1528,8 +1883,6 @@ static void pcpu_dump_alloc_info(const char *lvl,
 int __init pcpu_setup_first_chunk(const struct pcpu_alloc_info *ai,
 				  void *base_addr)
 {
-	static int smap[PERCPU_DYNAMIC_EARLY_SLOTS] __initdata;
-	static int dmap[PERCPU_DYNAMIC_EARLY_SLOTS] __initdata;
 	size_t dyn_size = ai->dyn_size;
 	size_t size_sum = ai->static_size + ai->reserved_size + dyn_size;
 	struct pcpu_chunk *schunk, *dchunk = NULL;
@@ -1644,57 +1997,29 @@ int __init pcpu_setup_first_chunk(const struct pcpu_alloc_info *ai,
 	 * covers static area + reserved area (mostly used for module
 	 * static percpu allocation).
 	 */
-	schunk = memblock_virt_alloc(pcpu_chunk_struct_size, 0);
-	INIT_LIST_HEAD(&schunk->list);
-	INIT_WORK(&schunk->map_extend_work, pcpu_map_extend_workfn);
-	schunk->base_addr = base_addr;
-	schunk->map = smap;
-	schunk->map_alloc = ARRAY_SIZE(smap);
-	schunk->immutable = true;
-	bitmap_fill(schunk->populated, pcpu_unit_pages);
-	schunk->nr_populated = pcpu_unit_pages;
-
 	if (ai->reserved_size) {
-		schunk->free_size = ai->reserved_size;
+		schunk = pcpu_alloc_first_chunk(base_addr, ai->static_size,
+						ai->reserved_size);
 		pcpu_reserved_chunk = schunk;
 		pcpu_reserved_chunk_limit = ai->static_size + ai->reserved_size;
 	} else {
-		schunk->free_size = dyn_size;
+		schunk = pcpu_alloc_first_chunk(base_addr, ai->static_size,
+						dyn_size);
 		dyn_size = 0;			/* dynamic area covered */
 	}
-	schunk->contig_hint = schunk->free_size;
-
-	schunk->map[0] = 1;
-	schunk->map[1] = ai->static_size;
-	schunk->map_used = 1;
-	if (schunk->free_size)
-		schunk->map[++schunk->map_used] = 1 | (ai->static_size + schunk->free_size);
-	else
-		schunk->map[1] |= 1;
 
 	/* init dynamic chunk if necessary */
-	if (dyn_size) {
-		dchunk = memblock_virt_alloc(pcpu_chunk_struct_size, 0);
-		INIT_LIST_HEAD(&dchunk->list);
-		INIT_WORK(&dchunk->map_extend_work, pcpu_map_extend_workfn);
-		dchunk->base_addr = base_addr;
-		dchunk->map = dmap;
-		dchunk->map_alloc = ARRAY_SIZE(dmap);
-		dchunk->immutable = true;
-		bitmap_fill(dchunk->populated, pcpu_unit_pages);
-		dchunk->nr_populated = pcpu_unit_pages;
-
-		dchunk->contig_hint = dchunk->free_size = dyn_size;
-		dchunk->map[0] = 1;
-		dchunk->map[1] = pcpu_reserved_chunk_limit;
-		dchunk->map[2] = (pcpu_reserved_chunk_limit + dchunk->free_size) | 1;
-		dchunk->map_used = 2;
-	}
+	if (dyn_size)
+		dchunk = pcpu_alloc_first_chunk(base_addr,
+						pcpu_reserved_chunk_limit,
+						dyn_size);
 
 	/* link the first chunk in */
 	pcpu_first_chunk = dchunk ?: schunk;
 	pcpu_nr_empty_pop_pages +=
-		pcpu_count_occupied_pages(pcpu_first_chunk, 1);
+		pcpu_count_occupied_pages(pcpu_first_chunk,
+			pcpu_first_chunk->first_bit,
+			pcpu_first_chunk->free_bytes / PCPU_MIN_ALLOC_SIZE);
 	pcpu_chunk_relocate(pcpu_first_chunk, -1);
 
 	/* we're done */
@@ -2252,36 +2577,6 @@ void __init setup_per_cpu_areas(void)
 
 #endif	/* CONFIG_SMP */
 
-/*
- * First and reserved chunks are initialized with temporary allocation
- * map in initdata so that they can be used before slab is online.
- * This function is called after slab is brought up and replaces those
- * with properly allocated maps.
- */
-void __init percpu_init_late(void)
-{
-	struct pcpu_chunk *target_chunks[] =
-		{ pcpu_first_chunk, pcpu_reserved_chunk, NULL };
-	struct pcpu_chunk *chunk;
-	unsigned long flags;
-	int i;
-
-	for (i = 0; (chunk = target_chunks[i]); i++) {
-		int *map;
-		const size_t size = PERCPU_DYNAMIC_EARLY_SLOTS * sizeof(map[0]);
-
-		BUILD_BUG_ON(size > PAGE_SIZE);
-
-		map = pcpu_mem_zalloc(size);
-		BUG_ON(!map);
-
-		spin_lock_irqsave(&pcpu_lock, flags);
-		memcpy(map, chunk->map, size);
-		chunk->map = map;
-		spin_unlock_irqrestore(&pcpu_lock, flags);
-	}
-}
-
 /*
  * Percpu allocator is initialized early during boot when neither slab or
  * workqueue is available.  Plug async management until everything is up
@@ -2290,6 +2585,7 @@ void __init percpu_init_late(void)
 static int __init percpu_enable_async(void)
 {
 	pcpu_async_enabled = true;
+	hotcpu_notifier(pcpu_cpu_notify, 0);
 	return 0;
 }
 subsys_initcall(percpu_enable_async);
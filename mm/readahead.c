@@ -20,6 +20,9 @@
 
 #include "internal.h"
 
+#define CREATE_TRACE_POINTS
+#include <trace/events/readahead.h>
+
 /*
  * Initialise a struct file's readahead state.  Assumes that the caller has
  * memset *ra to zero.
@@ -304,6 +307,12 @@ static unsigned long get_next_ra_size(struct file_ra_state *ra,
  * indicator. The flag won't be set on already cached pages, to avoid the
  * readahead-for-nothing fuss, saving pointless page cache lookups.
  *
+ * On top of that, the windows of up to RA_NR_STREAMS other streams are
+ * kept in ra->streams[].  When a read does not continue the current window
+ * but continues one of those, the two are swapped and that stream ramps up
+ * as if it had been alone.  Small random reads are recorded there too, so
+ * that the second read of a new interleaved stream already starts a window.
+ *
  * prev_pos tracks the last visited byte in the _previous_ read request.
  * It should be maintained by the caller, and will be used for detecting
  * small random reads. Note that the readahead algorithm checks loosely
@@ -337,6 +346,71 @@ static pgoff_t count_history_pages(struct address_space *mapping,
 	return offset - 1 - head;
 }
 
+/*
+ * Record a window in the stream table: the current one before it is
+ * replaced by the window of another stream, or a small random read that
+ * may turn out to be the start of a new stream.
+ */
+static void ra_save_stream(struct file_ra_state *ra, pgoff_t start,
+			   unsigned int size, unsigned int async_size)
+{
+	struct file_ra_stream *s;
+	unsigned int i;
+
+	if (!size)
+		return;
+
+	/* prefer a free slot, then the oldest one */
+	for (i = 0; i < RA_NR_STREAMS; i++)
+		if (!ra->streams[i].size)
+			break;
+	if (i == RA_NR_STREAMS)
+		i = ra->stream_next++ % RA_NR_STREAMS;
+
+	s = &ra->streams[i];
+	s->start = start;
+	s->size = size;
+	s->async_size = async_size;
+}
+
+/*
+ * Look for a saved stream that @offset continues: the expected callback
+ * offsets, as for the current window, or anywhere inside a window on a
+ * PG_readahead hit.  The matching stream is swapped with the current window,
+ * which gets saved in its place.
+ */
+static bool ra_switch_stream(struct file_ra_state *ra, pgoff_t offset,
+			     bool hit_readahead_marker)
+{
+	struct file_ra_stream *s, tmp;
+	unsigned int i;
+
+	for (i = 0; i < RA_NR_STREAMS; i++) {
+		s = &ra->streams[i];
+		if (!s->size)
+			continue;
+		if (offset == s->start + s->size ||
+		    (s->async_size &&
+		     offset == s->start + s->size - s->async_size))
+			break;
+		if (hit_readahead_marker && s->async_size &&
+		    offset >= s->start && offset < s->start + s->size)
+			break;
+	}
+	if (i == RA_NR_STREAMS)
+		return false;
+
+	tmp = *s;
+	s->start = ra->start;
+	s->size = ra->size;
+	s->async_size = ra->async_size;
+
+	ra->start = tmp.start;
+	ra->size = tmp.size;
+	ra->async_size = tmp.async_size;
+	return true;
+}
+
 /*
  * page cache context based read-ahead
  */
@@ -364,6 +438,7 @@ static int try_context_readahead(struct address_space *mapping,
 	if (size >= offset)
 		size *= 2;
 
+	ra_save_stream(ra, ra->start, ra->size, ra->async_size);
 	ra->start = offset;
 	ra->size = min(size + req_size, max);
 	ra->async_size = 1;
@@ -382,6 +457,7 @@ ondemand_readahead(struct address_space *mapping,
 {
 	unsigned long max = max_sane_readahead(ra->ra_pages);
 	pgoff_t prev_offset;
+	int pattern;
 
 	/*
 	 * start of file
@@ -395,7 +471,26 @@ ondemand_readahead(struct address_space *mapping,
 	 */
 	if ((offset == (ra->start + ra->size - ra->async_size) ||
 	     offset == (ra->start + ra->size))) {
+		pattern = RA_PATTERN_WINDOW;
+		goto next_window;
+	}
+
+	/*
+	 * Another stream on the same file, e.g. several threads doing
+	 * pread() on a shared fd: continue its own window rather than
+	 * letting the streams reset each other to small reads.
+	 */
+	if (ra_switch_stream(ra, offset, hit_readahead_marker)) {
+		pattern = RA_PATTERN_STREAM;
+		/* the stream so far was a single small read */
+		if (!ra->async_size)
+			goto initial_window;
+		if (!ra_has_index(ra, offset) ||
+		    offset == ra->start + ra->size - ra->async_size)
+			goto next_window;
+		/* marker hit inside the window, ramp up from the marker */
 		ra->start += ra->size;
+		ra->size = ra->start - offset + req_size;
 		ra->size = get_next_ra_size(ra, max);
 		ra->async_size = ra->size;
 		goto readit;
@@ -417,11 +512,13 @@ ondemand_readahead(struct address_space *mapping,
 		if (!start || start - offset > max)
 			return 0;
 
+		ra_save_stream(ra, ra->start, ra->size, ra->async_size);
 		ra->start = start;
 		ra->size = start - offset;	/* old async_size */
 		ra->size += req_size;
 		ra->size = get_next_ra_size(ra, max);
 		ra->async_size = ra->size;
+		pattern = RA_PATTERN_MARKER;
 		goto readit;
 	}
 
@@ -444,16 +541,32 @@ ondemand_readahead(struct address_space *mapping,
 	 * Query the page cache and look for the traces(cached history pages)
 	 * that a sequential stream would leave behind.
 	 */
-	if (try_context_readahead(mapping, ra, offset, req_size, max))
+	if (try_context_readahead(mapping, ra, offset, req_size, max)) {
+		pattern = RA_PATTERN_CONTEXT;
 		goto readit;
+	}
 
 	/*
 	 * standalone, small random read
-	 * Read as is, and do not pollute the readahead state.
+	 * Read as is, and do not pollute the readahead state.  Remember it
+	 * in the stream table though, so that the next read of an
+	 * interleaved sequential stream is recognised as such.
 	 */
+	ra_save_stream(ra, offset, req_size, 0);
+	trace_mm_readahead(mapping, ra, offset, req_size,
+			   hit_readahead_marker, RA_PATTERN_RANDOM);
 	return __do_page_cache_readahead(mapping, filp, offset, req_size, 0);
 
+next_window:
+	ra->start += ra->size;
+	ra->size = get_next_ra_size(ra, max);
+	ra->async_size = ra->size;
+	goto readit;
+
 initial_readahead:
+	ra_save_stream(ra, ra->start, ra->size, ra->async_size);
+	pattern = RA_PATTERN_INITIAL;
+initial_window:
 	ra->start = offset;
 	ra->size = get_init_ra_size(req_size, max);
 	ra->async_size = ra->size > req_size ? ra->size - req_size : ra->size;
@@ -469,6 +582,8 @@ readit:
 		ra->size += ra->async_size;
 	}
 
+	trace_mm_readahead(mapping, ra, offset, req_size,
+			   hit_readahead_marker, pattern);
 	return ra_submit(ra, mapping, filp);
 }
 
@@ -21,7 +21,7 @@
 #include <linux/debugobjects.h>
 #include <linux/kallsyms.h>
 #include <linux/list.h>
-#include <linux/rbtree.h>
+#include <linux/rbtree_augmented.h>
 #include <linux/radix-tree.h>
 #include <linux/rcupdate.h>
 #include <linux/pfn.h>
@@ -270,17 +270,15 @@ EXPORT_SYMBOL(vmalloc_to_pfn);
 #define VM_LAZY_FREE	0x01
 #define VM_LAZY_FREEING	0x02
 #define VM_VM_AREA	0x04
+#define VM_PCPU_CACHED	0x08
 
 static DEFINE_SPINLOCK(vmap_area_lock);
 /* Export for kexec only */
 LIST_HEAD(vmap_area_list);
 static struct rb_root vmap_area_root = RB_ROOT;
 
-/* The vmap cache globals are protected by vmap_area_lock */
-static struct rb_node *free_vmap_cache;
-static unsigned long cached_hole_size;
-static unsigned long cached_vstart;
-static unsigned long cached_align;
+/* Lazily freed areas waiting for a TLB flush */
+static LLIST_HEAD(vmap_purge_list);
 
 static unsigned long vmap_area_pcpu_hole;
 
@@ -303,11 +301,63 @@ static struct vmap_area *__find_vmap_area(unsigned long addr)
 	return NULL;
 }
 
+static inline struct vmap_area *prev_vmap_area(struct vmap_area *va)
+{
+	if (va->list.prev == &vmap_area_list)
+		return NULL;
+	return list_entry(va->list.prev, struct vmap_area, list);
+}
+
+static inline struct vmap_area *next_vmap_area(struct vmap_area *va)
+{
+	if (list_is_last(&va->list, &vmap_area_list))
+		return NULL;
+	return list_entry(va->list.next, struct vmap_area, list);
+}
+
+/*
+ * The rbtree is augmented with the largest hole preceding any area in each
+ * subtree, the same way the vma tree tracks rb_subtree_gap, so that
+ * alloc_vmap_area() can find the lowest fitting hole in O(log n) instead of
+ * walking every area below it.
+ */
+static unsigned long vmap_compute_subtree_gap(struct vmap_area *va)
+{
+	struct vmap_area *prev = prev_vmap_area(va);
+	unsigned long max, subtree_gap;
+
+	max = va->va_start;
+	if (prev)
+		max -= prev->va_end;
+	if (va->rb_node.rb_left) {
+		subtree_gap = rb_entry(va->rb_node.rb_left,
+				struct vmap_area, rb_node)->subtree_max_gap;
+		if (subtree_gap > max)
+			max = subtree_gap;
+	}
+	if (va->rb_node.rb_right) {
+		subtree_gap = rb_entry(va->rb_node.rb_right,
+				struct vmap_area, rb_node)->subtree_max_gap;
+		if (subtree_gap > max)
+			max = subtree_gap;
+	}
+	return max;
+}
+
+RB_DECLARE_CALLBACKS(static, vmap_gap_callbacks, struct vmap_area, rb_node,
+		     unsigned long, subtree_max_gap, vmap_compute_subtree_gap)
+
+static void vmap_gap_update(struct vmap_area *va)
+{
+	vmap_gap_callbacks_propagate(&va->rb_node, NULL);
+}
+
 static void __insert_vmap_area(struct vmap_area *va)
 {
 	struct rb_node **p = &vmap_area_root.rb_node;
 	struct rb_node *parent = NULL;
 	struct rb_node *tmp;
+	struct vmap_area *next;
 
 	while (*p) {
 		struct vmap_area *tmp_va;
@@ -322,8 +372,9 @@ static void __insert_vmap_area(struct vmap_area *va)
 			BUG();
 	}
 
+	/* as __vma_link_rb(): the propagation below may read it */
+	va->subtree_max_gap = 0;
 	rb_link_node(&va->rb_node, parent, p);
-	rb_insert_color(&va->rb_node, &vmap_area_root);
 
 	/* address-sort this list */
 	tmp = rb_prev(&va->rb_node);
@@ -333,9 +384,112 @@ static void __insert_vmap_area(struct vmap_area *va)
 		list_add_rcu(&va->list, &prev->list);
 	} else
 		list_add_rcu(&va->list, &vmap_area_list);
+
+	/* The hole before the next area shrinks, ours is new */
+	next = next_vmap_area(va);
+	if (next)
+		vmap_gap_update(next);
+	vmap_gap_update(va);
+	rb_insert_augmented(&va->rb_node, &vmap_area_root, &vmap_gap_callbacks);
+}
+
+/*
+ * Find the lowest address in [vstart, vend) where @size bytes aligned to
+ * @align fit, following unmapped_area().  The search length includes the
+ * worst case alignment overhead, so a hole that only fits with a lucky
+ * alignment can be missed.  Returns vend if nothing fits.
+ */
+static unsigned long __find_vmap_lowest_match(unsigned long size,
+				unsigned long align,
+				unsigned long vstart, unsigned long vend)
+{
+	struct vmap_area *va, *prev;
+	unsigned long length, low_limit, high_limit, gap_start, gap_end;
+	struct rb_node *last;
+
+	/* areas are page aligned, the rest of the alignment may be wasted */
+	length = size;
+	if (align > PAGE_SIZE)
+		length += align - PAGE_SIZE;
+	if (length < size || vend < length)
+		return vend;
+
+	high_limit = vend - length;
+	if (vstart > high_limit)
+		return vend;
+	low_limit = vstart + length;
+
+	/* Check if rbtree root looks promising */
+	if (RB_EMPTY_ROOT(&vmap_area_root))
+		goto check_highest;
+	va = rb_entry(vmap_area_root.rb_node, struct vmap_area, rb_node);
+	if (va->subtree_max_gap < length)
+		goto check_highest;
+
+	while (true) {
+		/* Visit left subtree if it looks promising */
+		gap_end = va->va_start;
+		if (gap_end >= low_limit && va->rb_node.rb_left) {
+			struct vmap_area *left = rb_entry(va->rb_node.rb_left,
+						struct vmap_area, rb_node);
+			if (left->subtree_max_gap >= length) {
+				va = left;
+				continue;
+			}
+		}
+
+		prev = prev_vmap_area(va);
+		gap_start = prev ? prev->va_end : 0;
+check_current:
+		/* Check if current node has a suitable gap */
+		if (gap_start > high_limit)
+			return vend;
+		if (gap_end >= low_limit && gap_end - gap_start >= length)
+			goto found;
+
+		/* Visit right subtree if it looks promising */
+		if (va->rb_node.rb_right) {
+			struct vmap_area *right = rb_entry(va->rb_node.rb_right,
+						struct vmap_area, rb_node);
+			if (right->subtree_max_gap >= length) {
+				va = right;
+				continue;
+			}
+		}
+
+		/* Go back up the rbtree to find next candidate node */
+		while (true) {
+			struct rb_node *node = &va->rb_node;
+
+			if (!rb_parent(node))
+				goto check_highest;
+			va = rb_entry(rb_parent(node), struct vmap_area, rb_node);
+			if (node == va->rb_node.rb_left) {
+				gap_start = prev_vmap_area(va)->va_end;
+				gap_end = va->va_start;
+				goto check_current;
+			}
+		}
+	}
+
+check_highest:
+	/* Check the hole above the last area */
+	last = rb_last(&vmap_area_root);
+	gap_start = last ? rb_entry(last, struct vmap_area, rb_node)->va_end : 0;
+	if (gap_start > high_limit)
+		return vend;
+
+found:
+	if (gap_start < vstart)
+		gap_start = vstart;
+	return ALIGN(gap_start, align);
 }
 
 static void purge_vmap_area_lazy(void);
+static struct vmap_area *vmap_cache_get(unsigned long size,
+				unsigned long align,
+				unsigned long vstart, unsigned long vend);
+static void vmap_cache_drain_all(void);
 
 /*
  * Allocate a region of KVA of the specified size and alignment, within the
@@ -347,15 +501,17 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 				int node, gfp_t gfp_mask)
 {
 	struct vmap_area *va;
-	struct rb_node *n;
 	unsigned long addr;
 	int purged = 0;
-	struct vmap_area *first;
 
 	BUG_ON(!size);
 	BUG_ON(size & ~PAGE_MASK);
 	BUG_ON(!is_power_of_2(align));
 
+	va = vmap_cache_get(size, align, vstart, vend);
+	if (va)
+		return va;
+
 	va = kmalloc_node(sizeof(struct vmap_area),
 			gfp_mask & GFP_RECLAIM_MASK, node);
 	if (unlikely(!va))
@@ -369,84 +525,14 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 
 retry:
 	spin_lock(&vmap_area_lock);
-	/*
-	 * Invalidate cache if we have more permissive parameters.
-	 * cached_hole_size notes the largest hole noticed _below_
-	 * the vmap_area cached in free_vmap_cache: if size fits
-	 * into that hole, we want to scan from vstart to reuse
-	 * the hole instead of allocating above free_vmap_cache.
-	 * Note that __free_vmap_area may update free_vmap_cache
-	 * without updating cached_hole_size or cached_align.
-	 */
-	if (!free_vmap_cache ||
-			size < cached_hole_size ||
-			vstart < cached_vstart ||
-			align < cached_align) {
-nocache:
-		cached_hole_size = 0;
-		free_vmap_cache = NULL;
-	}
-	/* record if we encounter less permissive parameters */
-	cached_vstart = vstart;
-	cached_align = align;
-
-	/* find starting point for our search */
-	if (free_vmap_cache) {
-		first = rb_entry(free_vmap_cache, struct vmap_area, rb_node);
-		addr = ALIGN(first->va_end, align);
-		if (addr < vstart)
-			goto nocache;
-		if (addr + size < addr)
-			goto overflow;
-
-	} else {
-		addr = ALIGN(vstart, align);
-		if (addr + size < addr)
-			goto overflow;
-
-		n = vmap_area_root.rb_node;
-		first = NULL;
-
-		while (n) {
-			struct vmap_area *tmp;
-			tmp = rb_entry(n, struct vmap_area, rb_node);
-			if (tmp->va_end >= addr) {
-				first = tmp;
-				if (tmp->va_start <= addr)
-					break;
-				n = n->rb_left;
-			} else
-				n = n->rb_right;
-		}
-
-		if (!first)
-			goto found;
-	}
-
-	/* from the starting point, walk areas until a suitable hole is found */
-	while (addr + size > first->va_start && addr + size <= vend) {
-		if (addr + cached_hole_size < first->va_start)
-			cached_hole_size = first->va_start - addr;
-		addr = ALIGN(first->va_end, align);
-		if (addr + size < addr)
-			goto overflow;
-
-		if (list_is_last(&first->list, &vmap_area_list))
-			goto found;
-
-		first = list_entry(first->list.next,
-				struct vmap_area, list);
-	}
-
-found:
-	if (addr + size > vend)
+	addr = __find_vmap_lowest_match(size, align, vstart, vend);
+	if (addr == vend)
 		goto overflow;
 
 	va->va_start = addr;
 	va->va_end = addr + size;
 	va->flags = 0;
 	__insert_vmap_area(va);
-	free_vmap_cache = &va->rb_node;
 	spin_unlock(&vmap_area_lock);
 
 	BUG_ON(va->va_start & (align-1));
@@ -459,6 +545,7 @@ overflow:
 	spin_unlock(&vmap_area_lock);
 	if (!purged) {
 		purge_vmap_area_lazy();
+		vmap_cache_drain_all();
 		purged = 1;
 		goto retry;
 	}
@@ -471,27 +558,19 @@ overflow:
 
 static void __free_vmap_area(struct vmap_area *va)
 {
+	struct vmap_area *next;
+
 	BUG_ON(RB_EMPTY_NODE(&va->rb_node));
 
-	if (free_vmap_cache) {
-		if (va->va_end < cached_vstart) {
-			free_vmap_cache = NULL;
-		} else {
-			struct vmap_area *cache;
-			cache = rb_entry(free_vmap_cache, struct vmap_area, rb_node);
-			if (va->va_start <= cache->va_start) {
-				free_vmap_cache = rb_prev(&va->rb_node);
-				/*
-				 * We don't try to update cached_hole_size or
-				 * cached_align, but it won't go very wrong.
-				 */
-			}
-		}
-	}
-	rb_erase(&va->rb_node, &vmap_area_root);
+	next = next_vmap_area(va);
+	rb_erase_augmented(&va->rb_node, &vmap_area_root, &vmap_gap_callbacks);
 	RB_CLEAR_NODE(&va->rb_node);
 	list_del_rcu(&va->list);
 
+	/* The hole before the next area grew by ours */
+	if (next)
+		vmap_gap_update(next);
+
 	/*
 	 * Track the highest possible candidate for pcpu area
 	 * allocation.  Areas outside of vmalloc area can be returned
@@ -570,6 +649,130 @@ static unsigned long lazy_max_pages(void)
 
 static atomic_t vmap_lazy_nr = ATOMIC_INIT(0);
 
+/*** Per cpu cache of free vmap areas ***/
+
+/*
+ * Small areas freed from the vmalloc range are not handed back to the
+ * rbtree right away.  Once the lazy purge has flushed them, they go to a
+ * cache on the purging cpu, still reserved in the tree, and
+ * alloc_vmap_area() reuses them for requests of the same size without
+ * taking vmap_area_lock or allocating a new vmap_area.
+ */
+#define VMAP_CACHE_MAX_PAGES	16	/* 60K vmalloc() with 4K pages */
+#define VMAP_CACHE_DEPTH	4
+#define VMAP_CACHE_MIN_SPACE	(128UL << 20)	/* of vmalloc space per cpu */
+
+struct vmap_area_cache {
+	spinlock_t lock;
+	unsigned int nr[VMAP_CACHE_MAX_PAGES];
+	struct llist_node *free[VMAP_CACHE_MAX_PAGES];
+};
+
+static DEFINE_PER_CPU(struct vmap_area_cache, vmap_area_cache);
+static bool vmap_cache_enabled __read_mostly;
+
+static int vmap_cache_index(unsigned long size, unsigned long align,
+			    unsigned long vstart, unsigned long vend)
+{
+	if (!vmap_cache_enabled || align > PAGE_SIZE ||
+	    vstart != VMALLOC_START || vend != VMALLOC_END ||
+	    size > (VMAP_CACHE_MAX_PAGES << PAGE_SHIFT))
+		return -1;
+	return (size >> PAGE_SHIFT) - 1;
+}
+
+static struct vmap_area *vmap_cache_get(unsigned long size,
+				unsigned long align,
+				unsigned long vstart, unsigned long vend)
+{
+	int idx = vmap_cache_index(size, align, vstart, vend);
+	struct vmap_area_cache *vc;
+	struct vmap_area *va = NULL;
+
+	if (idx < 0)
+		return NULL;
+
+	vc = get_cpu_ptr(&vmap_area_cache);
+	spin_lock(&vc->lock);
+	if (vc->free[idx]) {
+		va = llist_entry(vc->free[idx], struct vmap_area, purge_list);
+		vc->free[idx] = va->purge_list.next;
+		vc->nr[idx]--;
+		va->flags = 0;
+	}
+	spin_unlock(&vc->lock);
+	put_cpu_ptr(&vmap_area_cache);
+
+	return va;
+}
+
+/*
+ * Keep a purged area for reuse if it is a cacheable size and the local
+ * cache has room.  The area must be unmapped and flushed.
+ */
+static bool vmap_cache_put(struct vmap_area *va)
+{
+	int idx = vmap_cache_index(va->va_end - va->va_start, PAGE_SIZE,
+				   VMALLOC_START, VMALLOC_END);
+	struct vmap_area_cache *vc;
+	bool cached = false;
+
+	if (idx < 0 || va->va_start < VMALLOC_START ||
+	    va->va_end > VMALLOC_END)
+		return false;
+
+	vc = get_cpu_ptr(&vmap_area_cache);
+	spin_lock(&vc->lock);
+	if (vc->nr[idx] < VMAP_CACHE_DEPTH) {
+		va->flags = VM_PCPU_CACHED;
+		va->vm = NULL;
+		va->purge_list.next = vc->free[idx];
+		vc->free[idx] = &va->purge_list;
+		vc->nr[idx]++;
+		cached = true;
+	}
+	spin_unlock(&vc->lock);
+	put_cpu_ptr(&vmap_area_cache);
+
+	return cached;
+}
+
+/* Give all cached areas back to the rbtree, when vmalloc space runs out */
+static void vmap_cache_drain_all(void)
+{
+	struct llist_node *head = NULL;
+	struct vmap_area *va, *n_va;
+	int cpu, i;
+
+	if (!vmap_cache_enabled)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct vmap_area_cache *vc = per_cpu_ptr(&vmap_area_cache, cpu);
+
+		spin_lock(&vc->lock);
+		for (i = 0; i < VMAP_CACHE_MAX_PAGES; i++) {
+			while (vc->free[i]) {
+				struct llist_node *node = vc->free[i];
+
+				vc->free[i] = node->next;
+				node->next = head;
+				head = node;
+			}
+			vc->nr[i] = 0;
+		}
+		spin_unlock(&vc->lock);
+	}
+
+	if (!head)
+		return;
+
+	spin_lock(&vmap_area_lock);
+	llist_for_each_entry_safe(va, n_va, head, purge_list)
+		__free_vmap_area(va);
+	spin_unlock(&vmap_area_lock);
+}
+
 /* for per-CPU blocks */
 static void purge_fragmented_blocks_allcpus(void);
 
@@ -596,7 +799,7 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 					int sync, int force_flush)
 {
 	static DEFINE_SPINLOCK(purge_lock);
-	LIST_HEAD(valist);
+	struct llist_node *valist, *tofree = NULL;
 	struct vmap_area *va;
 	struct vmap_area *n_va;
 	int nr = 0;
@@ -615,20 +818,16 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 	if (sync)
 		purge_fragmented_blocks_allcpus();
 
-	rcu_read_lock();
-	list_for_each_entry_rcu(va, &vmap_area_list, list) {
-		if (va->flags & VM_LAZY_FREE) {
-			if (va->va_start < *start)
-				*start = va->va_start;
-			if (va->va_end > *end)
-				*end = va->va_end;
-			nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
-			list_add_tail(&va->purge_list, &valist);
-			va->flags |= VM_LAZY_FREEING;
-			va->flags &= ~VM_LAZY_FREE;
-		}
+	valist = llist_del_all(&vmap_purge_list);
+	llist_for_each_entry(va, valist, purge_list) {
+		if (va->va_start < *start)
+			*start = va->va_start;
+		if (va->va_end > *end)
+			*end = va->va_end;
+		nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
+		va->flags |= VM_LAZY_FREEING;
+		va->flags &= ~VM_LAZY_FREE;
 	}
-	rcu_read_unlock();
 
 	if (nr)
 		atomic_sub(nr, &vmap_lazy_nr);
@@ -637,8 +836,15 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 		flush_tlb_kernel_range(*start, *end);
 
 	if (nr) {
+		llist_for_each_entry_safe(va, n_va, valist, purge_list) {
+			if (vmap_cache_put(va))
+				continue;
+			va->purge_list.next = tofree;
+			tofree = &va->purge_list;
+		}
+
 		spin_lock(&vmap_area_lock);
-		list_for_each_entry_safe(va, n_va, &valist, purge_list)
+		llist_for_each_entry_safe(va, n_va, tofree, purge_list)
 			__free_vmap_area(va);
 		spin_unlock(&vmap_area_lock);
 	}
@@ -666,17 +872,37 @@ static void purge_vmap_area_lazy(void)
 	__purge_vmap_area_lazy(&start, &end, 1, 0);
 }
 
+static void purge_vmap_area_lazy_work(struct work_struct *work)
+{
+	try_purge_vmap_area_lazy();
+}
+
+static DECLARE_WORK(purge_vmap_work, purge_vmap_area_lazy_work);
+
 /*
  * Free a vmap area, caller ensuring that the area has been unmapped
  * and flush_cache_vunmap had been called for the correct range
  * previously.
+ *
+ * The purge, with its global TLB flush, is left to a worker so that the
+ * cpu which crossed lazy_max_pages() does not pay for everybody else's
+ * frees.  Only if the worker falls far behind do we purge here.
  */
 static void free_vmap_area_noflush(struct vmap_area *va)
 {
+	int nr_lazy;
+
 	va->flags |= VM_LAZY_FREE;
-	atomic_add((va->va_end - va->va_start) >> PAGE_SHIFT, &vmap_lazy_nr);
-	if (unlikely(atomic_read(&vmap_lazy_nr) > lazy_max_pages()))
-		try_purge_vmap_area_lazy();
+	nr_lazy = atomic_add_return((va->va_end - va->va_start) >> PAGE_SHIFT,
+				    &vmap_lazy_nr);
+	llist_add(&va->purge_list, &vmap_purge_list);
+
+	if (unlikely(nr_lazy > lazy_max_pages())) {
+		if (nr_lazy > 2 * lazy_max_pages())
+			try_purge_vmap_area_lazy();
+		else
+			schedule_work(&purge_vmap_work);
+	}
 }
 
 /*
@@ -1189,8 +1415,13 @@ void __init vmalloc_init(void)
 		p = &per_cpu(vfree_deferred, i);
 		init_llist_head(&p->list);
 		INIT_WORK(&p->wq, free_work);
+		spin_lock_init(&per_cpu(vmap_area_cache, i).lock);
 	}
 
+	/* Don't let the caches tie up a noticeable part of a small space */
+	vmap_cache_enabled = VMALLOC_TOTAL / num_possible_cpus() >=
+			     VMAP_CACHE_MIN_SPACE;
+
 	/* Import existing vmlist entries. */
 	for (tmp = vmlist; tmp; tmp = tmp->next) {
 		va = kzalloc(sizeof(struct vmap_area), GFP_NOWAIT);
@@ -1550,6 +1781,9 @@ void *vmap(struct page **pages, unsigned int count,
 }
 EXPORT_SYMBOL(vmap);
 
+/* Pages allocated per batch when populating a vmalloc area */
+#define VMALLOC_BULK_PAGES	100U
+
 static void *__vmalloc_node(unsigned long size, unsigned long align,
 			    gfp_t gfp_mask, pgprot_t prot,
 			    int node, const void *caller);
@@ -1558,7 +1792,7 @@ static void *__vmalloc_area_node(struct vm_struct *area, gfp_t gfp_mask,
 {
 	const int order = 0;
 	struct page **pages;
-	unsigned int nr_pages, array_size, i;
+	unsigned int nr_pages, array_size, i, nr;
 	const gfp_t nested_gfp = (gfp_mask & GFP_RECLAIM_MASK) | __GFP_ZERO;
 	const gfp_t alloc_mask = gfp_mask | __GFP_NOWARN;
 
@@ -1581,20 +1815,24 @@ static void *__vmalloc_area_node(struct vm_struct *area, gfp_t gfp_mask,
 		return NULL;
 	}
 
-	for (i = 0; i < area->nr_pages; i++) {
-		struct page *page;
+	/*
+	 * Allocate in batches off the per-cpu lists, but bounded so that
+	 * interrupts are not kept off for long and we can reschedule.
+	 */
+	for (i = 0; i < area->nr_pages; i += nr) {
+		unsigned int want = min(area->nr_pages - i, VMALLOC_BULK_PAGES);
 
 		if (node == NUMA_NO_NODE)
-			page = alloc_page(alloc_mask);
+			nr = alloc_pages_bulk(alloc_mask, want, pages + i);
 		else
-			page = alloc_pages_node(node, alloc_mask, order);
+			nr = alloc_pages_bulk_node(node, alloc_mask, want,
+						   pages + i);
 
-		if (unlikely(!page)) {
-			/* Successfully allocated i pages, free them in __vunmap() */
-			area->nr_pages = i;
+		if (unlikely(nr < want)) {
+			/* Successfully allocated i + nr pages, free them in __vunmap() */
+			area->nr_pages = i + nr;
 			goto fail;
 		}
-		area->pages[i] = page;
 		if (gfp_mask & __GFP_WAIT)
 			cond_resched();
 	}
@@ -2695,7 +2933,8 @@ void get_vmalloc_info(struct vmalloc_info *vmi)
 		if (addr >= VMALLOC_END)
 			break;
 
-		if (va->flags & (VM_LAZY_FREE | VM_LAZY_FREEING))
+		if (va->flags & (VM_LAZY_FREE | VM_LAZY_FREEING |
+				 VM_PCPU_CACHED))
 			continue;
 
 		vmi->used += (va->va_end - va->va_start);
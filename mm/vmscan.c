@@ -759,6 +759,17 @@ static enum page_references page_check_references(struct page *page,
 	int referenced_ptes, referenced_page;
 	unsigned long vm_flags;
 
+	/*
+	 * With the multigenerational LRU, aging has harvested the accessed
+	 * bits from the page tables already.  Skip the rmap walk and leave
+	 * pages that were used since to the young check in try_to_unmap().
+	 */
+	if (lru_gen_enabled()) {
+		if (TestClearPageReferenced(page) && !PageSwapBacked(page))
+			return PAGEREF_RECLAIM_CLEAN;
+		return PAGEREF_RECLAIM;
+	}
+
 	referenced_ptes = page_referenced(page, 1, sc->target_mem_cgroup,
 					  &vm_flags);
 	referenced_page = TestClearPageReferenced(page);
@@ -1290,6 +1301,544 @@ int __isolate_lru_page(struct page *page, isolate_mode_t mode)
 	return ret;
 }
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * Multigenerational LRU
+ *
+ * Instead of deciding page by page through the rmap whether a page on the
+ * inactive list has been used, aging walks the page tables of all mms,
+ * which finds the accessed pages with far better locality, and moves them
+ * to the youngest generation of their lruvec before starting a new one.
+ * Eviction then takes pages from the tail of the oldest generation.
+ */
+
+struct static_key lru_gen_key = STATIC_KEY_INIT_FALSE;
+
+/* Serializes switching between the classic and the generation lists */
+static DEFINE_MUTEX(lru_gen_state_mutex);
+
+/* All mms, in the order the page table walk visits them */
+static LIST_HEAD(lru_gen_mm_list);
+static DEFINE_SPINLOCK(lru_gen_mm_lock);
+
+#define LRU_GEN_WALK_BATCH	64
+
+/* One walk over the mm list at a time; the walk state below is shared */
+static DEFINE_MUTEX(lru_gen_walk_mutex);
+static unsigned long lru_gen_walk_seq;
+static unsigned long lru_gen_last_walk;
+static struct page *lru_gen_walk_batch[LRU_GEN_WALK_BATCH];
+static int lru_gen_walk_nr;
+
+static unsigned int lru_gen_min_walk_interval_ms = 100;
+
+void lru_gen_add_mm(struct mm_struct *mm)
+{
+	mm->lru_gen_seq = 0;
+	spin_lock(&lru_gen_mm_lock);
+	list_add(&mm->lru_gen_list, &lru_gen_mm_list);
+	spin_unlock(&lru_gen_mm_lock);
+}
+
+void lru_gen_del_mm(struct mm_struct *mm)
+{
+	spin_lock(&lru_gen_mm_lock);
+	list_del(&mm->lru_gen_list);
+	spin_unlock(&lru_gen_mm_lock);
+
+	/* Wait for a walk that took mmap_sem before mm_users dropped to 0 */
+	down_write(&mm->mmap_sem);
+	up_write(&mm->mmap_sem);
+}
+
+/*
+ * Returns the next mm not yet visited by walk pass @seq, with a reference
+ * on mm_count, or NULL once every mm on the list has been visited.
+ */
+static struct mm_struct *lru_gen_next_mm(unsigned long seq)
+{
+	struct mm_struct *mm = NULL;
+
+	spin_lock(&lru_gen_mm_lock);
+	while (!list_empty(&lru_gen_mm_list)) {
+		struct mm_struct *next = list_first_entry(&lru_gen_mm_list,
+					struct mm_struct, lru_gen_list);
+
+		if (next->lru_gen_seq == seq)
+			break;
+
+		next->lru_gen_seq = seq;
+		list_move_tail(&next->lru_gen_list, &lru_gen_mm_list);
+		if (atomic_read(&next->mm_users)) {
+			atomic_inc(&next->mm_count);
+			mm = next;
+			break;
+		}
+	}
+	spin_unlock(&lru_gen_mm_lock);
+
+	return mm;
+}
+
+/* Moves the accessed pages collected by the walk to their youngest gen */
+static void lru_gen_walk_flush(void)
+{
+	struct zone *zone = NULL;
+	unsigned long flags = 0;
+	int i;
+
+	for (i = 0; i < lru_gen_walk_nr; i++) {
+		struct page *page = lru_gen_walk_batch[i];
+		struct zone *pagezone = page_zone(page);
+		struct lruvec *lruvec;
+		int type, gen, new_gen;
+
+		if (pagezone != zone) {
+			if (zone)
+				spin_unlock_irqrestore(&zone->lru_lock, flags);
+			zone = pagezone;
+			spin_lock_irqsave(&zone->lru_lock, flags);
+		}
+
+		gen = page_lru_gen(page);
+		if (!PageLRU(page) || gen < 0)
+			continue;
+
+		lruvec = mem_cgroup_page_lruvec(page, zone);
+		type = page_is_file_cache(page);
+		new_gen = lru_gen_from_seq(lruvec->lrugen.max_seq[type]);
+		if (gen != new_gen) {
+			int nr_pages = hpage_nr_pages(page);
+
+			lru_gen_update_size(lruvec, type, gen, -nr_pages);
+			lru_gen_update_size(lruvec, type, new_gen, nr_pages);
+			lru_gen_set_page_gen(page, new_gen);
+		}
+		list_move(&page->lru, &lruvec->lrugen.lists[new_gen][type]);
+	}
+	if (zone)
+		spin_unlock_irqrestore(&zone->lru_lock, flags);
+
+	release_pages(lru_gen_walk_batch, lru_gen_walk_nr, false);
+	lru_gen_walk_nr = 0;
+}
+
+static void lru_gen_walk_add(struct page *page)
+{
+	get_page(page);
+	lru_gen_walk_batch[lru_gen_walk_nr++] = page;
+	if (lru_gen_walk_nr == LRU_GEN_WALK_BATCH)
+		lru_gen_walk_flush();
+}
+
+static int lru_gen_walk_pmd_range(pmd_t *pmd, unsigned long addr,
+				  unsigned long end, struct mm_walk *walk)
+{
+	struct vm_area_struct *vma = walk->vma;
+	spinlock_t *ptl;
+	pte_t *pte;
+
+	if (pmd_trans_huge_lock(pmd, vma, &ptl) == 1) {
+		if (pmdp_test_and_clear_young(vma, addr, pmd))
+			lru_gen_walk_add(pmd_page(*pmd));
+		spin_unlock(ptl);
+		return 0;
+	}
+
+	if (pmd_trans_unstable(pmd))
+		return 0;
+
+	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
+	for (; addr != end; pte++, addr += PAGE_SIZE) {
+		pte_t ptent = *pte;
+		struct page *page;
+
+		if (!pte_present(ptent) || !pte_young(ptent))
+			continue;
+
+		page = vm_normal_page(vma, addr, ptent);
+		if (!page || !PageLRU(page))
+			continue;
+
+		if (ptep_test_and_clear_young(vma, addr, pte))
+			lru_gen_walk_add(page);
+	}
+	pte_unmap_unlock(pte - 1, ptl);
+	cond_resched();
+	return 0;
+}
+
+static int lru_gen_walk_test(unsigned long start, unsigned long end,
+			     struct mm_walk *walk)
+{
+	if (walk->vma->vm_flags & (VM_LOCKED | VM_PFNMAP | VM_IO | VM_HUGETLB))
+		return 1;
+	return 0;
+}
+
+static void lru_gen_walk_mm(struct mm_struct *mm)
+{
+	struct mm_walk walk = {
+		.pmd_entry = lru_gen_walk_pmd_range,
+		.test_walk = lru_gen_walk_test,
+		.mm = mm,
+	};
+
+	if (!down_read_trylock(&mm->mmap_sem))
+		return;
+
+	/*
+	 * Once mm_users is 0, lru_gen_del_mm() may already have synchronized
+	 * with mmap_sem, and exit_mmap() tears down the page tables without
+	 * it.  Otherwise lru_gen_del_mm() waits for us.
+	 */
+	if (atomic_read(&mm->mm_users))
+		walk_page_range(0, mm->highest_vm_end, &walk);
+
+	up_read(&mm->mmap_sem);
+}
+
+/*
+ * Walks the page tables of every mm, clearing the accessed bits and moving
+ * the pages found accessed to the youngest generation.  Concurrent callers
+ * do not wait for a walk in progress, and walks are spaced at least
+ * lru_gen_min_walk_interval_ms apart, so that reclaim on many cpus does not
+ * turn into a storm of page table walks.
+ */
+static void lru_gen_walk_mm_list(void)
+{
+	struct mm_struct *mm;
+
+	if (!mutex_trylock(&lru_gen_walk_mutex))
+		return;
+
+	if (lru_gen_last_walk &&
+	    time_before(jiffies, lru_gen_last_walk +
+			msecs_to_jiffies(lru_gen_min_walk_interval_ms)))
+		goto unlock;
+
+	lru_gen_walk_seq++;
+	while ((mm = lru_gen_next_mm(lru_gen_walk_seq))) {
+		lru_gen_walk_mm(mm);
+		mmdrop(mm);
+		cond_resched();
+	}
+	if (lru_gen_walk_nr)
+		lru_gen_walk_flush();
+	lru_gen_last_walk = jiffies;
+unlock:
+	mutex_unlock(&lru_gen_walk_mutex);
+}
+
+/*
+ * Retires the empty oldest generations of @type and returns true if the
+ * oldest remaining one is inactive, i.e. can be evicted from.  Must be
+ * called with the lru_lock held.
+ */
+static bool lru_gen_evictable(struct lruvec *lruvec, int type)
+{
+	struct lru_gen *lrugen = &lruvec->lrugen;
+
+	while (lrugen->max_seq[type] - lrugen->min_seq[type] >= MIN_NR_GENS) {
+		int gen = lru_gen_from_seq(lrugen->min_seq[type]);
+
+		if (!list_empty(&lrugen->lists[gen][type]))
+			return true;
+		lrugen->min_seq[type]++;
+	}
+	return false;
+}
+
+/* Starts a new generation; the second youngest one becomes inactive */
+static void lru_gen_inc_max_seq(struct lruvec *lruvec, int type)
+{
+	struct lru_gen *lrugen = &lruvec->lrugen;
+	int gen = lru_gen_from_seq(lrugen->max_seq[type] - 1);
+	long delta = lrugen->nr_pages[gen][type];
+	enum lru_list lru = type * LRU_FILE;
+	struct zone *zone = lruvec_zone(lruvec);
+
+	if (lrugen->max_seq[type] - lrugen->min_seq[type] + 1 >= MAX_NR_GENS)
+		return;
+
+	mem_cgroup_update_lru_size(lruvec, lru + LRU_ACTIVE, -delta);
+	mem_cgroup_update_lru_size(lruvec, lru, delta);
+	__mod_zone_page_state(zone, NR_LRU_BASE + lru + LRU_ACTIVE, -delta);
+	__mod_zone_page_state(zone, NR_LRU_BASE + lru, delta);
+	__count_vm_events(PGDEACTIVATE, delta);
+
+	lrugen->max_seq[type]++;
+}
+
+/*
+ * Makes sure the oldest generation of @type is inactive, aging the lruvec
+ * if needed.  Returns false if there is nothing left to evict.
+ */
+static bool lru_gen_prepare_eviction(struct lruvec *lruvec, int type)
+{
+	struct zone *zone = lruvec_zone(lruvec);
+	bool evictable;
+	int i;
+
+	spin_lock_irq(&zone->lru_lock);
+	evictable = lru_gen_evictable(lruvec, type);
+	spin_unlock_irq(&zone->lru_lock);
+	if (evictable)
+		return true;
+
+	lru_gen_walk_mm_list();
+
+	/*
+	 * If all pages are in the youngest generation, it takes two new
+	 * ones for them to become inactive.
+	 */
+	spin_lock_irq(&zone->lru_lock);
+	for (i = 0; i < MIN_NR_GENS; i++) {
+		evictable = lru_gen_evictable(lruvec, type);
+		if (evictable)
+			break;
+		lru_gen_inc_max_seq(lruvec, type);
+	}
+	evictable = lru_gen_evictable(lruvec, type);
+	spin_unlock_irq(&zone->lru_lock);
+
+	return evictable;
+}
+
+/*
+ * The generation counterpart of the list scan in isolate_lru_pages(): it
+ * takes pages from the tail of the oldest, inactive generation of @type.
+ * The caller accounts the taken pages against the inactive zone counter.
+ */
+static unsigned long lru_gen_isolate_pages(unsigned long nr_to_scan,
+		struct lruvec *lruvec, struct list_head *dst,
+		unsigned long *nr_scanned, isolate_mode_t mode, int type)
+{
+	struct lru_gen *lrugen = &lruvec->lrugen;
+	unsigned long nr_taken = 0;
+	unsigned long scan = 0;
+
+	while (scan < nr_to_scan && lru_gen_evictable(lruvec, type)) {
+		int gen = lru_gen_from_seq(lrugen->min_seq[type]);
+		struct list_head *src = &lrugen->lists[gen][type];
+
+		for (; scan < nr_to_scan && !list_empty(src); scan++) {
+			struct page *page;
+			int nr_pages;
+
+			page = lru_to_page(src);
+			prefetchw_prev_lru_page(page, src, flags);
+
+			VM_BUG_ON_PAGE(!PageLRU(page), page);
+
+			switch (__isolate_lru_page(page, mode)) {
+			case 0:
+				nr_pages = hpage_nr_pages(page);
+				lrugen->nr_pages[gen][type] -= nr_pages;
+				mem_cgroup_update_lru_size(lruvec,
+						type * LRU_FILE, -nr_pages);
+				lru_gen_set_page_gen(page, -1);
+				list_move(&page->lru, dst);
+				nr_taken += nr_pages;
+				break;
+
+			case -EBUSY:
+				/* else it is being freed elsewhere */
+				list_move(&page->lru, src);
+				continue;
+
+			default:
+				BUG();
+			}
+		}
+	}
+
+	*nr_scanned = scan;
+	return nr_taken;
+}
+
+#define LRU_GEN_TRANSFER_BATCH	SWAP_CLUSTER_MAX
+
+/*
+ * Moves a batch of pages between the classic lists and the generation
+ * lists of @lruvec, in the direction given by the static key.  Returns
+ * true once the lists being emptied are empty.
+ */
+static bool lru_gen_transfer(struct lruvec *lruvec, bool enable)
+{
+	struct zone *zone = lruvec_zone(lruvec);
+	int nr = 0;
+
+	spin_lock_irq(&zone->lru_lock);
+	if (enable) {
+		enum lru_list lru;
+
+		for_each_evictable_lru(lru) {
+			struct list_head *head = &lruvec->lists[lru];
+
+			while (!list_empty(head)) {
+				struct page *page = lru_to_page(head);
+
+				if (nr++ == LRU_GEN_TRANSFER_BATCH)
+					goto unlock;
+				del_page_from_lru_list(page, lruvec, lru);
+				add_page_to_lru_list(page, lruvec, lru);
+			}
+		}
+	} else {
+		struct lru_gen *lrugen = &lruvec->lrugen;
+		int type;
+
+		for (type = 0; type < 2; type++) {
+			unsigned long seq;
+
+			for (seq = lrugen->min_seq[type];
+			     seq <= lrugen->max_seq[type]; seq++) {
+				int gen = lru_gen_from_seq(seq);
+				struct list_head *head = &lrugen->lists[gen][type];
+
+				while (!list_empty(head)) {
+					struct page *page = lru_to_page(head);
+					bool active;
+
+					if (nr++ == LRU_GEN_TRANSFER_BATCH)
+						goto unlock;
+					active = lru_gen_is_active(lruvec,
+								   type, gen);
+					del_page_from_lru_list(page, lruvec,
+							       page_lru(page));
+					if (active)
+						SetPageActive(page);
+					add_page_to_lru_list(page, lruvec,
+							     page_lru(page));
+				}
+			}
+		}
+	}
+unlock:
+	spin_unlock_irq(&zone->lru_lock);
+
+	return nr <= LRU_GEN_TRANSFER_BATCH;
+}
+
+static void lru_gen_change_state(bool enable)
+{
+	struct mem_cgroup *memcg;
+
+	mutex_lock(&lru_gen_state_mutex);
+	if (enable == lru_gen_enabled())
+		goto unlock;
+
+	if (enable)
+		static_key_slow_inc(&lru_gen_key);
+	else
+		static_key_slow_dec(&lru_gen_key);
+
+	/* Pages sitting in the pagevecs get added in the new mode */
+	lru_add_drain_all();
+
+	memcg = mem_cgroup_iter(NULL, NULL, NULL);
+	do {
+		struct zone *zone;
+
+		for_each_populated_zone(zone) {
+			struct lruvec *lruvec = mem_cgroup_zone_lruvec(zone,
+								       memcg);
+
+			while (!lru_gen_transfer(lruvec, enable))
+				cond_resched();
+		}
+		memcg = mem_cgroup_iter(NULL, memcg, NULL);
+	} while (memcg);
+unlock:
+	mutex_unlock(&lru_gen_state_mutex);
+}
+
+#ifdef CONFIG_SYSFS
+static ssize_t enabled_show(struct kobject *kobj,
+			    struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", lru_gen_enabled());
+}
+
+static ssize_t enabled_store(struct kobject *kobj,
+			     struct kobj_attribute *attr,
+			     const char *buf, size_t count)
+{
+	bool enable;
+
+	if (strtobool(buf, &enable))
+		return -EINVAL;
+
+	lru_gen_change_state(enable);
+
+	return count;
+}
+static struct kobj_attribute lru_gen_enabled_attr =
+	__ATTR(enabled, 0644, enabled_show, enabled_store);
+
+static ssize_t min_walk_interval_ms_show(struct kobject *kobj,
+					 struct kobj_attribute *attr,
+					 char *buf)
+{
+	return sprintf(buf, "%u\n", lru_gen_min_walk_interval_ms);
+}
+
+static ssize_t min_walk_interval_ms_store(struct kobject *kobj,
+					  struct kobj_attribute *attr,
+					  const char *buf, size_t count)
+{
+	unsigned long msecs;
+	int err;
+
+	err = kstrtoul(buf, 10, &msecs);
+	if (err || msecs > UINT_MAX)
+		return -EINVAL;
+
+	lru_gen_min_walk_interval_ms = msecs;
+
+	return count;
+}
+static struct kobj_attribute lru_gen_min_walk_interval_ms_attr =
+	__ATTR(min_walk_interval_ms, 0644, min_walk_interval_ms_show,
+	       min_walk_interval_ms_store);
+
+static struct attribute *lru_gen_attrs[] = {
+	&lru_gen_enabled_attr.attr,
+	&lru_gen_min_walk_interval_ms_attr.attr,
+	NULL,
+};
+
+static struct attribute_group lru_gen_attr_group = {
+	.attrs = lru_gen_attrs,
+	.name = "lru_gen",
+};
+#endif /* CONFIG_SYSFS */
+
+static int __init lru_gen_init(void)
+{
+#ifdef CONFIG_SYSFS
+	if (sysfs_create_group(mm_kobj, &lru_gen_attr_group))
+		pr_err("lru_gen: failed to register sysfs group\n");
+#endif
+	if (IS_ENABLED(CONFIG_LRU_GEN_ENABLED))
+		lru_gen_change_state(true);
+	return 0;
+}
+late_initcall(lru_gen_init);
+
+#else /* CONFIG_LRU_GEN */
+
+static unsigned long lru_gen_isolate_pages(unsigned long nr_to_scan,
+		struct lruvec *lruvec, struct list_head *dst,
+		unsigned long *nr_scanned, isolate_mode_t mode, int type)
+{
+	*nr_scanned = 0;
+	return 0;
+}
+
+#endif /* CONFIG_LRU_GEN */
+
 /*
  * zone->lru_lock is heavily contended.  Some of the functions that
  * shrink the lists perform better by taking out a batch of pages
@@ -1319,6 +1868,12 @@ static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
 	unsigned long nr_taken = 0;
 	unsigned long scan;
 
+	if (lru_gen_enabled() && !is_active_lru(lru)) {
+		nr_taken = lru_gen_isolate_pages(nr_to_scan, lruvec, dst,
+						 &scan, mode, is_file_lru(lru));
+		goto out;
+	}
+
 	for (scan = 0; scan < nr_to_scan && !list_empty(src); scan++) {
 		struct page *page;
 		int nr_pages;
@@ -1346,6 +1901,7 @@ static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
 		}
 	}
 
+out:
 	*nr_scanned = scan;
 	trace_mm_vmscan_lru_isolate(sc->order, nr_to_scan, scan,
 				    nr_taken, mode, is_file_lru(lru));
@@ -2118,6 +2674,84 @@ out:
 	}
 }
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * The generation counterpart of shrink_lruvec().  There are no active lists
+ * to balance: anon and file are scanned in proportion to their sizes and
+ * swappiness, from the oldest generation, which aging refills on demand.
+ */
+static void lru_gen_shrink_lruvec(struct lruvec *lruvec, int swappiness,
+				  struct scan_control *sc,
+				  unsigned long *lru_pages)
+{
+	unsigned long nr[2];
+	unsigned long nr_reclaimed = 0;
+	unsigned long nr_to_reclaim = sc->nr_to_reclaim;
+	struct blk_plug plug;
+	bool scan_adjusted;
+	int type;
+
+	*lru_pages = 0;
+	for (type = 0; type < 2; type++) {
+		unsigned long size;
+
+		size = get_lru_size(lruvec, type * LRU_FILE) +
+		       get_lru_size(lruvec, type * LRU_FILE + LRU_ACTIVE);
+		*lru_pages += size;
+
+		nr[type] = size >> sc->priority;
+		if (!nr[type] && (current_is_kswapd() || !global_reclaim(sc)))
+			nr[type] = min(size, SWAP_CLUSTER_MAX);
+	}
+
+	/* Same rules as get_scan_count() for leaving anon alone */
+	if (!sc->may_swap || get_nr_swap_pages() <= 0 ||
+	    (!global_reclaim(sc) && !swappiness)) {
+		nr[0] = 0;
+	} else {
+		nr[0] = nr[0] * swappiness / 100;
+		nr[1] = nr[1] * (200 - swappiness) / 100;
+	}
+
+	/* See shrink_lruvec() */
+	scan_adjusted = (global_reclaim(sc) && !current_is_kswapd() &&
+			 sc->priority == DEF_PRIORITY);
+
+	blk_start_plug(&plug);
+	while (nr[0] || nr[1]) {
+		for (type = 0; type < 2; type++) {
+			unsigned long nr_to_scan;
+
+			if (!nr[type])
+				continue;
+
+			if (!lru_gen_prepare_eviction(lruvec, type)) {
+				nr[type] = 0;
+				continue;
+			}
+
+			nr_to_scan = min(nr[type], SWAP_CLUSTER_MAX);
+			nr[type] -= nr_to_scan;
+			nr_reclaimed += shrink_inactive_list(nr_to_scan, lruvec,
+							     sc, type * LRU_FILE);
+		}
+
+		if (nr_reclaimed >= nr_to_reclaim && !scan_adjusted)
+			break;
+	}
+	blk_finish_plug(&plug);
+	sc->nr_reclaimed += nr_reclaimed;
+
+	throttle_vm_writeout(sc->gfp_mask);
+}
+#else
+static void lru_gen_shrink_lruvec(struct lruvec *lruvec, int swappiness,
+				  struct scan_control *sc,
+				  unsigned long *lru_pages)
+{
+}
+#endif /* CONFIG_LRU_GEN */
+
 /*
  * This is a basic per-zone page freer.  Used by both kswapd and direct reclaim.
  */
@@ -2133,6 +2767,11 @@ static void shrink_lruvec(struct lruvec *lruvec, int swappiness,
 	struct blk_plug plug;
 	bool scan_adjusted;
 
+	if (lru_gen_enabled()) {
+		lru_gen_shrink_lruvec(lruvec, swappiness, sc, lru_pages);
+		return;
+	}
+
 	get_scan_count(lruvec, swappiness, sc, nr, lru_pages);
 
 	/* Record the original scan target for proportional adjustments later */
@@ -2880,7 +3519,8 @@ static void age_active_anon(struct zone *zone, struct scan_control *sc)
 {
 	struct mem_cgroup *memcg;
 
-	if (!total_swap_pages)
+	/* Generations have no active list to rebalance */
+	if (!total_swap_pages || lru_gen_enabled())
 		return;
 
 	memcg = mem_cgroup_iter(NULL, NULL, NULL);
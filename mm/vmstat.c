@@ -570,6 +570,7 @@ void drain_zonestat(struct zone *zone, struct per_cpu_pageset *pset)
 /*
  * zonelist = the list of zones passed to the allocator
  * z 	    = the zone from which the allocation occurred.
+ * nr	    = the number of pages allocated from it.
  *
  * Must be called with interrupts disabled.
  *
@@ -577,19 +578,20 @@ void drain_zonestat(struct zone *zone, struct per_cpu_pageset *pset)
  * zone is the local node. This is useful for daemons who allocate
  * memory on behalf of other processes.
  */
-void zone_statistics(struct zone *preferred_zone, struct zone *z, gfp_t flags)
+void zone_statistics(struct zone *preferred_zone, struct zone *z, gfp_t flags,
+		     long nr)
 {
 	if (z->zone_pgdat == preferred_zone->zone_pgdat) {
-		__inc_zone_state(z, NUMA_HIT);
+		__mod_zone_page_state(z, NUMA_HIT, nr);
 	} else {
-		__inc_zone_state(z, NUMA_MISS);
-		__inc_zone_state(preferred_zone, NUMA_FOREIGN);
+		__mod_zone_page_state(z, NUMA_MISS, nr);
+		__mod_zone_page_state(preferred_zone, NUMA_FOREIGN, nr);
 	}
 	if (z->node == ((flags & __GFP_OTHER_NODE) ?
 			preferred_zone->node : numa_node_id()))
-		__inc_zone_state(z, NUMA_LOCAL);
+		__mod_zone_page_state(z, NUMA_LOCAL, nr);
 	else
-		__inc_zone_state(z, NUMA_OTHER);
+		__mod_zone_page_state(z, NUMA_OTHER, nr);
 }
 #endif
 
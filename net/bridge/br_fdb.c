@@ -78,6 +78,12 @@ static inline int br_mac_hash(const unsigned char *mac, __u16 vid)
 	return jhash_2words(key, vid, fdb_salt) & (BR_HASH_SIZE - 1);
 }
 
+static inline spinlock_t *fdb_bucket_lock(struct net_bridge *br,
+					  const unsigned char *addr, __u16 vid)
+{
+	return &br->hash_bucket_lock[br_mac_hash(addr, vid)];
+}
+
 static void fdb_rcu_free(struct rcu_head *head)
 {
 	struct net_bridge_fdb_entry *ent
@@ -130,6 +136,7 @@ static void fdb_del_hw_addr(struct net_bridge *br, const unsigned char *addr)
 	}
 }
 
+/* Called with the chain's hash_bucket_lock held */
 static void fdb_delete(struct net_bridge *br, struct net_bridge_fdb_entry *f)
 {
 	if (f->is_static)
@@ -175,12 +182,15 @@ void br_fdb_find_delete_local(struct net_bridge *br,
 			      const unsigned char *addr, u16 vid)
 {
 	struct hlist_head *head = &br->hash[br_mac_hash(addr, vid)];
+	spinlock_t *bucket_lock = fdb_bucket_lock(br, addr, vid);
 	struct net_bridge_fdb_entry *f;
 
 	spin_lock_bh(&br->hash_lock);
+	spin_lock(bucket_lock);
 	f = fdb_find(head, addr, vid);
 	if (f && f->is_local && !f->added_by_user && f->dst == p)
 		fdb_delete_local(br, p, f);
+	spin_unlock(bucket_lock);
 	spin_unlock_bh(&br->hash_lock);
 }
 
@@ -196,8 +206,10 @@ void br_fdb_changeaddr(struct net_bridge_port *p, const unsigned char *newaddr)
 
 	/* Search all chains since old address/hash is unknown */
 	for (i = 0; i < BR_HASH_SIZE; i++) {
-		struct hlist_node *h;
-		hlist_for_each(h, &br->hash[i]) {
+		struct hlist_node *h, *n;
+
+		spin_lock(&br->hash_bucket_lock[i]);
+		hlist_for_each_safe(h, n, &br->hash[i]) {
 			struct net_bridge_fdb_entry *f;
 
 			f = hlist_entry(h, struct net_bridge_fdb_entry, hlist);
@@ -209,10 +221,13 @@ void br_fdb_changeaddr(struct net_bridge_port *p, const unsigned char *newaddr)
 				 * configured, we can safely be done at
 				 * this point.
 				 */
-				if (no_vlan)
+				if (no_vlan) {
+					spin_unlock(&br->hash_bucket_lock[i]);
 					goto insert;
+				}
 			}
 		}
+		spin_unlock(&br->hash_bucket_lock[i]);
 	}
 
 insert:
@@ -233,19 +248,31 @@ done:
 	spin_unlock_bh(&br->hash_lock);
 }
 
-void br_fdb_change_mac_address(struct net_bridge *br, const u8 *newaddr)
+/* Delete the bridge's own local entry for @vid unless a port still uses
+ * the address.  Called with hash_lock held.
+ */
+static void fdb_delete_unassociated(struct net_bridge *br, u16 vid)
 {
+	const unsigned char *addr = br->dev->dev_addr;
+	spinlock_t *bucket_lock = fdb_bucket_lock(br, addr, vid);
 	struct net_bridge_fdb_entry *f;
+
+	spin_lock(bucket_lock);
+	f = __br_fdb_get(br, addr, vid);
+	if (f && f->is_local && !f->dst)
+		fdb_delete_local(br, NULL, f);
+	spin_unlock(bucket_lock);
+}
+
+void br_fdb_change_mac_address(struct net_bridge *br, const u8 *newaddr)
+{
 	struct net_port_vlans *pv;
 	u16 vid = 0;
 
 	spin_lock_bh(&br->hash_lock);
 
 	/* If old entry was unassociated with any port, then delete it. */
-	f = __br_fdb_get(br, br->dev->dev_addr, 0);
-	if (f && f->is_local && !f->dst)
-		fdb_delete_local(br, NULL, f);
-
+	fdb_delete_unassociated(br, 0);
 	fdb_insert(br, NULL, newaddr, 0);
 
 	/* Now remove and add entries for every VLAN configured on the
@@ -257,27 +284,33 @@ void br_fdb_change_mac_address(struct net_bridge *br, const u8 *newaddr)
 		goto out;
 
 	for_each_set_bit_from(vid, pv->vlan_bitmap, VLAN_N_VID) {
-		f = __br_fdb_get(br, br->dev->dev_addr, vid);
-		if (f && f->is_local && !f->dst)
-			fdb_delete_local(br, NULL, f);
+		fdb_delete_unassociated(br, vid);
 		fdb_insert(br, NULL, newaddr, vid);
 	}
 out:
 	spin_unlock_bh(&br->hash_lock);
 }
 
+/* Age BR_GC_BUCKETS chains per run, taking only one chain's lock at a
+ * time, so that learning on the rest of the table is never held up by a
+ * walk of the whole table.  Once a pass completes the timer is set for
+ * the earliest expiry seen during that pass.
+ */
 void br_fdb_cleanup(unsigned long _data)
 {
 	struct net_bridge *br = (struct net_bridge *)_data;
 	unsigned long delay = hold_time(br);
-	unsigned long next_timer = jiffies + br->ageing_time;
-	int i;
+	unsigned int i, end;
 
-	spin_lock(&br->hash_lock);
-	for (i = 0; i < BR_HASH_SIZE; i++) {
+	if (br->gc_bucket == 0)
+		br->gc_next_expire = jiffies + br->ageing_time;
+
+	end = min_t(unsigned int, br->gc_bucket + BR_GC_BUCKETS, BR_HASH_SIZE);
+	for (i = br->gc_bucket; i < end; i++) {
 		struct net_bridge_fdb_entry *f;
 		struct hlist_node *n;
 
+		spin_lock(&br->hash_bucket_lock[i]);
 		hlist_for_each_entry_safe(f, n, &br->hash[i], hlist) {
 			unsigned long this_timer;
 			if (f->is_static)
@@ -285,13 +318,19 @@ void br_fdb_cleanup(unsigned long _data)
 			this_timer = f->updated + delay;
 			if (time_before_eq(this_timer, jiffies))
 				fdb_delete(br, f);
-			else if (time_before(this_timer, next_timer))
-				next_timer = this_timer;
+			else if (time_before(this_timer, br->gc_next_expire))
+				br->gc_next_expire = this_timer;
 		}
+		spin_unlock(&br->hash_bucket_lock[i]);
 	}
-	spin_unlock(&br->hash_lock);
 
-	mod_timer(&br->gc_timer, round_jiffies_up(next_timer));
+	if (end < BR_HASH_SIZE) {
+		br->gc_bucket = end;
+		mod_timer(&br->gc_timer, jiffies + 1);
+	} else {
+		br->gc_bucket = 0;
+		mod_timer(&br->gc_timer, round_jiffies_up(br->gc_next_expire));
+	}
 }
 
 /* Completely flush all dynamic entries in forwarding database.*/
@@ -303,10 +342,13 @@ void br_fdb_flush(struct net_bridge *br)
 	for (i = 0; i < BR_HASH_SIZE; i++) {
 		struct net_bridge_fdb_entry *f;
 		struct hlist_node *n;
+
+		spin_lock(&br->hash_bucket_lock[i]);
 		hlist_for_each_entry_safe(f, n, &br->hash[i], hlist) {
 			if (!f->is_static)
 				fdb_delete(br, f);
 		}
+		spin_unlock(&br->hash_bucket_lock[i]);
 	}
 	spin_unlock_bh(&br->hash_lock);
 }
@@ -324,6 +366,7 @@ void br_fdb_delete_by_port(struct net_bridge *br,
 	for (i = 0; i < BR_HASH_SIZE; i++) {
 		struct hlist_node *h, *g;
 
+		spin_lock(&br->hash_bucket_lock[i]);
 		hlist_for_each_safe(h, g, &br->hash[i]) {
 			struct net_bridge_fdb_entry *f
 				= hlist_entry(h, struct net_bridge_fdb_entry, hlist);
@@ -338,6 +381,7 @@ void br_fdb_delete_by_port(struct net_bridge *br,
 			else
 				fdb_delete(br, f);
 		}
+		spin_unlock(&br->hash_bucket_lock[i]);
 	}
 	spin_unlock_bh(&br->hash_lock);
 }
@@ -466,6 +510,7 @@ static struct net_bridge_fdb_entry *fdb_find_rcu(struct hlist_head *head,
 	return NULL;
 }
 
+/* Called with the chain's hash_bucket_lock held */
 static struct net_bridge_fdb_entry *fdb_create(struct hlist_head *head,
 					       struct net_bridge_port *source,
 					       const unsigned char *addr,
@@ -488,22 +533,26 @@ static struct net_bridge_fdb_entry *fdb_create(struct hlist_head *head,
 	return fdb;
 }
 
+/* Called with hash_lock held */
 static int fdb_insert(struct net_bridge *br, struct net_bridge_port *source,
 		  const unsigned char *addr, u16 vid)
 {
 	struct hlist_head *head = &br->hash[br_mac_hash(addr, vid)];
+	spinlock_t *bucket_lock = fdb_bucket_lock(br, addr, vid);
 	struct net_bridge_fdb_entry *fdb;
+	int err = 0;
 
 	if (!is_valid_ether_addr(addr))
 		return -EINVAL;
 
+	spin_lock(bucket_lock);
 	fdb = fdb_find(head, addr, vid);
 	if (fdb) {
 		/* it is okay to have multiple ports with same
 		 * address, just use the first one.
 		 */
 		if (fdb->is_local)
-			return 0;
+			goto out;
 		br_warn(br, "adding interface %s with same address "
 		       "as a received packet\n",
 		       source ? source->dev->name : br->dev->name);
@@ -511,13 +560,17 @@ static int fdb_insert(struct net_bridge *br, struct net_bridge_port *source,
 	}
 
 	fdb = fdb_create(head, source, addr, vid);
-	if (!fdb)
-		return -ENOMEM;
+	if (!fdb) {
+		err = -ENOMEM;
+		goto out;
+	}
 
 	fdb->is_local = fdb->is_static = 1;
 	fdb_add_hw_addr(br, addr);
 	fdb_notify(br, fdb, RTM_NEWNEIGH);
-	return 0;
+out:
+	spin_unlock(bucket_lock);
+	return err;
 }
 
 /* Add entry for local address of interface */
@@ -557,19 +610,27 @@ void br_fdb_update(struct net_bridge *br, struct net_bridge_port *source,
 					"own address as source address\n",
 					source->dev->name);
 		} else {
-			/* fastpath: update of existing entry */
+			/* fastpath: update of existing entry, without any
+			 * lock.  Only store what changed so that a busy
+			 * entry's cacheline is not written by every CPU
+			 * forwarding from that MAC.
+			 */
 			if (unlikely(source != fdb->dst)) {
-				fdb->dst = source;
+				ACCESS_ONCE(fdb->dst) = source;
 				fdb_modified = true;
 			}
-			fdb->updated = jiffies;
+			if (fdb->updated != jiffies)
+				ACCESS_ONCE(fdb->updated) = jiffies;
 			if (unlikely(added_by_user))
 				fdb->added_by_user = 1;
 			if (unlikely(fdb_modified))
 				fdb_notify(br, fdb, RTM_NEWNEIGH);
 		}
 	} else {
-		spin_lock(&br->hash_lock);
+		spinlock_t *bucket_lock = fdb_bucket_lock(br, addr, vid);
+
+		/* Learning only serializes against writers of this chain */
+		spin_lock(bucket_lock);
 		if (likely(!fdb_find(head, addr, vid))) {
 			fdb = fdb_create(head, source, addr, vid);
 			if (fdb) {
@@ -581,7 +642,7 @@ void br_fdb_update(struct net_bridge *br, struct net_bridge_port *source,
 		/* else  we lose race and someone else inserts
 		 * it first, don't bother updating
 		 */
-		spin_unlock(&br->hash_lock);
+		spin_unlock(bucket_lock);
 	}
 }
 
@@ -796,13 +857,20 @@ static int __br_fdb_add(struct ndmsg *ndm, struct net_bridge_port *p,
 	int err = 0;
 
 	if (ndm->ndm_flags & NTF_USE) {
+		/* the chain locks are also taken from softirq context */
+		local_bh_disable();
 		rcu_read_lock();
 		br_fdb_update(p->br, p, addr, vid, true);
 		rcu_read_unlock();
+		local_bh_enable();
 	} else {
+		spinlock_t *bucket_lock = fdb_bucket_lock(p->br, addr, vid);
+
 		spin_lock_bh(&p->br->hash_lock);
+		spin_lock(bucket_lock);
 		err = fdb_add_entry(p, addr, ndm->ndm_state,
 				    nlh_flags, vid);
+		spin_unlock(bucket_lock);
 		spin_unlock_bh(&p->br->hash_lock);
 	}
 
@@ -881,10 +949,13 @@ static int fdb_delete_by_addr(struct net_bridge *br, const u8 *addr, u16 vlan)
 static int __br_fdb_delete(struct net_bridge_port *p,
 			   const unsigned char *addr, u16 vid)
 {
+	spinlock_t *bucket_lock = fdb_bucket_lock(p->br, addr, vid);
 	int err;
 
 	spin_lock_bh(&p->br->hash_lock);
+	spin_lock(bucket_lock);
 	err = fdb_delete_by_addr(p->br, addr, vid);
+	spin_unlock(bucket_lock);
 	spin_unlock_bh(&p->br->hash_lock);
 
 	return err;
@@ -998,6 +1069,7 @@ int br_fdb_external_learn_add(struct net_bridge *br, struct net_bridge_port *p,
 
 	ASSERT_RTNL();
 	spin_lock_bh(&br->hash_lock);
+	spin_lock(fdb_bucket_lock(br, addr, vid));
 
 	head = &br->hash[br_mac_hash(addr, vid)];
 	fdb = fdb_find(head, addr, vid);
@@ -1020,6 +1092,7 @@ int br_fdb_external_learn_add(struct net_bridge *br, struct net_bridge_port *p,
 	}
 
 err_unlock:
+	spin_unlock(fdb_bucket_lock(br, addr, vid));
 	spin_unlock_bh(&br->hash_lock);
 
 	return err;
@@ -1034,6 +1107,7 @@ int br_fdb_external_learn_del(struct net_bridge *br, struct net_bridge_port *p,
 
 	ASSERT_RTNL();
 	spin_lock_bh(&br->hash_lock);
+	spin_lock(fdb_bucket_lock(br, addr, vid));
 
 	head = &br->hash[br_mac_hash(addr, vid)];
 	fdb = fdb_find(head, addr, vid);
@@ -1042,6 +1116,7 @@ int br_fdb_external_learn_del(struct net_bridge *br, struct net_bridge_port *p,
 	else
 		err = -ENOENT;
 
+	spin_unlock(fdb_bucket_lock(br, addr, vid));
 	spin_unlock_bh(&br->hash_lock);
 
 	return err;
@@ -22,6 +22,8 @@
 
 #define BR_HASH_BITS 8
 #define BR_HASH_SIZE (1 << BR_HASH_BITS)
+/* Hash chains aged per run of the fdb gc timer */
+#define BR_GC_BUCKETS 32
 
 #define BR_HOLD_TIME (1*HZ)
 
@@ -211,8 +213,13 @@ struct net_bridge
 	struct net_device		*dev;
 
 	struct pcpu_sw_netstats		__percpu *stats;
+	/* hash_lock serializes configuration changes that may touch
+	 * several chains; it nests outside the per-chain locks.  A chain
+	 * is only modified with its hash_bucket_lock held.
+	 */
 	spinlock_t			hash_lock;
 	struct hlist_head		hash[BR_HASH_SIZE];
+	spinlock_t			hash_bucket_lock[BR_HASH_SIZE];
 #if IS_ENABLED(CONFIG_BRIDGE_NETFILTER)
 	struct rtable 			fake_rtable;
 	bool				nf_call_iptables;
@@ -286,6 +293,8 @@ struct net_bridge
 	struct timer_list		tcn_timer;
 	struct timer_list		topology_change_timer;
 	struct timer_list		gc_timer;
+	unsigned int			gc_bucket;
+	unsigned long			gc_next_expire;
 	struct kobject			*ifobj;
 	u32				auto_cnt;
 #ifdef CONFIG_BRIDGE_VLAN_FILTERING
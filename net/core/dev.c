@@ -119,6 +119,7 @@
 #include <linux/ip.h>
 #include <net/ip.h>
 #include <net/mpls.h>
+#include <net/busy_poll.h>
 #include <linux/ipv6.h>
 #include <linux/in.h>
 #include <linux/jhash.h>
@@ -135,6 +136,7 @@
 #include <linux/if_macvlan.h>
 #include <linux/errqueue.h>
 #include <linux/hrtimer.h>
+#include <linux/kthread.h>
 
 #include "net-sysfs.h"
 
@@ -3021,6 +3023,20 @@ int weight_p __read_mostly = 64;            /* old backlog weight */
 static inline void ____napi_schedule(struct softnet_data *sd,
 				     struct napi_struct *napi)
 {
+	struct task_struct *thread;
+
+	if (test_bit(NAPI_STATE_THREADED, &napi->state)) {
+		/* Paired with smp_mb__before_atomic() in dev_set_threaded():
+		 * the thread pointer is valid once the bit is seen.
+		 */
+		thread = ACCESS_ONCE(napi->thread);
+		if (thread) {
+			set_bit(NAPI_STATE_SCHED_THREADED, &napi->state);
+			wake_up_process(thread);
+			return;
+		}
+	}
+
 	list_add_tail(&napi->poll_list, &sd->poll_list);
 	__raise_softirq_irqoff(NET_RX_SOFTIRQ);
 }
@@ -4478,6 +4494,62 @@ struct napi_struct *napi_by_id(unsigned int napi_id)
 }
 EXPORT_SYMBOL_GPL(napi_by_id);
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/**
+ *	napi_busy_loop - busy poll a NAPI context
+ *	@napi_id: id of the NAPI context to poll
+ *	@end_time: busy_loop_us_clock() value to stop polling at
+ *	@loop_end: stop once this returns true, poll only once if NULL
+ *	@loop_end_arg: argument to @loop_end
+ *
+ *	Calls the driver's ndo_busy_poll() until @loop_end reports that the
+ *	caller has something to do, the time budget is used up or the task
+ *	should reschedule.  Returns false if @napi_id cannot be busy polled.
+ */
+bool napi_busy_loop(unsigned int napi_id, unsigned long end_time,
+		    bool (*loop_end)(void *), void *loop_end_arg)
+{
+	const struct net_device_ops *ops;
+	struct napi_struct *napi;
+	bool ret = false;
+	int rc;
+
+	/*
+	 * rcu read lock for napi hash
+	 * bh so we don't race with net_rx_action
+	 */
+	rcu_read_lock_bh();
+
+	napi = napi_by_id(napi_id);
+	if (!napi)
+		goto out;
+
+	ops = napi->dev->netdev_ops;
+	if (!ops->ndo_busy_poll)
+		goto out;
+
+	ret = true;
+	do {
+		rc = ops->ndo_busy_poll(napi);
+
+		if (rc == LL_FLUSH_FAILED)
+			break; /* permanent failure */
+
+		if (rc > 0)
+			/* local bh are disabled so it is ok to use _BH */
+			NET_ADD_STATS_BH(dev_net(napi->dev),
+					 LINUX_MIB_BUSYPOLLRXPACKETS, rc);
+		cpu_relax();
+
+	} while (loop_end && !loop_end(loop_end_arg) &&
+		 !need_resched() && !busy_loop_timeout(end_time));
+out:
+	rcu_read_unlock_bh();
+	return ret;
+}
+EXPORT_SYMBOL(napi_busy_loop);
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+
 void napi_hash_add(struct napi_struct *napi)
 {
 	if (!test_and_set_bit(NAPI_STATE_HASHED, &napi->state)) {
@@ -4527,6 +4599,96 @@ static enum hrtimer_restart napi_watchdog(struct hrtimer *timer)
 	return HRTIMER_NORESTART;
 }
 
+static int napi_threaded_poll(void *data);
+
+static int napi_kthread_create(struct napi_struct *n)
+{
+	int err = 0;
+
+	/* Create and wake up the kthread once to put it in
+	 * TASK_INTERRUPTIBLE mode, so that it does not count as a
+	 * blocked task nor towards the load average.
+	 */
+	n->thread = kthread_run(napi_threaded_poll, n, "napi/%s-%d",
+				n->dev->name, n->index);
+	if (IS_ERR(n->thread)) {
+		err = PTR_ERR(n->thread);
+		netdev_err(n->dev, "kthread for NAPI instance %d failed: %d\n",
+			   n->index, err);
+		n->thread = NULL;
+	}
+
+	return err;
+}
+
+/* The lowest index not taken by another NAPI instance of the device, so
+ * that the kthread names stay the same while instances come and go.
+ */
+static int napi_free_index(struct net_device *dev)
+{
+	struct napi_struct *n;
+	int index = 0;
+
+again:
+	list_for_each_entry(n, &dev->napi_list, dev_list) {
+		if (n->index == index) {
+			index++;
+			goto again;
+		}
+	}
+
+	return index;
+}
+
+/**
+ *	dev_set_threaded - poll a device's NAPI instances from kthreads
+ *	@dev: device
+ *	@threaded: true to poll from kthreads, false to use NET_RX softirq
+ *
+ *	Every NAPI instance of @dev gets a "napi/<dev>-<n>" kthread that
+ *	is scheduled like any other task, so its affinity and priority can
+ *	be set from userspace.  Threads are created on first use and kept
+ *	until the instance is deleted.  An instance that is being polled
+ *	switches mode at its next napi_schedule().  Caller holds RTNL.
+ */
+int dev_set_threaded(struct net_device *dev, bool threaded)
+{
+	struct napi_struct *napi;
+	int err = 0;
+
+	ASSERT_RTNL();
+
+	if (dev->threaded == threaded)
+		return 0;
+
+	if (threaded) {
+		list_for_each_entry(napi, &dev->napi_list, dev_list) {
+			if (!napi->thread) {
+				err = napi_kthread_create(napi);
+				if (err) {
+					threaded = false;
+					break;
+				}
+			}
+		}
+	}
+
+	dev->threaded = threaded;
+
+	/* Make sure the kthreads are visible before the THREADED bit */
+	smp_mb__before_atomic();
+
+	list_for_each_entry(napi, &dev->napi_list, dev_list) {
+		if (threaded)
+			set_bit(NAPI_STATE_THREADED, &napi->state);
+		else
+			clear_bit(NAPI_STATE_THREADED, &napi->state);
+	}
+
+	return err;
+}
+EXPORT_SYMBOL(dev_set_threaded);
+
 void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
 		    int (*poll)(struct napi_struct *, int), int weight)
 {
@@ -4541,13 +4703,24 @@ void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
 		pr_err_once("netif_napi_add() called with weight %d on device %s\n",
 			    weight, dev->name);
 	napi->weight = weight;
+	napi->index = napi_free_index(dev);
 	list_add(&napi->dev_list, &dev->napi_list);
 	napi->dev = dev;
 #ifdef CONFIG_NETPOLL
 	spin_lock_init(&napi->poll_lock);
 	napi->poll_owner = -1;
 #endif
+	napi->thread = NULL;
 	set_bit(NAPI_STATE_SCHED, &napi->state);
+
+	/* Instances added to a threaded device, e.g. when the number of
+	 * channels grows, follow the device's mode.  One without a kthread
+	 * is polled from NET_RX softirq, the others stay threaded.
+	 */
+	if (dev->threaded && !napi_kthread_create(napi)) {
+		smp_mb__before_atomic();
+		set_bit(NAPI_STATE_THREADED, &napi->state);
+	}
 }
 EXPORT_SYMBOL(netif_napi_add);
 
@@ -4570,6 +4743,11 @@ void netif_napi_del(struct napi_struct *napi)
 	list_del_init(&napi->dev_list);
 	napi_free_frags(napi);
 
+	if (napi->thread) {
+		kthread_stop(napi->thread);
+		napi->thread = NULL;
+	}
+
 	kfree_skb_list(napi->gro_list);
 	napi->gro_list = NULL;
 	napi->gro_count = 0;
@@ -4638,6 +4816,56 @@ out_unlock:
 	return work;
 }
 
+static int napi_thread_wait(struct napi_struct *napi)
+{
+	set_current_state(TASK_INTERRUPTIBLE);
+
+	while (!kthread_should_stop()) {
+		/* Only poll when ____napi_schedule() handed the instance to
+		 * us: NAPI_STATE_SCHED alone may also have been set by
+		 * napi_disable() or netpoll.
+		 */
+		if (test_and_clear_bit(NAPI_STATE_SCHED_THREADED,
+				       &napi->state)) {
+			WARN_ON(!list_empty(&napi->poll_list));
+			__set_current_state(TASK_RUNNING);
+			return 0;
+		}
+
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+
+	return -1;
+}
+
+static int napi_threaded_poll(void *data)
+{
+	struct napi_struct *napi = data;
+
+	while (!napi_thread_wait(napi)) {
+		for (;;) {
+			LIST_HEAD(repoll);
+
+			local_bh_disable();
+			napi_poll(napi, &repoll);
+			local_bh_enable();
+
+			/* napi_poll() queues the instance on @repoll when
+			 * it used its whole budget and is still ours.
+			 */
+			if (list_empty(&repoll))
+				break;
+			list_del_init(&napi->poll_list);
+
+			cond_resched();
+		}
+	}
+
+	return 0;
+}
+
 static void net_rx_action(struct softirq_action *h)
 {
 	struct softnet_data *sd = this_cpu_ptr(&softnet_data);
@@ -28,6 +28,8 @@
 #include <linux/sysctl.h>
 #endif
 #include <linux/times.h>
+#include <linux/sched.h>
+#include <linux/math64.h>
 #include <net/net_namespace.h>
 #include <net/neighbour.h>
 #include <net/dst.h>
@@ -116,11 +118,78 @@ unsigned long neigh_rand_reach_time(unsigned long base)
 EXPORT_SYMBOL(neigh_rand_reach_time);
 
 
-static int neigh_forced_gc(struct neigh_table *tbl)
+/*
+ * Release the entries of one hash bucket that GC may reclaim.  Forced GC
+ * takes anything unreferenced and not permanent; periodic GC only takes
+ * failed or stale entries.  Called with tbl->lock held for writing;
+ * returns the number of entries released.
+ */
+static int neigh_gc_bucket(struct neigh_table *tbl,
+			   struct neighbour __rcu **np, bool forced)
 {
+	struct neighbour *n;
 	int shrunk = 0;
-	int i;
+
+	while ((n = rcu_dereference_protected(*np,
+				lockdep_is_held(&tbl->lock))) != NULL) {
+		unsigned int state;
+		bool release;
+
+		write_lock(&n->lock);
+
+		state = n->nud_state;
+		if (forced) {
+			release = atomic_read(&n->refcnt) == 1 &&
+				  !(state & NUD_PERMANENT);
+		} else if (state & (NUD_PERMANENT | NUD_IN_TIMER)) {
+			release = false;
+		} else {
+			if (time_before(n->used, n->confirmed))
+				n->used = n->confirmed;
+
+			release = atomic_read(&n->refcnt) == 1 &&
+				  (state == NUD_FAILED ||
+				   time_after(jiffies, n->used +
+					      NEIGH_VAR(n->parms, GC_STALETIME)));
+		}
+
+		if (release) {
+			rcu_assign_pointer(*np,
+				rcu_dereference_protected(n->next,
+						lockdep_is_held(&tbl->lock)));
+			n->dead = 1;
+			write_unlock(&n->lock);
+			neigh_cleanup_and_release(n);
+			shrunk++;
+			continue;
+		}
+		write_unlock(&n->lock);
+		np = &n->next;
+	}
+
+	return shrunk;
+}
+
+static void neigh_gc_account(struct neigh_table *tbl, u64 start, int shrunk)
+{
+	NEIGH_CACHE_STAT_ADD(tbl, gc_time_us,
+			     div_u64(local_clock() - start, NSEC_PER_USEC));
+	NEIGH_CACHE_STAT_ADD(tbl, gc_reclaimed, shrunk);
+}
+
+/*
+ * Forced GC runs from neigh_alloc(), i.e. on the packet path.  Rather than
+ * sweeping the whole table under tbl->lock it takes the lock one bucket at
+ * a time and stops once the table is back under gc_thresh2; tbl->gc_cursor
+ * makes the next run carry on where this one stopped.
+ */
+static int neigh_forced_gc(struct neigh_table *tbl)
+{
+	int max_clean = atomic_read(&tbl->entries) - tbl->gc_thresh2;
+	u64 start = local_clock();
 	struct neigh_hash_table *nht;
+	unsigned int i, mask;
+	int shrunk = 0;
 
 	NEIGH_CACHE_STAT_INC(tbl, forced_gc_runs);
 
@@ -128,37 +197,25 @@ static int neigh_forced_gc(struct neigh_table *tbl)
 	nht = rcu_dereference_protected(tbl->nht,
 					lockdep_is_held(&tbl->lock));
 	for (i = 0; i < (1 << nht->hash_shift); i++) {
-		struct neighbour *n;
-		struct neighbour __rcu **np;
+		mask = (1 << nht->hash_shift) - 1;
+		shrunk += neigh_gc_bucket(tbl,
+				&nht->hash_buckets[tbl->gc_cursor++ & mask],
+				true);
+		if (shrunk >= max_clean)
+			break;
 
-		np = &nht->hash_buckets[i];
-		while ((n = rcu_dereference_protected(*np,
-					lockdep_is_held(&tbl->lock))) != NULL) {
-			/* Neighbour record may be discarded if:
-			 * - nobody refers to it.
-			 * - it is not permanent
-			 */
-			write_lock(&n->lock);
-			if (atomic_read(&n->refcnt) == 1 &&
-			    !(n->nud_state & NUD_PERMANENT)) {
-				rcu_assign_pointer(*np,
-					rcu_dereference_protected(n->next,
-						  lockdep_is_held(&tbl->lock)));
-				n->dead = 1;
-				shrunk	= 1;
-				write_unlock(&n->lock);
-				neigh_cleanup_and_release(n);
-				continue;
-			}
-			write_unlock(&n->lock);
-			np = &n->next;
-		}
+		write_unlock_bh(&tbl->lock);
+		write_lock_bh(&tbl->lock);
+		nht = rcu_dereference_protected(tbl->nht,
+						lockdep_is_held(&tbl->lock));
 	}
 
 	tbl->last_flush = jiffies;
 
 	write_unlock_bh(&tbl->lock);
 
+	neigh_gc_account(tbl, start, shrunk);
+
 	return shrunk;
 }
 
@@ -746,13 +803,17 @@ static void neigh_connect(struct neighbour *neigh)
 	neigh->output = neigh->ops->connected_output;
 }
 
+/* Periodic GC ages 1/NEIGH_GC_SLICES of the hash buckets per run */
+#define NEIGH_GC_SLICES		16
+
 static void neigh_periodic_work(struct work_struct *work)
 {
 	struct neigh_table *tbl = container_of(work, struct neigh_table, gc_work.work);
-	struct neighbour *n;
-	struct neighbour __rcu **np;
-	unsigned int i;
+	unsigned long delay = NEIGH_VAR(&tbl->parms, BASE_REACHABLE_TIME) >> 1;
 	struct neigh_hash_table *nht;
+	unsigned int i, slice, mask;
+	u64 start = local_clock();
+	int shrunk = 0;
 
 	NEIGH_CACHE_STAT_INC(tbl, periodic_gc_runs);
 
@@ -775,38 +836,12 @@ static void neigh_periodic_work(struct work_struct *work)
 	if (atomic_read(&tbl->entries) < tbl->gc_thresh1)
 		goto out;
 
-	for (i = 0 ; i < (1 << nht->hash_shift); i++) {
-		np = &nht->hash_buckets[i];
-
-		while ((n = rcu_dereference_protected(*np,
-				lockdep_is_held(&tbl->lock))) != NULL) {
-			unsigned int state;
-
-			write_lock(&n->lock);
-
-			state = n->nud_state;
-			if (state & (NUD_PERMANENT | NUD_IN_TIMER)) {
-				write_unlock(&n->lock);
-				goto next_elt;
-			}
-
-			if (time_before(n->used, n->confirmed))
-				n->used = n->confirmed;
-
-			if (atomic_read(&n->refcnt) == 1 &&
-			    (state == NUD_FAILED ||
-			     time_after(jiffies, n->used + NEIGH_VAR(n->parms, GC_STALETIME)))) {
-				*np = n->next;
-				n->dead = 1;
-				write_unlock(&n->lock);
-				neigh_cleanup_and_release(n);
-				continue;
-			}
-			write_unlock(&n->lock);
-
-next_elt:
-			np = &n->next;
-		}
+	slice = DIV_ROUND_UP(1 << nht->hash_shift, NEIGH_GC_SLICES);
+	for (i = 0; i < slice; i++) {
+		mask = (1 << nht->hash_shift) - 1;
+		shrunk += neigh_gc_bucket(tbl,
+				&nht->hash_buckets[tbl->gc_cursor++ & mask],
+				false);
 		/*
 		 * It's fine to release lock here, even if hash table
 		 * grows while we are preempted.
@@ -817,14 +852,16 @@ next_elt:
 		nht = rcu_dereference_protected(tbl->nht,
 						lockdep_is_held(&tbl->lock));
 	}
+	delay /= NEIGH_GC_SLICES;
 out:
-	/* Cycle through all hash buckets every BASE_REACHABLE_TIME/2 ticks.
-	 * ARP entry timeouts range from 1/2 BASE_REACHABLE_TIME to 3/2
-	 * BASE_REACHABLE_TIME.
+	/* Cycle through all hash buckets every BASE_REACHABLE_TIME/2 ticks,
+	 * one slice per run.  ARP entry timeouts range from 1/2
+	 * BASE_REACHABLE_TIME to 3/2 BASE_REACHABLE_TIME.
 	 */
-	queue_delayed_work(system_power_efficient_wq, &tbl->gc_work,
-			      NEIGH_VAR(&tbl->parms, BASE_REACHABLE_TIME) >> 1);
+	queue_delayed_work(system_power_efficient_wq, &tbl->gc_work, delay);
 	write_unlock_bh(&tbl->lock);
+
+	neigh_gc_account(tbl, start, shrunk);
 }
 
 static __inline__ int neigh_max_probes(struct neighbour *n)
@@ -1050,6 +1087,55 @@ static void neigh_update_hhs(struct neighbour *neigh)
 }
 
 
+/*
+ * An update that leaves the state and the link-layer address of a valid
+ * entry alone only refreshes its timestamps.  Such confirmations arrive
+ * with every ARP reply or neighbour advertisement, so apply them without
+ * taking neigh->lock, and only write timestamps that actually change.
+ * Returns false if the full neigh_update() is needed.
+ */
+static bool neigh_update_confirm(struct neighbour *neigh, const u8 *lladdr,
+				 u8 new, u32 flags)
+{
+	struct net_device *dev = neigh->dev;
+	u8 old = ACCESS_ONCE(neigh->nud_state);
+	unsigned long now = jiffies;
+
+	if (flags & (NEIGH_UPDATE_F_ADMIN | NEIGH_UPDATE_F_OVERRIDE_ISROUTER))
+		return false;
+	if (!(old & NUD_VALID) || (old & (NUD_NOARP | NUD_PERMANENT)) ||
+	    !(new & NUD_VALID))
+		return false;
+	/* neigh_update() keeps the current state for these */
+	if (new != old &&
+	    !(new == NUD_STALE &&
+	      ((flags & NEIGH_UPDATE_F_WEAK_OVERRIDE) || (old & NUD_CONNECTED))))
+		return false;
+
+	if (lladdr && dev->addr_len) {
+		unsigned int seq;
+		bool same;
+
+		do {
+			seq = read_seqbegin(&neigh->ha_lock);
+			same = !memcmp(lladdr, neigh->ha, dev->addr_len);
+		} while (read_seqretry(&neigh->ha_lock, seq));
+		if (!same)
+			return false;
+	}
+
+	if ((new & NUD_CONNECTED) && neigh->confirmed != now)
+		neigh->confirmed = now;
+	if (neigh->updated != now)
+		neigh->updated = now;
+
+	/* Raced with a state change; redo it under the lock. */
+	if (ACCESS_ONCE(neigh->nud_state) != old)
+		return false;
+
+	NEIGH_CACHE_STAT_INC(neigh->tbl, confirms_coalesced);
+	return true;
+}
 
 /* Generic update routine.
    -- lladdr is new lladdr or NULL, if it is not supplied.
@@ -1081,6 +1167,9 @@ int neigh_update(struct neighbour *neigh, const u8 *lladdr, u8 new,
 	struct net_device *dev;
 	int update_isrouter = 0;
 
+	if (neigh_update_confirm(neigh, lladdr, new, flags))
+		return 0;
+
 	write_lock_bh(&neigh->lock);
 
 	dev    = neigh->dev;
@@ -1873,6 +1962,9 @@ static int neightbl_fill_info(struct sk_buff *skb, struct neigh_table *tbl,
 			ndst.ndts_rcv_probes_ucast	+= st->rcv_probes_ucast;
 			ndst.ndts_periodic_gc_runs	+= st->periodic_gc_runs;
 			ndst.ndts_forced_gc_runs	+= st->forced_gc_runs;
+			ndst.ndts_gc_time_us		+= st->gc_time_us;
+			ndst.ndts_gc_reclaimed		+= st->gc_reclaimed;
+			ndst.ndts_confirms_coalesced	+= st->confirms_coalesced;
 		}
 
 		if (nla_put(skb, NDTA_STATS, sizeof(ndst), &ndst))
@@ -2261,6 +2353,20 @@ static int neigh_dump_table(struct neigh_table *tbl, struct sk_buff *skb,
 	rcu_read_lock_bh();
 	nht = rcu_dereference_bh(tbl->nht);
 
+	/* The bucket cursor is only valid for the hash table it was taken
+	 * from. neigh_hash_grow() reseeds the hash, so when the table has
+	 * been replaced since the last pass, start it over and flag the
+	 * dump as interrupted instead of silently skipping entries.
+	 */
+	if (cb->args[3] != (long)nht->hash_rnd[0]) {
+		if (cb->args[3]) {
+			nl_dump_mark_interrupted(cb);
+			s_h = 0;
+			s_idx = 0;
+		}
+		cb->args[3] = (long)nht->hash_rnd[0];
+	}
+
 	for (h = s_h; h < (1 << nht->hash_shift); h++) {
 		if (h > s_h)
 			s_idx = 0;
@@ -2702,12 +2808,13 @@ static int neigh_stat_seq_show(struct seq_file *seq, void *v)
 	struct neigh_statistics *st = v;
 
 	if (v == SEQ_START_TOKEN) {
-		seq_printf(seq, "entries  allocs destroys hash_grows  lookups hits  res_failed  rcv_probes_mcast rcv_probes_ucast  periodic_gc_runs forced_gc_runs unresolved_discards\n");
+		seq_printf(seq, "entries  allocs destroys hash_grows  lookups hits  res_failed  rcv_probes_mcast rcv_probes_ucast  periodic_gc_runs forced_gc_runs unresolved_discards  gc_time_us gc_reclaimed confirms_coalesced\n");
 		return 0;
 	}
 
 	seq_printf(seq, "%08x  %08lx %08lx %08lx  %08lx %08lx  %08lx  "
-			"%08lx %08lx  %08lx %08lx %08lx\n",
+			"%08lx %08lx  %08lx %08lx %08lx  "
+			"%08lx %08lx %08lx\n",
 		   atomic_read(&tbl->entries),
 
 		   st->allocs,
@@ -2724,7 +2831,11 @@ static int neigh_stat_seq_show(struct seq_file *seq, void *v)
 
 		   st->periodic_gc_runs,
 		   st->forced_gc_runs,
-		   st->unres_discards
+		   st->unres_discards,
+
+		   st->gc_time_us,
+		   st->gc_reclaimed,
+		   st->confirms_coalesced
 		   );
 
 	return 0;
@@ -1677,14 +1677,48 @@ static struct tnode *trie_nextleaf(struct tnode *l)
 	return leaf_walk_rcu(p, l);
 }
 
-static struct tnode *trie_leafindex(struct trie *t, int index)
+/*
+ * Find the first leaf with a key greater than or equal to KEY.  Costs one
+ * descent of the trie, so a dump can resume after its leaf went away
+ * without rescanning every leaf in front of it.
+ */
+static struct tnode *trie_leaf_ge(struct trie *t, t_key key)
 {
-	struct tnode *l = trie_firstleaf(t);
+	struct tnode *p = NULL, *n = rcu_dereference_rtnl(t->trie);
 
-	while (l && index-- > 0)
-		l = trie_nextleaf(l);
+	while (n) {
+		unsigned long index = get_index(key, n);
 
-	return l;
+		if (index & (~0ul << n->bits)) {
+			/* KEY diverges from the prefix of N: either all of
+			 * N's leaves sort after KEY or all of them before.
+			 */
+			if (key < n->key)
+				return IS_LEAF(n) ? n : leaf_walk_rcu(n, NULL);
+			return p ? leaf_walk_rcu(p, n) : NULL;
+		}
+
+		if (IS_LEAF(n))
+			return n;
+
+		p = n;
+		n = tnode_get_child_rcu(p, index);
+		if (!n) {
+			/* Empty slot: continue with the next child of P */
+			while (++index < tnode_child_length(p)) {
+				n = tnode_get_child_rcu(p, index);
+				if (n)
+					break;
+			}
+			if (!n)
+				return trie_nextleaf(p);
+			if (IS_LEAF(n))
+				return n;
+			return leaf_walk_rcu(n, NULL);
+		}
+	}
+
+	return NULL;
 }
 
 
@@ -1807,37 +1841,31 @@ int fib_table_dump(struct fib_table *tb, struct sk_buff *skb,
 	struct tnode *l;
 	struct trie *t = (struct trie *) tb->tb_data;
 	t_key key = cb->args[2];
-	int count = cb->args[3];
 
 	rcu_read_lock();
 	/* Dump starting at last key.
 	 * Note: 0.0.0.0/0 (ie default) is first key.
+	 *
+	 * If the leaf we stopped in has been removed meanwhile, carry on
+	 * with the one that now follows it; the positions within the old
+	 * leaf are meaningless for it.
 	 */
-	if (count == 0)
-		l = trie_firstleaf(t);
-	else {
-		/* Normally, continue from last key, but if that is missing
-		 * fallback to using slow rescan
-		 */
-		l = fib_find_node(t, key);
-		if (!l)
-			l = trie_leafindex(t, count);
-	}
+	l = trie_leaf_ge(t, key);
+	if (l && l->key != key)
+		memset(&cb->args[4], 0,
+		       sizeof(cb->args) - 4*sizeof(cb->args[0]));
 
 	while (l) {
 		cb->args[2] = l->key;
 		if (fn_trie_dump_leaf(l, tb, skb, cb) < 0) {
-			cb->args[3] = count;
 			rcu_read_unlock();
 			return -1;
 		}
 
-		++count;
 		l = trie_nextleaf(l);
 		memset(&cb->args[4], 0,
 		       sizeof(cb->args) - 4*sizeof(cb->args[0]));
 	}
-	cb->args[3] = count;
 	rcu_read_unlock();
 
 	return skb->len;
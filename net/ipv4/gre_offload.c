@@ -26,7 +26,7 @@ static struct sk_buff *gre_gso_segment(struct sk_buff *skb,
 	int mac_len = skb->mac_len;
 	__be16 protocol = skb->protocol;
 	int tnl_hlen;
-	bool csum;
+	bool csum, lco;
 
 	if (unlikely(skb_shinfo(skb)->gso_type &
 				~(SKB_GSO_TCPV4 |
@@ -51,8 +51,13 @@ static struct sk_buff *gre_gso_segment(struct sk_buff *skb,
 	if (unlikely(ghl < sizeof(*greh)))
 		goto out;
 
+	/* As for UDP tunnels, leave the inner checksum to a device that
+	 * can do it and compute the GRE checksum from the headers only.
+	 */
+	enc_features = skb->dev->hw_enc_features & features;
 	csum = !!(greh->flags & GRE_CSUM);
-	if (csum)
+	lco = csum && (enc_features & NETIF_F_ALL_CSUM);
+	if (csum && !lco)
 		skb->encap_hdr_csum = 1;
 
 	/* setup inner skb. */
@@ -68,7 +73,6 @@ static struct sk_buff *gre_gso_segment(struct sk_buff *skb,
 	skb->mac_len = skb_inner_network_offset(skb);
 
 	/* segment inner packet. */
-	enc_features = skb->dev->hw_enc_features & features;
 	segs = skb_mac_gso_segment(skb, enc_features);
 	if (IS_ERR_OR_NULL(segs)) {
 		skb_gso_error_unwind(skb, protocol, ghl, mac_offset, mac_len);
@@ -80,9 +84,11 @@ static struct sk_buff *gre_gso_segment(struct sk_buff *skb,
 	do {
 		__skb_push(skb, ghl);
 		if (csum) {
+			bool partial = lco &&
+				       skb->ip_summed == CHECKSUM_PARTIAL;
 			__be32 *pcsum;
 
-			if (skb_has_shared_frag(skb)) {
+			if (!partial && skb_has_shared_frag(skb)) {
 				int err;
 
 				err = __skb_linearize(skb);
@@ -99,7 +105,10 @@ static struct sk_buff *gre_gso_segment(struct sk_buff *skb,
 			    skb_transport_header(skb);
 			pcsum = (__be32 *)(greh + 1);
 			*pcsum = 0;
-			*(__sum16 *)pcsum = gso_make_checksum(skb, 0);
+			if (partial)
+				*(__sum16 *)pcsum = csum_fold(lco_csum(skb));
+			else
+				*(__sum16 *)pcsum = gso_make_checksum(skb, 0);
 		}
 		__skb_push(skb, tnl_hlen - ghl);
 
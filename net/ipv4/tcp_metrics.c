@@ -6,9 +6,10 @@
 #include <linux/slab.h>
 #include <linux/init.h>
 #include <linux/tcp.h>
-#include <linux/hash.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/rhashtable.h>
 #include <linux/tcp_metrics.h>
-#include <linux/vmalloc.h>
 
 #include <net/inet_connection_sock.h>
 #include <net/net_namespace.h>
@@ -22,10 +23,6 @@
 
 int sysctl_tcp_nometrics_save __read_mostly;
 
-static struct tcp_metrics_block *__tcp_get_metrics(const struct inetpeer_addr *saddr,
-						   const struct inetpeer_addr *daddr,
-						   struct net *net, unsigned int hash);
-
 struct tcp_fastopen_metrics {
 	u16	mss;
 	u16	syn_loss:10;		/* Recurring Fast Open SYN losses */
@@ -39,19 +36,31 @@ struct tcp_fastopen_metrics {
 #define TCP_METRIC_MAX_KERNEL (TCP_METRIC_MAX - 2)
 
 struct tcp_metrics_block {
-	struct tcp_metrics_block __rcu	*tcpm_next;
+	struct rhash_head		tcpm_node;
 	struct inetpeer_addr		tcpm_saddr;
 	struct inetpeer_addr		tcpm_daddr;
 	unsigned long			tcpm_stamp;
 	u32				tcpm_ts;
 	u32				tcpm_ts_stamp;
 	u32				tcpm_lock;
+	u32				tcpm_referenced;
 	u32				tcpm_vals[TCP_METRIC_MAX_KERNEL + 1];
 	struct tcp_fastopen_metrics	tcpm_fastopen;
 
 	struct rcu_head			rcu_head;
 };
 
+/* Per network namespace cache.  Lookups are RCU only, insertions and
+ * removals take the rhashtable bucket locks, and the table grows and
+ * shrinks with the number of peers instead of being sized for the worst
+ * case in every namespace.
+ */
+struct tcpm_table {
+	struct rhashtable	hash;
+	unsigned int		max_entries;
+	unsigned int		evict_slot;
+};
+
 static bool tcp_metric_locked(struct tcp_metrics_block *tm,
 			      enum tcp_metric_index idx)
 {
@@ -87,11 +96,48 @@ static bool addr_same(const struct inetpeer_addr *a,
 	return ipv6_addr_equal(a6, b6);
 }
 
-struct tcpm_hash_bucket {
-	struct tcp_metrics_block __rcu	*chain;
+/* Entries are hashed by destination only, so that netlink requests that
+ * name no source address find them too.  Only the bytes that are valid
+ * for the address family are hashed: callers build their keys on the
+ * stack and leave the rest of the union uninitialized.
+ */
+static u32 tcpm_hash(const void *data, u32 len, u32 seed)
+{
+	const struct inetpeer_addr *addr = data;
+
+	if (addr->family == AF_INET)
+		return jhash_1word((__force u32)addr->addr.a4, seed);
+
+	return jhash2((__force const u32 *)addr->addr.a6, 4, seed);
+}
+
+struct tcpm_cmp_arg {
+	const struct inetpeer_addr	*saddr;	/* NULL matches any */
+	const struct inetpeer_addr	*daddr;
 };
 
-static DEFINE_SPINLOCK(tcp_metrics_lock);
+static bool tcpm_cmp(void *ptr, void *arg)
+{
+	const struct tcp_metrics_block *tm = ptr;
+	const struct tcpm_cmp_arg *x = arg;
+
+	return addr_same(&tm->tcpm_daddr, x->daddr) &&
+	       (!x->saddr || addr_same(&tm->tcpm_saddr, x->saddr));
+}
+
+/* rcu_read_lock needs to be held by the caller */
+static struct tcp_metrics_block *tcpm_lookup(struct net *net,
+					     const struct inetpeer_addr *saddr,
+					     const struct inetpeer_addr *daddr)
+{
+	struct tcpm_cmp_arg arg = {
+		.saddr = saddr,
+		.daddr = daddr,
+	};
+
+	return rhashtable_lookup_compare(&net->ipv4.tcp_metrics->hash, daddr,
+					 tcpm_cmp, &arg);
+}
 
 static void tcpm_suck_dst(struct tcp_metrics_block *tm,
 			  const struct dst_entry *dst,
@@ -140,97 +186,96 @@ static void tcpm_check_stamp(struct tcp_metrics_block *tm, struct dst_entry *dst
 		tcpm_suck_dst(tm, dst, false);
 }
 
+/* Mark an entry as used for the eviction clock below.  Checked first so
+ * that lookups of hot entries do not keep dirtying the cache line.
+ */
+static void tcpm_touch(struct tcp_metrics_block *tm)
+{
+	if (tm && !tm->tcpm_referenced)
+		tm->tcpm_referenced = 1;
+}
+
+static void tcpm_free(struct tcpm_table *t, struct tcp_metrics_block *tm)
+{
+	/* Whoever unlinks the entry owns it */
+	if (rhashtable_remove(&t->hash, &tm->tcpm_node))
+		kfree_rcu(tm, rcu_head);
+}
+
+/* Average number of entries a hash slot held before the table became
+ * resizable; tcpmhash_entries times this bounds the cache.
+ */
 #define TCP_METRICS_RECLAIM_DEPTH	5
-#define TCP_METRICS_RECLAIM_PTR		(struct tcp_metrics_block *) 0x1UL
+/* Buckets one eviction pass may look at */
+#define TCP_METRICS_EVICT_SCAN		16
+
+/* Second chance eviction: sweep the buckets in turn, clearing the
+ * referenced mark of entries used since the last sweep and dropping the
+ * first one that was not.  Unlike recycling the oldest entry of the chain
+ * being inserted to, this keeps peers that are in active use no matter
+ * which bucket they hash to.  Caller holds rcu_read_lock.
+ */
+static void tcpm_evict(struct tcpm_table *t)
+{
+	const struct bucket_table *tbl;
+	struct tcp_metrics_block *tm;
+	struct rhash_head *pos;
+	unsigned int i, slot;
+
+	tbl = rht_dereference_rcu(t->hash.tbl, &t->hash);
+	for (i = 0; i < TCP_METRICS_EVICT_SCAN; i++) {
+		slot = t->evict_slot++ & (tbl->size - 1);
+		rht_for_each_entry_rcu(tm, pos, tbl, slot, tcpm_node) {
+			if (tm->tcpm_referenced) {
+				tm->tcpm_referenced = 0;
+				continue;
+			}
+			tcpm_free(t, tm);
+			return;
+		}
+	}
+}
 
 static struct tcp_metrics_block *tcpm_new(struct dst_entry *dst,
 					  struct inetpeer_addr *saddr,
-					  struct inetpeer_addr *daddr,
-					  unsigned int hash)
+					  struct inetpeer_addr *daddr)
 {
+	struct net *net = dev_net(dst->dev);
+	struct tcpm_table *t = net->ipv4.tcp_metrics;
 	struct tcp_metrics_block *tm;
-	struct net *net;
-	bool reclaim = false;
+	struct tcpm_cmp_arg arg = {
+		.saddr = saddr,
+		.daddr = daddr,
+	};
 
-	spin_lock_bh(&tcp_metrics_lock);
-	net = dev_net(dst->dev);
+	if (atomic_read(&t->hash.nelems) >= t->max_entries)
+		tcpm_evict(t);
 
-	/* While waiting for the spin-lock the cache might have been populated
-	 * with this entry and so we have to check again.
-	 */
-	tm = __tcp_get_metrics(saddr, daddr, net, hash);
-	if (tm == TCP_METRICS_RECLAIM_PTR) {
-		reclaim = true;
-		tm = NULL;
-	}
-	if (tm) {
-		tcpm_check_stamp(tm, dst);
-		goto out_unlock;
-	}
-
-	if (unlikely(reclaim)) {
-		struct tcp_metrics_block *oldest;
-
-		oldest = rcu_dereference(net->ipv4.tcp_metrics_hash[hash].chain);
-		for (tm = rcu_dereference(oldest->tcpm_next); tm;
-		     tm = rcu_dereference(tm->tcpm_next)) {
-			if (time_before(tm->tcpm_stamp, oldest->tcpm_stamp))
-				oldest = tm;
-		}
-		tm = oldest;
-	} else {
-		tm = kmalloc(sizeof(*tm), GFP_ATOMIC);
-		if (!tm)
-			goto out_unlock;
-	}
+	tm = kmalloc(sizeof(*tm), GFP_ATOMIC);
+	if (!tm)
+		return NULL;
 	tm->tcpm_saddr = *saddr;
 	tm->tcpm_daddr = *daddr;
+	tm->tcpm_referenced = 1;
 
 	tcpm_suck_dst(tm, dst, true);
 
-	if (likely(!reclaim)) {
-		tm->tcpm_next = net->ipv4.tcp_metrics_hash[hash].chain;
-		rcu_assign_pointer(net->ipv4.tcp_metrics_hash[hash].chain, tm);
+	/* Somebody else may have created the entry meanwhile */
+	if (!rhashtable_lookup_compare_insert(&t->hash, &tm->tcpm_node,
+					      tcpm_cmp, &arg)) {
+		kfree(tm);
+		tm = tcpm_lookup(net, saddr, daddr);
+		tcpm_check_stamp(tm, dst);
 	}
 
-out_unlock:
-	spin_unlock_bh(&tcp_metrics_lock);
 	return tm;
 }
 
-static struct tcp_metrics_block *tcp_get_encode(struct tcp_metrics_block *tm, int depth)
-{
-	if (tm)
-		return tm;
-	if (depth > TCP_METRICS_RECLAIM_DEPTH)
-		return TCP_METRICS_RECLAIM_PTR;
-	return NULL;
-}
-
-static struct tcp_metrics_block *__tcp_get_metrics(const struct inetpeer_addr *saddr,
-						   const struct inetpeer_addr *daddr,
-						   struct net *net, unsigned int hash)
-{
-	struct tcp_metrics_block *tm;
-	int depth = 0;
-
-	for (tm = rcu_dereference(net->ipv4.tcp_metrics_hash[hash].chain); tm;
-	     tm = rcu_dereference(tm->tcpm_next)) {
-		if (addr_same(&tm->tcpm_saddr, saddr) &&
-		    addr_same(&tm->tcpm_daddr, daddr))
-			break;
-		depth++;
-	}
-	return tcp_get_encode(tm, depth);
-}
-
 static struct tcp_metrics_block *__tcp_get_metrics_req(struct request_sock *req,
 						       struct dst_entry *dst)
 {
 	struct tcp_metrics_block *tm;
 	struct inetpeer_addr saddr, daddr;
-	unsigned int hash;
-	struct net *net;
 
 	saddr.family = req->rsk_ops->family;
 	daddr.family = req->rsk_ops->family;
@@ -238,28 +283,19 @@ static struct tcp_metrics_block *__tcp_get_metrics_req(struct request_sock *req,
 	case AF_INET:
 		saddr.addr.a4 = inet_rsk(req)->ir_loc_addr;
 		daddr.addr.a4 = inet_rsk(req)->ir_rmt_addr;
-		hash = (__force unsigned int) daddr.addr.a4;
 		break;
 #if IS_ENABLED(CONFIG_IPV6)
 	case AF_INET6:
 		*(struct in6_addr *)saddr.addr.a6 = inet_rsk(req)->ir_v6_loc_addr;
 		*(struct in6_addr *)daddr.addr.a6 = inet_rsk(req)->ir_v6_rmt_addr;
-		hash = ipv6_addr_hash(&inet_rsk(req)->ir_v6_rmt_addr);
 		break;
 #endif
 	default:
 		return NULL;
 	}
 
-	net = dev_net(dst->dev);
-	hash = hash_32(hash, net->ipv4.tcp_metrics_hash_log);
-
-	for (tm = rcu_dereference(net->ipv4.tcp_metrics_hash[hash].chain); tm;
-	     tm = rcu_dereference(tm->tcpm_next)) {
-		if (addr_same(&tm->tcpm_saddr, &saddr) &&
-		    addr_same(&tm->tcpm_daddr, &daddr))
-			break;
-	}
+	tm = tcpm_lookup(dev_net(dst->dev), &saddr, &daddr);
+	tcpm_touch(tm);
 	tcpm_check_stamp(tm, dst);
 	return tm;
 }
@@ -268,15 +304,12 @@ static struct tcp_metrics_block *__tcp_get_metrics_tw(struct inet_timewait_sock
 {
 	struct tcp_metrics_block *tm;
 	struct inetpeer_addr saddr, daddr;
-	unsigned int hash;
-	struct net *net;
 
 	if (tw->tw_family == AF_INET) {
 		saddr.family = AF_INET;
 		saddr.addr.a4 = tw->tw_rcv_saddr;
 		daddr.family = AF_INET;
 		daddr.addr.a4 = tw->tw_daddr;
-		hash = (__force unsigned int) daddr.addr.a4;
 	}
 #if IS_ENABLED(CONFIG_IPV6)
 	else if (tw->tw_family == AF_INET6) {
@@ -285,28 +318,19 @@ static struct tcp_metrics_block *__tcp_get_metrics_tw(struct inet_timewait_sock
 			saddr.addr.a4 = tw->tw_rcv_saddr;
 			daddr.family = AF_INET;
 			daddr.addr.a4 = tw->tw_daddr;
-			hash = (__force unsigned int) daddr.addr.a4;
 		} else {
 			saddr.family = AF_INET6;
 			*(struct in6_addr *)saddr.addr.a6 = tw->tw_v6_rcv_saddr;
 			daddr.family = AF_INET6;
 			*(struct in6_addr *)daddr.addr.a6 = tw->tw_v6_daddr;
-			hash = ipv6_addr_hash(&tw->tw_v6_daddr);
 		}
 	}
 #endif
 	else
 		return NULL;
 
-	net = twsk_net(tw);
-	hash = hash_32(hash, net->ipv4.tcp_metrics_hash_log);
-
-	for (tm = rcu_dereference(net->ipv4.tcp_metrics_hash[hash].chain); tm;
-	     tm = rcu_dereference(tm->tcpm_next)) {
-		if (addr_same(&tm->tcpm_saddr, &saddr) &&
-		    addr_same(&tm->tcpm_daddr, &daddr))
-			break;
-	}
+	tm = tcpm_lookup(twsk_net(tw), &saddr, &daddr);
+	tcpm_touch(tm);
 	return tm;
 }
 
@@ -316,15 +340,12 @@ static struct tcp_metrics_block *tcp_get_metrics(struct sock *sk,
 {
 	struct tcp_metrics_block *tm;
 	struct inetpeer_addr saddr, daddr;
-	unsigned int hash;
-	struct net *net;
 
 	if (sk->sk_family == AF_INET) {
 		saddr.family = AF_INET;
 		saddr.addr.a4 = inet_sk(sk)->inet_saddr;
 		daddr.family = AF_INET;
 		daddr.addr.a4 = inet_sk(sk)->inet_daddr;
-		hash = (__force unsigned int) daddr.addr.a4;
 	}
 #if IS_ENABLED(CONFIG_IPV6)
 	else if (sk->sk_family == AF_INET6) {
@@ -333,29 +354,23 @@ static struct tcp_metrics_block *tcp_get_metrics(struct sock *sk,
 			saddr.addr.a4 = inet_sk(sk)->inet_saddr;
 			daddr.family = AF_INET;
 			daddr.addr.a4 = inet_sk(sk)->inet_daddr;
-			hash = (__force unsigned int) daddr.addr.a4;
 		} else {
 			saddr.family = AF_INET6;
 			*(struct in6_addr *)saddr.addr.a6 = sk->sk_v6_rcv_saddr;
 			daddr.family = AF_INET6;
 			*(struct in6_addr *)daddr.addr.a6 = sk->sk_v6_daddr;
-			hash = ipv6_addr_hash(&sk->sk_v6_daddr);
 		}
 	}
 #endif
 	else
 		return NULL;
 
-	net = dev_net(dst->dev);
-	hash = hash_32(hash, net->ipv4.tcp_metrics_hash_log);
-
-	tm = __tcp_get_metrics(&saddr, &daddr, net, hash);
-	if (tm == TCP_METRICS_RECLAIM_PTR)
-		tm = NULL;
+	tm = tcpm_lookup(dev_net(dst->dev), &saddr, &daddr);
 	if (!tm && create)
-		tm = tcpm_new(dst, &saddr, &daddr, hash);
+		tm = tcpm_new(dst, &saddr, &daddr);
 	else
 		tcpm_check_stamp(tm, dst);
+	tcpm_touch(tm);
 
 	return tm;
 }
@@ -898,35 +913,48 @@ static int tcp_metrics_nl_dump(struct sk_buff *skb,
 			       struct netlink_callback *cb)
 {
 	struct net *net = sock_net(skb->sk);
-	unsigned int max_rows = 1U << net->ipv4.tcp_metrics_hash_log;
+	struct rhashtable *ht = &net->ipv4.tcp_metrics->hash;
+	const struct bucket_table *tbl;
 	unsigned int row, s_row = cb->args[0];
 	int s_col = cb->args[1], col = s_col;
 
-	for (row = s_row; row < max_rows; row++, s_col = 0) {
+	rcu_read_lock();
+	tbl = rht_dereference_rcu(ht->tbl, ht);
+
+	/* Rows only mean something for the table size they were taken at */
+	if (cb->args[2] != tbl->size) {
+		if (cb->args[2]) {
+			nl_dump_mark_interrupted(cb);
+			s_row = 0;
+			s_col = 0;
+		}
+		cb->args[2] = tbl->size;
+	}
+
+	for (row = s_row; row < tbl->size; row++, s_col = 0) {
 		struct tcp_metrics_block *tm;
-		struct tcpm_hash_bucket *hb = net->ipv4.tcp_metrics_hash + row;
+		struct rhash_head *pos;
 
-		rcu_read_lock();
-		for (col = 0, tm = rcu_dereference(hb->chain); tm;
-		     tm = rcu_dereference(tm->tcpm_next), col++) {
-			if (col < s_col)
+		col = 0;
+		rht_for_each_entry_rcu(tm, pos, tbl, row, tcpm_node) {
+			if (col++ < s_col)
 				continue;
 			if (tcp_metrics_dump_info(skb, cb, tm) < 0) {
-				rcu_read_unlock();
+				col--;
 				goto done;
 			}
 		}
-		rcu_read_unlock();
 	}
 
 done:
+	rcu_read_unlock();
 	cb->args[0] = row;
 	cb->args[1] = col;
 	return skb->len;
 }
 
 static int __parse_nl_addr(struct genl_info *info, struct inetpeer_addr *addr,
-			   unsigned int *hash, int optional, int v4, int v6)
+			   int optional, int v4, int v6)
 {
 	struct nlattr *a;
 
@@ -934,8 +962,6 @@ static int __parse_nl_addr(struct genl_info *info, struct inetpeer_addr *addr,
 	if (a) {
 		addr->family = AF_INET;
 		addr->addr.a4 = nla_get_be32(a);
-		if (hash)
-			*hash = (__force unsigned int) addr->addr.a4;
 		return 0;
 	}
 	a = info->attrs[v6];
@@ -944,24 +970,22 @@ static int __parse_nl_addr(struct genl_info *info, struct inetpeer_addr *addr,
 			return -EINVAL;
 		addr->family = AF_INET6;
 		memcpy(addr->addr.a6, nla_data(a), sizeof(addr->addr.a6));
-		if (hash)
-			*hash = ipv6_addr_hash((struct in6_addr *) addr->addr.a6);
 		return 0;
 	}
 	return optional ? 1 : -EAFNOSUPPORT;
 }
 
 static int parse_nl_addr(struct genl_info *info, struct inetpeer_addr *addr,
-			 unsigned int *hash, int optional)
+			 int optional)
 {
-	return __parse_nl_addr(info, addr, hash, optional,
+	return __parse_nl_addr(info, addr, optional,
 			       TCP_METRICS_ATTR_ADDR_IPV4,
 			       TCP_METRICS_ATTR_ADDR_IPV6);
 }
 
 static int parse_nl_saddr(struct genl_info *info, struct inetpeer_addr *addr)
 {
-	return __parse_nl_addr(info, addr, NULL, 0,
+	return __parse_nl_addr(info, addr, 0,
 			       TCP_METRICS_ATTR_SADDR_IPV4,
 			       TCP_METRICS_ATTR_SADDR_IPV6);
 }
@@ -970,14 +994,13 @@ static int tcp_metrics_nl_cmd_get(struct sk_buff *skb, struct genl_info *info)
 {
 	struct tcp_metrics_block *tm;
 	struct inetpeer_addr saddr, daddr;
-	unsigned int hash;
 	struct sk_buff *msg;
 	struct net *net = genl_info_net(info);
 	void *reply;
 	int ret;
 	bool src = true;
 
-	ret = parse_nl_addr(info, &daddr, &hash, 0);
+	ret = parse_nl_addr(info, &daddr, 0);
 	if (ret < 0)
 		return ret;
 
@@ -994,17 +1017,11 @@ static int tcp_metrics_nl_cmd_get(struct sk_buff *skb, struct genl_info *info)
 	if (!reply)
 		goto nla_put_failure;
 
-	hash = hash_32(hash, net->ipv4.tcp_metrics_hash_log);
 	ret = -ESRCH;
 	rcu_read_lock();
-	for (tm = rcu_dereference(net->ipv4.tcp_metrics_hash[hash].chain); tm;
-	     tm = rcu_dereference(tm->tcpm_next)) {
-		if (addr_same(&tm->tcpm_daddr, &daddr) &&
-		    (!src || addr_same(&tm->tcpm_saddr, &saddr))) {
-			ret = tcp_metrics_fill_info(msg, tm);
-			break;
-		}
-	}
+	tm = tcpm_lookup(net, src ? &saddr : NULL, &daddr);
+	if (tm)
+		ret = tcp_metrics_fill_info(msg, tm);
 	rcu_read_unlock();
 	if (ret < 0)
 		goto out_free;
@@ -1020,48 +1037,33 @@ out_free:
 	return ret;
 }
 
-#define deref_locked_genl(p)	\
-	rcu_dereference_protected(p, lockdep_genl_is_held() && \
-				     lockdep_is_held(&tcp_metrics_lock))
-
-#define deref_genl(p)	rcu_dereference_protected(p, lockdep_genl_is_held())
-
 static int tcp_metrics_flush_all(struct net *net)
 {
-	unsigned int max_rows = 1U << net->ipv4.tcp_metrics_hash_log;
-	struct tcpm_hash_bucket *hb = net->ipv4.tcp_metrics_hash;
+	struct tcpm_table *t = net->ipv4.tcp_metrics;
+	const struct bucket_table *tbl;
 	struct tcp_metrics_block *tm;
+	struct rhash_head *pos;
 	unsigned int row;
 
-	for (row = 0; row < max_rows; row++, hb++) {
-		spin_lock_bh(&tcp_metrics_lock);
-		tm = deref_locked_genl(hb->chain);
-		if (tm)
-			hb->chain = NULL;
-		spin_unlock_bh(&tcp_metrics_lock);
-		while (tm) {
-			struct tcp_metrics_block *next;
-
-			next = deref_genl(tm->tcpm_next);
-			kfree_rcu(tm, rcu_head);
-			tm = next;
-		}
+	rcu_read_lock();
+	tbl = rht_dereference_rcu(t->hash.tbl, &t->hash);
+	for (row = 0; row < tbl->size; row++) {
+		rht_for_each_entry_rcu(tm, pos, tbl, row, tcpm_node)
+			tcpm_free(t, tm);
 	}
+	rcu_read_unlock();
 	return 0;
 }
 
 static int tcp_metrics_nl_cmd_del(struct sk_buff *skb, struct genl_info *info)
 {
-	struct tcpm_hash_bucket *hb;
 	struct tcp_metrics_block *tm;
-	struct tcp_metrics_block __rcu **pp;
 	struct inetpeer_addr saddr, daddr;
-	unsigned int hash;
 	struct net *net = genl_info_net(info);
 	int ret;
 	bool src = true, found = false;
 
-	ret = parse_nl_addr(info, &daddr, &hash, 1);
+	ret = parse_nl_addr(info, &daddr, 1);
 	if (ret < 0)
 		return ret;
 	if (ret > 0)
@@ -1070,21 +1072,12 @@ static int tcp_metrics_nl_cmd_del(struct sk_buff *skb, struct genl_info *info)
 	if (ret < 0)
 		src = false;
 
-	hash = hash_32(hash, net->ipv4.tcp_metrics_hash_log);
-	hb = net->ipv4.tcp_metrics_hash + hash;
-	pp = &hb->chain;
-	spin_lock_bh(&tcp_metrics_lock);
-	for (tm = deref_locked_genl(*pp); tm; tm = deref_locked_genl(*pp)) {
-		if (addr_same(&tm->tcpm_daddr, &daddr) &&
-		    (!src || addr_same(&tm->tcpm_saddr, &saddr))) {
-			*pp = tm->tcpm_next;
-			kfree_rcu(tm, rcu_head);
-			found = true;
-		} else {
-			pp = &tm->tcpm_next;
-		}
+	rcu_read_lock();
+	while ((tm = tcpm_lookup(net, src ? &saddr : NULL, &daddr))) {
+		tcpm_free(net->ipv4.tcp_metrics, tm);
+		found = true;
 	}
-	spin_unlock_bh(&tcp_metrics_lock);
+	rcu_read_unlock();
 	if (!found)
 		return -ESRCH;
 	return 0;
@@ -1123,8 +1116,17 @@ __setup("tcpmhash_entries=", set_tcpmhash_entries);
 
 static int __net_init tcp_net_metrics_init(struct net *net)
 {
-	size_t size;
+	struct rhashtable_params params = {
+		.head_offset = offsetof(struct tcp_metrics_block, tcpm_node),
+		.key_offset = offsetof(struct tcp_metrics_block, tcpm_daddr),
+		.key_len = sizeof(struct inetpeer_addr),
+		.hashfn = tcpm_hash,
+		.grow_decision = rht_grow_above_75,
+		.shrink_decision = rht_shrink_below_30,
+	};
+	struct tcpm_table *t;
 	unsigned int slots;
+	int err;
 
 	slots = tcpmhash_entries;
 	if (!slots) {
@@ -1134,34 +1136,47 @@ static int __net_init tcp_net_metrics_init(struct net *net)
 			slots = 8 * 1024;
 	}
 
-	net->ipv4.tcp_metrics_hash_log = order_base_2(slots);
-	size = sizeof(struct tcpm_hash_bucket) << net->ipv4.tcp_metrics_hash_log;
+	t = kzalloc(sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return -ENOMEM;
 
-	net->ipv4.tcp_metrics_hash = kzalloc(size, GFP_KERNEL | __GFP_NOWARN);
-	if (!net->ipv4.tcp_metrics_hash)
-		net->ipv4.tcp_metrics_hash = vzalloc(size);
+	t->max_entries = slots * TCP_METRICS_RECLAIM_DEPTH;
+	params.max_shift = order_base_2(t->max_entries);
 
-	if (!net->ipv4.tcp_metrics_hash)
-		return -ENOMEM;
+	err = rhashtable_init(&t->hash, &params);
+	if (err) {
+		kfree(t);
+		return err;
+	}
 
+	net->ipv4.tcp_metrics = t;
 	return 0;
 }
 
 static void __net_exit tcp_net_metrics_exit(struct net *net)
 {
+	struct tcpm_table *t = net->ipv4.tcp_metrics;
+	const struct bucket_table *tbl;
+	struct rhash_head *pos, *next;
 	unsigned int i;
 
-	for (i = 0; i < (1U << net->ipv4.tcp_metrics_hash_log) ; i++) {
-		struct tcp_metrics_block *tm, *next;
-
-		tm = rcu_dereference_protected(net->ipv4.tcp_metrics_hash[i].chain, 1);
-		while (tm) {
-			next = rcu_dereference_protected(tm->tcpm_next, 1);
-			kfree(tm);
-			tm = next;
+	/* Nobody can reach the table anymore; stop the resize worker
+	 * before walking the buckets it might otherwise be rewriting.
+	 */
+	cancel_work_sync(&t->hash.run_work);
+
+	tbl = rcu_dereference_protected(t->hash.tbl, 1);
+	for (i = 0; i < tbl->size; i++) {
+		pos = rcu_dereference_protected(tbl->buckets[i], 1);
+		while (!rht_is_a_nulls(pos)) {
+			next = rcu_dereference_protected(pos->next, 1);
+			kfree(container_of(pos, struct tcp_metrics_block,
+					   tcpm_node));
+			pos = next;
 		}
 	}
-	kvfree(net->ipv4.tcp_metrics_hash);
+	rhashtable_destroy(&t->hash);
+	kfree(t);
 }
 
 static __net_initdata struct pernet_operations tcp_net_metrics_ops = {
@@ -149,15 +149,45 @@ static struct fib6_node *node_alloc(void)
 	return fn;
 }
 
-static void node_free(struct fib6_node *fn)
+static void node_free_rcu(struct rcu_head *head)
 {
+	struct fib6_node *fn = container_of(head, struct fib6_node, rcu);
+
 	kmem_cache_free(fib6_node_kmem, fn);
 }
 
+/* Route lookups walk the tree under rcu_read_lock() only */
+static void node_free(struct fib6_node *fn)
+{
+	call_rcu(&fn->rcu, node_free_rcu);
+}
+
+static void rt6_free_rcu(struct rcu_head *head)
+{
+	struct rt6_info *rt = container_of(head, struct rt6_info,
+					   dst.rcu_head);
+	int cpu;
+
+	if (rt->rt6i_pcpu) {
+		for_each_possible_cpu(cpu) {
+			struct rt6_info **ppcpu_rt, *pcpu_rt;
+
+			ppcpu_rt = per_cpu_ptr(rt->rt6i_pcpu, cpu);
+			pcpu_rt = *ppcpu_rt;
+			if (pcpu_rt) {
+				dst_free(&pcpu_rt->dst);
+				*ppcpu_rt = NULL;
+			}
+		}
+	}
+
+	dst_free(&rt->dst);
+}
+
 static void rt6_release(struct rt6_info *rt)
 {
 	if (atomic_dec_and_test(&rt->rt6i_ref))
-		dst_free(&rt->dst);
+		call_rcu(&rt->dst.rcu_head, rt6_free_rcu);
 }
 
 static void fib6_link_table(struct net *net, struct fib6_table *tb)
@@ -509,6 +539,8 @@ static struct fib6_node *fib6_add_1(struct fib6_node *root,
 	ln->parent = pn;
 	ln->fn_sernum = sernum;
 
+	/* initialise the node before lockless lookups can reach it */
+	smp_wmb();
 	if (dir)
 		pn->right = ln;
 	else
@@ -569,12 +601,6 @@ insert_above:
 
 		in->fn_sernum = sernum;
 
-		/* update parent pointer */
-		if (dir)
-			pn->right = in;
-		else
-			pn->left  = in;
-
 		ln->fn_bit = plen;
 
 		ln->parent = in;
@@ -589,6 +615,13 @@ insert_above:
 			in->left  = ln;
 			in->right = fn;
 		}
+
+		/* update parent pointer, once both children hang off in */
+		smp_wmb();
+		if (dir)
+			pn->right = in;
+		else
+			pn->left  = in;
 	} else { /* plen <= bit */
 
 		/*
@@ -608,17 +641,18 @@ insert_above:
 
 		ln->fn_sernum = sernum;
 
-		if (dir)
-			pn->right = ln;
-		else
-			pn->left  = ln;
-
 		if (addr_bit_set(&key->addr, plen))
 			ln->right = fn;
 		else
 			ln->left  = fn;
 
 		fn->parent = ln;
+
+		smp_wmb();
+		if (dir)
+			pn->right = ln;
+		else
+			pn->left  = ln;
 	}
 	return ln;
 }
@@ -770,8 +804,8 @@ static int fib6_add_rt2node(struct fib6_node *fn, struct rt6_info *rt,
 		while (sibling) {
 			if (sibling->rt6i_metric == rt->rt6i_metric &&
 			    rt6_qualify_for_ecmp(sibling)) {
-				list_add_tail(&rt->rt6i_siblings,
-					      &sibling->rt6i_siblings);
+				list_add_tail_rcu(&rt->rt6i_siblings,
+						  &sibling->rt6i_siblings);
 				break;
 			}
 			sibling = sibling->dst.rt6_next;
@@ -803,9 +837,10 @@ add:
 			return err;
 
 		rt->dst.rt6_next = iter;
-		*ins = rt;
 		rt->rt6i_node = fn;
 		atomic_inc(&rt->rt6i_ref);
+		smp_wmb();
+		*ins = rt;
 		inet6_rt_notify(RTM_NEWROUTE, rt, info);
 		info->nl_net->ipv6.rt6_stats->fib_rt_entries++;
 
@@ -826,10 +861,11 @@ add:
 		if (err)
 			return err;
 
-		*ins = rt;
 		rt->rt6i_node = fn;
 		rt->dst.rt6_next = iter->dst.rt6_next;
 		atomic_inc(&rt->rt6i_ref);
+		smp_wmb();
+		*ins = rt;
 		inet6_rt_notify(RTM_NEWROUTE, rt, info);
 		if (!(fn->fn_flags & RTN_RTINFO)) {
 			info->nl_net->ipv6.rt6_stats->fib_route_nodes++;
@@ -881,6 +917,13 @@ int fib6_add(struct fib6_node *root, struct rt6_info *rt,
 	if (!allow_create && !replace_required)
 		pr_warn("RTM_NEWROUTE with no NLM_F_CREATE or NLM_F_REPLACE\n");
 
+	/* Slots for the per-cpu copies handed out by lookups.  Without them
+	 * lookups simply return the route itself.
+	 */
+	if (!(rt->rt6i_flags & RTF_CACHE) && !rt->rt6i_pcpu)
+		rt->rt6i_pcpu = alloc_percpu_gfp(struct rt6_info *,
+						 GFP_ATOMIC | __GFP_NOWARN);
+
 	fn = fib6_add_1(root, &rt->rt6i_dst.addr, rt->rt6i_dst.plen,
 			offsetof(struct rt6_info, rt6i_dst), allow_create,
 			replace_required, sernum);
@@ -938,6 +981,7 @@ int fib6_add(struct fib6_node *root, struct rt6_info *rt,
 
 			/* Now link new subtree to main tree */
 			sfn->parent = fn;
+			smp_wmb();
 			fn->subtree = sfn;
 		} else {
 			sn = fib6_add_1(fn->subtree, &rt->rt6i_src.addr,
@@ -1034,7 +1078,8 @@ static struct fib6_node *fib6_lookup_1(struct fib6_node *root,
 
 		dir = addr_bit_set(args->addr, fn->fn_bit);
 
-		next = dir ? fn->right : fn->left;
+		next = dir ? lockless_dereference(fn->right) :
+			     lockless_dereference(fn->left);
 
 		if (next) {
 			fn = next;
@@ -1044,18 +1089,22 @@ static struct fib6_node *fib6_lookup_1(struct fib6_node *root,
 	}
 
 	while (fn) {
-		if (FIB6_SUBTREE(fn) || fn->fn_flags & RTN_RTINFO) {
+		struct rt6_info *leaf = lockless_dereference(fn->leaf);
+
+		/* leaf is briefly NULL while a node is being repaired */
+		if (leaf && (FIB6_SUBTREE(fn) || fn->fn_flags & RTN_RTINFO)) {
 			struct rt6key *key;
 
-			key = (struct rt6key *) ((u8 *) fn->leaf +
-						 args->offset);
+			key = (struct rt6key *) ((u8 *) leaf + args->offset);
 
 			if (ipv6_prefix_equal(&key->addr, args->addr, key->plen)) {
 #ifdef CONFIG_IPV6_SUBTREES
-				if (fn->subtree) {
+				struct fib6_node *subtree;
+
+				subtree = lockless_dereference(fn->subtree);
+				if (subtree) {
 					struct fib6_node *sfn;
-					sfn = fib6_lookup_1(fn->subtree,
-							    args + 1);
+					sfn = fib6_lookup_1(subtree, args + 1);
 					if (!sfn)
 						goto backtrack;
 					fn = sfn;
@@ -1323,7 +1372,7 @@ static void fib6_del_route(struct fib6_node *fn, struct rt6_info **rtp,
 					 &rt->rt6i_siblings, rt6i_siblings)
 			sibling->rt6i_nsiblings--;
 		rt->rt6i_nsiblings = 0;
-		list_del_init(&rt->rt6i_siblings);
+		list_del_rcu(&rt->rt6i_siblings);
 	}
 
 	/* Adjust walkers */
@@ -1338,7 +1387,9 @@ static void fib6_del_route(struct fib6_node *fn, struct rt6_info **rtp,
 	}
 	read_unlock(&fib6_walker_lock);
 
-	rt->dst.rt6_next = NULL;
+	/* rt->dst.rt6_next is left alone: lookups that raced with us may
+	 * still be walking the list through rt.
+	 */
 
 	/* If it was last route, expunge its radix tree node */
 	if (!fn->leaf) {
@@ -1785,6 +1836,8 @@ static void fib6_net_exit(struct net *net)
 {
 	rt6_ifdown(net, NULL);
 	del_timer_sync(&net->ipv6.ip6_fib_timer);
+	/* let deferred route frees run before their table goes away */
+	rcu_barrier();
 
 #ifdef CONFIG_IPV6_MULTIPLE_TABLES
 	inetpeer_invalidate_tree(&net->ipv6.fib6_local_tbl->tb6_peers);
@@ -1835,6 +1888,7 @@ out_kmem_cache_create:
 void fib6_gc_cleanup(void)
 {
 	unregister_pernet_subsys(&fib6_net_ops);
+	rcu_barrier();
 	kmem_cache_destroy(fib6_node_kmem);
 }
 
@@ -57,7 +57,10 @@ static bool rpfilter_lookup_reverse6(const struct sk_buff *skb,
 	if (rt->dst.error)
 		goto out;
 
-	if (rt->rt6i_flags & (RTF_REJECT|RTF_ANYCAST))
+	if (rt->rt6i_flags & RTF_REJECT)
+		goto out;
+
+	if (ipv6_anycast_destination((struct dst_entry *)rt, &iph->saddr))
 		goto out;
 
 	if (rt->rt6i_flags & RTF_LOCAL) {
@@ -328,6 +328,8 @@ static void ip6_dst_destroy(struct dst_entry *dst)
 	if (!(rt->dst.flags & DST_HOST))
 		dst_destroy_metrics_generic(dst);
 
+	free_percpu(rt->rt6i_pcpu);
+
 	if (idev) {
 		rt->rt6i_idev = NULL;
 		in6_dev_put(idev);
@@ -411,7 +413,7 @@ static struct rt6_info *rt6_multipath_select(struct rt6_info *match,
 					     struct flowi6 *fl6, int oif,
 					     int strict)
 {
-	struct rt6_info *sibling, *next_sibling;
+	struct rt6_info *sibling;
 	int route_choosen;
 
 	route_choosen = rt6_info_hash_nhsfn(match->rt6i_nsiblings + 1, fl6);
@@ -419,8 +421,8 @@ static struct rt6_info *rt6_multipath_select(struct rt6_info *match,
 	 * (siblings does not include ourself)
 	 */
 	if (route_choosen)
-		list_for_each_entry_safe(sibling, next_sibling,
-				&match->rt6i_siblings, rt6i_siblings) {
+		list_for_each_entry_rcu(sibling, &match->rt6i_siblings,
+					rt6i_siblings) {
 			route_choosen--;
 			if (route_choosen == 0) {
 				if (rt6_score_route(sibling, oif, strict) < 0)
@@ -433,7 +435,7 @@ static struct rt6_info *rt6_multipath_select(struct rt6_info *match,
 }
 
 /*
- *	Route lookup. Any table->tb6_lock is implied.
+ *	Route lookup. rcu_read_lock() or table->tb6_lock is implied.
  */
 
 static inline struct rt6_info *rt6_device_match(struct net *net,
@@ -668,15 +670,19 @@ static struct rt6_info *find_rr_leaf(struct fib6_node *fn,
 	return match;
 }
 
-static struct rt6_info *rt6_select(struct fib6_node *fn, int oif, int strict)
+static struct rt6_info *rt6_select(struct net *net, struct fib6_node *fn,
+				   int oif, int strict)
 {
-	struct rt6_info *match, *rt0;
-	struct net *net;
+	struct rt6_info *match, *rt0, *leaf;
 	bool do_rr = false;
 
-	rt0 = fn->rr_ptr;
+	leaf = lockless_dereference(fn->leaf);
+	if (!leaf)
+		return net->ipv6.ip6_null_entry;
+
+	rt0 = lockless_dereference(fn->rr_ptr);
 	if (!rt0)
-		fn->rr_ptr = rt0 = fn->leaf;
+		rt0 = leaf;
 
 	match = find_rr_leaf(fn, rt0, rt0->rt6i_metric, oif, strict,
 			     &do_rr);
@@ -686,13 +692,22 @@ static struct rt6_info *rt6_select(struct fib6_node *fn, int oif, int strict)
 
 		/* no entries matched; do round-robin */
 		if (!next || next->rt6i_metric != rt0->rt6i_metric)
-			next = fn->leaf;
+			next = leaf;
+
+		if (next != rt0) {
+			struct fib6_table *table = rt0->rt6i_table;
 
-		if (next != rt0)
-			fn->rr_ptr = next;
+			/* Lookups run under RCU only; the rare round-robin
+			 * update is serialized with deletions, which reset
+			 * rr_ptr, by the table lock.
+			 */
+			write_lock_bh(&table->tb6_lock);
+			if (next->rt6i_node == fn)
+				fn->rr_ptr = next;
+			write_unlock_bh(&table->tb6_lock);
+		}
 	}
 
-	net = dev_net(rt0->dst.dev);
 	return match ? match : net->ipv6.ip6_null_entry;
 }
 
@@ -796,11 +811,15 @@ static struct rt6_info *ip6_pol_route_lookup(struct net *net,
 	struct fib6_node *fn;
 	struct rt6_info *rt;
 
-	read_lock_bh(&table->tb6_lock);
+	rcu_read_lock();
 	fn = fib6_lookup(&table->tb6_root, &fl6->daddr, &fl6->saddr);
 restart:
-	rt = fn->leaf;
-	rt = rt6_device_match(net, rt, &fl6->saddr, fl6->flowi6_oif, flags);
+	rt = lockless_dereference(fn->leaf);
+	if (rt)
+		rt = rt6_device_match(net, rt, &fl6->saddr,
+				      fl6->flowi6_oif, flags);
+	else
+		rt = net->ipv6.ip6_null_entry;
 	if (rt->rt6i_nsiblings && fl6->flowi6_oif == 0)
 		rt = rt6_multipath_select(rt, fl6, fl6->flowi6_oif, flags);
 	if (rt == net->ipv6.ip6_null_entry) {
@@ -809,7 +828,7 @@ restart:
 			goto restart;
 	}
 	dst_use(&rt->dst, jiffies);
-	read_unlock_bh(&table->tb6_lock);
+	rcu_read_unlock();
 	return rt;
 
 }
@@ -874,9 +893,9 @@ int ip6_ins_rt(struct rt6_info *rt)
 	return __ip6_ins_rt(rt, &info, &mxc);
 }
 
-static struct rt6_info *rt6_alloc_cow(struct rt6_info *ort,
-				      const struct in6_addr *daddr,
-				      const struct in6_addr *saddr)
+static struct rt6_info *ip6_rt_cache_alloc(struct rt6_info *ort,
+					   const struct in6_addr *daddr,
+					   const struct in6_addr *saddr)
 {
 	struct rt6_info *rt;
 
@@ -885,14 +904,15 @@ static struct rt6_info *rt6_alloc_cow(struct rt6_info *ort,
 	 */
 
 	rt = ip6_rt_copy(ort, daddr);
+	if (!rt)
+		return NULL;
 
-	if (rt) {
+	rt->rt6i_flags |= RTF_CACHE;
+
+	if (!(ort->rt6i_flags & (RTF_NONEXTHOP | RTF_GATEWAY))) {
 		if (ort->rt6i_dst.plen != 128 &&
 		    ipv6_addr_equal(&ort->rt6i_dst.addr, daddr))
 			rt->rt6i_flags |= RTF_ANYCAST;
-
-		rt->rt6i_flags |= RTF_CACHE;
-
 #ifdef CONFIG_IPV6_SUBTREES
 		if (rt->rt6i_src.plen && saddr) {
 			rt->rt6i_src.addr = *saddr;
@@ -904,37 +924,95 @@ static struct rt6_info *rt6_alloc_cow(struct rt6_info *ort,
 	return rt;
 }
 
-static struct rt6_info *rt6_alloc_clone(struct rt6_info *ort,
-					const struct in6_addr *daddr)
+/*
+ * A per-cpu copy stands in for its fib6 route towards every destination
+ * covered by the prefix.  It is never linked into the tree: it shares the
+ * route's metrics, is validated through dst.from and is freed together
+ * with the route once that has left the tree (see rt6_release()).
+ */
+static struct rt6_info *ip6_rt_pcpu_alloc(struct rt6_info *rt)
 {
-	struct rt6_info *rt = ip6_rt_copy(ort, daddr);
+	struct net *net = dev_net(rt->dst.dev);
+	struct rt6_info *pcpu_rt;
 
-	if (rt)
-		rt->rt6i_flags |= RTF_CACHE;
-	return rt;
+	pcpu_rt = ip6_dst_alloc(net, rt->dst.dev, DST_NOCOUNT,
+				rt->rt6i_table);
+	if (!pcpu_rt)
+		return NULL;
+
+	pcpu_rt->dst.input = rt->dst.input;
+	pcpu_rt->dst.output = rt->dst.output;
+	pcpu_rt->dst.error = rt->dst.error;
+	pcpu_rt->dst.lastuse = jiffies;
+	pcpu_rt->rt6i_idev = rt->rt6i_idev;
+	if (pcpu_rt->rt6i_idev)
+		in6_dev_hold(pcpu_rt->rt6i_idev);
+
+	pcpu_rt->rt6i_dst = rt->rt6i_dst;
+#ifdef CONFIG_IPV6_SUBTREES
+	pcpu_rt->rt6i_src = rt->rt6i_src;
+#endif
+	pcpu_rt->rt6i_prefsrc = rt->rt6i_prefsrc;
+	pcpu_rt->rt6i_gateway = rt->rt6i_gateway;
+	pcpu_rt->rt6i_metric = rt->rt6i_metric;
+	pcpu_rt->rt6i_protocol = rt->rt6i_protocol;
+	pcpu_rt->rt6i_flags = rt->rt6i_flags | RTF_PCPU;
+	rt6_set_from(pcpu_rt, rt);
+	dst_init_metrics(&pcpu_rt->dst, dst_metrics_ptr(&rt->dst), true);
+
+	return pcpu_rt;
+}
+
+/* It should be called with rcu_read_lock() held */
+static struct rt6_info *rt6_get_pcpu_route(struct rt6_info *rt)
+{
+	struct rt6_info *pcpu_rt, *prev, **p;
+
+	p = raw_cpu_ptr(rt->rt6i_pcpu);
+	pcpu_rt = ACCESS_ONCE(*p);
+	if (!pcpu_rt) {
+		pcpu_rt = ip6_rt_pcpu_alloc(rt);
+		if (!pcpu_rt)
+			return NULL;
+
+		/* We may have migrated, or raced with an interrupt on this
+		 * cpu; keep whichever copy made it into the slot first.
+		 */
+		prev = cmpxchg(p, NULL, pcpu_rt);
+		if (prev) {
+			dst_destroy(&pcpu_rt->dst);
+			pcpu_rt = prev;
+		}
+	}
+
+	return pcpu_rt;
+}
+
+static void rt6_dst_from_metrics_check(struct rt6_info *rt)
+{
+	if (rt->dst.from &&
+	    dst_metrics_ptr(&rt->dst) != dst_metrics_ptr(rt->dst.from))
+		dst_init_metrics(&rt->dst, dst_metrics_ptr(rt->dst.from), true);
 }
 
 static struct rt6_info *ip6_pol_route(struct net *net, struct fib6_table *table, int oif,
 				      struct flowi6 *fl6, int flags)
 {
 	struct fib6_node *fn, *saved_fn;
-	struct rt6_info *rt, *nrt;
+	struct rt6_info *rt, *pcpu_rt;
 	int strict = 0;
-	int attempts = 3;
-	int err;
 
 	strict |= flags & RT6_LOOKUP_F_IFACE;
 	if (net->ipv6.devconf_all->forwarding == 0)
 		strict |= RT6_LOOKUP_F_REACHABLE;
 
-redo_fib6_lookup_lock:
-	read_lock_bh(&table->tb6_lock);
+	rcu_read_lock();
 
 	fn = fib6_lookup(&table->tb6_root, &fl6->daddr, &fl6->saddr);
 	saved_fn = fn;
 
 redo_rt6_select:
-	rt = rt6_select(fn, oif, strict);
+	rt = rt6_select(net, fn, oif, strict);
 	if (rt->rt6i_nsiblings)
 		rt = rt6_multipath_select(rt, fl6, oif, strict);
 	if (rt == net->ipv6.ip6_null_entry) {
@@ -946,49 +1024,28 @@ redo_rt6_select:
 			strict &= ~RT6_LOOKUP_F_REACHABLE;
 			fn = saved_fn;
 			goto redo_rt6_select;
-		} else {
-			dst_hold(&rt->dst);
-			read_unlock_bh(&table->tb6_lock);
-			goto out2;
 		}
 	}
 
-	dst_hold(&rt->dst);
-	read_unlock_bh(&table->tb6_lock);
-
-	if (rt->rt6i_flags & RTF_CACHE)
-		goto out2;
-
-	if (!(rt->rt6i_flags & (RTF_NONEXTHOP | RTF_GATEWAY)))
-		nrt = rt6_alloc_cow(rt, &fl6->daddr, &fl6->saddr);
-	else if (!(rt->dst.flags & DST_HOST))
-		nrt = rt6_alloc_clone(rt, &fl6->daddr);
-	else
-		goto out2;
-
-	ip6_rt_put(rt);
-	rt = nrt ? : net->ipv6.ip6_null_entry;
-
-	dst_hold(&rt->dst);
-	if (nrt) {
-		err = ip6_ins_rt(nrt);
-		if (!err)
-			goto out2;
-	}
-
-	if (--attempts <= 0)
-		goto out2;
-
-	/*
-	 * Race condition! In the gap, when table->tb6_lock was
-	 * released someone could insert this route.  Relookup.
+	/* Cached clones (PMTU, redirects) and the null entry are handed
+	 * out as they are; everything else through its per-cpu copy, so
+	 * that neither the lookup nor the refcounting below touches
+	 * cache lines shared with other cpus.
 	 */
-	ip6_rt_put(rt);
-	goto redo_fib6_lookup_lock;
+	if (rt == net->ipv6.ip6_null_entry || (rt->rt6i_flags & RTF_CACHE) ||
+	    !rt->rt6i_pcpu) {
+		dst_use(&rt->dst, jiffies);
+		rcu_read_unlock();
+		return rt;
+	}
 
-out2:
-	rt->dst.lastuse = jiffies;
-	rt->dst.__use++;
+	pcpu_rt = rt6_get_pcpu_route(rt);
+	if (pcpu_rt) {
+		rt6_dst_from_metrics_check(pcpu_rt);
+		rt = pcpu_rt;
+	}
+	dst_use(&rt->dst, jiffies);
+	rcu_read_unlock();
 
 	return rt;
 }
@@ -1095,6 +1152,29 @@ struct dst_entry *ip6_blackhole_route(struct net *net, struct dst_entry *dst_ori
  *	Destination cache support functions
  */
 
+static struct dst_entry *rt6_check(struct rt6_info *rt, u32 cookie)
+{
+	if (!rt->rt6i_node || (rt->rt6i_node->fn_sernum != cookie))
+		return NULL;
+
+	if (rt6_check_expired(rt))
+		return NULL;
+
+	return &rt->dst;
+}
+
+static struct dst_entry *rt6_dst_from_check(struct rt6_info *rt, u32 cookie)
+{
+	/* A per-cpu copy is released (and marked dead) only together with
+	 * the route it was made from, so checking that route is enough.
+	 */
+	if (rt->dst.obsolete == DST_OBSOLETE_FORCE_CHK &&
+	    rt6_check((struct rt6_info *)(rt->dst.from), cookie))
+		return &rt->dst;
+	else
+		return NULL;
+}
+
 static struct dst_entry *ip6_dst_check(struct dst_entry *dst, u32 cookie)
 {
 	struct rt6_info *rt;
@@ -1105,13 +1185,12 @@ static struct dst_entry *ip6_dst_check(struct dst_entry *dst, u32 cookie)
 	 * DST_OBSOLETE_FORCE_CHK which forces validation calls down
 	 * into this function always.
 	 */
-	if (!rt->rt6i_node || (rt->rt6i_node->fn_sernum != cookie))
-		return NULL;
-
-	if (rt6_check_expired(rt))
-		return NULL;
+	if (rt->rt6i_flags & RTF_PCPU) {
+		rt6_dst_from_metrics_check(rt);
+		return rt6_dst_from_check(rt, cookie);
+	}
 
-	return dst;
+	return rt6_check(rt, cookie);
 }
 
 static struct dst_entry *ip6_negative_advice(struct dst_entry *dst)
@@ -1144,28 +1223,72 @@ static void ip6_link_failure(struct sk_buff *skb)
 			dst_hold(&rt->dst);
 			if (ip6_del_rt(rt))
 				dst_free(&rt->dst);
-		} else if (rt->rt6i_node && (rt->rt6i_flags & RTF_DEFAULT)) {
-			rt->rt6i_node->fn_sernum = -1;
+		} else {
+			if (rt->rt6i_flags & RTF_PCPU)
+				rt = (struct rt6_info *)rt->dst.from;
+			if (rt->rt6i_node && (rt->rt6i_flags & RTF_DEFAULT))
+				rt->rt6i_node->fn_sernum = -1;
 		}
 	}
 }
 
-static void ip6_rt_update_pmtu(struct dst_entry *dst, struct sock *sk,
-			       struct sk_buff *skb, u32 mtu)
+static void rt6_do_update_pmtu(struct rt6_info *rt, u32 mtu)
+{
+	struct net *net = dev_net(rt->dst.dev);
+
+	rt->rt6i_flags |= RTF_MODIFIED;
+	dst_metric_set(&rt->dst, RTAX_MTU, mtu);
+	rt6_update_expires(rt, net->ipv6.sysctl.ip6_rt_mtu_expires);
+}
+
+static void __ip6_rt_update_pmtu(struct dst_entry *dst, const struct sock *sk,
+				 const struct ipv6hdr *iph, u32 mtu)
 {
 	struct rt6_info *rt6 = (struct rt6_info *)dst;
+	const struct in6_addr *daddr, *saddr;
+	struct rt6_info *nrt6;
+
+	if (rt6->rt6i_flags & RTF_LOCAL)
+		return;
 
 	dst_confirm(dst);
-	if (mtu < dst_mtu(dst) && rt6->rt6i_dst.plen == 128) {
-		struct net *net = dev_net(dst->dev);
+	if (mtu < IPV6_MIN_MTU)
+		mtu = IPV6_MIN_MTU;
+	if (mtu >= dst_mtu(dst))
+		return;
 
-		rt6->rt6i_flags |= RTF_MODIFIED;
-		if (mtu < IPV6_MIN_MTU)
-			mtu = IPV6_MIN_MTU;
+	if (rt6->rt6i_flags & RTF_CACHE) {
+		rt6_do_update_pmtu(rt6, mtu);
+		return;
+	}
 
-		dst_metric_set(dst, RTAX_MTU, mtu);
-		rt6_update_expires(rt6, net->ipv6.sysctl.ip6_rt_mtu_expires);
+	/* Routes and their per-cpu copies are shared by a whole prefix, so
+	 * the reduced MTU goes into a host clone in the tree instead.
+	 */
+	if (iph) {
+		daddr = &iph->daddr;
+		saddr = &iph->saddr;
+	} else if (sk) {
+		daddr = &sk->sk_v6_daddr;
+		saddr = &inet6_sk(sk)->saddr;
+	} else {
+		return;
 	}
+
+	nrt6 = ip6_rt_cache_alloc(rt6, daddr, saddr);
+	if (nrt6) {
+		rt6_do_update_pmtu(nrt6, mtu);
+		/* Inserting the clone bumps the sernum of its fib6 node, so
+		 * sockets caching the old route look up again.
+		 */
+		ip6_ins_rt(nrt6);
+	}
+}
+
+static void ip6_rt_update_pmtu(struct dst_entry *dst, struct sock *sk,
+			       struct sk_buff *skb, u32 mtu)
+{
+	__ip6_rt_update_pmtu(dst, sk, skb ? ipv6_hdr(skb) : NULL, mtu);
 }
 
 void ip6_update_pmtu(struct sk_buff *skb, struct net *net, __be32 mtu,
@@ -1184,7 +1307,7 @@ void ip6_update_pmtu(struct sk_buff *skb, struct net *net, __be32 mtu,
 
 	dst = ip6_route_output(net, NULL, &fl6);
 	if (!dst->error)
-		ip6_rt_update_pmtu(dst, NULL, skb, ntohl(mtu));
+		__ip6_rt_update_pmtu(dst, NULL, iph, ntohl(mtu));
 	dst_release(dst);
 }
 EXPORT_SYMBOL_GPL(ip6_update_pmtu);
@@ -1932,8 +2055,12 @@ static struct rt6_info *ip6_rt_copy(struct rt6_info *ort,
 				    const struct in6_addr *dest)
 {
 	struct net *net = dev_net(ort->dst.dev);
-	struct rt6_info *rt = ip6_dst_alloc(net, ort->dst.dev, 0,
-					    ort->rt6i_table);
+	struct rt6_info *rt;
+
+	if (ort->rt6i_flags & RTF_PCPU)
+		ort = (struct rt6_info *)ort->dst.from;
+
+	rt = ip6_dst_alloc(net, ort->dst.dev, 0, ort->rt6i_table);
 
 	if (rt) {
 		rt->dst.input = ort->dst.input;
@@ -2249,6 +2376,10 @@ int ip6_route_get_saddr(struct net *net,
 {
 	struct inet6_dev *idev = ip6_dst_idev((struct dst_entry *)rt);
 	int err = 0;
+
+	/* prefsrc can be cleared on the fib6 route after the copy was made */
+	if (rt->rt6i_flags & RTF_PCPU)
+		rt = (struct rt6_info *)rt->dst.from;
 	if (rt->rt6i_prefsrc.plen)
 		*saddr = rt->rt6i_prefsrc.addr;
 	else
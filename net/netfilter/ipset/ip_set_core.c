@@ -239,6 +239,8 @@ unlock:
 	ip_set_type_unlock();
 
 	synchronize_rcu();
+	/* Wait for the pending frees of the type's data structures */
+	rcu_barrier_bh();
 }
 EXPORT_SYMBOL_GPL(ip_set_type_unregister);
 
@@ -481,6 +483,26 @@ ip_set_rcu_get(struct net *net, ip_set_id_t index)
 	return set;
 }
 
+/* Kernel side add/del of the types with bucket locks need the set lock
+ * for reading only: writers of different buckets can run in parallel */
+static inline void
+ip_set_adt_lock(struct ip_set *set)
+{
+	if (set->variant->bucket_locks)
+		read_lock_bh(&set->lock);
+	else
+		write_lock_bh(&set->lock);
+}
+
+static inline void
+ip_set_adt_unlock(struct ip_set *set)
+{
+	if (set->variant->bucket_locks)
+		read_unlock_bh(&set->lock);
+	else
+		write_unlock_bh(&set->lock);
+}
+
 int
 ip_set_test(ip_set_id_t index, const struct sk_buff *skb,
 	    const struct xt_action_param *par, struct ip_set_adt_opt *opt)
@@ -496,16 +518,22 @@ ip_set_test(ip_set_id_t index, const struct sk_buff *skb,
 	    !(opt->family == set->family || set->family == NFPROTO_UNSPEC))
 		return 0;
 
-	read_lock_bh(&set->lock);
-	ret = set->variant->kadt(set, skb, par, IPSET_TEST, opt);
-	read_unlock_bh(&set->lock);
+	if (set->variant->rcu_test) {
+		rcu_read_lock_bh();
+		ret = set->variant->kadt(set, skb, par, IPSET_TEST, opt);
+		rcu_read_unlock_bh();
+	} else {
+		read_lock_bh(&set->lock);
+		ret = set->variant->kadt(set, skb, par, IPSET_TEST, opt);
+		read_unlock_bh(&set->lock);
+	}
 
 	if (ret == -EAGAIN) {
 		/* Type requests element to be completed */
 		pr_debug("element must be completed, ADD is triggered\n");
-		write_lock_bh(&set->lock);
+		ip_set_adt_lock(set);
 		set->variant->kadt(set, skb, par, IPSET_ADD, opt);
-		write_unlock_bh(&set->lock);
+		ip_set_adt_unlock(set);
 		ret = 1;
 	} else {
 		/* --return-nomatch: invert matched element */
@@ -535,9 +563,9 @@ ip_set_add(ip_set_id_t index, const struct sk_buff *skb,
 	    !(opt->family == set->family || set->family == NFPROTO_UNSPEC))
 		return -IPSET_ERR_TYPE_MISMATCH;
 
-	write_lock_bh(&set->lock);
+	ip_set_adt_lock(set);
 	ret = set->variant->kadt(set, skb, par, IPSET_ADD, opt);
-	write_unlock_bh(&set->lock);
+	ip_set_adt_unlock(set);
 
 	return ret;
 }
@@ -558,9 +586,9 @@ ip_set_del(ip_set_id_t index, const struct sk_buff *skb,
 	    !(opt->family == set->family || set->family == NFPROTO_UNSPEC))
 		return -IPSET_ERR_TYPE_MISMATCH;
 
-	write_lock_bh(&set->lock);
+	ip_set_adt_lock(set);
 	ret = set->variant->kadt(set, skb, par, IPSET_DEL, opt);
-	write_unlock_bh(&set->lock);
+	ip_set_adt_unlock(set);
 
 	return ret;
 }
@@ -1327,9 +1355,17 @@ dump_last:
 				goto next_set;
 			/* Fall through and add elements */
 		default:
-			read_lock_bh(&set->lock);
+			/* Kernel side writers with bucket locks may free
+			 * the extensions (comments) of the listed entries */
+			if (set->variant->bucket_locks)
+				write_lock_bh(&set->lock);
+			else
+				read_lock_bh(&set->lock);
 			ret = set->variant->list(set, skb, cb);
-			read_unlock_bh(&set->lock);
+			if (set->variant->bucket_locks)
+				write_unlock_bh(&set->lock);
+			else
+				read_unlock_bh(&set->lock);
 			if (!cb->args[IPSET_CB_ARG0])
 				/* Set is done, proceed with next one */
 				goto next_set;
@@ -9,6 +9,7 @@
 #define _IP_SET_HASH_GEN_H
 
 #include <linux/rcupdate.h>
+#include <linux/bitmap.h>
 #include <linux/jhash.h>
 #include <linux/netfilter/ipset/ip_set_timeout.h>
 #ifndef rcu_dereference_bh
@@ -28,14 +29,36 @@
  *
  * Resizing can be triggered by userspace command only, and those
  * are serialized by the nfnl mutex. During resizing the set is
- * read-locked, so the only possible concurrent operations are
+ * write-locked, so the only possible concurrent operations are
  * the kernel side readers. Those must be protected by proper RCU locking.
+ *
+ * Readers and writers
+ *
+ * Kernel side adds and deletes hold the set lock for reading only and are
+ * serialized per bucket by the bucket locks, so writers of different
+ * buckets run in parallel. Everything else which modifies the set holds
+ * the set lock for writing, and expire takes the bucket locks too.
+ * Kernel side tests may run without the set lock, under rcu_read_lock_bh()
+ * only. Therefore a bucket is never resized in place: a grown or shrunk
+ * copy is published with rcu_assign_pointer() and the old one is freed
+ * after an RCU-bh grace period. Free slots inside a bucket are marked
+ * in the "used" bitmap, which readers check before looking at an entry:
+ * new entries are filled out completely before they are marked as used.
+ * A slot which has ever been marked as used in a bucket is never written
+ * again in the same bucket, because a reader may still be looking at the
+ * former entry: the new entry is stored in a copy of the bucket instead.
  */
 
 /* Number of elements to store in an initial array block */
 #define AHASH_INIT_SIZE			4
 /* Max number of elements to store in an array block */
 #define AHASH_MAX_SIZE			(3*AHASH_INIT_SIZE)
+/* Max number of elements in an array block when tuned */
+#define AHASH_MAX_TUNED			64
+
+/* Number of locks serializing the writers of the buckets */
+#define AHASH_LOCKS			64
+#define ahash_lock(h, key)	(&(h)->bucket_lock[(key) & (AHASH_LOCKS - 1)])
 
 /* Max number of elements can be tuned */
 #ifdef IP_SET_HASH_WITH_MULTI
@@ -53,7 +76,7 @@ tune_ahash_max(u8 curr, u32 multi)
 	/* Currently, at listing one hash bucket must fit into a message.
 	 * Therefore we have a hard limit here.
 	 */
-	return n > curr && n <= 64 ? n : curr;
+	return n > curr && n <= AHASH_MAX_TUNED ? n : curr;
 }
 #define TUNE_AHASH_MAX(h, multi)	\
 	((h)->ahash_max = tune_ahash_max((h)->ahash_max, multi))
@@ -64,18 +87,23 @@ tune_ahash_max(u8 curr, u32 multi)
 
 /* A hash bucket */
 struct hbucket {
-	void *value;		/* the array of the values */
+	struct rcu_head rcu;	/* for freeing the bucket after readers */
+	/* Which positions are used in the array */
+	DECLARE_BITMAP(used, AHASH_MAX_TUNED);
 	u8 size;		/* size of the array */
 	u8 pos;			/* position of the first free entry */
+	u8 touched;		/* slots below were used in this bucket */
+	unsigned char value[0]	/* the array of the values */
+		__aligned(__alignof__(u64));
 };
 
 /* The hash table: the table size stored here in order to make resizing easy */
 struct htable {
 	u8 htable_bits;		/* size of hash table == 2^htable_bits */
-	struct hbucket bucket[0]; /* hashtable buckets */
+	struct hbucket __rcu *bucket[0]; /* hashtable buckets */
 };
 
-#define hbucket(h, i)		(&((h)->bucket[i]))
+#define hbucket(h, i)		((h)->bucket[i])
 
 #ifndef IPSET_NET_COUNT
 #define IPSET_NET_COUNT		1
@@ -97,11 +125,11 @@ htable_size(u8 hbits)
 	if (hbits > 31)
 		return 0;
 	hsize = jhash_size(hbits);
-	if ((((size_t)-1) - sizeof(struct htable))/sizeof(struct hbucket)
+	if ((((size_t)-1) - sizeof(struct htable))/sizeof(struct hbucket *)
 	    < hsize)
 		return 0;
 
-	return hsize * sizeof(struct hbucket) + sizeof(struct htable);
+	return hsize * sizeof(struct hbucket *) + sizeof(struct htable);
 }
 
 /* Compute htable_bits from the user input parameter hashsize */
@@ -117,28 +145,71 @@ htable_bits(u32 hashsize)
 	return bits;
 }
 
-static int
-hbucket_elem_add(struct hbucket *n, u8 ahash_max, size_t dsize)
+static void
+hbucket_free_rcu(struct rcu_head *head)
 {
-	if (n->pos >= n->size) {
-		void *tmp;
+	kfree(container_of(head, struct hbucket, rcu));
+}
 
-		if (n->size >= ahash_max)
-			/* Trigger rehashing */
-			return -EAGAIN;
-
-		tmp = kzalloc((n->size + AHASH_INIT_SIZE) * dsize,
-			      GFP_ATOMIC);
-		if (!tmp)
-			return -ENOMEM;
-		if (n->size) {
-			memcpy(tmp, n->value, n->size * dsize);
-			kfree(n->value);
-		}
-		n->value = tmp;
-		n->size += AHASH_INIT_SIZE;
+/* Free a bucket which may still be seen by lockless readers */
+#define hbucket_free(n)		call_rcu_bh(&(n)->rcu, hbucket_free_rcu)
+
+/* Allocate a copy of the bucket n (which may be NULL) with room
+ * for extra more entries. */
+static struct hbucket *
+hbucket_copy(const struct hbucket *n, size_t dsize, u8 extra)
+{
+	struct hbucket *tmp;
+	u8 size = n ? n->size : 0;
+
+	tmp = kzalloc(sizeof(*tmp) + (size + extra) * dsize, GFP_ATOMIC);
+	if (!tmp)
+		return NULL;
+	if (n) {
+		memcpy(tmp->value, n->value, size * dsize);
+		bitmap_copy(tmp->used, n->used, AHASH_MAX_TUNED);
+		tmp->pos = tmp->touched = n->pos;
 	}
-	return 0;
+	tmp->size = size + extra;
+
+	return tmp;
+}
+
+/* Release the unused space of bucket n at position r of the table after
+ * entries were deleted: trim the free tail, drop the bucket when it became
+ * empty and replace it with a compacted copy when that saves at least
+ * one AHASH_INIT_SIZE block. Must be called with the bucket lock held. */
+static void
+hbucket_shrink(struct htable *t, u32 r, struct hbucket *n, size_t dsize)
+{
+	struct hbucket *tmp;
+	u8 i, k = 0;
+
+	while (n->pos && !test_bit(n->pos - 1, n->used))
+		n->pos--;
+	if (!n->pos) {
+		rcu_assign_pointer(hbucket(t, r), NULL);
+		hbucket_free(n);
+		return;
+	}
+	if (bitmap_weight(n->used, n->pos) + AHASH_INIT_SIZE >= n->size)
+		return;
+
+	tmp = kzalloc(sizeof(*tmp) + (n->size - AHASH_INIT_SIZE) * dsize,
+		      GFP_ATOMIC);
+	if (!tmp)
+		/* Keep the holes, they are reused by add */
+		return;
+	for (i = 0; i < n->pos; i++) {
+		if (!test_bit(i, n->used))
+			continue;
+		memcpy(tmp->value + k * dsize, n->value + i * dsize, dsize);
+		__set_bit(k++, tmp->used);
+	}
+	tmp->pos = tmp->touched = k;
+	tmp->size = n->size - AHASH_INIT_SIZE;
+	rcu_assign_pointer(hbucket(t, r), tmp);
+	hbucket_free(n);
 }
 
 #ifdef IP_SET_HASH_WITH_NETS
@@ -267,7 +338,7 @@ hbucket_elem_add(struct hbucket *n, u8 ahash_max, size_t dsize)
 struct htype {
 	struct htable __rcu *table; /* the hash table */
 	u32 maxelem;		/* max elements in the hash */
-	u32 elements;		/* current element (vs timeout) */
+	atomic_t elements;	/* current element (vs timeout) */
 	u32 initval;		/* random jhash init value */
 #ifdef IP_SET_HASH_WITH_MARKMASK
 	u32 markmask;		/* markmask value for mark mask to store */
@@ -283,7 +354,9 @@ struct htype {
 #ifdef IP_SET_HASH_WITH_RBTREE
 	struct rb_root rbtree;
 #endif
+	spinlock_t bucket_lock[AHASH_LOCKS]; /* serialize bucket writers */
 #ifdef IP_SET_HASH_WITH_NETS
+	spinlock_t nets_lock;	/* serialize the prefix book-keeping */
 	struct net_prefixes nets[0]; /* book-keeping of prefixes */
 #endif
 };
@@ -340,16 +413,20 @@ static size_t
 mtype_ahash_memsize(const struct htype *h, const struct htable *t,
 		    u8 nets_length, size_t dsize)
 {
+	const struct hbucket *n;
 	u32 i;
 	size_t memsize = sizeof(*h)
 			 + sizeof(*t)
 #ifdef IP_SET_HASH_WITH_NETS
 			 + sizeof(struct net_prefixes) * nets_length
 #endif
-			 + jhash_size(t->htable_bits) * sizeof(struct hbucket);
+			 + jhash_size(t->htable_bits) * sizeof(struct hbucket *);
 
-	for (i = 0; i < jhash_size(t->htable_bits); i++)
-		memsize += t->bucket[i].size * dsize;
+	for (i = 0; i < jhash_size(t->htable_bits); i++) {
+		n = rcu_dereference_bh_nfnl(hbucket(t, i));
+		if (n)
+			memsize += sizeof(struct hbucket) + n->size * dsize;
+	}
 
 	return memsize;
 }
@@ -364,7 +441,8 @@ mtype_ext_cleanup(struct ip_set *set, struct hbucket *n)
 	int i;
 
 	for (i = 0; i < n->pos; i++)
-		ip_set_ext_destroy(set, ahash_data(n, i, set->dsize));
+		if (test_bit(i, n->used))
+			ip_set_ext_destroy(set, ahash_data(n, i, set->dsize));
 }
 
 /* Flush a hash type of set: destroy all elements */
@@ -378,22 +456,21 @@ mtype_flush(struct ip_set *set)
 
 	t = rcu_dereference_bh_nfnl(h->table);
 	for (i = 0; i < jhash_size(t->htable_bits); i++) {
-		n = hbucket(t, i);
-		if (n->size) {
-			if (set->extensions & IPSET_EXT_DESTROY)
-				mtype_ext_cleanup(set, n);
-			n->size = n->pos = 0;
-			/* FIXME: use slab cache */
-			kfree(n->value);
-		}
+		n = rcu_dereference_bh_nfnl(hbucket(t, i));
+		if (!n)
+			continue;
+		if (set->extensions & IPSET_EXT_DESTROY)
+			mtype_ext_cleanup(set, n);
+		rcu_assign_pointer(hbucket(t, i), NULL);
+		hbucket_free(n);
 	}
 #ifdef IP_SET_HASH_WITH_NETS
 	memset(h->nets, 0, sizeof(struct net_prefixes) * NLEN(set->family));
 #endif
-	h->elements = 0;
+	atomic_set(&h->elements, 0);
 }
 
-/* Destroy the hashtable part of the set */
+/* Destroy the hashtable part of the set: there must be no readers */
 static void
 mtype_ahash_destroy(struct ip_set *set, struct htable *t, bool ext_destroy)
 {
@@ -401,13 +478,13 @@ mtype_ahash_destroy(struct ip_set *set, struct htable *t, bool ext_destroy)
 	u32 i;
 
 	for (i = 0; i < jhash_size(t->htable_bits); i++) {
-		n = hbucket(t, i);
-		if (n->size) {
-			if (set->extensions & IPSET_EXT_DESTROY && ext_destroy)
-				mtype_ext_cleanup(set, n);
-			/* FIXME: use slab cache */
-			kfree(n->value);
-		}
+		n = rcu_dereference_bh_nfnl(hbucket(t, i));
+		if (!n)
+			continue;
+		if (set->extensions & IPSET_EXT_DESTROY && ext_destroy)
+			mtype_ext_cleanup(set, n);
+		/* FIXME: use slab cache */
+		kfree(n);
 	}
 
 	ip_set_free(t);
@@ -471,48 +548,39 @@ mtype_expire(struct ip_set *set, struct htype *h, u8 nets_length, size_t dsize)
 	struct hbucket *n;
 	struct mtype_elem *data;
 	u32 i;
-	int j;
+	int j, d;
 #ifdef IP_SET_HASH_WITH_NETS
 	u8 k;
 #endif
 
-	rcu_read_lock_bh();
-	t = rcu_dereference_bh(h->table);
+	t = rcu_dereference_bh_nfnl(h->table);
 	for (i = 0; i < jhash_size(t->htable_bits); i++) {
-		n = hbucket(t, i);
-		for (j = 0; j < n->pos; j++) {
+		spin_lock(ahash_lock(h, i));
+		n = rcu_dereference_bh_nfnl(hbucket(t, i));
+		for (j = 0, d = 0; n && j < n->pos; j++) {
+			if (!test_bit(j, n->used))
+				continue;
 			data = ahash_data(n, j, dsize);
 			if (ip_set_timeout_expired(ext_timeout(data, set))) {
 				pr_debug("expired %u/%u\n", i, j);
+				clear_bit(j, n->used);
+				smp_mb__after_atomic();
 #ifdef IP_SET_HASH_WITH_NETS
+				spin_lock(&h->nets_lock);
 				for (k = 0; k < IPSET_NET_COUNT; k++)
 					mtype_del_cidr(h, SCIDR(data->cidr, k),
 						       nets_length, k);
+				spin_unlock(&h->nets_lock);
 #endif
 				ip_set_ext_destroy(set, data);
-				if (j != n->pos - 1)
-					/* Not last one */
-					memcpy(data,
-					       ahash_data(n, n->pos - 1, dsize),
-					       dsize);
-				n->pos--;
-				h->elements--;
+				atomic_dec(&h->elements);
+				d++;
 			}
 		}
-		if (n->pos + AHASH_INIT_SIZE < n->size) {
-			void *tmp = kzalloc((n->size - AHASH_INIT_SIZE)
-					    * dsize,
-					    GFP_ATOMIC);
-			if (!tmp)
-				/* Still try to delete expired elements */
-				continue;
-			n->size -= AHASH_INIT_SIZE;
-			memcpy(tmp, n->value, n->size * dsize);
-			kfree(n->value);
-			n->value = tmp;
-		}
+		if (d)
+			hbucket_shrink(t, i, n, dsize);
+		spin_unlock(ahash_lock(h, i));
 	}
-	rcu_read_unlock_bh();
 }
 
 static void
@@ -544,17 +612,17 @@ mtype_resize(struct ip_set *set, bool retried)
 #endif
 	struct mtype_elem *data;
 	struct mtype_elem *d;
-	struct hbucket *n, *m;
-	u32 i, j;
+	struct hbucket *n, *m, *tmp;
+	u32 i, j, key;
 	int ret;
 
 	/* Try to cleanup once */
 	if (SET_WITH_TIMEOUT(set) && !retried) {
-		i = h->elements;
+		i = atomic_read(&h->elements);
 		write_lock_bh(&set->lock);
 		mtype_expire(set, set->data, NLEN(set->family), set->dsize);
 		write_unlock_bh(&set->lock);
-		if (h->elements < i)
+		if (atomic_read(&h->elements) < i)
 			return 0;
 	}
 
@@ -569,35 +637,57 @@ retry:
 			set->name);
 		return -IPSET_ERR_HASH_FULL;
 	}
-	t = ip_set_alloc(sizeof(*t)
-			 + jhash_size(htable_bits) * sizeof(struct hbucket));
+	t = ip_set_alloc(htable_size(htable_bits));
 	if (!t)
 		return -ENOMEM;
 	t->htable_bits = htable_bits;
 
-	read_lock_bh(&set->lock);
+	/* Exclude the kernel side writers as well */
+	write_lock_bh(&set->lock);
 	for (i = 0; i < jhash_size(orig->htable_bits); i++) {
-		n = hbucket(orig, i);
+		n = rcu_dereference_bh_nfnl(hbucket(orig, i));
+		if (!n)
+			continue;
 		for (j = 0; j < n->pos; j++) {
+			if (!test_bit(j, n->used))
+				continue;
 			data = ahash_data(n, j, set->dsize);
 #ifdef IP_SET_HASH_WITH_NETS
 			flags = 0;
 			mtype_data_reset_flags(data, &flags);
 #endif
-			m = hbucket(t, HKEY(data, h->initval, htable_bits));
-			ret = hbucket_elem_add(m, AHASH_MAX(h), set->dsize);
-			if (ret < 0) {
+			key = HKEY(data, h->initval, htable_bits);
+			m = rcu_dereference_bh_nfnl(hbucket(t, key));
+			if (!m || m->pos >= m->size) {
+				/* The new table is not visible yet: buckets
+				 * can be replaced without waiting for readers
+				 */
+				if (m && m->size >= AHASH_MAX(h)) {
+					ret = -EAGAIN;
+				} else {
+					tmp = hbucket_copy(m, set->dsize,
+							   AHASH_INIT_SIZE);
+					if (!tmp)
+						ret = -ENOMEM;
+				}
+				if (ret < 0) {
 #ifdef IP_SET_HASH_WITH_NETS
-				mtype_data_reset_flags(data, &flags);
+					mtype_data_reset_flags(data, &flags);
 #endif
-				read_unlock_bh(&set->lock);
-				mtype_ahash_destroy(set, t, false);
-				if (ret == -EAGAIN)
-					goto retry;
-				return ret;
+					write_unlock_bh(&set->lock);
+					mtype_ahash_destroy(set, t, false);
+					if (ret == -EAGAIN)
+						goto retry;
+					return ret;
+				}
+				kfree(m);
+				RCU_INIT_POINTER(hbucket(t, key), tmp);
+				m = tmp;
 			}
-			d = ahash_data(m, m->pos++, set->dsize);
+			d = ahash_data(m, m->pos, set->dsize);
 			memcpy(d, data, set->dsize);
+			__set_bit(m->pos++, m->used);
+			m->touched = m->pos;
 #ifdef IP_SET_HASH_WITH_NETS
 			mtype_data_reset_flags(d, &flags);
 #endif
@@ -605,7 +695,7 @@ retry:
 	}
 
 	rcu_assign_pointer(h->table, t);
-	read_unlock_bh(&set->lock);
+	write_unlock_bh(&set->lock);
 
 	/* Give time to other readers of the set */
 	synchronize_rcu_bh();
@@ -627,17 +717,29 @@ mtype_add(struct ip_set *set, void *value, const struct ip_set_ext *ext,
 	struct htable *t;
 	const struct mtype_elem *d = value;
 	struct mtype_elem *data;
-	struct hbucket *n;
-	int i, ret = 0;
-	int j = AHASH_MAX(h) + 1;
-	bool flag_exist = flags & IPSET_FLAG_EXIST;
+	struct hbucket *n, *old;
+	int i, j = -1, ret = 0;
+	int free = -1;
+	bool flag_exist = flags & IPSET_FLAG_EXIST, same = false;
+	bool reuse = false;
 	u32 key, multi = 0;
 
-	rcu_read_lock_bh();
-	t = rcu_dereference_bh(h->table);
+	t = rcu_dereference_bh_nfnl(h->table);
+	if (SET_WITH_TIMEOUT(set) &&
+	    atomic_read(&h->elements) >= h->maxelem)
+		/* FIXME: when set is full, we slow down here */
+		mtype_expire(set, h, NLEN(set->family), set->dsize);
+
 	key = HKEY(value, h->initval, t->htable_bits);
-	n = hbucket(t, key);
-	for (i = 0; i < n->pos; i++) {
+	spin_lock(ahash_lock(h, key));
+	n = old = rcu_dereference_bh_nfnl(hbucket(t, key));
+	for (i = 0; n && i < n->pos; i++) {
+		if (!test_bit(i, n->used)) {
+			/* Reuse first free entry */
+			if (free == -1)
+				free = i;
+			continue;
+		}
 		data = ahash_data(n, i, set->dsize);
 		if (mtype_data_equal(data, d, &multi)) {
 			if (flag_exist ||
@@ -645,6 +747,7 @@ mtype_add(struct ip_set *set, void *value, const struct ip_set_ext *ext,
 			     ip_set_timeout_expired(ext_timeout(data, set)))) {
 				/* Just the extensions could be overwritten */
 				j = i;
+				same = true;
 				goto reuse_slot;
 			} else {
 				ret = -IPSET_ERR_EXIST;
@@ -654,56 +757,71 @@ mtype_add(struct ip_set *set, void *value, const struct ip_set_ext *ext,
 		/* Reuse first timed out entry */
 		if (SET_WITH_TIMEOUT(set) &&
 		    ip_set_timeout_expired(ext_timeout(data, set)) &&
-		    j != AHASH_MAX(h) + 1)
+		    j == -1)
 			j = i;
 	}
-	if (h->elements >= h->maxelem && SET_WITH_FORCEADD(set) && n->pos) {
+	if (atomic_read(&h->elements) >= h->maxelem &&
+	    SET_WITH_FORCEADD(set) && n && test_bit(0, n->used)) {
 		/* Choosing the first entry in the array to replace */
 		j = 0;
-		goto reuse_slot;
-	}
-	if (SET_WITH_TIMEOUT(set) && h->elements >= h->maxelem)
-		/* FIXME: when set is full, we slow down here */
-		mtype_expire(set, h, NLEN(set->family), set->dsize);
-
-	if (h->elements >= h->maxelem) {
-		if (net_ratelimit())
-			pr_warn("Set %s is full, maxelem %u reached\n",
-				set->name, h->maxelem);
-		ret = -IPSET_ERR_HASH_FULL;
-		goto out;
 	}
 
 reuse_slot:
-	if (j != AHASH_MAX(h) + 1) {
-		/* Fill out reused slot */
-		data = ahash_data(n, j, set->dsize);
-#ifdef IP_SET_HASH_WITH_NETS
-		for (i = 0; i < IPSET_NET_COUNT; i++) {
-			mtype_del_cidr(h, SCIDR(data->cidr, i),
-				       NLEN(set->family), i);
-			mtype_add_cidr(h, SCIDR(d->cidr, i),
-				       NLEN(set->family), i);
-		}
-#endif
-		ip_set_ext_destroy(set, data);
+	if (j != -1) {
+		reuse = true;
 	} else {
-		/* Use/create a new slot */
+		/* Count the new element, unless the set is full */
+		if (atomic_inc_return(&h->elements) > h->maxelem) {
+			atomic_dec(&h->elements);
+			if (net_ratelimit())
+				pr_warn("Set %s is full, maxelem %u reached\n",
+					set->name, h->maxelem);
+			ret = -IPSET_ERR_HASH_FULL;
+			goto out;
+		}
+		/* Use a never used, a free or create a new slot */
 		TUNE_AHASH_MAX(h, multi);
-		ret = hbucket_elem_add(n, AHASH_MAX(h), set->dsize);
-		if (ret != 0) {
-			if (ret == -EAGAIN)
-				mtype_data_next(&h->next, d);
+		if (n && n->touched < n->size) {
+			j = n->touched;
+		} else if (free != -1) {
+			j = free;
+		} else if (n && n->pos < n->size) {
+			j = n->pos;
+		} else if (n && n->size >= AHASH_MAX(h)) {
+			/* Trigger rehashing */
+			atomic_dec(&h->elements);
+			mtype_data_next(&h->next, d);
+			ret = -EAGAIN;
 			goto out;
 		}
-		data = ahash_data(n, n->pos++, set->dsize);
+	}
+	if (j == -1 || (!same && j < n->touched)) {
+		/* No room in the bucket, or readers may still look at
+		 * the former entry of the slot: fill out a copy */
+		n = hbucket_copy(old, set->dsize,
+				 j == -1 ? AHASH_INIT_SIZE : 0);
+		if (!n) {
+			if (!reuse)
+				atomic_dec(&h->elements);
+			ret = -ENOMEM;
+			goto out;
+		}
+		if (j == -1)
+			j = n->pos;
+	}
+	data = ahash_data(n, j, set->dsize);
 #ifdef IP_SET_HASH_WITH_NETS
-		for (i = 0; i < IPSET_NET_COUNT; i++)
-			mtype_add_cidr(h, SCIDR(d->cidr, i), NLEN(set->family),
-				       i);
-#endif
-		h->elements++;
+	spin_lock(&h->nets_lock);
+	for (i = 0; i < IPSET_NET_COUNT; i++) {
+		if (reuse)
+			mtype_del_cidr(h, SCIDR(data->cidr, i),
+				       NLEN(set->family), i);
+		mtype_add_cidr(h, SCIDR(d->cidr, i), NLEN(set->family), i);
 	}
+	spin_unlock(&h->nets_lock);
+#endif
+	if (reuse)
+		ip_set_ext_destroy(set, data);
 	memcpy(data, d, sizeof(struct mtype_elem));
 #ifdef IP_SET_HASH_WITH_NETS
 	mtype_data_set_flags(data, flags);
@@ -716,13 +834,26 @@ reuse_slot:
 		ip_set_init_comment(ext_comment(data, set), ext);
 	if (SET_WITH_SKBINFO(set))
 		ip_set_init_skbinfo(ext_skbinfo(data, set), ext);
+	/* The entry must be complete before readers can find it */
+	smp_mb__before_atomic();
+	set_bit(j, n->used);
+	if (j >= n->pos)
+		n->pos = j + 1;
+	if (j >= n->touched)
+		n->touched = j + 1;
+	if (n != old) {
+		rcu_assign_pointer(hbucket(t, key), n);
+		if (old)
+			/* The replaced entry is freed after the readers */
+			hbucket_free(old);
+	}
 
 out:
-	rcu_read_unlock_bh();
+	spin_unlock(ahash_lock(h, key));
 	return ret;
 }
 
-/* Delete an element from the hash: swap it with the last element
+/* Delete an element from the hash: mark its slot free
  * and free up space if possible.
  */
 static int
@@ -740,49 +871,37 @@ mtype_del(struct ip_set *set, void *value, const struct ip_set_ext *ext,
 #endif
 	u32 key, multi = 0;
 
-	rcu_read_lock_bh();
-	t = rcu_dereference_bh(h->table);
+	t = rcu_dereference_bh_nfnl(h->table);
 	key = HKEY(value, h->initval, t->htable_bits);
-	n = hbucket(t, key);
-	for (i = 0; i < n->pos; i++) {
+	spin_lock(ahash_lock(h, key));
+	n = rcu_dereference_bh_nfnl(hbucket(t, key));
+	for (i = 0; n && i < n->pos; i++) {
+		if (!test_bit(i, n->used))
+			continue;
 		data = ahash_data(n, i, set->dsize);
 		if (!mtype_data_equal(data, d, &multi))
 			continue;
 		if (SET_WITH_TIMEOUT(set) &&
 		    ip_set_timeout_expired(ext_timeout(data, set)))
-			goto out;
-		if (i != n->pos - 1)
-			/* Not last one */
-			memcpy(data, ahash_data(n, n->pos - 1, set->dsize),
-			       set->dsize);
+			break;
 
-		n->pos--;
-		h->elements--;
+		clear_bit(i, n->used);
+		smp_mb__after_atomic();
+		atomic_dec(&h->elements);
 #ifdef IP_SET_HASH_WITH_NETS
+		spin_lock(&h->nets_lock);
 		for (j = 0; j < IPSET_NET_COUNT; j++)
 			mtype_del_cidr(h, SCIDR(d->cidr, j), NLEN(set->family),
 				       j);
+		spin_unlock(&h->nets_lock);
 #endif
 		ip_set_ext_destroy(set, data);
-		if (n->pos + AHASH_INIT_SIZE < n->size) {
-			void *tmp = kzalloc((n->size - AHASH_INIT_SIZE)
-					    * set->dsize,
-					    GFP_ATOMIC);
-			if (!tmp) {
-				ret = 0;
-				goto out;
-			}
-			n->size -= AHASH_INIT_SIZE;
-			memcpy(tmp, n->value, n->size * set->dsize);
-			kfree(n->value);
-			n->value = tmp;
-		}
+		hbucket_shrink(t, key, n, set->dsize);
 		ret = 0;
-		goto out;
+		break;
 	}
+	spin_unlock(ahash_lock(h, key));
 
-out:
-	rcu_read_unlock_bh();
 	return ret;
 }
 
@@ -832,8 +951,12 @@ mtype_test_cidrs(struct ip_set *set, struct mtype_elem *d,
 		mtype_data_netmask(d, NCIDR(h->nets[j].cidr[0]));
 #endif
 		key = HKEY(d, h->initval, t->htable_bits);
-		n = hbucket(t, key);
+		n = rcu_dereference_bh(hbucket(t, key));
+		if (!n)
+			continue;
 		for (i = 0; i < n->pos; i++) {
+			if (!test_bit(i, n->used))
+				continue;
 			data = ahash_data(n, i, set->dsize);
 			if (!mtype_data_equal(data, d, &multi))
 				continue;
@@ -886,8 +1009,12 @@ mtype_test(struct ip_set *set, void *value, const struct ip_set_ext *ext,
 #endif
 
 	key = HKEY(d, h->initval, t->htable_bits);
-	n = hbucket(t, key);
+	n = rcu_dereference_bh(hbucket(t, key));
+	if (!n)
+		goto out;
 	for (i = 0; i < n->pos; i++) {
+		if (!test_bit(i, n->used))
+			continue;
 		data = ahash_data(n, i, set->dsize);
 		if (mtype_data_equal(data, d, &multi) &&
 		    !(SET_WITH_TIMEOUT(set) &&
@@ -963,10 +1090,15 @@ mtype_list(const struct ip_set *set,
 	for (; cb->args[IPSET_CB_ARG0] < jhash_size(t->htable_bits);
 	     cb->args[IPSET_CB_ARG0]++) {
 		incomplete = skb_tail_pointer(skb);
-		n = hbucket(t, cb->args[IPSET_CB_ARG0]);
+		n = rcu_dereference_bh_nfnl(hbucket(t,
+						 cb->args[IPSET_CB_ARG0]));
+		if (!n)
+			continue;
 		pr_debug("cb->arg bucket: %lu, t %p n %p\n",
 			 cb->args[IPSET_CB_ARG0], t, n);
 		for (i = 0; i < n->pos; i++) {
+			if (!test_bit(i, n->used))
+				continue;
 			e = ahash_data(n, i, set->dsize);
 			if (SET_WITH_TIMEOUT(set) &&
 			    ip_set_timeout_expired(ext_timeout(e, set)))
@@ -1029,6 +1161,11 @@ static const struct ip_set_type_variant mtype_variant = {
 	.list	= mtype_list,
 	.resize	= mtype_resize,
 	.same_set = mtype_same_set,
+#ifndef IP_SET_HASH_WITH_RBTREE
+	/* The interface name tree of hash:net,iface is not RCU safe */
+	.rcu_test = true,
+	.bucket_locks = true,
+#endif
 };
 
 #ifdef IP_SET_EMIT_CREATE
@@ -1045,6 +1182,7 @@ IPSET_TOKEN(HTYPE, _create)(struct net *net, struct ip_set *set,
 	u8 netmask;
 #endif
 	size_t hsize;
+	int i;
 	struct HTYPE *h;
 	struct htable *t;
 
@@ -1108,6 +1246,11 @@ IPSET_TOKEN(HTYPE, _create)(struct net *net, struct ip_set *set,
 		return -ENOMEM;
 
 	h->maxelem = maxelem;
+	for (i = 0; i < AHASH_LOCKS; i++)
+		spin_lock_init(&h->bucket_lock[i]);
+#ifdef IP_SET_HASH_WITH_NETS
+	spin_lock_init(&h->nets_lock);
+#endif
 #ifdef IP_SET_HASH_WITH_NETMASK
 	h->netmask = netmask;
 #endif
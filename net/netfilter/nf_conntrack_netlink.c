@@ -805,6 +805,12 @@ ctnetlink_dump_table(struct sk_buff *skb, struct netlink_callback *cb)
 	last = (struct nf_conn *)cb->args[1];
 
 	local_bh_disable();
+	/* Bucket numbers change meaning when the table is resized */
+	if (cb->args[2] != net->ct.htable_size) {
+		if (cb->args[2])
+			nl_dump_mark_interrupted(cb);
+		cb->args[2] = net->ct.htable_size;
+	}
 	for (; cb->args[0] < net->ct.htable_size; cb->args[0]++) {
 restart:
 		lockp = &nf_conntrack_locks[cb->args[0] % CONNTRACK_LOCKS];
@@ -847,7 +853,11 @@ restart:
 		}
 		spin_unlock(lockp);
 		if (cb->args[1]) {
+			/* The entry we stopped at is gone; dump the bucket
+			 * again from its start and let userspace know.
+			 */
 			cb->args[1] = 0;
+			nl_dump_mark_interrupted(cb);
 			goto restart;
 		}
 	}
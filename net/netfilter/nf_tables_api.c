@@ -2211,6 +2211,11 @@ static const struct nla_policy nft_set_policy[NFTA_SET_MAX + 1] = {
 
 static const struct nla_policy nft_set_desc_policy[NFTA_SET_DESC_MAX + 1] = {
 	[NFTA_SET_DESC_SIZE]		= { .type = NLA_U32 },
+	[NFTA_SET_DESC_CONCAT]		= { .type = NLA_NESTED },
+};
+
+static const struct nla_policy nft_set_field_policy[NFTA_SET_FIELD_MAX + 1] = {
+	[NFTA_SET_FIELD_LEN]		= { .type = NLA_U32 },
 };
 
 static int nft_ctx_init_from_setattr(struct nft_ctx *ctx,
@@ -2318,6 +2323,30 @@ cont:
 	return 0;
 }
 
+static int nf_tables_fill_set_concat(struct sk_buff *skb,
+				     const struct nft_set *set)
+{
+	struct nlattr *concat, *field;
+	unsigned int i;
+
+	concat = nla_nest_start(skb, NFTA_SET_DESC_CONCAT);
+	if (concat == NULL)
+		return -1;
+
+	for (i = 0; i < set->field_count; i++) {
+		field = nla_nest_start(skb, NFTA_LIST_ELEM);
+		if (field == NULL)
+			return -1;
+		if (nla_put_be32(skb, NFTA_SET_FIELD_LEN,
+				 htonl(set->field_len[i])))
+			return -1;
+		nla_nest_end(skb, field);
+	}
+
+	nla_nest_end(skb, concat);
+	return 0;
+}
+
 static int nf_tables_fill_set(struct sk_buff *skb, const struct nft_ctx *ctx,
 			      const struct nft_set *set, u16 event, u16 flags)
 {
@@ -2368,6 +2397,9 @@ static int nf_tables_fill_set(struct sk_buff *skb, const struct nft_ctx *ctx,
 	if (set->size &&
 	    nla_put_be32(skb, NFTA_SET_DESC_SIZE, htonl(set->size)))
 		goto nla_put_failure;
+	if (set->field_count &&
+	    nf_tables_fill_set_concat(skb, set) < 0)
+		goto nla_put_failure;
 	nla_nest_end(skb, desc);
 
 	nlmsg_end(skb, nlh);
@@ -2538,6 +2570,46 @@ err:
 	return err;
 }
 
+/*
+ * A concatenated key is described by the lengths of its fields, which must
+ * add up to the key length.  Backends supporting ranges over such keys
+ * match each field separately.
+ */
+static int nf_tables_set_desc_concat_parse(struct nft_set_desc *desc,
+					   const struct nlattr *nla)
+{
+	struct nlattr *fa[NFTA_SET_FIELD_MAX + 1];
+	const struct nlattr *attr;
+	unsigned int len, total = 0;
+	int rem, err;
+
+	nla_for_each_nested(attr, nla, rem) {
+		if (nla_type(attr) != NFTA_LIST_ELEM)
+			return -EINVAL;
+		if (desc->field_count >= NFT_SET_MAXFIELDS)
+			return -E2BIG;
+
+		err = nla_parse_nested(fa, NFTA_SET_FIELD_MAX, attr,
+				       nft_set_field_policy);
+		if (err < 0)
+			return err;
+		if (fa[NFTA_SET_FIELD_LEN] == NULL)
+			return -EINVAL;
+
+		len = ntohl(nla_get_be32(fa[NFTA_SET_FIELD_LEN]));
+		if (len == 0 || len > desc->klen)
+			return -EINVAL;
+
+		desc->field_len[desc->field_count++] = len;
+		total += len;
+	}
+
+	if (desc->field_count < 2 || total != desc->klen)
+		return -EINVAL;
+
+	return 0;
+}
+
 static int nf_tables_set_desc_parse(const struct nft_ctx *ctx,
 				    struct nft_set_desc *desc,
 				    const struct nlattr *nla)
@@ -2552,6 +2624,13 @@ static int nf_tables_set_desc_parse(const struct nft_ctx *ctx,
 	if (da[NFTA_SET_DESC_SIZE] != NULL)
 		desc->size = ntohl(nla_get_be32(da[NFTA_SET_DESC_SIZE]));
 
+	if (da[NFTA_SET_DESC_CONCAT] != NULL) {
+		err = nf_tables_set_desc_concat_parse(desc,
+						      da[NFTA_SET_DESC_CONCAT]);
+		if (err < 0)
+			return err;
+	}
+
 	return 0;
 }
 
@@ -2689,6 +2768,8 @@ static int nf_tables_newset(struct sock *nlsk, struct sk_buff *skb,
 	set->flags = flags;
 	set->size  = desc.size;
 	set->policy = policy;
+	set->field_count = desc.field_count;
+	memcpy(set->field_len, desc.field_len, sizeof(set->field_len));
 
 	err = ops->init(set, &desc, nla);
 	if (err < 0)
@@ -2821,6 +2902,7 @@ static const struct nla_policy nft_set_elem_policy[NFTA_SET_ELEM_MAX + 1] = {
 	[NFTA_SET_ELEM_KEY]		= { .type = NLA_NESTED },
 	[NFTA_SET_ELEM_DATA]		= { .type = NLA_NESTED },
 	[NFTA_SET_ELEM_FLAGS]		= { .type = NLA_U32 },
+	[NFTA_SET_ELEM_KEY_END]		= { .type = NLA_NESTED },
 };
 
 static const struct nla_policy nft_set_elem_list_policy[NFTA_SET_ELEM_LIST_MAX + 1] = {
@@ -2870,6 +2952,11 @@ static int nf_tables_fill_setelem(struct sk_buff *skb,
 			  set->klen) < 0)
 		goto nla_put_failure;
 
+	if (set->field_count &&
+	    nft_data_dump(skb, NFTA_SET_ELEM_KEY_END, &elem->key_end,
+			  NFT_DATA_VALUE, set->klen) < 0)
+		goto nla_put_failure;
+
 	if (set->flags & NFT_SET_MAP &&
 	    !(elem->flags & NFT_SET_ELEM_INTERVAL_END) &&
 	    nft_data_dump(skb, NFTA_SET_ELEM_DATA, &elem->data,
@@ -3100,6 +3187,45 @@ static struct nft_trans *nft_trans_elem_alloc(struct nft_ctx *ctx,
 	return trans;
 }
 
+/*
+ * Elements of sets with a concatenated key cover the range from their key
+ * to their key end, compared field by field.  A missing key end makes the
+ * element match its key only.
+ */
+static int nft_setelem_parse_key_end(struct nft_ctx *ctx,
+				     const struct nft_set *set,
+				     const struct nlattr * const nla[],
+				     struct nft_set_elem *elem)
+{
+	struct nft_data_desc desc;
+	int err;
+
+	if (!set->field_count) {
+		if (nla[NFTA_SET_ELEM_KEY_END] != NULL)
+			return -EINVAL;
+		return 0;
+	}
+
+	if (elem->flags & NFT_SET_ELEM_INTERVAL_END)
+		return -EINVAL;
+
+	if (nla[NFTA_SET_ELEM_KEY_END] == NULL) {
+		elem->key_end = elem->key;
+		return 0;
+	}
+
+	err = nft_data_init(ctx, &elem->key_end, &desc,
+			    nla[NFTA_SET_ELEM_KEY_END]);
+	if (err < 0)
+		return err;
+
+	if (desc.type != NFT_DATA_VALUE || desc.len != set->klen) {
+		nft_data_uninit(&elem->key_end, desc.type);
+		return -EINVAL;
+	}
+	return 0;
+}
+
 static int nft_add_set_elem(struct nft_ctx *ctx, struct nft_set *set,
 			    const struct nlattr *attr)
 {
@@ -3148,6 +3274,10 @@ static int nft_add_set_elem(struct nft_ctx *ctx, struct nft_set *set,
 	if (d1.type != NFT_DATA_VALUE || d1.len != set->klen)
 		goto err2;
 
+	err = nft_setelem_parse_key_end(ctx, set, nla, &elem);
+	if (err < 0)
+		goto err2;
+
 	err = -EEXIST;
 	if (set->ops->get(set, &elem) == 0)
 		goto err2;
@@ -3265,6 +3395,11 @@ static int nft_del_setelem(struct nft_ctx *ctx, struct nft_set *set,
 	if (desc.type != NFT_DATA_VALUE || desc.len != set->klen)
 		goto err2;
 
+	elem.flags = 0;
+	err = nft_setelem_parse_key_end(ctx, set, nla, &elem);
+	if (err < 0)
+		goto err2;
+
 	err = set->ops->get(set, &elem);
 	if (err < 0)
 		goto err2;
@@ -3519,11 +3654,72 @@ static void nf_tables_commit_release(struct nft_trans *trans)
 	kfree(trans);
 }
 
+/* Let set backends build what they publish at commit time, this may fail. */
+static int nf_tables_prepare_sets(struct net *net)
+{
+	const struct nft_af_info *afi;
+	const struct nft_table *table;
+	const struct nft_set *set;
+	int err;
+
+	list_for_each_entry(afi, &net->nft.af_info, list) {
+		list_for_each_entry(table, &afi->tables, list) {
+			list_for_each_entry(set, &table->sets, list) {
+				if (set->ops->prepare == NULL)
+					continue;
+				err = set->ops->prepare(set);
+				if (err < 0)
+					return err;
+			}
+		}
+	}
+	return 0;
+}
+
+/* Let set backends publish the element changes of this transaction. */
+static void nf_tables_commit_sets(struct net *net)
+{
+	const struct nft_af_info *afi;
+	const struct nft_table *table;
+	const struct nft_set *set;
+
+	list_for_each_entry(afi, &net->nft.af_info, list) {
+		list_for_each_entry(table, &afi->tables, list) {
+			list_for_each_entry(set, &table->sets, list) {
+				if (set->ops->commit != NULL)
+					set->ops->commit(set);
+			}
+		}
+	}
+}
+
+static void nf_tables_abort_sets(struct net *net)
+{
+	const struct nft_af_info *afi;
+	const struct nft_table *table;
+	const struct nft_set *set;
+
+	list_for_each_entry(afi, &net->nft.af_info, list) {
+		list_for_each_entry(table, &afi->tables, list) {
+			list_for_each_entry(set, &table->sets, list) {
+				if (set->ops->abort != NULL)
+					set->ops->abort(set);
+			}
+		}
+	}
+}
+
 static int nf_tables_commit(struct sk_buff *skb)
 {
 	struct net *net = sock_net(skb->sk);
 	struct nft_trans *trans, *next;
 	struct nft_trans_elem *te;
+	int err;
+
+	/* Nothing is committed yet, nfnetlink aborts the batch on errors. */
+	err = nf_tables_prepare_sets(net);
+	if (err < 0)
+		return err;
 
 	/* Bump generation counter, invalidate any dump in progress */
 	while (++net->nft.base_seq == 0);
@@ -3623,6 +3819,8 @@ static int nf_tables_commit(struct sk_buff *skb)
 		}
 	}
 
+	nf_tables_commit_sets(net);
+
 	synchronize_rcu();
 
 	list_for_each_entry_safe(trans, next, &net->nft.commit_list, list) {
@@ -3731,6 +3929,8 @@ static int nf_tables_abort(struct sk_buff *skb)
 		}
 	}
 
+	nf_tables_abort_sets(net);
+
 	synchronize_rcu();
 
 	list_for_each_entry_safe_reverse(trans, next,
@@ -419,10 +419,19 @@ ack:
 		skb_pull(skb, msglen);
 	}
 done:
-	if (success && done)
-		ss->commit(oskb);
-	else
+	if (success && done) {
+		err = ss->commit(oskb);
+		if (err < 0) {
+			/* Nothing was committed, report the failure on the
+			 * batch header and undo the batch.
+			 */
+			nfnl_err_reset(&err_list);
+			netlink_ack(skb, nlmsg_hdr(oskb), err);
+			ss->abort(oskb);
+		}
+	} else {
 		ss->abort(oskb);
+	}
 
 	nfnl_err_deliver(&err_list, oskb);
 	nfnl_unlock(subsys_id);
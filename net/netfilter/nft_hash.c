@@ -226,6 +226,10 @@ static bool nft_hash_estimate(const struct nft_set_desc *desc, u32 features,
 {
 	unsigned int esize;
 
+	/* no ranges over the fields of concatenated keys */
+	if (desc->field_count)
+		return false;
+
 	esize = sizeof(struct nft_hash_elem);
 	if (features & NFT_SET_MAP)
 		esize += FIELD_SIZEOF(struct nft_hash_elem, data[0]);
@@ -246,6 +246,10 @@ static bool nft_rbtree_estimate(const struct nft_set_desc *desc, u32 features,
 {
 	unsigned int nsize;
 
+	/* intervals are ordered on the whole key, not field by field */
+	if (desc->field_count)
+		return false;
+
 	nsize = sizeof(struct nft_rbtree_elem);
 	if (features & NFT_SET_MAP)
 		nsize += FIELD_SIZEOF(struct nft_rbtree_elem, data[0]);
@@ -0,0 +1,786 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Set backend matching ranges over concatenated keys: PIle PAcket POlicies.
+ *
+ * The key of the set is made of fields (say, source address and destination
+ * address), and each element covers one range per field.  Ranges are
+ * expanded into prefixes, the rules of a field, and every field is split
+ * into groups of four bits.  For each group, a lookup table holds one
+ * bitmap of rules per possible value of the group:
+ *
+ *	lt[group][value] = rules of the field matching value in that group
+ *
+ * Looking up a field is then an AND of one bitmap per group, a word at a
+ * time.  The rules left over are mapped, through a mapping table, to the
+ * rules of the next field they belong with: those bits are the starting
+ * bitmap of the next field.  Rules of the last field map to elements.
+ *
+ * Rules are laid out in element order, so when elements overlap the first
+ * one, in (key, key end) order, wins.
+ *
+ * The lookup and mapping tables are rebuilt from the list of elements
+ * before a transaction inserting elements commits, so that running out of
+ * memory fails the transaction, and swapped in with RCU once it commits:
+ * lookups take no lock and never see a half updated table.  Elements added
+ * in a transaction only match once it is committed.  Removing an element
+ * clears its rules, which needs no memory, and leaves them unused until
+ * the next rebuild.
+ */
+
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/bitmap.h>
+#include <linux/bitops.h>
+#include <linux/percpu.h>
+#include <linux/rbtree.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nf_tables.h>
+#include <net/netfilter/nf_tables.h>
+
+#define NFT_PIPAPO_GROUP_BITS	4
+#define NFT_PIPAPO_BUCKETS	(1 << NFT_PIPAPO_GROUP_BITS)
+#define NFT_PIPAPO_MAX_BYTES	FIELD_SIZEOF(struct nft_data, data)
+/* a range over n bits expands to at most 2n - 2 prefixes */
+#define NFT_PIPAPO_MAX_RULES	(2 * NFT_PIPAPO_MAX_BYTES * BITS_PER_BYTE)
+
+static DEFINE_SPINLOCK(nft_pipapo_lock);
+
+struct nft_pipapo_map {
+	unsigned int		to;
+	unsigned int		n;
+};
+
+/**
+ *	struct nft_pipapo_field - lookup and mapping tables of one field
+ *
+ *	@groups: number of four bit groups in the field
+ *	@rules: number of rules (prefixes) of the field
+ *	@bsize: size of a rule bitmap, in longs
+ *	@lt: lookup table, groups * NFT_PIPAPO_BUCKETS bitmaps of bsize longs
+ *	@mt: mapping table, for each rule the rules of the next field it
+ *	     enables, or for the last field the element it belongs to
+ */
+struct nft_pipapo_field {
+	unsigned int		groups;
+	unsigned int		rules;
+	unsigned int		bsize;
+	unsigned long		*lt;
+	struct nft_pipapo_map	*mt;
+};
+
+struct nft_pipapo_match {
+	struct rcu_head		rcu;
+	unsigned int		gen;
+	unsigned long * __percpu *scratch;
+	unsigned int		bsize_max;
+	unsigned int		field_count;
+	struct nft_data		*data;
+	struct nft_pipapo_field	f[];
+};
+
+struct nft_pipapo {
+	struct nft_pipapo_match __rcu	*match;
+	struct nft_pipapo_match		*pending;
+	struct rb_root			root;
+	unsigned int			nelems;
+	unsigned int			gen;
+	bool				dirty;
+};
+
+/*
+ * @gen is the table the element was last added to, @rule its first rule
+ * in the last field of that table.
+ */
+struct nft_pipapo_elem {
+	struct rb_node		node;
+	unsigned int		gen;
+	unsigned int		rule;
+	struct nft_data		key;
+	struct nft_data		key_end;
+	struct nft_data		data[];
+};
+
+struct nft_pipapo_rule {
+	u8			base[NFT_PIPAPO_MAX_BYTES];
+	unsigned int		plen;
+};
+
+static unsigned int nft_pipapo_nibble(const u8 *p, unsigned int group)
+{
+	if (group % 2)
+		return p[group / 2] & 0x0f;
+	return p[group / 2] >> 4;
+}
+
+static void nft_pipapo_and_field(const struct nft_pipapo_field *f,
+				 unsigned long *res, const u8 *p)
+{
+	const unsigned long *lt;
+	unsigned int g, i;
+
+	for (g = 0; g < f->groups; g++) {
+		lt = f->lt + (g * NFT_PIPAPO_BUCKETS +
+			      nft_pipapo_nibble(p, g)) * f->bsize;
+		for (i = 0; i < f->bsize; i++)
+			res[i] &= lt[i];
+	}
+}
+
+static bool nft_pipapo_lookup(const struct nft_set *set,
+			      const struct nft_data *key,
+			      struct nft_data *data)
+{
+	const struct nft_pipapo *priv = nft_set_priv(set);
+	const struct nft_pipapo_match *m;
+	const struct nft_pipapo_field *f;
+	const u8 *p = (const u8 *)key->data;
+	unsigned long *res, *fill;
+	unsigned int i, r, next;
+	bool ret = false;
+
+	local_bh_disable();
+	m = rcu_dereference(priv->match);
+	if (m == NULL)
+		goto out;
+
+	res = *this_cpu_ptr(m->scratch);
+	fill = res + m->bsize_max;
+	memset(res, 0xff, m->f[0].bsize * sizeof(unsigned long));
+
+	for (i = 0; i < m->field_count; i++) {
+		f = &m->f[i];
+		nft_pipapo_and_field(f, res, p);
+		p += set->field_len[i];
+
+		r = find_first_bit(res, f->rules);
+		if (r >= f->rules)
+			goto out;
+
+		if (i == m->field_count - 1) {
+			if (set->flags & NFT_SET_MAP)
+				nft_data_copy(data, &m->data[f->mt[r].to]);
+			ret = true;
+			goto out;
+		}
+
+		next = f[1].bsize;
+		memset(fill, 0, next * sizeof(unsigned long));
+		for (; r < f->rules; r = find_next_bit(res, f->rules, r + 1))
+			bitmap_set(fill, f->mt[r].to, f->mt[r].n);
+		swap(res, fill);
+	}
+out:
+	local_bh_enable();
+	return ret;
+}
+
+/* Number of trailing zero bits of a big endian number of len bytes */
+static unsigned int nft_pipapo_ctz(const u8 *p, unsigned int len)
+{
+	unsigned int i;
+
+	for (i = len; i > 0; i--) {
+		if (p[i - 1])
+			return (len - i) * BITS_PER_BYTE + __ffs(p[i - 1]);
+	}
+	return len * BITS_PER_BYTE;
+}
+
+/* dst = src with its k lowest bits set */
+static void nft_pipapo_set_low(u8 *dst, const u8 *src, unsigned int len,
+			       unsigned int k)
+{
+	unsigned int i;
+
+	memcpy(dst, src, len);
+	for (i = len; i > 0 && k > 0; i--) {
+		if (k >= BITS_PER_BYTE) {
+			dst[i - 1] = 0xff;
+			k -= BITS_PER_BYTE;
+		} else {
+			dst[i - 1] |= (1 << k) - 1;
+			k = 0;
+		}
+	}
+}
+
+static void nft_pipapo_inc(u8 *p, unsigned int len)
+{
+	unsigned int i;
+
+	for (i = len; i > 0; i--) {
+		if (++p[i - 1])
+			break;
+	}
+}
+
+/*
+ * Split the range [start, end] of a field into the shortest list of
+ * prefixes covering it, and return their number.
+ */
+static unsigned int nft_pipapo_expand(struct nft_pipapo_rule *rules,
+				      const u8 *start, const u8 *end,
+				      unsigned int len)
+{
+	unsigned int bits = len * BITS_PER_BYTE, n = 0, k;
+	u8 cur[NFT_PIPAPO_MAX_BYTES], top[NFT_PIPAPO_MAX_BYTES];
+
+	memcpy(cur, start, len);
+	for (;;) {
+		k = nft_pipapo_ctz(cur, len);
+		for (;;) {
+			nft_pipapo_set_low(top, cur, len, k);
+			if (memcmp(top, end, len) <= 0)
+				break;
+			k--;
+		}
+
+		if (rules != NULL) {
+			memcpy(rules[n].base, cur, len);
+			rules[n].plen = bits - k;
+		}
+		n++;
+
+		if (!memcmp(top, end, len))
+			return n;
+		memcpy(cur, top, len);
+		nft_pipapo_inc(cur, len);
+	}
+}
+
+/* Set the bit of rule r in every bucket matching the prefix */
+static void nft_pipapo_fill_lt(struct nft_pipapo_field *f, unsigned int r,
+			       const struct nft_pipapo_rule *rule)
+{
+	unsigned int g, v, nibble, shift;
+	unsigned long *lt;
+
+	for (g = 0; g < f->groups; g++) {
+		lt = f->lt + g * NFT_PIPAPO_BUCKETS * f->bsize;
+		nibble = nft_pipapo_nibble(rule->base, g);
+
+		if (rule->plen >= (g + 1) * NFT_PIPAPO_GROUP_BITS) {
+			__set_bit(r, lt + nibble * f->bsize);
+			continue;
+		}
+
+		if (rule->plen <= g * NFT_PIPAPO_GROUP_BITS)
+			shift = NFT_PIPAPO_GROUP_BITS;
+		else
+			shift = (g + 1) * NFT_PIPAPO_GROUP_BITS - rule->plen;
+
+		for (v = 0; v < NFT_PIPAPO_BUCKETS; v++) {
+			if (shift == NFT_PIPAPO_GROUP_BITS ||
+			    (v >> shift) == (nibble >> shift))
+				__set_bit(r, lt + v * f->bsize);
+		}
+	}
+}
+
+static void *nft_pipapo_zalloc(size_t size)
+{
+	void *p;
+
+	p = kzalloc(size, GFP_KERNEL | __GFP_NOWARN);
+	if (p == NULL)
+		p = vzalloc(size);
+	return p;
+}
+
+static void nft_pipapo_match_free(struct nft_pipapo_match *m)
+{
+	unsigned int i;
+	int cpu;
+
+	if (m->scratch != NULL) {
+		for_each_possible_cpu(cpu)
+			kfree(*per_cpu_ptr(m->scratch, cpu));
+		free_percpu(m->scratch);
+	}
+	for (i = 0; i < m->field_count; i++) {
+		kvfree(m->f[i].lt);
+		kvfree(m->f[i].mt);
+	}
+	kvfree(m->data);
+	kfree(m);
+}
+
+static void nft_pipapo_match_free_rcu(struct rcu_head *head)
+{
+	nft_pipapo_match_free(container_of(head, struct nft_pipapo_match, rcu));
+}
+
+static int nft_pipapo_alloc_scratch(struct nft_pipapo_match *m)
+{
+	unsigned long *scratch;
+	int cpu;
+
+	m->scratch = alloc_percpu(unsigned long *);
+	if (m->scratch == NULL)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		scratch = kmalloc_node(2 * m->bsize_max * sizeof(unsigned long),
+				       GFP_KERNEL, cpu_to_node(cpu));
+		if (scratch == NULL)
+			return -ENOMEM;
+		*per_cpu_ptr(m->scratch, cpu) = scratch;
+	}
+	return 0;
+}
+
+/* Add the rules of one element, last field first */
+static void nft_pipapo_add_elem(const struct nft_set *set,
+				struct nft_pipapo_match *m,
+				struct nft_pipapo_rule *rules,
+				const struct nft_pipapo_elem *e,
+				unsigned int idx, unsigned int *next_rule,
+				const unsigned int *offset)
+{
+	struct nft_pipapo_map map = { .to = idx, .n = 1 };
+	const u8 *start = (const u8 *)e->key.data;
+	const u8 *end = (const u8 *)e->key_end.data;
+	struct nft_pipapo_field *f;
+	unsigned int i, r, n;
+
+	for (i = m->field_count; i > 0; i--) {
+		f = &m->f[i - 1];
+		n = nft_pipapo_expand(rules, start + offset[i - 1],
+				      end + offset[i - 1], set->field_len[i - 1]);
+		for (r = 0; r < n; r++) {
+			nft_pipapo_fill_lt(f, next_rule[i - 1] + r, &rules[r]);
+			f->mt[next_rule[i - 1] + r] = map;
+		}
+		map.to = next_rule[i - 1];
+		map.n = n;
+		next_rule[i - 1] += n;
+	}
+
+	if (set->flags & NFT_SET_MAP)
+		nft_data_copy(&m->data[idx], e->data);
+}
+
+static struct nft_pipapo_match *nft_pipapo_build(const struct nft_set *set)
+{
+	struct nft_pipapo *priv = nft_set_priv(set);
+	unsigned int offset[NFT_SET_MAXFIELDS], next_rule[NFT_SET_MAXFIELDS];
+	struct nft_pipapo_rule *rules = NULL;
+	struct nft_pipapo_elem *e;
+	struct nft_pipapo_match *m;
+	struct nft_pipapo_field *f;
+	struct rb_node *node;
+	unsigned int i, idx;
+
+	m = kzalloc(sizeof(*m) + set->field_count * sizeof(m->f[0]),
+		    GFP_KERNEL);
+	if (m == NULL)
+		return NULL;
+	m->field_count = set->field_count;
+
+	rules = kmalloc(NFT_PIPAPO_MAX_RULES * sizeof(*rules), GFP_KERNEL);
+	if (rules == NULL)
+		goto err;
+
+	for (i = 0; i < m->field_count; i++) {
+		offset[i] = i ? offset[i - 1] + set->field_len[i - 1] : 0;
+		next_rule[i] = 0;
+		m->f[i].groups = set->field_len[i] * BITS_PER_BYTE /
+				 NFT_PIPAPO_GROUP_BITS;
+	}
+
+	for (node = rb_first(&priv->root); node; node = rb_next(node)) {
+		e = rb_entry(node, struct nft_pipapo_elem, node);
+		for (i = 0; i < m->field_count; i++)
+			m->f[i].rules += nft_pipapo_expand(NULL,
+				(const u8 *)e->key.data + offset[i],
+				(const u8 *)e->key_end.data + offset[i],
+				set->field_len[i]);
+	}
+
+	for (i = 0; i < m->field_count; i++) {
+		f = &m->f[i];
+		f->bsize = BITS_TO_LONGS(f->rules);
+		f->lt = nft_pipapo_zalloc(f->groups * NFT_PIPAPO_BUCKETS *
+					  f->bsize * sizeof(unsigned long));
+		f->mt = nft_pipapo_zalloc(f->rules * sizeof(*f->mt));
+		if (f->lt == NULL || f->mt == NULL)
+			goto err;
+		m->bsize_max = max(m->bsize_max, f->bsize);
+	}
+
+	if (set->flags & NFT_SET_MAP) {
+		m->data = nft_pipapo_zalloc(priv->nelems * sizeof(*m->data));
+		if (m->data == NULL)
+			goto err;
+	}
+
+	if (nft_pipapo_alloc_scratch(m) < 0)
+		goto err;
+
+	/* never zero, the generation of elements not added to any table */
+	m->gen = ++priv->gen ? : ++priv->gen;
+	idx = 0;
+	for (node = rb_first(&priv->root); node; node = rb_next(node)) {
+		e = rb_entry(node, struct nft_pipapo_elem, node);
+		e->gen = m->gen;
+		e->rule = next_rule[m->field_count - 1];
+		nft_pipapo_add_elem(set, m, rules, e, idx++, next_rule, offset);
+	}
+
+	kfree(rules);
+	return m;
+err:
+	kfree(rules);
+	nft_pipapo_match_free(m);
+	return NULL;
+}
+
+/*
+ * Stop an element from matching in a table.  Its rules in the other fields
+ * only lead to its rules in the last field, so clearing those is enough.
+ */
+static void nft_pipapo_clear_elem(const struct nft_set *set,
+				  struct nft_pipapo_match *m,
+				  const struct nft_pipapo_elem *e)
+{
+	unsigned int last = m->field_count - 1, offset = 0, b, i, n, r;
+	struct nft_pipapo_field *f = &m->f[last];
+
+	for (i = 0; i < last; i++)
+		offset += set->field_len[i];
+
+	n = nft_pipapo_expand(NULL, (const u8 *)e->key.data + offset,
+			      (const u8 *)e->key_end.data + offset,
+			      set->field_len[last]);
+	for (b = 0; b < f->groups * NFT_PIPAPO_BUCKETS; b++) {
+		for (r = e->rule; r < e->rule + n; r++)
+			clear_bit(r, f->lt + b * f->bsize);
+	}
+}
+
+/*
+ * Build the tables for the elements inserted by a transaction.  Elements
+ * it removes are still in the tree at this point, nft_pipapo_remove()
+ * clears them from the new tables later.
+ */
+static int nft_pipapo_prepare(const struct nft_set *set)
+{
+	struct nft_pipapo *priv = nft_set_priv(set);
+
+	if (!priv->dirty || priv->pending != NULL)
+		return 0;
+
+	priv->pending = nft_pipapo_build(set);
+	if (priv->pending == NULL)
+		return -ENOMEM;
+	return 0;
+}
+
+static void nft_pipapo_commit(const struct nft_set *set)
+{
+	struct nft_pipapo *priv = nft_set_priv(set);
+	struct nft_pipapo_match *old;
+
+	if (!priv->dirty)
+		return;
+
+	old = rcu_dereference_protected(priv->match, 1);
+	rcu_assign_pointer(priv->match, priv->pending);
+	priv->pending = NULL;
+	priv->dirty = false;
+	if (old != NULL)
+		call_rcu(&old->rcu, nft_pipapo_match_free_rcu);
+}
+
+/*
+ * The published tables never held the elements of an aborted transaction.
+ * If new tables were built already, the elements now refer to those, so
+ * have the next transaction build them again.
+ */
+static void nft_pipapo_abort(const struct nft_set *set)
+{
+	struct nft_pipapo *priv = nft_set_priv(set);
+
+	if (priv->pending != NULL) {
+		nft_pipapo_match_free(priv->pending);
+		priv->pending = NULL;
+		return;
+	}
+	priv->dirty = false;
+}
+
+static int nft_pipapo_cmp(const struct nft_set *set,
+			  const struct nft_pipapo_elem *e,
+			  const struct nft_set_elem *elem)
+{
+	int d;
+
+	d = nft_data_cmp(&e->key, &elem->key, set->klen);
+	if (d)
+		return d;
+	return nft_data_cmp(&e->key_end, &elem->key_end, set->klen);
+}
+
+static int nft_pipapo_insert(const struct nft_set *set,
+			     const struct nft_set_elem *elem)
+{
+	struct nft_pipapo *priv = nft_set_priv(set);
+	const u8 *start = (const u8 *)elem->key.data;
+	const u8 *end = (const u8 *)elem->key_end.data;
+	struct nft_pipapo_elem *e, *new;
+	struct rb_node *parent, **p;
+	unsigned int i, size;
+	int d;
+
+	for (i = 0; i < set->field_count; i++) {
+		if (memcmp(start, end, set->field_len[i]) > 0)
+			return -EINVAL;
+		start += set->field_len[i];
+		end += set->field_len[i];
+	}
+
+	size = sizeof(*new);
+	if (set->flags & NFT_SET_MAP)
+		size += sizeof(new->data[0]);
+
+	new = kzalloc(size, GFP_KERNEL);
+	if (new == NULL)
+		return -ENOMEM;
+
+	nft_data_copy(&new->key, &elem->key);
+	nft_data_copy(&new->key_end, &elem->key_end);
+	if (set->flags & NFT_SET_MAP)
+		nft_data_copy(new->data, &elem->data);
+
+	spin_lock_bh(&nft_pipapo_lock);
+	parent = NULL;
+	p = &priv->root.rb_node;
+	while (*p != NULL) {
+		parent = *p;
+		e = rb_entry(parent, struct nft_pipapo_elem, node);
+		d = nft_pipapo_cmp(set, e, elem);
+		if (d < 0)
+			p = &parent->rb_left;
+		else if (d > 0)
+			p = &parent->rb_right;
+		else {
+			spin_unlock_bh(&nft_pipapo_lock);
+			kfree(new);
+			return -EEXIST;
+		}
+	}
+	rb_link_node(&new->node, parent, p);
+	rb_insert_color(&new->node, &priv->root);
+	priv->nelems++;
+	priv->dirty = true;
+	spin_unlock_bh(&nft_pipapo_lock);
+	return 0;
+}
+
+/*
+ * Clear the element from the tables built for this transaction, or from
+ * the published ones if nothing was inserted: lookups may still match it
+ * until then, as with any other set.  The tables hold their own copy of
+ * the element data, so the element can go right away.
+ */
+static void nft_pipapo_remove(const struct nft_set *set,
+			      const struct nft_set_elem *elem)
+{
+	struct nft_pipapo *priv = nft_set_priv(set);
+	struct nft_pipapo_elem *e = elem->cookie;
+	struct nft_pipapo_match *m;
+
+	m = priv->pending;
+	if (m == NULL)
+		m = rcu_dereference_protected(priv->match, 1);
+	if (m != NULL && e->gen == m->gen)
+		nft_pipapo_clear_elem(set, m, e);
+
+	spin_lock_bh(&nft_pipapo_lock);
+	rb_erase(&e->node, &priv->root);
+	priv->nelems--;
+	spin_unlock_bh(&nft_pipapo_lock);
+	kfree(e);
+}
+
+static int nft_pipapo_get(const struct nft_set *set, struct nft_set_elem *elem)
+{
+	const struct nft_pipapo *priv = nft_set_priv(set);
+	const struct rb_node *parent = priv->root.rb_node;
+	struct nft_pipapo_elem *e;
+	int d;
+
+	spin_lock_bh(&nft_pipapo_lock);
+	while (parent != NULL) {
+		e = rb_entry(parent, struct nft_pipapo_elem, node);
+
+		d = nft_pipapo_cmp(set, e, elem);
+		if (d < 0)
+			parent = parent->rb_left;
+		else if (d > 0)
+			parent = parent->rb_right;
+		else {
+			elem->cookie = e;
+			if (set->flags & NFT_SET_MAP)
+				nft_data_copy(&elem->data, e->data);
+			elem->flags = 0;
+			spin_unlock_bh(&nft_pipapo_lock);
+			return 0;
+		}
+	}
+	spin_unlock_bh(&nft_pipapo_lock);
+	return -ENOENT;
+}
+
+static void nft_pipapo_walk(const struct nft_ctx *ctx,
+			    const struct nft_set *set,
+			    struct nft_set_iter *iter)
+{
+	const struct nft_pipapo *priv = nft_set_priv(set);
+	const struct nft_pipapo_elem *e;
+	struct nft_set_elem elem;
+	struct rb_node *node;
+
+	spin_lock_bh(&nft_pipapo_lock);
+	for (node = rb_first(&priv->root); node != NULL; node = rb_next(node)) {
+		if (iter->count < iter->skip)
+			goto cont;
+
+		e = rb_entry(node, struct nft_pipapo_elem, node);
+		nft_data_copy(&elem.key, &e->key);
+		nft_data_copy(&elem.key_end, &e->key_end);
+		if (set->flags & NFT_SET_MAP)
+			nft_data_copy(&elem.data, e->data);
+		elem.flags = 0;
+
+		iter->err = iter->fn(ctx, set, iter, &elem);
+		if (iter->err < 0) {
+			spin_unlock_bh(&nft_pipapo_lock);
+			return;
+		}
+cont:
+		iter->count++;
+	}
+	spin_unlock_bh(&nft_pipapo_lock);
+}
+
+static unsigned int nft_pipapo_privsize(const struct nlattr * const nla[])
+{
+	return sizeof(struct nft_pipapo);
+}
+
+static int nft_pipapo_init(const struct nft_set *set,
+			   const struct nft_set_desc *desc,
+			   const struct nlattr * const nla[])
+{
+	struct nft_pipapo *priv = nft_set_priv(set);
+	unsigned int i;
+
+	for (i = 0; i < desc->field_count; i++) {
+		if (desc->field_len[i] > NFT_PIPAPO_MAX_BYTES)
+			return -EINVAL;
+	}
+
+	RCU_INIT_POINTER(priv->match, NULL);
+	priv->pending = NULL;
+	priv->root = RB_ROOT;
+	priv->nelems = 0;
+	priv->gen = 0;
+	priv->dirty = false;
+	return 0;
+}
+
+static void nft_pipapo_destroy(const struct nft_set *set)
+{
+	struct nft_pipapo *priv = nft_set_priv(set);
+	struct nft_pipapo_match *m;
+	struct nft_pipapo_elem *e;
+	struct rb_node *node;
+
+	m = rcu_dereference_protected(priv->match, 1);
+	if (m != NULL)
+		nft_pipapo_match_free(m);
+	if (priv->pending != NULL)
+		nft_pipapo_match_free(priv->pending);
+
+	while ((node = priv->root.rb_node) != NULL) {
+		rb_erase(node, &priv->root);
+		e = rb_entry(node, struct nft_pipapo_elem, node);
+		nft_data_uninit(&e->key, NFT_DATA_VALUE);
+		nft_data_uninit(&e->key_end, NFT_DATA_VALUE);
+		if (set->flags & NFT_SET_MAP)
+			nft_data_uninit(e->data, set->dtype);
+		kfree(e);
+	}
+}
+
+static bool nft_pipapo_estimate(const struct nft_set_desc *desc, u32 features,
+				struct nft_set_estimate *est)
+{
+	unsigned int esize, groups = 0, i;
+
+	/* only ranges over concatenated keys are handled here */
+	if (!desc->field_count)
+		return false;
+
+	for (i = 0; i < desc->field_count; i++)
+		groups += desc->field_len[i] * BITS_PER_BYTE /
+			  NFT_PIPAPO_GROUP_BITS;
+
+	/* assume two rules per field: one bit per bucket, one mapping */
+	esize = sizeof(struct nft_pipapo_elem) +
+		2 * groups * NFT_PIPAPO_BUCKETS / BITS_PER_BYTE +
+		2 * desc->field_count * sizeof(struct nft_pipapo_map);
+	if (features & NFT_SET_MAP)
+		esize += 2 * sizeof(struct nft_data);
+
+	if (desc->size)
+		est->size = sizeof(struct nft_pipapo) + desc->size * esize;
+	else
+		est->size = esize;
+
+	est->class = NFT_SET_CLASS_O_N;
+
+	return true;
+}
+
+static struct nft_set_ops nft_pipapo_ops __read_mostly = {
+	.privsize	= nft_pipapo_privsize,
+	.estimate	= nft_pipapo_estimate,
+	.init		= nft_pipapo_init,
+	.destroy	= nft_pipapo_destroy,
+	.insert		= nft_pipapo_insert,
+	.remove		= nft_pipapo_remove,
+	.get		= nft_pipapo_get,
+	.lookup		= nft_pipapo_lookup,
+	.walk		= nft_pipapo_walk,
+	.prepare	= nft_pipapo_prepare,
+	.commit		= nft_pipapo_commit,
+	.abort		= nft_pipapo_abort,
+	.features	= NFT_SET_INTERVAL | NFT_SET_MAP,
+	.owner		= THIS_MODULE,
+};
+
+static int __init nft_pipapo_module_init(void)
+{
+	return nft_register_set(&nft_pipapo_ops);
+}
+
+static void __exit nft_pipapo_module_exit(void)
+{
+	nft_unregister_set(&nft_pipapo_ops);
+	rcu_barrier();
+}
+
+module_init(nft_pipapo_module_init);
+module_exit(nft_pipapo_module_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_ALIAS_NFT_SET();
@@ -820,6 +820,7 @@ static void netlink_ring_set_copied(struct sock *sk, struct sk_buff *skb)
 #define netlink_tx_is_mmaped(sk)	false
 #define netlink_mmap			sock_no_mmap
 #define netlink_poll			datagram_poll
+#define netlink_dump_space(nlk)		false
 #define netlink_mmap_sendmsg(sk, msg, dst_portid, dst_group, scm)	0
 #endif /* CONFIG_NETLINK_MMAP */
 
@@ -2389,7 +2390,7 @@ static int netlink_recvmsg(struct kiocb *kiocb, struct socket *sock,
 	/* Record the max length of recvmsg() calls for future allocations */
 	nlk->max_recvmsg_len = max(nlk->max_recvmsg_len, len);
 	nlk->max_recvmsg_len = min_t(size_t, nlk->max_recvmsg_len,
-				     16384);
+				     NETLINK_DUMP_MAX_ALLOC);
 
 	copied = data_skb->len;
 	if (len < copied) {
@@ -2607,6 +2608,18 @@ __nlmsg_put(struct sk_buff *skb, u32 portid, u32 seq, int type, int len, int fla
 }
 EXPORT_SYMBOL(__nlmsg_put);
 
+/* A dump keeps going while the receiver has room for more: half of the
+ * receive buffer, or half of the ring for memory mapped receivers. These
+ * are the same thresholds recvmsg() and poll() use to restart a dump.
+ */
+static bool netlink_dump_room(struct sock *sk)
+{
+	if (netlink_rx_is_mmaped(sk))
+		return netlink_dump_space(nlk_sk(sk));
+
+	return atomic_read(&sk->sk_rmem_alloc) <= sk->sk_rcvbuf / 2;
+}
+
 /*
  * It looks a bit ugly.
  * It would be better to create kernel thread.
@@ -2620,6 +2633,7 @@ static int netlink_dump(struct sock *sk)
 	struct nlmsghdr *nlh;
 	int len, err = -ENOBUFS;
 	int alloc_size;
+	int budget = NETLINK_DUMP_BATCH;
 
 	mutex_lock(nlk->cb_mutex);
 	if (!nlk->cb_running) {
@@ -2627,6 +2641,7 @@ static int netlink_dump(struct sock *sk)
 		goto errout_skb;
 	}
 
+next:
 	cb = &nlk->cb;
 	alloc_size = max_t(int, cb->min_dump_alloc, NLMSG_GOODSIZE);
 
@@ -2635,9 +2650,9 @@ static int netlink_dump(struct sock *sk)
 		goto errout_skb;
 
 	/* NLMSG_GOODSIZE is small to avoid high order allocations being
-	 * required, but it makes sense to _attempt_ a 16K bytes allocation
-	 * to reduce number of system calls on dump operations, if user
-	 * ever provided a big enough buffer.
+	 * required, but it makes sense to _attempt_ a larger allocation
+	 * (up to NETLINK_DUMP_MAX_ALLOC) to reduce number of system calls
+	 * on dump operations, if user ever provided a big enough buffer.
 	 */
 	if (alloc_size < nlk->max_recvmsg_len) {
 		skb = netlink_alloc_skb(sk,
@@ -2667,7 +2682,24 @@ static int netlink_dump(struct sock *sk)
 			kfree_skb(skb);
 		else
 			__netlink_sendskb(sk, skb);
-		return 0;
+
+		/* Rather than waiting for the next recvmsg() to resume the
+		 * walk, fill a few more skbs while the receiver has room.
+		 * cb_mutex is dropped in between so that its other users
+		 * (RTNL for most dumps) are not held off for the whole batch.
+		 */
+		if (!--budget || !netlink_dump_room(sk))
+			return 0;
+
+		cond_resched();
+		skb = NULL;
+		mutex_lock(nlk->cb_mutex);
+		if (!nlk->cb_running) {
+			/* finished by a concurrent reader */
+			mutex_unlock(nlk->cb_mutex);
+			return 0;
+		}
+		goto next;
 	}
 
 	nlh = nlmsg_put_answer(skb, cb, NLMSG_DONE, sizeof(len), NLM_F_MULTI);
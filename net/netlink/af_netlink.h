@@ -8,6 +8,12 @@
 #define NLGRPSZ(x)	(ALIGN(x, sizeof(unsigned long) * 8) / 8)
 #define NLGRPLONGS(x)	(NLGRPSZ(x)/sizeof(unsigned long))
 
+/* Largest skb a dump is filled into when the reader's buffer allows it,
+ * and how many skbs one netlink_dump() call may queue back to back.
+ */
+#define NETLINK_DUMP_MAX_ALLOC	32768
+#define NETLINK_DUMP_BATCH	16
+
 struct netlink_ring {
 	void			**pg_vec;
 	unsigned int		head;
@@ -284,6 +284,134 @@ static struct rpc_xprt *rpc_clnt_set_transport(struct rpc_clnt *clnt,
 	return old;
 }
 
+static void rpc_xprt_switch_put(struct rpc_xprt_switch *xps)
+{
+	unsigned int i;
+
+	if (xps == NULL || !atomic_dec_and_test(&xps->xps_count))
+		return;
+	for (i = 0; i < xps->xps_nxprts; i++)
+		xprt_put(xps->xps_xprt[i]);
+	kfree(xps);
+}
+
+static struct rpc_xprt_switch *rpc_clnt_get_xprt_switch(struct rpc_clnt *clnt)
+{
+	struct rpc_xprt_switch *xps;
+
+	rcu_read_lock();
+	xps = rcu_dereference(clnt->cl_xpsw);
+	if (xps != NULL && !atomic_inc_not_zero(&xps->xps_count))
+		xps = NULL;
+	rcu_read_unlock();
+	return xps;
+}
+
+/*
+ * Open @n more transports to the server @xprt talks to, so that requests
+ * can be spread over several connections.  Failing to open them is not
+ * fatal: the client just uses fewer connections.
+ */
+static void rpc_clnt_add_xprts(struct rpc_clnt *clnt,
+			       struct xprt_create *xprtargs,
+			       struct rpc_xprt *xprt, unsigned int n)
+{
+	struct rpc_xprt_switch *xps;
+	struct rpc_xprt *new;
+
+	/* Only cl_xprt is ever rebound, so the extra ones need a fixed port */
+	if (!xprt_bound(xprt))
+		return;
+
+	xps = kzalloc(sizeof(*xps) + n * sizeof(xps->xps_xprt[0]), GFP_KERNEL);
+	if (xps == NULL)
+		return;
+	atomic_set(&xps->xps_count, 1);
+
+	while (xps->xps_nxprts < n) {
+		new = xprt_create_transport(xprtargs);
+		if (IS_ERR(new)) {
+			dprintk("RPC:       %s: cannot create transport %u: %ld\n",
+				__func__, xps->xps_nxprts + 1, PTR_ERR(new));
+			break;
+		}
+		new->resvport = xprt->resvport;
+		xps->xps_xprt[xps->xps_nxprts++] = new;
+	}
+
+	if (xps->xps_nxprts == 0) {
+		kfree(xps);
+		return;
+	}
+	rcu_assign_pointer(clnt->cl_xpsw, xps);
+}
+
+/**
+ * rpc_clnt_next_xprt - pick the transport for a new request
+ * @clnt: RPC client
+ *
+ * Returns a referenced transport, chosen round-robin among cl_xprt and
+ * the client's extra transports.
+ */
+struct rpc_xprt *rpc_clnt_next_xprt(struct rpc_clnt *clnt)
+{
+	struct rpc_xprt_switch *xps;
+	struct rpc_xprt *xprt = NULL;
+	unsigned int i;
+
+	rcu_read_lock();
+	xps = rcu_dereference(clnt->cl_xpsw);
+	if (xps != NULL) {
+		i = (unsigned int)atomic_inc_return(&xps->xps_next) %
+			(xps->xps_nxprts + 1);
+		if (i != 0)
+			xprt = xprt_get(xps->xps_xprt[i - 1]);
+	}
+	if (xprt == NULL)
+		xprt = xprt_get(rcu_dereference(clnt->cl_xprt));
+	rcu_read_unlock();
+	return xprt;
+}
+EXPORT_SYMBOL_GPL(rpc_clnt_next_xprt);
+
+/**
+ * rpc_clnt_iterate_for_each_xprt - call a function for every transport
+ * @clnt: RPC client
+ * @fn: function to call, stops the iteration by returning non-zero
+ * @data: argument to @fn
+ *
+ * Used for per-connection operations such as binding each connection to
+ * an NFSv4.1 session.  Returns the first non-zero value @fn returned.
+ */
+int rpc_clnt_iterate_for_each_xprt(struct rpc_clnt *clnt,
+		int (*fn)(struct rpc_clnt *, struct rpc_xprt *, void *),
+		void *data)
+{
+	struct rpc_xprt_switch *xps;
+	struct rpc_xprt *xprt;
+	unsigned int i;
+	int ret;
+
+	rcu_read_lock();
+	xprt = xprt_get(rcu_dereference(clnt->cl_xprt));
+	rcu_read_unlock();
+	if (xprt == NULL)
+		return -EAGAIN;
+	ret = fn(clnt, xprt, data);
+	xprt_put(xprt);
+	if (ret)
+		return ret;
+
+	xps = rpc_clnt_get_xprt_switch(clnt);
+	if (xps == NULL)
+		return 0;
+	for (i = 0; i < xps->xps_nxprts && !ret; i++)
+		ret = fn(clnt, xps->xps_xprt[i], data);
+	rpc_xprt_switch_put(xps);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(rpc_clnt_iterate_for_each_xprt);
+
 static void rpc_clnt_set_nodename(struct rpc_clnt *clnt, const char *nodename)
 {
 	clnt->cl_nodelen = strlcpy(clnt->cl_nodename,
@@ -490,6 +618,7 @@ EXPORT_SYMBOL_GPL(rpc_create_xprt);
  */
 struct rpc_clnt *rpc_create(struct rpc_create_args *args)
 {
+	struct rpc_clnt *clnt;
 	struct rpc_xprt *xprt;
 	struct xprt_create xprtargs = {
 		.net = args->net,
@@ -554,7 +683,10 @@ struct rpc_clnt *rpc_create(struct rpc_create_args *args)
 	if (args->flags & RPC_CLNT_CREATE_NONPRIVPORT)
 		xprt->resvport = 0;
 
-	return rpc_create_xprt(args, xprt);
+	clnt = rpc_create_xprt(args, xprt);
+	if (!IS_ERR(clnt) && args->nconnect > 1)
+		rpc_clnt_add_xprts(clnt, &xprtargs, xprt, args->nconnect - 1);
+	return clnt;
 }
 EXPORT_SYMBOL_GPL(rpc_create);
 
@@ -584,6 +716,7 @@ static struct rpc_clnt *__rpc_clone_client(struct rpc_create_args *args,
 		err = PTR_ERR(new);
 		goto out_err;
 	}
+	rcu_assign_pointer(new->cl_xpsw, rpc_clnt_get_xprt_switch(clnt));
 
 	/* Turn off autobind on clones */
 	new->cl_autobind = 0;
@@ -659,6 +792,7 @@ int rpc_switch_client_transport(struct rpc_clnt *clnt,
 {
 	const struct rpc_timeout *old_timeo;
 	rpc_authflavor_t pseudoflavor;
+	struct rpc_xprt_switch *old_xps;
 	struct rpc_xprt *xprt, *old;
 	struct rpc_clnt *parent;
 	int err;
@@ -675,6 +809,10 @@ int rpc_switch_client_transport(struct rpc_clnt *clnt,
 	old_timeo = clnt->cl_timeout;
 	old = rpc_clnt_set_transport(clnt, xprt, timeout);
 
+	/* The extra transports lead to the old server */
+	old_xps = rcu_dereference_protected(clnt->cl_xpsw, 1);
+	RCU_INIT_POINTER(clnt->cl_xpsw, NULL);
+
 	rpc_unregister_client(clnt);
 	__rpc_clnt_remove_pipedir(clnt);
 	rpc_clnt_debugfs_unregister(clnt);
@@ -700,11 +838,13 @@ int rpc_switch_client_transport(struct rpc_clnt *clnt,
 	if (parent != clnt)
 		rpc_release_client(parent);
 	xprt_put(old);
+	rpc_xprt_switch_put(old_xps);
 	dprintk("RPC:       replaced xprt for clnt %p\n", clnt);
 	return 0;
 
 out_revert:
 	rpc_clnt_set_transport(clnt, old, old_timeo);
+	rcu_assign_pointer(clnt->cl_xpsw, old_xps);
 	clnt->cl_parent = parent;
 	rpc_client_register(clnt, pseudoflavor, NULL);
 	xprt_put(xprt);
@@ -785,6 +925,7 @@ rpc_free_client(struct rpc_clnt *clnt)
 	rpc_free_iostats(clnt->cl_metrics);
 	clnt->cl_metrics = NULL;
 	xprt_put(rcu_dereference_raw(clnt->cl_xprt));
+	rpc_xprt_switch_put(rcu_dereference_raw(clnt->cl_xpsw));
 	rpciod_down();
 	rpc_free_clid(clnt);
 	kfree(clnt);
@@ -871,6 +1012,10 @@ void rpc_task_release_client(struct rpc_task *task)
 {
 	struct rpc_clnt *clnt = task->tk_client;
 
+	if (task->tk_xprt != NULL) {
+		xprt_put(task->tk_xprt);
+		task->tk_xprt = NULL;
+	}
 	if (clnt != NULL) {
 		/* Remove from client task list */
 		spin_lock(&clnt->cl_lock);
@@ -954,6 +1099,8 @@ struct rpc_task *rpc_run_task(const struct rpc_task_setup *task_setup_data)
 		goto out;
 
 	rpc_task_set_client(task, task_setup_data->rpc_client);
+	if (task_setup_data->rpc_xprt != NULL)
+		task->tk_xprt = xprt_get(task_setup_data->rpc_xprt);
 	rpc_task_set_rpc_message(task, task_setup_data->rpc_message);
 
 	if (task->tk_action == NULL)
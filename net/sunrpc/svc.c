@@ -46,7 +46,7 @@ enum {
 	SVC_POOL_PERCPU,	/* one pool per cpu */
 	SVC_POOL_PERNODE	/* one pool per numa node */
 };
-#define SVC_POOL_DEFAULT	SVC_POOL_GLOBAL
+#define SVC_POOL_DEFAULT	SVC_POOL_AUTO
 
 /*
  * Structure for mapping cpus to pools and vice versa.
@@ -343,6 +343,30 @@ svc_pool_map_set_cpumask(struct task_struct *task, unsigned int pidx)
 	}
 }
 
+/*
+ * Find a pool with threads for the work of pool @pidx, which has none.
+ * Threads are handed out to the pools round-robin, so with fewer threads
+ * than pools the populated ones are usually the first sv_nrthreads (give
+ * or take the references that also count there): spread the orphaned
+ * pools over those rather than piling all their work onto one pool, and
+ * scan onwards if the guess is empty.
+ */
+static struct svc_pool *
+svc_pool_populated(struct svc_serv *serv, unsigned int pidx)
+{
+	unsigned int n = serv->sv_nrpools;
+	unsigned int nr = clamp(ACCESS_ONCE(serv->sv_nrthreads), 1U, n);
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		struct svc_pool *pool = &serv->sv_pools[(pidx % nr + i) % n];
+
+		if (ACCESS_ONCE(pool->sp_nrthreads))
+			return pool;
+	}
+	return &serv->sv_pools[0];
+}
+
 /*
  * Use the mapping mode to choose a pool for a given CPU.
  * Used when enqueueing an incoming RPC.  Always returns
@@ -352,6 +376,7 @@ struct svc_pool *
 svc_pool_for_cpu(struct svc_serv *serv, int cpu)
 {
 	struct svc_pool_map *m = &svc_pool_map;
+	struct svc_pool *pool;
 	unsigned int pidx = 0;
 
 	/*
@@ -369,7 +394,15 @@ svc_pool_for_cpu(struct svc_serv *serv, int cpu)
 			break;
 		}
 	}
-	return &serv->sv_pools[pidx % serv->sv_nrpools];
+	pool = &serv->sv_pools[pidx % serv->sv_nrpools];
+
+	/*
+	 * With fewer threads than pools some pools have nobody to
+	 * service them; hand their work to one that has.
+	 */
+	if (unlikely(!ACCESS_ONCE(pool->sp_nrthreads)))
+		pool = svc_pool_populated(serv, pidx);
+	return pool;
 }
 
 int svc_rpcb_setup(struct svc_serv *serv, struct net *net)
@@ -614,7 +647,6 @@ svc_prepare_thread(struct svc_serv *serv, struct svc_pool *pool, int node)
 
 	serv->sv_nrthreads++;
 	__set_bit(RQ_BUSY, &rqstp->rq_flags);
-	spin_lock_init(&rqstp->rq_lock);
 	rqstp->rq_server = serv;
 	rqstp->rq_pool = pool;
 	spin_lock_bh(&pool->sp_lock);
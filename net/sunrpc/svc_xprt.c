@@ -347,6 +347,10 @@ static void svc_xprt_do_enqueue(struct svc_xprt *xprt)
 	atomic_long_inc(&pool->sp_stats.packets);
 
 redo_search:
+	/* don't walk the thread list if every thread is busy */
+	if (!atomic_read(&pool->sp_nridle))
+		goto queue;
+
 	/* find a thread for this xprt */
 	rcu_read_lock();
 	list_for_each_entry_rcu(rqstp, &pool->sp_all_threads, rq_all) {
@@ -361,17 +365,19 @@ redo_search:
 		 * do so.
 		 */
 		if (!queued) {
-			spin_lock_bh(&rqstp->rq_lock);
-			if (test_and_set_bit(RQ_BUSY, &rqstp->rq_flags)) {
-				/* already busy, move on... */
-				spin_unlock_bh(&rqstp->rq_lock);
+			/*
+			 * Setting RQ_BUSY claims the thread; it will wait
+			 * in svc_get_next_xprt() until rq_xprt is set.
+			 */
+			if (test_and_set_bit(RQ_BUSY, &rqstp->rq_flags))
 				continue;
-			}
+			atomic_dec(&pool->sp_nridle);
 
 			/* this one will do */
-			rqstp->rq_xprt = xprt;
 			svc_xprt_get(xprt);
-			spin_unlock_bh(&rqstp->rq_lock);
+			rqstp->rq_qtime = ktime_get();
+			smp_wmb();
+			ACCESS_ONCE(rqstp->rq_xprt) = xprt;
 		}
 		rcu_read_unlock();
 
@@ -382,6 +388,7 @@ redo_search:
 	}
 	rcu_read_unlock();
 
+queue:
 	/*
 	 * We didn't find an idle thread to use, so we need to queue the xprt.
 	 * Do so and then search again. If we find one, we can't hook this one
@@ -391,10 +398,13 @@ redo_search:
 	if (!queued) {
 		queued = true;
 		dprintk("svc: transport %p put into queue\n", xprt);
+		xprt->xpt_qtime = ktime_get();
 		spin_lock_bh(&pool->sp_lock);
 		list_add_tail(&xprt->xpt_ready, &pool->sp_sockets);
 		pool->sp_stats.sockets_queued++;
 		spin_unlock_bh(&pool->sp_lock);
+		/* pairs with the smp_mb() in svc_get_next_xprt() */
+		smp_mb();
 		goto redo_search;
 	}
 	rqstp = NULL;
@@ -432,6 +442,8 @@ static struct svc_xprt *svc_xprt_dequeue(struct svc_pool *pool)
 					struct svc_xprt, xpt_ready);
 		list_del_init(&xprt->xpt_ready);
 		svc_xprt_get(xprt);
+		atomic_long_add(ktime_us_delta(ktime_get(), xprt->xpt_qtime),
+				&pool->sp_stats.queue_time);
 
 		dprintk("svc: transport %p dequeued, inuse=%d\n",
 			xprt, atomic_read(&xprt->xpt_ref.refcount));
@@ -610,19 +622,16 @@ static int svc_alloc_arg(struct svc_rqst *rqstp)
 	if (pages >= RPCSVC_MAXPAGES)
 		/* use as many pages as possible */
 		pages = RPCSVC_MAXPAGES - 1;
-	for (i = 0; i < pages ; i++)
-		while (rqstp->rq_pages[i] == NULL) {
-			struct page *p = alloc_page(GFP_KERNEL);
-			if (!p) {
-				set_current_state(TASK_INTERRUPTIBLE);
-				if (signalled() || kthread_should_stop()) {
-					set_current_state(TASK_RUNNING);
-					return -EINTR;
-				}
-				schedule_timeout(msecs_to_jiffies(500));
-			}
-			rqstp->rq_pages[i] = p;
+	/* refill the pages consumed by the last request in one batch */
+	while (alloc_pages_bulk(GFP_KERNEL, pages, rqstp->rq_pages) < pages) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (signalled() || kthread_should_stop()) {
+			set_current_state(TASK_RUNNING);
+			return -EINTR;
 		}
+		schedule_timeout(msecs_to_jiffies(500));
+	}
+	i = pages;
 	rqstp->rq_page_end = &rqstp->rq_pages[i];
 	rqstp->rq_pages[i++] = NULL; /* this might be seen in nfs_read_actor */
 
@@ -695,6 +704,7 @@ static struct svc_xprt *svc_get_next_xprt(struct svc_rqst *rqstp, long timeout)
 	 * to bring down the daemons ...
 	 */
 	set_current_state(TASK_INTERRUPTIBLE);
+	atomic_inc(&pool->sp_nridle);
 	clear_bit(RQ_BUSY, &rqstp->rq_flags);
 	smp_mb();
 
@@ -705,13 +715,19 @@ static struct svc_xprt *svc_get_next_xprt(struct svc_rqst *rqstp, long timeout)
 
 	try_to_freeze();
 
-	spin_lock_bh(&rqstp->rq_lock);
-	set_bit(RQ_BUSY, &rqstp->rq_flags);
-	spin_unlock_bh(&rqstp->rq_lock);
-
-	xprt = rqstp->rq_xprt;
-	if (xprt != NULL)
+	if (test_and_set_bit(RQ_BUSY, &rqstp->rq_flags)) {
+		/*
+		 * svc_xprt_do_enqueue() claimed us and is about to hand
+		 * over its transport, if it hasn't already.
+		 */
+		while (!(xprt = ACCESS_ONCE(rqstp->rq_xprt)))
+			cpu_relax();
+		smp_rmb();
+		atomic_long_add(ktime_us_delta(ktime_get(), rqstp->rq_qtime),
+				&pool->sp_stats.wakeup_time);
 		return xprt;
+	}
+	atomic_dec(&pool->sp_nridle);
 
 	if (!time_left)
 		atomic_long_inc(&pool->sp_stats.threads_timedout);
@@ -1336,16 +1352,18 @@ static int svc_pool_stats_show(struct seq_file *m, void *p)
 	struct svc_pool *pool = p;
 
 	if (p == SEQ_START_TOKEN) {
-		seq_puts(m, "# pool packets-arrived sockets-enqueued threads-woken threads-timedout\n");
+		seq_puts(m, "# pool packets-arrived sockets-enqueued threads-woken threads-timedout queue-time-us wakeup-time-us\n");
 		return 0;
 	}
 
-	seq_printf(m, "%u %lu %lu %lu %lu\n",
+	seq_printf(m, "%u %lu %lu %lu %lu %lu %lu\n",
 		pool->sp_id,
 		(unsigned long)atomic_long_read(&pool->sp_stats.packets),
 		pool->sp_stats.sockets_queued,
 		(unsigned long)atomic_long_read(&pool->sp_stats.threads_woken),
-		(unsigned long)atomic_long_read(&pool->sp_stats.threads_timedout));
+		(unsigned long)atomic_long_read(&pool->sp_stats.threads_timedout),
+		(unsigned long)atomic_long_read(&pool->sp_stats.queue_time),
+		(unsigned long)atomic_long_read(&pool->sp_stats.wakeup_time));
 
 	return 0;
 }
@@ -0,0 +1,334 @@
+/*
+ * Lookup rates in a directory with a large negative dentry population.
+ *
+ *   dcache_bench [-d dir] [-n files] [-m misses] [-t threads] [-l loops]
+ *                [-b batch]
+ *
+ * Creates "files" files in "dir" and looks up "misses" names that do not
+ * exist, which leaves that many negative dentries behind (or as many as
+ * fs.negative-dentry-limit lets the superblock keep).  Then "threads"
+ * threads each go "loops" times over:
+ *
+ *   hit       the existing names
+ *   miss      the names that were looked up before
+ *   cold      names that were never looked up, new ones on every loop
+ *
+ * with fstatat(AT_SYMLINK_NOFOLLOW), and hit and miss once more in batches
+ * of "batch" names with FS_IOC_LOOKUP_BATCH.  Reports lookups per second,
+ * and the dcache's unused and negative dentry counts after every phase.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifndef FS_IOC_LOOKUP_BATCH
+struct lookup_batch_entry {
+	uint64_t	name;
+	int32_t		result;
+	uint32_t	mode;
+	uint64_t	ino;
+};
+
+struct lookup_batch {
+	uint64_t	entries;
+	uint32_t	count;
+	uint32_t	flags;
+};
+
+#define FS_IOC_LOOKUP_BATCH	_IOWR('f', 40, struct lookup_batch)
+#endif
+
+enum { PHASE_HIT, PHASE_MISS, PHASE_COLD };
+
+static const char * const phase_names[] = {
+	[PHASE_HIT]	= "hit",
+	[PHASE_MISS]	= "miss",
+	[PHASE_COLD]	= "cold",
+};
+
+static const char *dir = "./dcache_bench.dir";
+static unsigned int nfiles = 10000;
+static unsigned int nmisses = 1000000;
+static unsigned int nthreads = 1;
+static unsigned int loops = 3;
+static unsigned int batch = 32;
+static int dir_fd = -1;
+
+struct worker {
+	pthread_t	thread;
+	unsigned int	id;
+	int		phase;
+	int		batched;
+	unsigned long	errors;
+};
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned int phase_count(int phase)
+{
+	return phase == PHASE_HIT ? nfiles : nmisses;
+}
+
+/* the i'th name of a phase; cold names are new for every thread and loop */
+static void phase_name(char *buf, size_t size, int phase, unsigned int id,
+		       unsigned int loop, unsigned int i)
+{
+	switch (phase) {
+	case PHASE_HIT:
+		snprintf(buf, size, "f%u", i);
+		break;
+	case PHASE_MISS:
+		snprintf(buf, size, "n%u", i);
+		break;
+	case PHASE_COLD:
+		snprintf(buf, size, "c%u.%u.%u", id, loop, i);
+		break;
+	}
+}
+
+static int expected(int phase)
+{
+	return phase == PHASE_HIT ? 0 : -ENOENT;
+}
+
+static void print_dentry_state(void)
+{
+	long nr_dentry, nr_unused, age, want, nr_negative;
+	FILE *f = fopen("/proc/sys/fs/dentry-state", "r");
+
+	if (!f)
+		return;
+	if (fscanf(f, "%ld %ld %ld %ld %ld", &nr_dentry, &nr_unused, &age,
+		   &want, &nr_negative) == 5)
+		printf("  dentries %ld, unused %ld, negative %ld\n",
+		       nr_dentry, nr_unused, nr_negative);
+	fclose(f);
+}
+
+static void lookup_single(struct worker *w, unsigned int loop)
+{
+	unsigned int i, count = phase_count(w->phase);
+	int want = expected(w->phase);
+	char name[64];
+	struct stat st;
+
+	for (i = 0; i < count; i++) {
+		int ret;
+
+		phase_name(name, sizeof(name), w->phase, w->id, loop, i);
+		ret = fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) ? -errno : 0;
+		if (ret != want)
+			w->errors++;
+	}
+}
+
+static void lookup_batched(struct worker *w, unsigned int loop)
+{
+	unsigned int i, j, count = phase_count(w->phase);
+	struct lookup_batch_entry *ent;
+	struct lookup_batch lb;
+	int want = expected(w->phase);
+	char (*names)[64];
+
+	ent = calloc(batch, sizeof(*ent));
+	names = calloc(batch, sizeof(*names));
+	if (!ent || !names)
+		die("calloc");
+
+	for (i = 0; i < count; i += batch) {
+		lb.entries = (uintptr_t)ent;
+		lb.count = count - i < batch ? count - i : batch;
+		lb.flags = 0;
+		for (j = 0; j < lb.count; j++) {
+			phase_name(names[j], sizeof(names[j]), w->phase, w->id,
+				   loop, i + j);
+			ent[j].name = (uintptr_t)names[j];
+		}
+		if (ioctl(dir_fd, FS_IOC_LOOKUP_BATCH, &lb))
+			die("FS_IOC_LOOKUP_BATCH");
+		for (j = 0; j < lb.count; j++)
+			if (ent[j].result != want)
+				w->errors++;
+	}
+	free(ent);
+	free(names);
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	unsigned int loop;
+
+	for (loop = 0; loop < loops; loop++) {
+		if (w->batched)
+			lookup_batched(w, loop);
+		else
+			lookup_single(w, loop);
+	}
+	return NULL;
+}
+
+static void run(int phase, int batched)
+{
+	struct worker *workers = calloc(nthreads, sizeof(*workers));
+	unsigned long errors = 0;
+	double start, elapsed;
+	unsigned int i;
+
+	if (!workers)
+		die("calloc");
+
+	start = now();
+	for (i = 0; i < nthreads; i++) {
+		workers[i].id = i;
+		workers[i].phase = phase;
+		workers[i].batched = batched;
+		if (pthread_create(&workers[i].thread, NULL, worker_fn,
+				   &workers[i]))
+			die("pthread_create");
+	}
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		errors += workers[i].errors;
+	}
+	elapsed = now() - start;
+
+	printf("%-5s %-7s: %u threads, %.0f lookups/s", phase_names[phase],
+	       batched ? "batched" : "stat", nthreads,
+	       (double)phase_count(phase) * loops * nthreads / elapsed);
+	if (errors)
+		printf(", %lu unexpected results", errors);
+	printf("\n");
+	print_dentry_state();
+	free(workers);
+}
+
+static int batch_supported(void)
+{
+	struct lookup_batch lb = { .entries = 0, .count = 0, .flags = 0 };
+
+	return !ioctl(dir_fd, FS_IOC_LOOKUP_BATCH, &lb);
+}
+
+static void setup(void)
+{
+	char name[64];
+	struct stat st;
+	unsigned int i;
+
+	if (mkdir(dir, 0700) && errno != EEXIST)
+		die("mkdir");
+	dir_fd = open(dir, O_RDONLY | O_DIRECTORY);
+	if (dir_fd < 0)
+		die("open");
+
+	for (i = 0; i < nfiles; i++) {
+		int fd;
+
+		snprintf(name, sizeof(name), "f%u", i);
+		fd = openat(dir_fd, name, O_CREAT | O_WRONLY, 0600);
+		if (fd < 0)
+			die("openat");
+		close(fd);
+	}
+
+	/* populate the negative dentries */
+	for (i = 0; i < nmisses; i++) {
+		snprintf(name, sizeof(name), "n%u", i);
+		if (!fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW))
+			unlinkat(dir_fd, name, 0);
+	}
+	printf("setup: %u files, %u misses\n", nfiles, nmisses);
+	print_dentry_state();
+}
+
+static void cleanup(void)
+{
+	char name[64];
+	unsigned int i;
+
+	for (i = 0; i < nfiles; i++) {
+		snprintf(name, sizeof(name), "f%u", i);
+		unlinkat(dir_fd, name, 0);
+	}
+	close(dir_fd);
+	rmdir(dir);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-d dir] [-n files] [-m misses] [-t threads] [-l loops] [-b batch]\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:n:m:t:l:b:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 'n':
+			nfiles = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			nmisses = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			nthreads = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			loops = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			batch = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!nfiles || !nmisses || !nthreads || !loops || !batch ||
+	    batch > 4096)
+		usage(argv[0]);
+
+	setup();
+
+	run(PHASE_HIT, 0);
+	run(PHASE_MISS, 0);
+	run(PHASE_COLD, 0);
+	if (batch_supported()) {
+		run(PHASE_HIT, 1);
+		run(PHASE_MISS, 1);
+	} else {
+		printf("FS_IOC_LOOKUP_BATCH not supported, skipping batches\n");
+	}
+
+	cleanup();
+	return 0;
+}
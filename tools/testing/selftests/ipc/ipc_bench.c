@@ -0,0 +1,252 @@
+/*
+ * SysV IPC ping-pong throughput.
+ *
+ *   ipc_bench [-t pairs] [-d seconds] [-m sem|semmulti|semmixed|msg|poll]
+ *
+ * Runs "pairs" pairs of threads that hand a token back and forth:
+ *
+ *   sem       over two semaphores per pair, all in one semaphore set
+ *   semmulti  the same, but every wait is two -1 sops on the same
+ *             semaphore (and every post a +2), i.e. a multi-sop operation
+ *             that only decrements a single semaphore
+ *   semmixed  every wait is {-1, 0} on one semaphore, which only succeeds
+ *             at 1, and every post a +2 followed by a plain -1: the waiter
+ *             must be woken by the decrement.  Without progress the run
+ *             fails, that is a lost wakeup
+ *   msg       over one message queue shared by all pairs, each pair using
+ *             its own two message types
+ *   poll      every thread polls the (empty) queue with IPC_NOWAIT
+ *
+ * Reports the round trips per second over all pairs (receive attempts for
+ * "poll").  The run is ended by removing the IPC object, which fails all
+ * sleeping operations with EIDRM.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ipc.h>
+#include <sys/msg.h>
+#include <sys/sem.h>
+
+enum { MODE_SEM, MODE_SEMMULTI, MODE_SEMMIXED, MODE_MSG, MODE_POLL };
+
+static const char * const mode_names[] = {
+	[MODE_SEM]	= "sem",
+	[MODE_SEMMULTI]	= "semmulti",
+	[MODE_SEMMIXED]	= "semmixed",
+	[MODE_MSG]	= "msg",
+	[MODE_POLL]	= "poll",
+};
+
+static int mode;
+static int npairs = 1;
+static int seconds = 5;
+static int semid = -1;
+static int msqid = -1;
+static volatile int stop;
+
+struct worker {
+	pthread_t	thread;
+	int		pair;
+	int		side;
+	unsigned long	ops;
+};
+
+struct msg {
+	long	mtype;
+	char	mtext[16];
+};
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+/* post or wait for the token on semaphore num */
+static int sem_op(int num, int post)
+{
+	struct sembuf sops[2];
+	int nsops = 1;
+
+	sops[0].sem_num = num;
+	sops[0].sem_flg = 0;
+	sops[0].sem_op = post ? 1 : -1;
+
+	if (mode == MODE_SEMMULTI) {
+		if (post) {
+			sops[0].sem_op = 2;
+		} else {
+			sops[1] = sops[0];
+			nsops = 2;
+		}
+	}
+	if (mode == MODE_SEMMIXED) {
+		if (post) {
+			sops[0].sem_op = 2;
+			if (semop(semid, sops, 1))
+				return -1;
+			sops[0].sem_op = -1;
+		} else {
+			sops[1] = sops[0];
+			sops[1].sem_op = 0;
+			nsops = 2;
+		}
+	}
+	return semop(semid, sops, nsops);
+}
+
+static void *sem_worker(void *arg)
+{
+	struct worker *w = arg;
+	int post = 2 * w->pair + w->side;
+	int wait = 2 * w->pair + !w->side;
+
+	while (!stop) {
+		/* side 0 starts by posting, side 1 by waiting */
+		if (w->side == 0 && sem_op(post, 1))
+			break;
+		if (sem_op(wait, 0))
+			break;
+		if (w->side == 1 && sem_op(post, 1))
+			break;
+		w->ops++;
+	}
+	return NULL;
+}
+
+static void *msg_worker(void *arg)
+{
+	struct worker *w = arg;
+	long snd = 2 * w->pair + 1 + w->side;
+	long rcv = 2 * w->pair + 2 - w->side;
+	struct msg m;
+
+	memset(&m, 0, sizeof(m));
+	while (!stop) {
+		if (w->side == 0) {
+			m.mtype = snd;
+			if (msgsnd(msqid, &m, sizeof(m.mtext), 0))
+				break;
+		}
+		if (msgrcv(msqid, &m, sizeof(m.mtext), rcv, 0) < 0)
+			break;
+		if (w->side == 1) {
+			m.mtype = snd;
+			if (msgsnd(msqid, &m, sizeof(m.mtext), 0))
+				break;
+		}
+		w->ops++;
+	}
+	return NULL;
+}
+
+static void *poll_worker(void *arg)
+{
+	struct worker *w = arg;
+	struct msg m;
+
+	while (!stop) {
+		if (msgrcv(msqid, &m, sizeof(m.mtext), 0, IPC_NOWAIT) >= 0 ||
+		    errno != ENOMSG)
+			break;
+		w->ops++;
+	}
+	return NULL;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-t pairs] [-d seconds] [-m sem|semmulti|semmixed|msg|poll]\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	void *(*fn)(void *) = sem_worker;
+	struct worker *workers;
+	unsigned long ops = 0;
+	int i, opt;
+
+	while ((opt = getopt(argc, argv, "t:d:m:")) != -1) {
+		switch (opt) {
+		case 't':
+			npairs = atoi(optarg);
+			break;
+		case 'd':
+			seconds = atoi(optarg);
+			break;
+		case 'm':
+			for (mode = 0; mode <= MODE_POLL; mode++)
+				if (!strcmp(optarg, mode_names[mode]))
+					break;
+			if (mode > MODE_POLL)
+				usage(argv[0]);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (npairs < 1 || seconds < 1)
+		usage(argv[0]);
+
+	switch (mode) {
+	case MODE_SEM:
+	case MODE_SEMMULTI:
+	case MODE_SEMMIXED:
+		semid = semget(IPC_PRIVATE, 2 * npairs, IPC_CREAT | 0600);
+		if (semid < 0)
+			die("semget");
+		break;
+	case MODE_MSG:
+	case MODE_POLL:
+		fn = mode == MODE_MSG ? msg_worker : poll_worker;
+		msqid = msgget(IPC_PRIVATE, IPC_CREAT | 0600);
+		if (msqid < 0)
+			die("msgget");
+		break;
+	}
+
+	workers = calloc(2 * npairs, sizeof(*workers));
+	if (!workers)
+		die("calloc");
+
+	for (i = 0; i < 2 * npairs; i++) {
+		workers[i].pair = i / 2;
+		workers[i].side = i % 2;
+		if (pthread_create(&workers[i].thread, NULL, fn, &workers[i]))
+			die("pthread_create");
+	}
+
+	sleep(seconds);
+	stop = 1;
+	if (semid >= 0 && semctl(semid, 0, IPC_RMID))
+		die("semctl");
+	if (msqid >= 0 && msgctl(msqid, IPC_RMID, NULL))
+		die("msgctl");
+
+	for (i = 0; i < 2 * npairs; i++) {
+		pthread_join(workers[i].thread, NULL);
+		/* a round trip is counted on both sides of a pair */
+		ops += workers[i].ops;
+	}
+	if (mode != MODE_POLL)
+		ops /= 2;
+
+	printf("%s: %d pairs, %lu ops/s\n", mode_names[mode], npairs,
+	       ops / seconds);
+	if (!ops) {
+		fprintf(stderr, "%s: no progress, lost wakeup?\n",
+			mode_names[mode]);
+		return 1;
+	}
+
+	free(workers);
+	return 0;
+}
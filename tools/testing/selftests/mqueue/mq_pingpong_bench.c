@@ -0,0 +1,200 @@
+/*
+ * POSIX message queue throughput and latency.
+ *
+ *   mq_pingpong_bench [-n messages] [-s size] [-p priorities] [-b base]
+ *
+ * Throughput: one thread streams "messages" messages of "size" bytes
+ * through a queue to a second thread, cycling through "priorities"
+ * priorities starting at "base".  Latency: the two threads bounce one
+ * message back and forth over two queues, the round trip times are
+ * reported as average and percentiles.
+ *
+ * Priorities below 32 exercise the embedded per-priority buckets, higher
+ * ones the priority tree.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <mqueue.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static long nmsgs = 1000000;
+static size_t msgsize = 64;
+static unsigned int nprios = 1;
+static unsigned int base_prio;
+static char qname[2][32];
+static mqd_t q[2];
+static double *rtt;
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *stream_receiver(void *arg)
+{
+	char *buf = malloc(msgsize);
+	long i;
+
+	if (!buf)
+		die("malloc");
+	for (i = 0; i < nmsgs; i++)
+		if (mq_receive(q[0], buf, msgsize, NULL) < 0)
+			die("mq_receive");
+	free(buf);
+	return NULL;
+}
+
+static void *pong(void *arg)
+{
+	char *buf = malloc(msgsize);
+	long i;
+
+	if (!buf)
+		die("malloc");
+	for (i = 0; i < nmsgs; i++) {
+		if (mq_receive(q[0], buf, msgsize, NULL) < 0)
+			die("mq_receive");
+		if (mq_send(q[1], buf, msgsize, base_prio))
+			die("mq_send");
+	}
+	free(buf);
+	return NULL;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void throughput(void)
+{
+	char *buf = calloc(1, msgsize);
+	pthread_t thread;
+	double start, elapsed;
+	long i;
+
+	if (!buf)
+		die("calloc");
+	if (pthread_create(&thread, NULL, stream_receiver, NULL))
+		die("pthread_create");
+
+	start = now();
+	for (i = 0; i < nmsgs; i++)
+		if (mq_send(q[0], buf, msgsize, base_prio + i % nprios))
+			die("mq_send");
+	pthread_join(thread, NULL);
+	elapsed = now() - start;
+
+	printf("throughput: %zu bytes, %u priorities from %u: %.0f msgs/s\n",
+	       msgsize, nprios, base_prio, nmsgs / elapsed);
+	free(buf);
+}
+
+static void latency(void)
+{
+	char *buf = calloc(1, msgsize);
+	pthread_t thread;
+	double sum = 0;
+	long i;
+
+	if (!buf)
+		die("calloc");
+	if (pthread_create(&thread, NULL, pong, NULL))
+		die("pthread_create");
+
+	for (i = 0; i < nmsgs; i++) {
+		double start = now();
+
+		if (mq_send(q[0], buf, msgsize, base_prio))
+			die("mq_send");
+		if (mq_receive(q[1], buf, msgsize, NULL) < 0)
+			die("mq_receive");
+		rtt[i] = now() - start;
+		sum += rtt[i];
+	}
+	pthread_join(thread, NULL);
+
+	qsort(rtt, nmsgs, sizeof(*rtt), cmp_double);
+	printf("latency: %zu bytes: avg %.2f us, p50 %.2f us, p99 %.2f us, max %.2f us\n",
+	       msgsize, sum / nmsgs * 1e6, rtt[nmsgs / 2] * 1e6,
+	       rtt[nmsgs / 100 * 99] * 1e6, rtt[nmsgs - 1] * 1e6);
+	free(buf);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-n messages] [-s size] [-p priorities] [-b base]\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct mq_attr attr;
+	int i, opt;
+
+	while ((opt = getopt(argc, argv, "n:s:p:b:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nmsgs = atol(optarg);
+			break;
+		case 's':
+			msgsize = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			nprios = atoi(optarg);
+			break;
+		case 'b':
+			base_prio = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nmsgs < 100 || !msgsize || !nprios)
+		usage(argv[0]);
+
+	rtt = calloc(nmsgs, sizeof(*rtt));
+	if (!rtt)
+		die("calloc");
+
+	memset(&attr, 0, sizeof(attr));
+	attr.mq_maxmsg = 10;
+	attr.mq_msgsize = msgsize;
+	for (i = 0; i < 2; i++) {
+		snprintf(qname[i], sizeof(qname[i]), "/mq_pingpong.%d.%d",
+			 getpid(), i);
+		q[i] = mq_open(qname[i], O_RDWR | O_CREAT | O_EXCL, 0600,
+			       &attr);
+		if (q[i] == (mqd_t)-1)
+			die("mq_open");
+	}
+
+	throughput();
+	latency();
+
+	for (i = 0; i < 2; i++) {
+		mq_close(q[i]);
+		mq_unlink(qname[i]);
+	}
+	free(rtt);
+	return 0;
+}
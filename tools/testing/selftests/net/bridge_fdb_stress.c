@@ -0,0 +1,250 @@
+/*
+ * Bridge MAC learning rate against the number of CPUs sending.
+ *
+ *   bridge_fdb_stress [-n macs] bridge if0 [if1 ...]
+ *
+ * Each interface must be the peer of a bridge port (see run_fdbstress).
+ * For 1..N senders, the bridge fdb is flushed and each sender thread,
+ * pinned to its own CPU, transmits frames with distinct source MACs on
+ * its interface.  The number of entries the bridge learned is divided by
+ * the elapsed time.  Frames are addressed to the bridge itself with a
+ * local experimental ethertype, so they are neither flooded nor handled.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#define ETH_P_EXPERIMENTAL	0x88b5
+#define BATCH			64
+#define MAX_SENDERS		256
+
+/* Record layout of /sys/class/net/<bridge>/brforward */
+struct fdb_record {
+	unsigned char mac_addr[6];
+	unsigned char port_no;
+	unsigned char is_local;
+	unsigned int ageing_timer_value;
+	unsigned char port_hi;
+	unsigned char pad0;
+	unsigned short unused;
+};
+
+struct sender {
+	pthread_t thread;
+	int id;
+	int ifindex;
+	unsigned long macs;
+};
+
+static const char *bridge;
+static unsigned char bridge_mac[ETH_ALEN];
+static pthread_barrier_t barrier;
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static void write_sysfs(const char *attr, const char *val)
+{
+	char path[128];
+	int fd;
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s/bridge/%s",
+		 bridge, attr);
+	fd = open(path, O_WRONLY);
+	if (fd < 0 || write(fd, val, strlen(val)) < 0)
+		die(path);
+	close(fd);
+}
+
+static unsigned long count_learned(void)
+{
+	struct fdb_record rec[256];
+	unsigned long learned = 0;
+	char path[128];
+	ssize_t n, i;
+	int fd;
+
+	snprintf(path, sizeof(path), "/sys/class/net/%s/brforward", bridge);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		die(path);
+	while ((n = read(fd, rec, sizeof(rec))) > 0) {
+		for (i = 0; i < n / (ssize_t)sizeof(rec[0]); i++)
+			if (!rec[i].is_local)
+				learned++;
+	}
+	close(fd);
+	return learned;
+}
+
+static void get_bridge_mac(void)
+{
+	struct ifreq ifr;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		die("socket");
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, bridge, IFNAMSIZ - 1);
+	if (ioctl(fd, SIOCGIFHWADDR, &ifr))
+		die("SIOCGIFHWADDR");
+	memcpy(bridge_mac, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+	close(fd);
+}
+
+static void *sender_fn(void *arg)
+{
+	struct sender *s = arg;
+	unsigned char frames[BATCH][ETH_ZLEN];
+	struct mmsghdr msgs[BATCH];
+	struct iovec iov[BATCH];
+	struct sockaddr_ll sll;
+	unsigned long mac = 0;
+	cpu_set_t cpus;
+	int fd, i;
+
+	CPU_ZERO(&cpus);
+	CPU_SET(s->id % sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+	fd = socket(AF_PACKET, SOCK_RAW, 0);
+	if (fd < 0)
+		die("socket AF_PACKET");
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_ifindex = s->ifindex;
+	if (bind(fd, (struct sockaddr *)&sll, sizeof(sll)))
+		die("bind");
+
+	memset(frames, 0, sizeof(frames));
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < BATCH; i++) {
+		struct ethhdr *eth = (struct ethhdr *)frames[i];
+
+		memcpy(eth->h_dest, bridge_mac, ETH_ALEN);
+		eth->h_proto = htons(ETH_P_EXPERIMENTAL);
+		iov[i].iov_base = frames[i];
+		iov[i].iov_len = ETH_ZLEN;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	pthread_barrier_wait(&barrier);
+
+	while (mac < s->macs) {
+		int n = s->macs - mac < BATCH ? s->macs - mac : BATCH;
+
+		/* locally administered unicast: 02:<sender>:<mac index> */
+		for (i = 0; i < n; i++) {
+			unsigned char *src = frames[i] + ETH_ALEN;
+			unsigned long m = mac + i;
+
+			src[0] = 0x02;
+			src[1] = s->id;
+			src[2] = m >> 24;
+			src[3] = m >> 16;
+			src[4] = m >> 8;
+			src[5] = m;
+		}
+		n = sendmmsg(fd, msgs, n, 0);
+		if (n < 0) {
+			if (errno == ENOBUFS)
+				continue;
+			die("sendmmsg");
+		}
+		mac += n;
+	}
+
+	close(fd);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	static struct sender senders[MAX_SENDERS];
+	unsigned long macs = 100000;
+	int nifs, nsend, i, c;
+
+	while ((c = getopt(argc, argv, "n:")) != -1) {
+		switch (c) {
+		case 'n':
+			macs = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (argc - optind < 2)
+		goto usage;
+
+	bridge = argv[optind++];
+	nifs = argc - optind;
+	if (nifs > MAX_SENDERS)
+		nifs = MAX_SENDERS;
+	for (i = 0; i < nifs; i++) {
+		senders[i].id = i;
+		senders[i].ifindex = if_nametoindex(argv[optind + i]);
+		if (!senders[i].ifindex)
+			die(argv[optind + i]);
+	}
+	get_bridge_mac();
+
+	/* Keep everything learned during a run */
+	write_sysfs("ageing_time", "100000");
+
+	for (nsend = 1; nsend <= nifs; nsend++) {
+		struct timespec start, end;
+		unsigned long learned;
+		double secs;
+
+		write_sysfs("flush", "1");
+		pthread_barrier_init(&barrier, NULL, nsend + 1);
+		for (i = 0; i < nsend; i++) {
+			senders[i].macs = macs / nsend;
+			if (pthread_create(&senders[i].thread, NULL,
+					   sender_fn, &senders[i]))
+				die("pthread_create");
+		}
+
+		pthread_barrier_wait(&barrier);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i = 0; i < nsend; i++)
+			pthread_join(senders[i].thread, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		pthread_barrier_destroy(&barrier);
+
+		/* let the last frames drain through the backlog */
+		usleep(100000);
+		learned = count_learned();
+
+		secs = (end.tv_sec - start.tv_sec) +
+		       (end.tv_nsec - start.tv_nsec) / 1e9;
+		printf("%3d sender(s): %lu of %lu MACs learned in %.3f s, "
+		       "%.0f MACs/s\n", nsend, learned,
+		       (macs / nsend) * nsend, secs, learned / secs);
+	}
+
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-n macs] bridge if0 [if1 ...]\n",
+		argv[0]);
+	return 1;
+}
@@ -0,0 +1,171 @@
+/*
+ * Time rtnetlink dumps of large tables.
+ *
+ *   nl_dump_bench [-t route|neigh|link] [-f family] [-b bufsize] [-n loops]
+ *
+ * Each loop dumps the whole table once, reading it with recvmsg() calls of
+ * bufsize bytes, and reports how many messages and syscalls that took.  A
+ * dump that came back flagged NLM_F_DUMP_INTR is counted separately: the
+ * table changed in a way the kernel could not resume across.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+static int type = RTM_GETROUTE;
+static int family = AF_INET;
+static size_t bufsize = 32768;
+static unsigned long loops = 10;
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void send_dump(int fd, unsigned int seq)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct rtmsg rtm;
+	} req;
+	struct sockaddr_nl sa = { .nl_family = AF_NETLINK };
+
+	memset(&req, 0, sizeof(req));
+	req.nlh.nlmsg_len = sizeof(req);
+	req.nlh.nlmsg_type = type;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nlh.nlmsg_seq = seq;
+	req.rtm.rtm_family = family;
+
+	if (sendto(fd, &req, sizeof(req), 0, (struct sockaddr *)&sa,
+		   sizeof(sa)) < 0)
+		die("sendto");
+}
+
+/* Returns 1 if the dump was flagged as interrupted */
+static int read_dump(int fd, char *buf, unsigned int seq,
+		     unsigned long *msgs, unsigned long *calls,
+		     unsigned long *bytes)
+{
+	int intr = 0;
+
+	for (;;) {
+		struct nlmsghdr *nlh;
+		ssize_t len;
+
+		len = recv(fd, buf, bufsize, 0);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			die("recv");
+		}
+		(*calls)++;
+		*bytes += len;
+
+		for (nlh = (struct nlmsghdr *)buf; NLMSG_OK(nlh, len);
+		     nlh = NLMSG_NEXT(nlh, len)) {
+			if (nlh->nlmsg_seq != seq)
+				continue;
+			if (nlh->nlmsg_flags & NLM_F_DUMP_INTR)
+				intr = 1;
+			if (nlh->nlmsg_type == NLMSG_DONE)
+				return intr;
+			if (nlh->nlmsg_type == NLMSG_ERROR) {
+				struct nlmsgerr *err = NLMSG_DATA(nlh);
+
+				errno = -err->error;
+				die("dump");
+			}
+			(*msgs)++;
+		}
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-t route|neigh|link] [-f 0|4|6] [-b bufsize] [-n loops]\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long msgs = 0, calls = 0, bytes = 0, intr = 0, i;
+	int fd, opt, rcvbuf = 1 << 20;
+	double start, elapsed;
+	char *buf;
+
+	while ((opt = getopt(argc, argv, "t:f:b:n:")) != -1) {
+		switch (opt) {
+		case 't':
+			if (!strcmp(optarg, "route"))
+				type = RTM_GETROUTE;
+			else if (!strcmp(optarg, "neigh"))
+				type = RTM_GETNEIGH;
+			else if (!strcmp(optarg, "link"))
+				type = RTM_GETLINK;
+			else
+				usage(argv[0]);
+			break;
+		case 'f':
+			family = atoi(optarg) == 6 ? AF_INET6 :
+				 atoi(optarg) == 4 ? AF_INET : AF_UNSPEC;
+			break;
+		case 'b':
+			bufsize = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			loops = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (bufsize < 4096 || !loops)
+		usage(argv[0]);
+
+	buf = malloc(bufsize);
+	if (!buf)
+		die("malloc");
+
+	fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE);
+	if (fd < 0)
+		die("socket");
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)))
+		die("setsockopt");
+
+	start = now();
+	for (i = 0; i < loops; i++) {
+		send_dump(fd, i + 1);
+		intr += read_dump(fd, buf, i + 1, &msgs, &calls, &bytes);
+	}
+	elapsed = now() - start;
+
+	printf("%s dump, bufsize %zu: %lu msgs/dump, %.1f msgs/recv, %.1f KB/recv, %.2f ms/dump, %lu interrupted\n",
+	       type == RTM_GETROUTE ? "route" :
+	       type == RTM_GETNEIGH ? "neigh" : "link",
+	       bufsize, msgs / loops, (double)msgs / calls,
+	       bytes / 1024.0 / calls, elapsed * 1000 / loops, intr);
+
+	free(buf);
+	close(fd);
+	return 0;
+}
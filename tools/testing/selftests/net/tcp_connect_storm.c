@@ -0,0 +1,181 @@
+/*
+ * TCP connect/close storm against many destination addresses.
+ *
+ *   tcp_connect_storm [-t threads] [-d dests] [-s secs] [-p port] [-r]
+ *
+ * A listener on INADDR_ANY accepts and closes every connection.  Each
+ * client thread connects to 127.x.y.z, cycling through "dests" different
+ * loopback addresses, so that every connect looks up (and, for new
+ * destinations, creates) a TCP metrics entry and every orderly close
+ * updates one.  With -r the clients abort with a RST instead, which skips
+ * the update on close.  Reports connections per second over all threads.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+static int nthreads = 4;
+static unsigned int ndests = 65536;
+static int duration = 5;
+static int port = 8766;
+static int use_rst;
+static volatile int stop;
+
+struct client {
+	pthread_t	thread;
+	unsigned int	id;
+	unsigned long	conns;
+	unsigned long	errors;
+};
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static void *server_thread(void *arg)
+{
+	int lfd = (long)arg;
+
+	for (;;) {
+		int fd = accept(lfd, NULL, NULL);
+
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED ||
+			    errno == EMFILE || errno == ENFILE)
+				continue;
+			die("accept");
+		}
+		close(fd);
+	}
+	return NULL;
+}
+
+static void *client_thread(void *arg)
+{
+	struct client *c = arg;
+	struct linger lin = { .l_onoff = 1, .l_linger = 0 };
+	struct sockaddr_in sin = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+	};
+	unsigned int dest = c->id * (ndests / nthreads);
+	char buf[16];
+
+	while (!stop) {
+		int fd;
+
+		/* 127.0.0.0/8 minus .0 and .255 host parts */
+		dest = (dest + 1) % ndests;
+		sin.sin_addr.s_addr = htonl(0x7f000000 |
+					    ((dest / 254) << 8) |
+					    (dest % 254 + 1));
+
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd < 0)
+			die("socket");
+		if (connect(fd, (struct sockaddr *)&sin, sizeof(sin))) {
+			c->errors++;
+			close(fd);
+			continue;
+		}
+		if (use_rst)
+			setsockopt(fd, SOL_SOCKET, SO_LINGER, &lin,
+				   sizeof(lin));
+		else
+			/* wait for the server's FIN so both sides close */
+			while (read(fd, buf, sizeof(buf)) > 0)
+				;
+		close(fd);
+		c->conns++;
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_in sin = { .sin_family = AF_INET };
+	unsigned long conns = 0, errors = 0;
+	struct client *clients;
+	pthread_t server;
+	int lfd, opt, one = 1;
+	int i;
+
+	while ((opt = getopt(argc, argv, "t:d:s:p:r")) != -1) {
+		switch (opt) {
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 'd':
+			ndests = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			duration = atoi(optarg);
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'r':
+			use_rst = 1;
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-t threads] [-d dests] [-s secs] [-p port] [-r]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (nthreads < 1 || !ndests || ndests > 254 * 65536 || duration < 1) {
+		fprintf(stderr, "invalid arguments\n");
+		return 1;
+	}
+
+	lfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (lfd < 0)
+		die("socket");
+	setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	sin.sin_port = htons(port);
+	sin.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(lfd, (struct sockaddr *)&sin, sizeof(sin)))
+		die("bind");
+	if (listen(lfd, 4096))
+		die("listen");
+	if (pthread_create(&server, NULL, server_thread, (void *)(long)lfd))
+		die("pthread_create");
+
+	clients = calloc(nthreads, sizeof(*clients));
+	if (!clients)
+		die("calloc");
+	for (i = 0; i < nthreads; i++) {
+		clients[i].id = i;
+		if (pthread_create(&clients[i].thread, NULL, client_thread,
+				   &clients[i]))
+			die("pthread_create");
+	}
+
+	sleep(duration);
+	stop = 1;
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(clients[i].thread, NULL);
+		conns += clients[i].conns;
+		errors += clients[i].errors;
+	}
+
+	printf("%d threads, %u destinations%s: %lu connections/s, %lu errors\n",
+	       nthreads, ndests, use_rst ? " (RST)" : "",
+	       conns / duration, errors);
+
+	free(clients);
+	close(lfd);
+	return 0;
+}
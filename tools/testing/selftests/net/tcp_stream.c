@@ -0,0 +1,166 @@
+/*
+ * TCP bulk throughput.
+ *
+ *   tcp_stream -s [-p port]
+ *   tcp_stream -c host [-p port] [-l secs] [-w writesize]
+ *
+ * The server accepts one connection at a time and discards everything it
+ * reads.  The client streams writesize byte writes at it for secs seconds
+ * and reports the achieved goodput.  Meant to be run across a tunnel and
+ * then across its underlay, to compare the two.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+static const char *host;
+static const char *port = "8767";
+static int duration = 5;
+static size_t wsize = 65536;
+static int server;
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run_server(void)
+{
+	struct sockaddr_in6 sin6 = {
+		.sin6_family = AF_INET6,
+		.sin6_addr = IN6ADDR_ANY_INIT,
+		.sin6_port = htons(atoi(port)),
+	};
+	int lfd, one = 1;
+	char *buf;
+
+	buf = malloc(wsize);
+	if (!buf)
+		die("malloc");
+
+	lfd = socket(AF_INET6, SOCK_STREAM, 0);
+	if (lfd < 0)
+		die("socket");
+	setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(lfd, (struct sockaddr *)&sin6, sizeof(sin6)))
+		die("bind");
+	if (listen(lfd, 16))
+		die("listen");
+
+	for (;;) {
+		int fd = accept(lfd, NULL, NULL);
+
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			die("accept");
+		}
+		while (read(fd, buf, wsize) > 0)
+			;
+		close(fd);
+	}
+}
+
+static void run_client(void)
+{
+	struct addrinfo hints = { .ai_socktype = SOCK_STREAM };
+	unsigned long long bytes = 0;
+	struct addrinfo *ai;
+	double start, end, t;
+	int fd, err;
+	char *buf;
+
+	err = getaddrinfo(host, port, &hints, &ai);
+	if (err) {
+		fprintf(stderr, "%s: %s\n", host, gai_strerror(err));
+		exit(1);
+	}
+
+	buf = malloc(wsize);
+	if (!buf)
+		die("malloc");
+	memset(buf, 0xa5, wsize);
+
+	fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+	if (fd < 0)
+		die("socket");
+	if (connect(fd, ai->ai_addr, ai->ai_addrlen))
+		die("connect");
+	freeaddrinfo(ai);
+
+	start = t = now();
+	end = start + duration;
+	while (t < end) {
+		ssize_t len = write(fd, buf, wsize);
+
+		if (len < 0 && errno != EINTR)
+			die("write");
+		if (len > 0)
+			bytes += len;
+		t = now();
+	}
+
+	printf("%s: %zu byte writes: %.2f Gbit/s\n", host, wsize,
+	       bytes * 8 / (t - start) / 1e9);
+
+	close(fd);
+	free(buf);
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "sc:p:l:w:")) != -1) {
+		switch (opt) {
+		case 's':
+			server = 1;
+			break;
+		case 'c':
+			host = optarg;
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		case 'l':
+			duration = atoi(optarg);
+			break;
+		case 'w':
+			wsize = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (server == !!host || duration < 1 || !wsize)
+		goto usage;
+
+	if (server)
+		run_server();
+	else
+		run_client();
+	return 0;
+
+usage:
+	fprintf(stderr,
+		"usage: %s -s [-p port]\n"
+		"       %s -c host [-p port] [-l secs] [-w writesize]\n",
+		argv[0], argv[0]);
+	return 1;
+}
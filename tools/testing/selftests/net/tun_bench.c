@@ -0,0 +1,247 @@
+/*
+ * Packets per second injected through a tun device, one write() per packet
+ * versus TUNSENDMMSG batches, and through a packet socket with sendmmsg()
+ * for comparison with veth.
+ *
+ *   tun_bench [-n packets] [-s size] [-b batch] [-z]
+ *   tun_bench -i veth0 [-n packets] [-s size] [-b batch]
+ *
+ * -z pins frames of a page or more instead of copying them.  Without -i a
+ * tun device is created; with -i frames go out of an existing interface,
+ * e.g. one end of a veth pair set up by run_tunbench.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/if_tun.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+
+#ifndef TUNSENDMMSG
+struct tun_mmsg {
+	uint64_t addr;
+	uint32_t len;
+	uint32_t flags;
+};
+
+struct tun_mmsg_batch {
+	uint64_t msgs;
+	uint32_t count;
+	uint32_t flags;
+};
+
+#define TUN_MMSG_ZEROCOPY	0x0001
+#define TUNSENDMMSG	_IOW('T', 222, struct tun_mmsg_batch)
+#define TUNRECVMMSG	_IOW('T', 223, struct tun_mmsg_batch)
+#endif
+
+#define MAX_BATCH	1024
+#define MAX_SIZE	65000
+
+static unsigned long npackets = 1000000;
+static unsigned int size = 64;
+static unsigned int batch = 1;
+static int zerocopy;
+static const char *ifname;
+
+static char frame[MAX_SIZE + ETH_HLEN] __attribute__((aligned(4096)));
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+/* An IPv4/UDP packet to 198.18.0.1, which nothing on the host answers */
+static void build_packet(char *buf, unsigned int len)
+{
+	struct iphdr *iph = (struct iphdr *)buf;
+	struct udphdr *udph = (struct udphdr *)(iph + 1);
+
+	memset(buf, 0, len);
+	iph->version = 4;
+	iph->ihl = 5;
+	iph->ttl = 64;
+	iph->protocol = IPPROTO_UDP;
+	iph->tot_len = htons(len);
+	iph->saddr = htonl(0xc6120002);
+	iph->daddr = htonl(0xc6120001);
+	udph->source = htons(9);
+	udph->dest = htons(9);
+	udph->len = htons(len - sizeof(*iph));
+}
+
+static int tun_open(void)
+{
+	struct ifreq ifr;
+	int fd, sock;
+
+	fd = open("/dev/net/tun", O_RDWR);
+	if (fd < 0)
+		die("open /dev/net/tun");
+
+	memset(&ifr, 0, sizeof(ifr));
+	ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
+	if (ioctl(fd, TUNSETIFF, &ifr))
+		die("TUNSETIFF");
+
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0)
+		die("socket");
+	ifr.ifr_flags = IFF_UP;
+	if (ioctl(sock, SIOCSIFFLAGS, &ifr))
+		die("SIOCSIFFLAGS");
+	close(sock);
+
+	return fd;
+}
+
+static unsigned long run_tun(void)
+{
+	static struct tun_mmsg msgs[MAX_BATCH];
+	struct tun_mmsg_batch b = {
+		.msgs = (uintptr_t)msgs,
+		.flags = zerocopy ? TUN_MMSG_ZEROCOPY : 0,
+	};
+	unsigned long sent = 0;
+	int fd = tun_open();
+	unsigned int i;
+
+	build_packet(frame, size);
+
+	while (sent < npackets) {
+		int n;
+
+		if (batch == 1 && !zerocopy) {
+			if (write(fd, frame, size) != size)
+				die("write");
+			sent++;
+			continue;
+		}
+
+		b.count = batch;
+		for (i = 0; i < batch; i++) {
+			msgs[i].addr = (uintptr_t)frame;
+			msgs[i].len = size;
+		}
+		n = ioctl(fd, TUNSENDMMSG, &b);
+		if (n < 0)
+			die("TUNSENDMMSG");
+		sent += n;
+	}
+
+	close(fd);
+	return sent;
+}
+
+static unsigned long run_packet(void)
+{
+	static struct mmsghdr msgs[MAX_BATCH];
+	struct iovec iov = {
+		.iov_base = frame,
+		.iov_len = size + ETH_HLEN,
+	};
+	struct sockaddr_ll sll;
+	unsigned long sent = 0;
+	struct ethhdr *eth;
+	unsigned int i;
+	int fd;
+
+	fd = socket(AF_PACKET, SOCK_RAW, 0);
+	if (fd < 0)
+		die("socket AF_PACKET");
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_ifindex = if_nametoindex(ifname);
+	if (!sll.sll_ifindex)
+		die(ifname);
+	if (bind(fd, (struct sockaddr *)&sll, sizeof(sll)))
+		die("bind");
+
+	build_packet(frame + ETH_HLEN, size);
+	eth = (struct ethhdr *)frame;
+	memset(eth->h_dest, 0xff, ETH_ALEN);
+	eth->h_source[0] = 0x02;
+	eth->h_proto = htons(ETH_P_IP);
+
+	for (i = 0; i < batch; i++) {
+		msgs[i].msg_hdr.msg_iov = &iov;
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while (sent < npackets) {
+		int n = sendmmsg(fd, msgs, batch, 0);
+
+		if (n < 0) {
+			if (errno == ENOBUFS)
+				continue;
+			die("sendmmsg");
+		}
+		sent += n;
+	}
+
+	close(fd);
+	return sent;
+}
+
+int main(int argc, char **argv)
+{
+	struct timespec start, end;
+	unsigned long sent;
+	double secs;
+	int c;
+
+	while ((c = getopt(argc, argv, "n:s:b:zi:")) != -1) {
+		switch (c) {
+		case 'n':
+			npackets = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			batch = strtoul(optarg, NULL, 0);
+			break;
+		case 'z':
+			zerocopy = 1;
+			break;
+		case 'i':
+			ifname = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n packets] [-s size] "
+				"[-b batch] [-z] [-i ifname]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (size < sizeof(struct iphdr) + sizeof(struct udphdr) ||
+	    size > MAX_SIZE || !batch || batch > MAX_BATCH) {
+		fprintf(stderr, "size or batch out of range\n");
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	sent = ifname ? run_packet() : run_tun();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	secs = (end.tv_sec - start.tv_sec) +
+	       (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("%s size %u batch %u%s: %lu packets in %.3f s, %.0f pps\n",
+	       ifname ? ifname : "tun", size, batch,
+	       zerocopy ? " zerocopy" : "", sent, secs, sent / secs);
+
+	return 0;
+}
@@ -0,0 +1,284 @@
+/*
+ * UDP request/response latency and one-way throughput.
+ *
+ *   udp_rr -s [-e] [-b usecs] [-p port]		server: echo every request
+ *   udp_rr -c host [-e] [-b usecs] [-p port] [-n count] [-l size]
+ *						client: latency
+ *   udp_rr -c host -T [-p port] [-n count] [-l size]	client: throughput
+ *
+ * In latency mode the client keeps one request in flight and reports the
+ * round-trip time distribution.  In throughput mode it sends as fast as it
+ * can and the server reports the rate it received at after an idle second.
+ *
+ * With -e, both sides wait for datagrams in epoll_wait() like an event
+ * driven server, and -b sets that epoll instance's busy poll budget.
+ */
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#ifndef EPIOCSPARAMS
+struct epoll_params {
+	uint32_t busy_poll_usecs;
+	uint16_t busy_poll_budget;
+	uint8_t prefer_busy_poll;
+	uint8_t __pad;
+};
+#define EPIOCSPARAMS	_IOW(0x8A, 0x01, struct epoll_params)
+#endif
+
+#define MAX_SIZE	65507
+
+static const char *host;
+static const char *port = "8765";
+static unsigned long count = 100000;
+static unsigned int size = 64;
+static int throughput;
+static int use_epoll;
+static long busy_poll_usecs = -1;
+static int epfd = -1;
+
+static char buf[MAX_SIZE];
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int udp_socket(int server)
+{
+	struct addrinfo hints = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_DGRAM,
+		.ai_flags = server ? AI_PASSIVE : 0,
+	};
+	struct addrinfo *ai;
+	int fd, err;
+
+	err = getaddrinfo(host, port, &hints, &ai);
+	if (err) {
+		fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(err));
+		exit(1);
+	}
+	fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+	if (fd < 0)
+		die("socket");
+	if (server ? bind(fd, ai->ai_addr, ai->ai_addrlen) :
+		     connect(fd, ai->ai_addr, ai->ai_addrlen))
+		die(server ? "bind" : "connect");
+	freeaddrinfo(ai);
+	return fd;
+}
+
+static void epoll_setup(int fd)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+
+	if (!use_epoll)
+		return;
+
+	epfd = epoll_create1(0);
+	if (epfd < 0)
+		die("epoll_create1");
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev))
+		die("epoll_ctl");
+	if (busy_poll_usecs >= 0) {
+		struct epoll_params params = {
+			.busy_poll_usecs = busy_poll_usecs,
+		};
+
+		if (ioctl(epfd, EPIOCSPARAMS, &params))
+			die("EPIOCSPARAMS");
+	}
+}
+
+/* with -e, block in epoll_wait() and only then read without blocking */
+static void wait_readable(void)
+{
+	struct epoll_event ev;
+
+	if (epfd < 0)
+		return;
+	while (epoll_wait(epfd, &ev, 1, -1) != 1) {
+		if (errno != EINTR)
+			die("epoll_wait");
+	}
+}
+
+static void server(void)
+{
+	int fd = udp_socket(1);
+
+	epoll_setup(fd);
+	for (;;) {
+		struct sockaddr_storage peer;
+		socklen_t plen = sizeof(peer);
+		unsigned long received = 0;
+		double start = 0, last = 0;
+		ssize_t n;
+
+		wait_readable();
+		n = recvfrom(fd, buf, sizeof(buf), 0,
+			     (struct sockaddr *)&peer, &plen);
+		if (n < 0)
+			die("recvfrom");
+
+		/* a request starting with 'T' opens a throughput run */
+		if (buf[0] != 'T') {
+			if (sendto(fd, buf, n, 0, (struct sockaddr *)&peer,
+				   plen) < 0)
+				die("sendto");
+			continue;
+		}
+
+		start = last = now();
+		for (;;) {
+			struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+			if (poll(&pfd, 1, 1000) <= 0)
+				break;
+			n = recv(fd, buf, sizeof(buf), 0);
+			if (n < 0)
+				die("recv");
+			received++;
+			last = now();
+		}
+		printf("received %lu datagrams in %.3f s: %.0f pps\n",
+		       received, last - start,
+		       last > start ? received / (last - start) : 0);
+		fflush(stdout);
+	}
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void client_latency(int fd)
+{
+	double *rtt = calloc(count, sizeof(*rtt));
+	double total = 0;
+	unsigned long i;
+
+	if (!rtt)
+		die("calloc");
+
+	memset(buf, 'R', size);
+	for (i = 0; i < count; i++) {
+		double t = now();
+
+		if (send(fd, buf, size, 0) < 0)
+			die("send");
+		wait_readable();
+		if (recv(fd, buf, sizeof(buf), 0) < 0)
+			die("recv");
+		rtt[i] = (now() - t) * 1e6;
+		total += rtt[i];
+	}
+
+	qsort(rtt, count, sizeof(*rtt), cmp_double);
+	printf("%lu requests of %u bytes: avg %.1f us, p50 %.1f us, "
+	       "p99 %.1f us, p99.9 %.1f us, max %.1f us\n",
+	       count, size, total / count, rtt[count / 2],
+	       rtt[count * 99 / 100], rtt[count * 999 / 1000],
+	       rtt[count - 1]);
+	free(rtt);
+}
+
+static void client_throughput(int fd)
+{
+	unsigned long i;
+	double t;
+
+	memset(buf, 'T', size);
+	t = now();
+	for (i = 0; i < count; i++) {
+		if (send(fd, buf, size, 0) < 0 && errno != ENOBUFS &&
+		    errno != ECONNREFUSED)
+			die("send");
+	}
+	t = now() - t;
+	printf("sent %lu datagrams of %u bytes in %.3f s: %.0f pps\n",
+	       count, size, t, count / t);
+}
+
+int main(int argc, char **argv)
+{
+	int is_server = 0;
+	int c, fd;
+
+	while ((c = getopt(argc, argv, "sc:p:n:l:Teb:")) != -1) {
+		switch (c) {
+		case 's':
+			is_server = 1;
+			break;
+		case 'c':
+			host = optarg;
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'T':
+			throughput = 1;
+			break;
+		case 'e':
+			use_epoll = 1;
+			break;
+		case 'b':
+			busy_poll_usecs = strtol(optarg, NULL, 0);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (is_server == !!host || !count || !size || size > MAX_SIZE ||
+	    (busy_poll_usecs >= 0 && !use_epoll))
+		goto usage;
+
+	if (is_server)
+		server();
+
+	fd = udp_socket(0);
+	epoll_setup(fd);
+	if (throughput)
+		client_throughput(fd);
+	else
+		client_latency(fd);
+	close(fd);
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: %s -s [-e] [-b usecs] [-p port]\n"
+		"       %s -c host [-T] [-e] [-b usecs] [-p port] [-n count] "
+		"[-l size]\n", argv[0], argv[0]);
+	return 1;
+}
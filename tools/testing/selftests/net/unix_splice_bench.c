@@ -0,0 +1,171 @@
+/*
+ * Throughput of AF_UNIX stream sockets with read()/write() compared to
+ * moving the same data through pipes with splice().
+ *
+ * A child process produces TOTAL_BYTES into one end of a socketpair,
+ * the parent consumes it from the other end and discards it.  In splice
+ * mode the producer vmsplice()s its buffer into a pipe and splices the
+ * pipe into the socket; the consumer splices the socket into a pipe and
+ * the pipe into /dev/null, so no payload byte is copied to userspace.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#define CHUNK		(64 * 1024)
+#define TOTAL_BYTES	(1024UL * 1024 * 1024)
+
+static char buf[CHUNK] __attribute__((aligned(4096)));
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static void produce_copy(int sock)
+{
+	unsigned long left = TOTAL_BYTES;
+
+	while (left) {
+		ssize_t n = write(sock, buf, left < CHUNK ? left : CHUNK);
+
+		if (n < 0)
+			die("write");
+		left -= n;
+	}
+}
+
+static void consume_copy(int sock)
+{
+	unsigned long left = TOTAL_BYTES;
+
+	while (left) {
+		ssize_t n = read(sock, buf, CHUNK);
+
+		if (n < 0)
+			die("read");
+		if (n == 0)
+			break;
+		left -= n;
+	}
+}
+
+static void produce_splice(int sock)
+{
+	unsigned long left = TOTAL_BYTES;
+	int p[2];
+
+	if (pipe(p))
+		die("pipe");
+
+	while (left) {
+		struct iovec iov = {
+			.iov_base = buf,
+			.iov_len = left < CHUNK ? left : CHUNK,
+		};
+		ssize_t in, out;
+
+		in = vmsplice(p[1], &iov, 1, 0);
+		if (in < 0)
+			die("vmsplice");
+		while (in) {
+			out = splice(p[0], NULL, sock, NULL, in, SPLICE_F_MOVE);
+			if (out < 0)
+				die("splice to socket");
+			in -= out;
+			left -= out;
+		}
+	}
+}
+
+static void consume_splice(int sock)
+{
+	unsigned long left = TOTAL_BYTES;
+	int devnull, p[2];
+
+	devnull = open("/dev/null", O_WRONLY);
+	if (devnull < 0)
+		die("open /dev/null");
+	if (pipe(p))
+		die("pipe");
+
+	while (left) {
+		ssize_t in, out;
+
+		in = splice(sock, NULL, p[1], NULL, CHUNK, SPLICE_F_MOVE);
+		if (in < 0) {
+			if (errno == EINVAL)
+				die("splice from socket (kernel support?)");
+			die("splice from socket");
+		}
+		if (in == 0)
+			break;
+		left -= in;
+		while (in) {
+			out = splice(p[0], NULL, devnull, NULL, in,
+				     SPLICE_F_MOVE);
+			if (out < 0)
+				die("splice to /dev/null");
+			in -= out;
+		}
+	}
+	close(devnull);
+}
+
+static void run(const char *name, void (*produce)(int),
+		void (*consume)(int))
+{
+	struct timespec start, end;
+	int sv[2], status;
+	double secs, mbps;
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv))
+		die("socketpair");
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	pid = fork();
+	if (pid < 0)
+		die("fork");
+	if (pid == 0) {
+		close(sv[1]);
+		produce(sv[0]);
+		_exit(0);
+	}
+	close(sv[0]);
+	consume(sv[1]);
+	if (waitpid(pid, &status, 0) < 0)
+		die("waitpid");
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+		exit(1);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	close(sv[1]);
+
+	secs = (end.tv_sec - start.tv_sec) +
+	       (end.tv_nsec - start.tv_nsec) / 1e9;
+	mbps = TOTAL_BYTES / secs / (1024 * 1024);
+	printf("%-8s %lu bytes in %.3f s: %.1f MB/s\n",
+	       name, TOTAL_BYTES, secs, mbps);
+}
+
+int main(void)
+{
+	memset(buf, 0x5a, sizeof(buf));
+
+	run("copy", produce_copy, consume_copy);
+	run("splice", produce_splice, consume_splice);
+
+	return 0;
+}
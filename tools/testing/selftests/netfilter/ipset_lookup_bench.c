@@ -0,0 +1,141 @@
+/*
+ * Scaling of ipset lookups with the number of CPUs.
+ *
+ *   ipset_lookup_bench [-t threads] [-n addrs] [-d seconds]
+ *
+ * Starts one sender thread per CPU, up to the given number of threads, each
+ * sending UDP packets to random addresses out of the first n addresses of
+ * 127.2.0.0/15.  The run_ipsetbench script puts those addresses into a hash
+ * set and drops matching packets in the output chain, so every packet costs
+ * one set lookup and the aggregate send rate follows the lookup cost.  With
+ * the set lock taken for every lookup the rate stops growing after a few
+ * CPUs; lockless lookups should keep it close to linear.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define BASE_ADDR	((127 << 24) + (2 << 16))
+
+static unsigned int nthreads = 1;
+static unsigned int naddrs = 65536;
+static unsigned int seconds = 5;
+static volatile int stop;
+
+struct sender {
+	pthread_t thread;
+	unsigned int cpu;
+	unsigned long packets;
+};
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *sender(void *arg)
+{
+	struct sender *s = arg;
+	struct sockaddr_in sin = {
+		.sin_family = AF_INET,
+		.sin_port = htons(9),
+	};
+	unsigned int seed = s->cpu + 1;
+	cpu_set_t cpus;
+	char payload[16] = "";
+	int fd;
+
+	CPU_ZERO(&cpus);
+	CPU_SET(s->cpu, &cpus);
+	pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		die("socket");
+	while (!stop) {
+		sin.sin_addr.s_addr = htonl(BASE_ADDR + rand_r(&seed) % naddrs);
+		/* dropped packets fail with EPERM, which is what we want */
+		sendto(fd, payload, sizeof(payload), 0,
+		       (struct sockaddr *)&sin, sizeof(sin));
+		s->packets++;
+	}
+	close(fd);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	struct sender *senders;
+	unsigned long total = 0;
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int i;
+	double start, elapsed;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:n:d:")) != -1) {
+		switch (opt) {
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 'n':
+			naddrs = atoi(optarg);
+			break;
+		case 'd':
+			seconds = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-t threads] [-n addrs] [-d seconds]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (!nthreads || !naddrs || naddrs > 131072 || !seconds) {
+		fprintf(stderr, "bad arguments\n");
+		return 1;
+	}
+	if (ncpus > 0 && nthreads > ncpus)
+		nthreads = ncpus;
+
+	senders = calloc(nthreads, sizeof(*senders));
+	if (!senders)
+		die("calloc");
+
+	start = now();
+	for (i = 0; i < nthreads; i++) {
+		senders[i].cpu = i;
+		if (pthread_create(&senders[i].thread, NULL, sender,
+				   &senders[i]))
+			die("pthread_create");
+	}
+	sleep(seconds);
+	stop = 1;
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(senders[i].thread, NULL);
+		total += senders[i].packets;
+	}
+	elapsed = now() - start;
+
+	printf("threads %3u: %10.0f lookups/s, %9.0f per thread\n",
+	       nthreads, total / elapsed, total / elapsed / nthreads);
+	free(senders);
+	return 0;
+}
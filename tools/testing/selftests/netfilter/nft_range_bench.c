@@ -0,0 +1,533 @@
+/*
+ * Cost of matching packets against many (source, destination) ranges.
+ *
+ *   nft_range_bench [-t pipapo|rbtree|rules] [-n ranges] [-c packets]
+ *
+ * Sets up an nf_tables output chain, in the current network namespace,
+ * dropping UDP packets from 127.0.0.1 to any of n destination ranges, then
+ * times sending packets to random destinations in those ranges:
+ *
+ *   pipapo	one set keyed on saddr . daddr, a range per field
+ *   rbtree	one interval set keyed on daddr
+ *   rules	one rule per range, comparing saddr and daddr against bounds
+ *
+ * Every packet is dropped, so the send rate follows the lookup cost.  The
+ * table is removed on exit.  Needs CAP_NET_ADMIN, best run in a fresh
+ * network namespace with lo up.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/netlink.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nf_tables.h>
+
+#define TABLE		"range_bench"
+#define CHAIN		"out"
+#define SET		"ranges"
+#define SET_ID		1
+#define BATCH_SIZE	(128 * 1024)
+/* each range covers 62 of 64 addresses, so it expands to a few prefixes */
+#define RANGE_STRIDE	64
+
+enum { PIPAPO, RBTREE, RULES };
+
+static int type = PIPAPO;
+static unsigned int nranges = 1000;
+static unsigned long count = 1000000;
+
+static int nl;
+static char buf[BATCH_SIZE + 4096];
+static size_t buflen;
+static unsigned int seq, nacks;
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t range_start(unsigned int i)
+{
+	return (127 << 24) + (1 << 16) + i * RANGE_STRIDE + 1;
+}
+
+static uint32_t range_end(unsigned int i)
+{
+	return range_start(i) + RANGE_STRIDE - 3;
+}
+
+static struct nlmsghdr *msg_start(uint16_t type, uint16_t flags, int res_id)
+{
+	struct nlmsghdr *nlh = (struct nlmsghdr *)(buf + buflen);
+	struct nfgenmsg *nfg;
+
+	nlh->nlmsg_len = NLMSG_LENGTH(sizeof(*nfg));
+	nlh->nlmsg_type = type;
+	nlh->nlmsg_flags = NLM_F_REQUEST | flags;
+	nlh->nlmsg_seq = ++seq;
+	nlh->nlmsg_pid = 0;
+	nfg = NLMSG_DATA(nlh);
+	nfg->nfgen_family = NFPROTO_IPV4;
+	nfg->version = NFNETLINK_V0;
+	nfg->res_id = res_id;
+	if (flags & NLM_F_ACK)
+		nacks++;
+	return nlh;
+}
+
+static void msg_end(struct nlmsghdr *nlh)
+{
+	buflen += NLMSG_ALIGN(nlh->nlmsg_len);
+}
+
+static struct nlmsghdr *nft_msg(int msg, uint16_t flags)
+{
+	return msg_start((NFNL_SUBSYS_NFTABLES << 8) | msg, flags | NLM_F_ACK,
+			 0);
+}
+
+static struct nlattr *attr_put(struct nlmsghdr *nlh, uint16_t type,
+			       const void *data, size_t len)
+{
+	struct nlattr *nla = (struct nlattr *)((char *)nlh +
+					       NLMSG_ALIGN(nlh->nlmsg_len));
+
+	nla->nla_type = type;
+	nla->nla_len = NLA_HDRLEN + len;
+	if (len)
+		memcpy((char *)nla + NLA_HDRLEN, data, len);
+	nlh->nlmsg_len = NLMSG_ALIGN(nlh->nlmsg_len) + NLA_ALIGN(nla->nla_len);
+	return nla;
+}
+
+static void attr_put_u32(struct nlmsghdr *nlh, uint16_t type, uint32_t v)
+{
+	v = htonl(v);
+	attr_put(nlh, type, &v, sizeof(v));
+}
+
+static void attr_put_str(struct nlmsghdr *nlh, uint16_t type, const char *s)
+{
+	attr_put(nlh, type, s, strlen(s) + 1);
+}
+
+static struct nlattr *nest_start(struct nlmsghdr *nlh, uint16_t type)
+{
+	return attr_put(nlh, type | NLA_F_NESTED, NULL, 0);
+}
+
+static void nest_end(struct nlmsghdr *nlh, struct nlattr *nest)
+{
+	nest->nla_len = (char *)nlh + nlh->nlmsg_len - (char *)nest;
+}
+
+static void put_value(struct nlmsghdr *nlh, uint16_t type, const void *data,
+		      size_t len)
+{
+	struct nlattr *nest = nest_start(nlh, type);
+
+	attr_put(nlh, NFTA_DATA_VALUE, data, len);
+	nest_end(nlh, nest);
+}
+
+static void batch_begin(void)
+{
+	buflen = 0;
+	nacks = 0;
+	msg_end(msg_start(NFNL_MSG_BATCH_BEGIN, 0, NFNL_SUBSYS_NFTABLES));
+}
+
+/* Close and send the batch, fail on the first error reported */
+static void batch_commit(void)
+{
+	char rbuf[8192];
+	struct nlmsghdr *nlh;
+	struct nlmsgerr *err;
+	ssize_t n;
+
+	msg_end(msg_start(NFNL_MSG_BATCH_END, 0, NFNL_SUBSYS_NFTABLES));
+	if (send(nl, buf, buflen, 0) < 0)
+		die("send batch");
+
+	while (nacks) {
+		n = recv(nl, rbuf, sizeof(rbuf), 0);
+		if (n < 0)
+			die("recv ack");
+		for (nlh = (struct nlmsghdr *)rbuf; NLMSG_OK(nlh, n);
+		     nlh = NLMSG_NEXT(nlh, n)) {
+			if (nlh->nlmsg_type != NLMSG_ERROR)
+				continue;
+			err = NLMSG_DATA(nlh);
+			if (err->error) {
+				errno = -err->error;
+				die("nf_tables");
+			}
+			nacks--;
+		}
+	}
+}
+
+static void add_expr(struct nlmsghdr *nlh, const char *name,
+		     void (*fill)(struct nlmsghdr *, const void *),
+		     const void *arg)
+{
+	struct nlattr *elem, *data;
+
+	elem = nest_start(nlh, NFTA_LIST_ELEM);
+	attr_put_str(nlh, NFTA_EXPR_NAME, name);
+	data = nest_start(nlh, NFTA_EXPR_DATA);
+	fill(nlh, arg);
+	nest_end(nlh, data);
+	nest_end(nlh, elem);
+}
+
+struct payload {
+	uint32_t offset, len;
+};
+
+static void fill_payload(struct nlmsghdr *nlh, const void *arg)
+{
+	const struct payload *p = arg;
+
+	attr_put_u32(nlh, NFTA_PAYLOAD_DREG, NFT_REG_1);
+	attr_put_u32(nlh, NFTA_PAYLOAD_BASE, NFT_PAYLOAD_NETWORK_HEADER);
+	attr_put_u32(nlh, NFTA_PAYLOAD_OFFSET, p->offset);
+	attr_put_u32(nlh, NFTA_PAYLOAD_LEN, p->len);
+}
+
+struct cmp {
+	uint32_t op, addr;
+};
+
+static void fill_cmp(struct nlmsghdr *nlh, const void *arg)
+{
+	const struct cmp *c = arg;
+	uint32_t addr = htonl(c->addr);
+
+	attr_put_u32(nlh, NFTA_CMP_SREG, NFT_REG_1);
+	attr_put_u32(nlh, NFTA_CMP_OP, c->op);
+	put_value(nlh, NFTA_CMP_DATA, &addr, sizeof(addr));
+}
+
+static void fill_lookup(struct nlmsghdr *nlh, const void *arg)
+{
+	attr_put_str(nlh, NFTA_LOOKUP_SET, SET);
+	attr_put_u32(nlh, NFTA_LOOKUP_SET_ID, SET_ID);
+	attr_put_u32(nlh, NFTA_LOOKUP_SREG, NFT_REG_1);
+}
+
+static void fill_drop(struct nlmsghdr *nlh, const void *arg)
+{
+	struct nlattr *data, *verdict;
+
+	attr_put_u32(nlh, NFTA_IMMEDIATE_DREG, NFT_REG_VERDICT);
+	data = nest_start(nlh, NFTA_IMMEDIATE_DATA);
+	verdict = nest_start(nlh, NFTA_DATA_VERDICT);
+	attr_put_u32(nlh, NFTA_VERDICT_CODE, NF_DROP);
+	nest_end(nlh, verdict);
+	nest_end(nlh, data);
+}
+
+static struct nlmsghdr *rule_start(struct nlattr **exprs)
+{
+	struct nlmsghdr *nlh;
+
+	nlh = nft_msg(NFT_MSG_NEWRULE, NLM_F_CREATE | NLM_F_APPEND);
+	attr_put_str(nlh, NFTA_RULE_TABLE, TABLE);
+	attr_put_str(nlh, NFTA_RULE_CHAIN, CHAIN);
+	*exprs = nest_start(nlh, NFTA_RULE_EXPRESSIONS);
+	return nlh;
+}
+
+static void rule_end(struct nlmsghdr *nlh, struct nlattr *exprs)
+{
+	nest_end(nlh, exprs);
+	msg_end(nlh);
+}
+
+static void setup_table(void)
+{
+	struct nlmsghdr *nlh;
+	struct nlattr *hook;
+
+	batch_begin();
+	nlh = nft_msg(NFT_MSG_NEWTABLE, NLM_F_CREATE);
+	attr_put_str(nlh, NFTA_TABLE_NAME, TABLE);
+	msg_end(nlh);
+
+	nlh = nft_msg(NFT_MSG_NEWCHAIN, NLM_F_CREATE);
+	attr_put_str(nlh, NFTA_CHAIN_TABLE, TABLE);
+	attr_put_str(nlh, NFTA_CHAIN_NAME, CHAIN);
+	attr_put_str(nlh, NFTA_CHAIN_TYPE, "filter");
+	hook = nest_start(nlh, NFTA_CHAIN_HOOK);
+	attr_put_u32(nlh, NFTA_HOOK_HOOKNUM, NF_INET_LOCAL_OUT);
+	attr_put_u32(nlh, NFTA_HOOK_PRIORITY, 0);
+	nest_end(nlh, hook);
+	msg_end(nlh);
+	batch_commit();
+}
+
+static void delete_table(void)
+{
+	struct nlmsghdr *nlh;
+
+	batch_begin();
+	nlh = nft_msg(NFT_MSG_DELTABLE, 0);
+	attr_put_str(nlh, NFTA_TABLE_NAME, TABLE);
+	msg_end(nlh);
+	batch_commit();
+}
+
+static void setup_set(void)
+{
+	struct nlattr *desc, *concat, *field, *exprs;
+	struct payload p;
+	struct nlmsghdr *nlh;
+	int i;
+
+	batch_begin();
+	nlh = nft_msg(NFT_MSG_NEWSET, NLM_F_CREATE);
+	attr_put_str(nlh, NFTA_SET_TABLE, TABLE);
+	attr_put_str(nlh, NFTA_SET_NAME, SET);
+	attr_put_u32(nlh, NFTA_SET_FLAGS, NFT_SET_INTERVAL);
+	attr_put_u32(nlh, NFTA_SET_KEY_LEN, type == PIPAPO ? 8 : 4);
+	attr_put_u32(nlh, NFTA_SET_ID, SET_ID);
+	desc = nest_start(nlh, NFTA_SET_DESC);
+	attr_put_u32(nlh, NFTA_SET_DESC_SIZE, 2 * nranges);
+	if (type == PIPAPO) {
+		concat = nest_start(nlh, NFTA_SET_DESC_CONCAT);
+		for (i = 0; i < 2; i++) {
+			field = nest_start(nlh, NFTA_LIST_ELEM);
+			attr_put_u32(nlh, NFTA_SET_FIELD_LEN, 4);
+			nest_end(nlh, field);
+		}
+		nest_end(nlh, concat);
+	}
+	nest_end(nlh, desc);
+	msg_end(nlh);
+
+	/* ip saddr . ip daddr, or ip daddr, looked up in the set */
+	p.offset = type == PIPAPO ? 12 : 16;
+	p.len = type == PIPAPO ? 8 : 4;
+	nlh = rule_start(&exprs);
+	add_expr(nlh, "payload", fill_payload, &p);
+	add_expr(nlh, "lookup", fill_lookup, NULL);
+	add_expr(nlh, "immediate", fill_drop, NULL);
+	rule_end(nlh, exprs);
+	batch_commit();
+}
+
+static struct nlmsghdr *elems_start(struct nlattr **elems)
+{
+	struct nlmsghdr *nlh;
+
+	nlh = nft_msg(NFT_MSG_NEWSETELEM, NLM_F_CREATE);
+	attr_put_str(nlh, NFTA_SET_ELEM_LIST_TABLE, TABLE);
+	attr_put_str(nlh, NFTA_SET_ELEM_LIST_SET, SET);
+	*elems = nest_start(nlh, NFTA_SET_ELEM_LIST_ELEMENTS);
+	return nlh;
+}
+
+static void put_elem(struct nlmsghdr *nlh, uint32_t start, uint32_t end)
+{
+	uint32_t key[2], key_end[2];
+	struct nlattr *elem;
+
+	if (type == PIPAPO) {
+		key[0] = key_end[0] = htonl(INADDR_LOOPBACK);
+		key[1] = htonl(start);
+		key_end[1] = htonl(end);
+		elem = nest_start(nlh, NFTA_LIST_ELEM);
+		put_value(nlh, NFTA_SET_ELEM_KEY, key, sizeof(key));
+		put_value(nlh, NFTA_SET_ELEM_KEY_END, key_end, sizeof(key_end));
+		nest_end(nlh, elem);
+		return;
+	}
+
+	/* intervals are a start element and an end element past the range */
+	key[0] = htonl(start);
+	elem = nest_start(nlh, NFTA_LIST_ELEM);
+	put_value(nlh, NFTA_SET_ELEM_KEY, key, sizeof(key[0]));
+	nest_end(nlh, elem);
+
+	key[0] = htonl(end + 1);
+	elem = nest_start(nlh, NFTA_LIST_ELEM);
+	put_value(nlh, NFTA_SET_ELEM_KEY, key, sizeof(key[0]));
+	attr_put_u32(nlh, NFTA_SET_ELEM_FLAGS, NFT_SET_ELEM_INTERVAL_END);
+	nest_end(nlh, elem);
+}
+
+static void fill_set(void)
+{
+	struct nlmsghdr *nlh;
+	struct nlattr *elems;
+	unsigned int i;
+
+	batch_begin();
+	nlh = elems_start(&elems);
+	for (i = 0; i < nranges; i++) {
+		put_elem(nlh, range_start(i), range_end(i));
+		if (buflen + nlh->nlmsg_len > BATCH_SIZE - 256) {
+			nest_end(nlh, elems);
+			msg_end(nlh);
+			batch_commit();
+			batch_begin();
+			nlh = elems_start(&elems);
+		}
+	}
+	nest_end(nlh, elems);
+	msg_end(nlh);
+	batch_commit();
+}
+
+static void fill_rules(void)
+{
+	struct payload saddr = { 12, 4 }, daddr = { 16, 4 };
+	struct cmp c;
+	struct nlmsghdr *nlh;
+	struct nlattr *exprs;
+	unsigned int i;
+
+	batch_begin();
+	for (i = 0; i < nranges; i++) {
+		nlh = rule_start(&exprs);
+		add_expr(nlh, "payload", fill_payload, &saddr);
+		c.op = NFT_CMP_EQ;
+		c.addr = INADDR_LOOPBACK;
+		add_expr(nlh, "cmp", fill_cmp, &c);
+		add_expr(nlh, "payload", fill_payload, &daddr);
+		c.op = NFT_CMP_GTE;
+		c.addr = range_start(i);
+		add_expr(nlh, "cmp", fill_cmp, &c);
+		c.op = NFT_CMP_LTE;
+		c.addr = range_end(i);
+		add_expr(nlh, "cmp", fill_cmp, &c);
+		add_expr(nlh, "immediate", fill_drop, NULL);
+		rule_end(nlh, exprs);
+
+		if (buflen > BATCH_SIZE - 1024) {
+			batch_commit();
+			batch_begin();
+		}
+	}
+	batch_commit();
+}
+
+static void send_packets(void)
+{
+	struct sockaddr_in dst = {
+		.sin_family = AF_INET,
+		.sin_port = htons(9),
+	};
+	unsigned long i, dropped = 0;
+	unsigned int r;
+	char payload[32] = { 0 };
+	double t;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0)
+		die("socket");
+
+	t = now();
+	for (i = 0; i < count; i++) {
+		r = random() % nranges;
+		dst.sin_addr.s_addr = htonl(range_start(r) +
+					    random() % (RANGE_STRIDE - 2));
+		if (sendto(fd, payload, sizeof(payload), 0,
+			   (struct sockaddr *)&dst, sizeof(dst)) < 0) {
+			if (errno != EPERM)
+				die("sendto");
+			dropped++;
+		}
+	}
+	t = now() - t;
+	close(fd);
+
+	printf("%s: %u ranges, %lu packets (%lu dropped) in %.3f s: "
+	       "%.0f pps\n", type == PIPAPO ? "pipapo" :
+	       type == RBTREE ? "rbtree" : "rules", nranges, count, dropped,
+	       t, count / t);
+	if (dropped != count)
+		fprintf(stderr, "warning: %lu packets not dropped\n",
+			count - dropped);
+}
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_nl snl = { .nl_family = AF_NETLINK };
+	int sndbuf = 4 * BATCH_SIZE;
+	double t;
+	int c;
+
+	while ((c = getopt(argc, argv, "t:n:c:")) != -1) {
+		switch (c) {
+		case 't':
+			if (!strcmp(optarg, "pipapo"))
+				type = PIPAPO;
+			else if (!strcmp(optarg, "rbtree"))
+				type = RBTREE;
+			else if (!strcmp(optarg, "rules"))
+				type = RULES;
+			else
+				goto usage;
+			break;
+		case 'n':
+			nranges = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	/* ranges go from 127.1.0.0 up to the end of 127.0.0.0/8 */
+	if (!nranges || nranges > ((1 << 24) - (1 << 16)) / RANGE_STRIDE ||
+	    !count)
+		goto usage;
+
+	nl = socket(AF_NETLINK, SOCK_RAW, NETLINK_NETFILTER);
+	if (nl < 0)
+		die("netlink socket");
+	if (bind(nl, (struct sockaddr *)&snl, sizeof(snl)) < 0)
+		die("netlink bind");
+	setsockopt(nl, SOL_SOCKET, SO_SNDBUFFORCE, &sndbuf, sizeof(sndbuf));
+
+	setup_table();
+	t = now();
+	if (type == RULES) {
+		fill_rules();
+	} else {
+		setup_set();
+		fill_set();
+	}
+	printf("loaded %u ranges in %.3f s\n", nranges, now() - t);
+
+	send_packets();
+	delete_table();
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-t pipapo|rbtree|rules] [-n ranges] "
+		"[-c packets]\n", argv[0]);
+	return 1;
+}
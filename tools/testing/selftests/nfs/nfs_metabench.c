@@ -0,0 +1,116 @@
+/*
+ * Small-file metadata rate on a directory, normally an NFS mount.
+ *
+ *   nfs_metabench [-t threads] [-s seconds] dir
+ *
+ * Each thread works in its own subdirectory and repeatedly creates, stats
+ * and unlinks a file, so every operation is a separate synchronous RPC on
+ * an NFS mount.  The combined rate is reported along with the slowest
+ * thread's, which shows whether some requests are being starved.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+
+static const char *dir;
+static int nthreads = 4;
+static int seconds = 10;
+static volatile int stop;
+
+struct worker {
+	pthread_t thread;
+	int id;
+	unsigned long ops;
+};
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	char sub[PATH_MAX], path[PATH_MAX + 32];
+	unsigned long i;
+	struct stat st;
+	int fd;
+
+	snprintf(sub, sizeof(sub), "%s/mb%d", dir, w->id);
+	if (mkdir(sub, 0755) && errno != EEXIST)
+		die("mkdir");
+
+	for (i = 0; !stop; i++) {
+		snprintf(path, sizeof(path), "%s/f%lu", sub, i);
+		fd = open(path, O_CREAT | O_EXCL | O_WRONLY, 0644);
+		if (fd < 0)
+			die("open");
+		close(fd);
+		if (stat(path, &st))
+			die("stat");
+		if (unlink(path))
+			die("unlink");
+		w->ops += 3;
+	}
+	rmdir(sub);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	struct worker *workers;
+	unsigned long total = 0, slowest = ~0UL;
+	int c, i;
+
+	while ((c = getopt(argc, argv, "t:s:")) != -1) {
+		switch (c) {
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc - 1 || nthreads <= 0 || seconds <= 0)
+		goto usage;
+	dir = argv[optind];
+
+	workers = calloc(nthreads, sizeof(*workers));
+	if (!workers)
+		die("calloc");
+	for (i = 0; i < nthreads; i++) {
+		workers[i].id = i;
+		if (pthread_create(&workers[i].thread, NULL, worker_fn,
+				   &workers[i]))
+			die("pthread_create");
+	}
+	sleep(seconds);
+	stop = 1;
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		total += workers[i].ops;
+		if (workers[i].ops < slowest)
+			slowest = workers[i].ops;
+	}
+
+	printf("%d threads: %.0f ops/s, slowest thread %.0f ops/s\n",
+	       nthreads, (double)total / seconds, (double)slowest / seconds);
+	free(workers);
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-t threads] [-s seconds] dir\n", argv[0]);
+	return 1;
+}
@@ -0,0 +1,138 @@
+/*
+ * Small random O_DIRECT reads, normally from files on an NFS mount.
+ *
+ *   nfs_readbench [-t threads] [-s seconds] [-l size] file...
+ *
+ * O_DIRECT keeps the client's page cache out of the way, so every read is
+ * a READ call to the server.  Threads pick files round-robin, so with more
+ * files than threads the server sees a stream of different file handles.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+static char **files;
+static int nfiles;
+static int nthreads = 4;
+static int seconds = 10;
+static size_t size = 4096;
+static volatile int stop;
+
+struct worker {
+	pthread_t thread;
+	int id;
+	unsigned long ops;
+};
+
+struct target {
+	int fd;
+	off_t blocks;
+};
+
+static struct target *targets;
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	unsigned int seed = w->id;
+	void *buf;
+	int i;
+
+	if (posix_memalign(&buf, 4096, size))
+		die("posix_memalign");
+
+	for (i = w->id; !stop; i++) {
+		struct target *t = &targets[i % nfiles];
+		off_t off = (rand_r(&seed) % t->blocks) * size;
+
+		if (pread(t->fd, buf, size, off) < 0)
+			die("pread");
+		w->ops++;
+	}
+	free(buf);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	struct worker *workers;
+	unsigned long total = 0;
+	int c, i;
+
+	while ((c = getopt(argc, argv, "t:s:l:")) != -1) {
+		switch (c) {
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		case 'l':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind >= argc || nthreads <= 0 || seconds <= 0 || !size ||
+	    size % 512)
+		goto usage;
+	files = argv + optind;
+	nfiles = argc - optind;
+
+	targets = calloc(nfiles, sizeof(*targets));
+	if (!targets)
+		die("calloc");
+	for (i = 0; i < nfiles; i++) {
+		struct stat st;
+
+		targets[i].fd = open(files[i], O_RDONLY | O_DIRECT);
+		if (targets[i].fd < 0)
+			die(files[i]);
+		if (fstat(targets[i].fd, &st))
+			die("fstat");
+		targets[i].blocks = st.st_size / size;
+		if (!targets[i].blocks) {
+			fprintf(stderr, "%s: shorter than %zu bytes\n",
+				files[i], size);
+			return 1;
+		}
+	}
+
+	workers = calloc(nthreads, sizeof(*workers));
+	if (!workers)
+		die("calloc");
+	for (i = 0; i < nthreads; i++) {
+		workers[i].id = i;
+		if (pthread_create(&workers[i].thread, NULL, worker_fn,
+				   &workers[i]))
+			die("pthread_create");
+	}
+	sleep(seconds);
+	stop = 1;
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		total += workers[i].ops;
+	}
+
+	printf("%d threads, %d files, %zu byte reads: %.0f reads/s\n",
+	       nthreads, nfiles, size, (double)total / seconds);
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-t threads] [-s seconds] [-l size] file...\n",
+		argv[0]);
+	return 1;
+}
@@ -0,0 +1,276 @@
+/*
+ * Key-value cache workload under memory pressure.
+ *
+ *   cache_bench [-t threads] [-m MB] [-i itemsize] [-s skew] [-d secs]
+ *               [-w write%] [-f file]
+ *
+ * Fills a cache of MB megabytes with items, in anonymous memory or, with
+ * -f, in a shared mapping of the given file, then has each thread look up
+ * items chosen with a skewed popularity (a small set of hot keys and a long
+ * cold tail, like a memcached server sees) and overwrite write% of them.
+ * Run it in a memory cgroup smaller than the cache to have reclaim pick
+ * which items stay resident.  Reports operations per second together with
+ * the reclaim work it took: pages scanned and stolen, refaults and swap-ins
+ * from /proc/vmstat, and the cpu time used by kswapd.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+static int nthreads = 4;
+static size_t cache_mb = 1024;
+static size_t itemsize = 4096;
+static double skew = 4.0;
+static int duration = 30;
+static int write_pct = 10;
+static const char *file;
+static volatile int stop;
+
+static char *cache;
+static unsigned long nitems;
+
+struct worker {
+	pthread_t	thread;
+	unsigned int	seed;
+	unsigned long	ops;
+	unsigned long	sum;
+};
+
+/* Per-zone counters are summed over all zones */
+static const char *vmstat_names[] = {
+	"pgscan_kswapd", "pgscan_direct", "pgsteal_kswapd", "pgsteal_direct",
+	"workingset_refault", "workingset_activate", "pswpin", "pswpout",
+};
+#define NR_VMSTAT	(sizeof(vmstat_names) / sizeof(vmstat_names[0]))
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void read_vmstat(unsigned long long *vals)
+{
+	char name[64];
+	unsigned long long val;
+	FILE *f = fopen("/proc/vmstat", "r");
+	unsigned int i;
+
+	memset(vals, 0, NR_VMSTAT * sizeof(*vals));
+	if (!f)
+		return;
+	while (fscanf(f, "%63s %llu", name, &val) == 2) {
+		if (strstr(name, "throttle"))
+			continue;
+		for (i = 0; i < NR_VMSTAT; i++)
+			if (!strncmp(name, vmstat_names[i],
+				     strlen(vmstat_names[i])))
+				vals[i] += val;
+	}
+	fclose(f);
+}
+
+/* utime + stime of all kswapd threads, in clock ticks */
+static unsigned long long kswapd_ticks(void)
+{
+	unsigned long long total = 0;
+	struct dirent *de;
+	DIR *dir = opendir("/proc");
+
+	if (!dir)
+		return 0;
+	while ((de = readdir(dir))) {
+		unsigned long long utime, stime;
+		char path[300], comm[64];
+		FILE *f;
+
+		if (de->d_name[0] < '0' || de->d_name[0] > '9')
+			continue;
+		snprintf(path, sizeof(path), "/proc/%s/stat", de->d_name);
+		f = fopen(path, "r");
+		if (!f)
+			continue;
+		if (fscanf(f, "%*d (%63[^)]) %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+			   comm, &utime, &stime) == 3 &&
+		    !strncmp(comm, "kswapd", 6))
+			total += utime + stime;
+		fclose(f);
+	}
+	closedir(dir);
+	return total;
+}
+
+/*
+ * Picks a key with a power law popularity: u^skew concentrates on small
+ * ranks, and a multiplicative permutation spreads the ranks over the cache
+ * so that hot items do not share pages.
+ */
+static unsigned long pick_key(unsigned int *seed)
+{
+	double u = (double)rand_r(seed) / RAND_MAX;
+	unsigned long rank = (unsigned long)(pow(u, skew) * (nitems - 1));
+
+	return (rank * 2654435761UL) % nitems;
+}
+
+static void *worker_thread(void *arg)
+{
+	struct worker *w = arg;
+
+	while (!stop) {
+		int i;
+
+		for (i = 0; i < 64; i++) {
+			char *item = cache + pick_key(&w->seed) * itemsize;
+
+			if (rand_r(&w->seed) % 100 < write_pct) {
+				memset(item, w->ops & 0xff, itemsize);
+			} else {
+				size_t off;
+
+				for (off = 0; off < itemsize; off += 64)
+					w->sum += item[off];
+			}
+		}
+		w->ops += i;
+	}
+	return NULL;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-t threads] [-m MB] [-i itemsize] [-s skew] [-d secs] [-w write%%] [-f file]\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long long before[NR_VMSTAT], after[NR_VMSTAT];
+	unsigned long long ticks;
+	struct rusage ru_start, ru_end;
+	double start, elapsed, stime;
+	struct worker *workers;
+	unsigned long ops = 0;
+	size_t size;
+	unsigned int i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:m:i:s:d:w:f:")) != -1) {
+		switch (opt) {
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 'm':
+			cache_mb = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			itemsize = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			skew = atof(optarg);
+			break;
+		case 'd':
+			duration = atoi(optarg);
+			break;
+		case 'w':
+			write_pct = atoi(optarg);
+			break;
+		case 'f':
+			file = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (nthreads < 1 || !cache_mb || itemsize < 64 || skew < 1 ||
+	    duration < 1 || write_pct < 0 || write_pct > 100)
+		usage(argv[0]);
+
+	size = cache_mb << 20;
+	nitems = size / itemsize;
+	if (!nitems)
+		usage(argv[0]);
+
+	if (file) {
+		int fd = open(file, O_RDWR | O_CREAT, 0600);
+
+		if (fd < 0)
+			die("open");
+		if (ftruncate(fd, size))
+			die("ftruncate");
+		cache = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			     fd, 0);
+		close(fd);
+	} else {
+		cache = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	}
+	if (cache == MAP_FAILED)
+		die("mmap");
+
+	/* Populate every item once, as a cache warming up would */
+	for (i = 0; i < nitems; i++)
+		memset(cache + (size_t)i * itemsize, i & 0xff, itemsize);
+
+	workers = calloc(nthreads, sizeof(*workers));
+	if (!workers)
+		die("calloc");
+
+	read_vmstat(before);
+	ticks = kswapd_ticks();
+	getrusage(RUSAGE_SELF, &ru_start);
+	start = now();
+
+	for (i = 0; i < (unsigned int)nthreads; i++) {
+		workers[i].seed = i + 1;
+		if (pthread_create(&workers[i].thread, NULL, worker_thread,
+				   &workers[i]))
+			die("pthread_create");
+	}
+	sleep(duration);
+	stop = 1;
+	for (i = 0; i < (unsigned int)nthreads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		ops += workers[i].ops;
+	}
+
+	elapsed = now() - start;
+	getrusage(RUSAGE_SELF, &ru_end);
+	ticks = kswapd_ticks() - ticks;
+	read_vmstat(after);
+
+	stime = (ru_end.ru_stime.tv_sec - ru_start.ru_stime.tv_sec) +
+		(ru_end.ru_stime.tv_usec - ru_start.ru_stime.tv_usec) / 1e6;
+
+	printf("%d threads, %zu MB %s cache, %lu items, skew %.1f: %.0f ops/s\n",
+	       nthreads, cache_mb, file ? "file" : "anon", nitems, skew,
+	       ops / elapsed);
+	for (i = 0; i < NR_VMSTAT; i++)
+		printf("  %-24s %llu\n", vmstat_names[i], after[i] - before[i]);
+	printf("  %-24s %.2f s\n", "kswapd cpu",
+	       (double)ticks / sysconf(_SC_CLK_TCK));
+	printf("  %-24s %.2f s\n", "system time", stime);
+
+	free(workers);
+	munmap(cache, size);
+	return 0;
+}
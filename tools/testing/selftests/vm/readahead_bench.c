@@ -0,0 +1,185 @@
+/*
+ * Interleaved sequential readers on one shared file descriptor.
+ *
+ *   readahead_bench -f file [-m MB] [-t readers] [-b KB] [-n]
+ *
+ * Creates "file" with MB megabytes if it is shorter than that, drops it
+ * from the page cache and then has each reader thread pread() its own
+ * contiguous part of the file, front to back, in blocks of KB kilobytes.
+ * All readers share a single fd and with it a single readahead state, the
+ * way threads of one process reading a big data file usually do.  With -n
+ * every reader opens the file itself instead, for comparison.  Reports
+ * the total throughput.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+
+static const char *file;
+static size_t file_mb = 1024;
+static int nreaders = 4;
+static size_t bs = 16 << 10;
+static int own_fd;
+static int shared_fd;
+
+struct reader {
+	pthread_t	thread;
+	off_t		start;
+	off_t		end;
+	size_t		bytes;
+};
+
+static void die(const char *msg)
+{
+	perror(msg);
+	exit(1);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void create_file(size_t size)
+{
+	struct stat st;
+	char *buf;
+	size_t off;
+	int fd;
+
+	fd = open(file, O_RDWR | O_CREAT, 0600);
+	if (fd < 0)
+		die("open");
+	if (fstat(fd, &st))
+		die("fstat");
+	if ((size_t)st.st_size < size) {
+		buf = malloc(1 << 20);
+		if (!buf)
+			die("malloc");
+		memset(buf, 0x5a, 1 << 20);
+		for (off = 0; off < size; off += 1 << 20)
+			if (pwrite(fd, buf, 1 << 20, off) != 1 << 20)
+				die("pwrite");
+		free(buf);
+	}
+	if (fsync(fd))
+		die("fsync");
+	posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+	close(fd);
+}
+
+static void *reader_thread(void *arg)
+{
+	struct reader *r = arg;
+	char *buf = malloc(bs);
+	off_t off;
+	int fd = shared_fd;
+
+	if (!buf)
+		die("malloc");
+	if (own_fd) {
+		fd = open(file, O_RDONLY);
+		if (fd < 0)
+			die("open");
+	}
+
+	for (off = r->start; off < r->end; off += bs) {
+		ssize_t ret = pread(fd, buf, bs, off);
+
+		if (ret < 0)
+			die("pread");
+		if (!ret)
+			break;
+		r->bytes += ret;
+	}
+
+	if (own_fd)
+		close(fd);
+	free(buf);
+	return NULL;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s -f file [-m MB] [-t readers] [-b KB] [-n]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct reader *readers;
+	size_t size, part, bytes = 0;
+	double start, elapsed;
+	int i, opt;
+
+	while ((opt = getopt(argc, argv, "f:m:t:b:n")) != -1) {
+		switch (opt) {
+		case 'f':
+			file = optarg;
+			break;
+		case 'm':
+			file_mb = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			nreaders = atoi(optarg);
+			break;
+		case 'b':
+			bs = strtoul(optarg, NULL, 0) << 10;
+			break;
+		case 'n':
+			own_fd = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!file || !file_mb || nreaders < 1 || !bs)
+		usage(argv[0]);
+
+	size = file_mb << 20;
+	part = size / nreaders / bs * bs;
+	if (!part)
+		usage(argv[0]);
+
+	create_file(size);
+
+	shared_fd = open(file, O_RDONLY);
+	if (shared_fd < 0)
+		die("open");
+
+	readers = calloc(nreaders, sizeof(*readers));
+	if (!readers)
+		die("calloc");
+
+	start = now();
+	for (i = 0; i < nreaders; i++) {
+		readers[i].start = (off_t)i * part;
+		readers[i].end = readers[i].start + part;
+		if (pthread_create(&readers[i].thread, NULL, reader_thread,
+				   &readers[i]))
+			die("pthread_create");
+	}
+	for (i = 0; i < nreaders; i++) {
+		pthread_join(readers[i].thread, NULL);
+		bytes += readers[i].bytes;
+	}
+	elapsed = now() - start;
+
+	printf("%d readers, %s fd, %zu KB blocks: %.1f MB/s\n",
+	       nreaders, own_fd ? "own" : "shared", bs >> 10,
+	       bytes / elapsed / (1 << 20));
+
+	free(readers);
+	close(shared_fd);
+	return 0;
+}